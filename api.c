@@ -20,6 +20,8 @@
 #include <unistd.h>
 #include <limits.h>
 #include <sys/types.h>
+#include <poll.h>
+#include <fcntl.h>
 
 #include "compat.h"
 #include "miner.h"
@@ -48,6 +50,14 @@
 // However lots of PGA's may mean more
 #define QUEUE   100
 
+// Clients served at the same time, more are accepted and closed at once
+#define API_MAX_CONN    32
+// Idle keep-alive connections and stalled requests are closed after this
+#define API_IDLE_SECS   10
+// A plain "cmd|param" request has no terminator, it is complete once
+// nothing more arrived for this long
+#define API_PLAIN_MS    20
+
 #if defined WIN32
 static char WSAbuf[1024];
 
@@ -250,6 +260,8 @@ static const char *OSINFO =
 #define _SUMMARY    "SUMMARY"
 #define _NONCENUM   "NONCENUM"
 #define _FANCTRL   "FANCTRL"
+#define _LOGLEVEL  "LOGLEVEL"
+#define _APISTATS  "APISTATS"
 #define _STATUS     "STATUS"
 #define _VERSION    "VERSION"
 #define _MINECONFIG "CONFIG"
@@ -293,6 +305,8 @@ static const char ISJSON = '{';
 #define JSON_SUMMARY    JSON1 _SUMMARY JSON2
 #define JSON_NONCENUM   JSON1 _NONCENUM JSON2
 #define JSON_FANCTRL  JSON1 _FANCTRL JSON2
+#define JSON_LOGLEVEL JSON1 _LOGLEVEL JSON2
+#define JSON_APISTATS JSON1 _APISTATS JSON2
 
 #define JSON_STATUS JSON1 _STATUS JSON2
 #define JSON_VERSION    JSON1 _VERSION JSON2
@@ -452,6 +466,8 @@ static const char *JSON_PARAMETER = "parameter";
 #define MSG_LCD 125
 #define MSG_OK 126
 #define MSG_FANCTRL 127
+#define MSG_LOGLEVEL 128
+#define MSG_APISTATS 129
 
 enum code_severity
 {
@@ -629,6 +645,8 @@ struct CODES
     { SEVERITY_WARN,  MSG_LOCKDIS, PARAM_NONE, "Lock stats not enabled" },
     { SEVERITY_SUCC,  MSG_OK, PARAM_NONE, "OK" },
     { SEVERITY_SUCC,  MSG_FANCTRL, PARAM_NONE, "Fan control values" },
+    { SEVERITY_SUCC,  MSG_LOGLEVEL, PARAM_NONE, "Log levels" },
+    { SEVERITY_SUCC,  MSG_APISTATS, PARAM_NONE, "API statistics" },
     { SEVERITY_FAIL, 0, 0, NULL }
 };
 
@@ -693,23 +711,9 @@ static struct io_list *io_head = NULL;
 #define io_new(init) _io_new(init, false)
 #define sock_io_new() _io_new(SOCKBUFALLOCSIZ, true)
 
-#define ALLOC_SBITEMS 2
-#define LIMIT_SBITEMS 0
-
-typedef struct sbitem
-{
-    char *buf;
-    size_t siz;
-    size_t tot;
-} SBITEM;
-
-// Size to grow tot if exceeded
+// Size to grow a cached reply buffer by if exceeded
 #define SBEXTEND 4096
 
-#define DATASB(_item) ((SBITEM *)(_item->data))
-
-static K_LIST *strbufs;
-
 static void io_reinit(struct io_data *io_data)
 {
     io_data->cur = io_data->ptr;
@@ -749,11 +753,11 @@ static struct io_data *_io_new(size_t initial, bool socket_buf)
     return io_data;
 }
 
-static bool io_add(struct io_data *io_data, char *buf)
+// make room for len more bytes, plus what send_result() may append
+static void io_reserve(struct io_data *io_data, size_t len)
 {
-    size_t len, dif, tot;
+    size_t dif, tot;
 
-    len = strlen(buf);
     dif = io_data->cur - io_data->ptr;
     // send will always have enough space to add the JSON
     tot = len + 1 + dif + sizeof(JSON_CLOSE) + sizeof(JSON_END);
@@ -766,13 +770,24 @@ static bool io_add(struct io_data *io_data, char *buf)
             new = (2 + (size_t)((float)tot / (float)SOCKBUFALLOCSIZ)) * SOCKBUFALLOCSIZ;
 
         io_data->ptr = realloc(io_data->ptr, new);
+        if (unlikely(!io_data->ptr))
+            quithere(1, "OOM io_data siz=%d", (int)new);
         io_data->cur = io_data->ptr + dif;
         io_data->siz = new;
     }
+}
 
-    memcpy(io_data->cur, buf, len + 1);
+static void io_addn(struct io_data *io_data, const char *buf, size_t len)
+{
+    io_reserve(io_data, len);
+    memcpy(io_data->cur, buf, len);
     io_data->cur += len;
+    *(io_data->cur) = '\0';
+}
 
+static bool io_add(struct io_data *io_data, char *buf)
+{
+    io_addn(io_data, buf, strlen(buf));
     return true;
 }
 
@@ -908,13 +923,115 @@ static struct api_data *api_add_extra(struct api_data *root, struct api_data *ex
     return root;
 }
 
+/*
+ * While a request is served, api_data nodes, their names and copied
+ * values are carved out of a chunk list that is reset in one go once
+ * the reply is built, instead of two or three mallocs and frees per
+ * item. The chunks are kept for the next request.
+ */
+#define API_ARENA_CHUNK 65536
+
+struct api_arena_chunk
+{
+    struct api_arena_chunk *next;
+    size_t used;
+    size_t siz;
+    char mem[] __attribute__((aligned(8)));
+};
+
+static struct api_arena_chunk *api_arena_head;
+static struct api_arena_chunk *api_arena_cur;
+// only the API thread, and only inside a request, uses the arena
+static __thread bool api_arena_on;
+
+static void *api_arena_alloc(size_t len)
+{
+    struct api_arena_chunk *ch = api_arena_cur;
+    void *ptr;
+
+    len = (len + 7) & ~(size_t)7;
+    if (!ch || ch->used + len > ch->siz)
+    {
+        struct api_arena_chunk *next = ch ? ch->next : api_arena_head;
+
+        if (!next || next->siz < len)
+        {
+            size_t siz = len > API_ARENA_CHUNK ? len : API_ARENA_CHUNK;
+
+            next = malloc(sizeof(*next) + siz);
+            if (!next)
+                quithere(1, "OOM api arena siz=%d", (int)siz);
+            next->siz = siz;
+            if (ch)
+            {
+                next->next = ch->next;
+                ch->next = next;
+            }
+            else
+            {
+                next->next = api_arena_head;
+                api_arena_head = next;
+            }
+        }
+        next->used = 0;
+        api_arena_cur = ch = next;
+    }
+
+    ptr = ch->mem + ch->used;
+    ch->used += len;
+    return ptr;
+}
+
+static void api_arena_begin(void)
+{
+    api_arena_cur = NULL;
+    api_arena_on = true;
+}
+
+// everything allocated since api_arena_begin() is gone after this
+static void api_arena_end(void)
+{
+    api_arena_on = false;
+    api_arena_cur = NULL;
+}
+
+static void api_arena_free(void)
+{
+    struct api_arena_chunk *ch;
+
+    while ((ch = api_arena_head))
+    {
+        api_arena_head = ch->next;
+        free(ch);
+    }
+    api_arena_cur = NULL;
+}
+
+static void *api_data_alloc(struct api_data *api_data, size_t len)
+{
+    if (api_data->in_arena)
+        return api_arena_alloc(len);
+    return malloc(len);
+}
+
 static struct api_data *api_add_data_full(struct api_data *root, char *name, enum api_data_type type, void *data, bool copy_data)
 {
     struct api_data *api_data;
+    size_t namelen = strlen(name) + 1;
 
-    api_data = (struct api_data *)malloc(sizeof(struct api_data));
+    if (api_arena_on)
+    {
+        api_data = (struct api_data *)api_arena_alloc(sizeof(struct api_data));
+        api_data->in_arena = true;
+    }
+    else
+    {
+        api_data = (struct api_data *)malloc(sizeof(struct api_data));
+        api_data->in_arena = false;
+    }
 
-    api_data->name = strdup(name);
+    api_data->name = api_data_alloc(api_data, namelen);
+    memcpy(api_data->name, name, namelen);
     api_data->type = type;
 
     if (root == NULL)
@@ -949,46 +1066,46 @@ static struct api_data *api_add_data_full(struct api_data *root, char *name, enu
             case API_ESCAPE:
             case API_STRING:
             case API_CONST:
-                api_data->data = (void *)malloc(strlen((char *)data) + 1);
+                api_data->data = api_data_alloc(api_data, strlen((char *)data) + 1);
                 strcpy((char*)(api_data->data), (char *)data);
                 break;
             case API_UINT8:
                 /* Most OSs won't really alloc less than 4 */
-                api_data->data = malloc(4);
+                api_data->data = api_data_alloc(api_data, 4);
                 *(uint8_t *)api_data->data = *(uint8_t *)data;
                 break;
             case API_INT16:
                 /* Most OSs won't really alloc less than 4 */
-                api_data->data = malloc(4);
+                api_data->data = api_data_alloc(api_data, 4);
                 *(int16_t *)api_data->data = *(int16_t *)data;
                 break;
             case API_UINT16:
                 /* Most OSs won't really alloc less than 4 */
-                api_data->data = malloc(4);
+                api_data->data = api_data_alloc(api_data, 4);
                 *(uint16_t *)api_data->data = *(uint16_t *)data;
                 break;
             case API_INT:
-                api_data->data = (void *)malloc(sizeof(int));
+                api_data->data = api_data_alloc(api_data, sizeof(int));
                 *((int *)(api_data->data)) = *((int *)data);
                 break;
             case API_UINT:
-                api_data->data = (void *)malloc(sizeof(unsigned int));
+                api_data->data = api_data_alloc(api_data, sizeof(unsigned int));
                 *((unsigned int *)(api_data->data)) = *((unsigned int *)data);
                 break;
             case API_UINT32:
-                api_data->data = (void *)malloc(sizeof(uint32_t));
+                api_data->data = api_data_alloc(api_data, sizeof(uint32_t));
                 *((uint32_t *)(api_data->data)) = *((uint32_t *)data);
                 break;
             case API_HEX32:
-                api_data->data = (void *)malloc(sizeof(uint32_t));
+                api_data->data = api_data_alloc(api_data, sizeof(uint32_t));
                 *((uint32_t *)(api_data->data)) = *((uint32_t *)data);
                 break;
             case API_UINT64:
-                api_data->data = (void *)malloc(sizeof(uint64_t));
+                api_data->data = api_data_alloc(api_data, sizeof(uint64_t));
                 *((uint64_t *)(api_data->data)) = *((uint64_t *)data);
                 break;
             case API_INT64:
-                api_data->data = (void *)malloc(sizeof(int64_t));
+                api_data->data = api_data_alloc(api_data, sizeof(int64_t));
                 *((int64_t *)(api_data->data)) = *((int64_t *)data);
                 break;
             case API_DOUBLE:
@@ -1000,25 +1117,25 @@ static struct api_data *api_add_data_full(struct api_data *root, char *name, enu
             case API_HS:
             case API_DIFF:
             case API_PERCENT:
-                api_data->data = (void *)malloc(sizeof(double));
+                api_data->data = api_data_alloc(api_data, sizeof(double));
                 *((double *)(api_data->data)) = *((double *)data);
                 break;
             case API_BOOL:
-                api_data->data = (void *)malloc(sizeof(bool));
+                api_data->data = api_data_alloc(api_data, sizeof(bool));
                 *((bool *)(api_data->data)) = *((bool *)data);
                 break;
             case API_TIMEVAL:
-                api_data->data = (void *)malloc(sizeof(struct timeval));
+                api_data->data = api_data_alloc(api_data, sizeof(struct timeval));
                 memcpy(api_data->data, data, sizeof(struct timeval));
                 break;
             case API_TIME:
-                api_data->data = (void *)malloc(sizeof(time_t));
+                api_data->data = api_data_alloc(api_data, sizeof(time_t));
                 *(time_t *)(api_data->data) = *((time_t *)data);
                 break;
             case API_VOLTS:
             case API_TEMP:
             case API_AVG:
-                api_data->data = (void *)malloc(sizeof(float));
+                api_data->data = api_data_alloc(api_data, sizeof(float));
                 *((float *)(api_data->data)) = *((float *)data);
                 break;
             default:
@@ -1167,193 +1284,226 @@ struct api_data *api_add_avg(struct api_data *root, char *name, float *data, boo
     return api_add_data_full(root, name, API_AVG, (void *)data, copy_data);
 }
 
-static void add_item_buf(K_ITEM *item, const char *str)
+// escaped copy of str, straight into the reply
+static void io_add_escape(struct io_data *io_data, const char *str, bool isjson)
 {
-    size_t old_siz, new_siz, siz, ext;
-    char *buf;
-
-    buf = DATASB(item)->buf;
-    siz = (size_t)strlen(str);
+    size_t len = strlen(str);
+    char *ptr;
 
-    old_siz = DATASB(item)->siz;
-    new_siz = old_siz + siz + 1; // include '\0'
-    if (DATASB(item)->tot < new_siz)
+    // worst case every character needs a backslash
+    io_reserve(io_data, len * 2);
+    ptr = io_data->cur;
+    while (*str)
     {
-        ext = (siz + 1) + SBEXTEND - ((siz + 1) % SBEXTEND);
-        DATASB(item)->buf = buf = realloc(DATASB(item)->buf, DATASB(item)->tot + ext);
-        if (!buf)
+        switch (*str)
         {
-            quithere(1, "OOM buf siz=%d tot=%d ext=%d",
-                     (int)siz, (int)(DATASB(item)->tot), (int)ext);
+            case ',':
+            case '|':
+            case '=':
+                if (!isjson)
+                    *(ptr++) = '\\';
+                break;
+            case '"':
+                if (isjson)
+                    *(ptr++) = '\\';
+                break;
+            case '\\':
+                *(ptr++) = '\\';
+                break;
         }
-        DATASB(item)->tot += ext;
+        *(ptr++) = *(str++);
     }
-    memcpy(buf + old_siz, str, siz + 1);
-    DATASB(item)->siz += siz;
+    *ptr = '\0';
+    io_data->cur = ptr;
 }
 
-static struct api_data *print_data(struct io_data *io_data, struct api_data *root, bool isjson, bool precom)
+static void io_add_uint64(struct io_data *io_data, uint64_t val)
 {
-    // N.B. strings don't use this buffer so 64 is enough (for now)
-    char buf[64];
-    struct api_data *tmp;
-    bool done, first = true;
-    char *original, *escape;
-    K_ITEM *item;
+    char buf[24], *ptr = buf + sizeof(buf);
+
+    do
+    {
+        *(--ptr) = '0' + val % 10;
+        val /= 10;
+    }
+    while (val);
+
+    io_addn(io_data, ptr, buf + sizeof(buf) - ptr);
+}
+
+static void io_add_int64(struct io_data *io_data, int64_t val)
+{
+    if (val < 0)
+    {
+        io_addn(io_data, "-", 1);
+        io_add_uint64(io_data, -(uint64_t)val);
+    }
+    else
+        io_add_uint64(io_data, val);
+}
+
+// N.B. only used for numbers, so 64 is enough (for now)
+static void __attribute__((format(printf, 2, 3))) io_add_fmt(struct io_data *io_data, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
 
-    K_WLOCK(strbufs);
-    item = k_unlink_head(strbufs);
-    K_WUNLOCK(strbufs);
+    io_reserve(io_data, 64);
+    va_start(ap, fmt);
+    len = vsnprintf(io_data->cur, 64, fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        len = 0;
+    else if (len > 63)
+        len = 63;
+    io_data->cur += len;
+    *(io_data->cur) = '\0';
+}
 
-    DATASB(item)->siz = 0;
+/*
+ * Serialise the items straight into the reply buffer: known lengths,
+ * in place escaping and no intermediate string per value.
+ */
+static struct api_data *print_data(struct io_data *io_data, struct api_data *root, bool isjson, bool precom)
+{
+    struct api_data *tmp;
+    bool first = true;
 
     if (precom)
-        add_item_buf(item, COMMA);
+        io_addn(io_data, ",", 1);
 
     if (isjson)
-        add_item_buf(item, JSON0);
+        io_addn(io_data, JSON0, 1);
 
     while (root)
     {
         if (!first)
-            add_item_buf(item, COMMA);
+            io_addn(io_data, ",", 1);
         else
             first = false;
 
         if (isjson)
-            add_item_buf(item, JSON1);
-
-        add_item_buf(item, root->name);
-
-        if (isjson)
-            add_item_buf(item, JSON1);
-
-        if (isjson)
-            add_item_buf(item, ":");
+        {
+            io_addn(io_data, JSON1, 1);
+            io_add(io_data, root->name);
+            io_addn(io_data, JSON1 ":", 2);
+        }
         else
-            add_item_buf(item, "=");
-
-        first = false;
+        {
+            io_add(io_data, root->name);
+            io_addn(io_data, "=", 1);
+        }
 
-        done = false;
         switch(root->type)
         {
             case API_STRING:
             case API_CONST:
                 if (isjson)
-                    add_item_buf(item, JSON1);
-                add_item_buf(item, (char *)(root->data));
+                    io_addn(io_data, JSON1, 1);
+                io_add(io_data, (char *)(root->data));
                 if (isjson)
-                    add_item_buf(item, JSON1);
-                done = true;
+                    io_addn(io_data, JSON1, 1);
                 break;
             case API_ESCAPE:
-                original = (char *)(root->data);
-                escape = escape_string((char *)(root->data), isjson);
                 if (isjson)
-                    add_item_buf(item, JSON1);
-                add_item_buf(item, escape);
+                    io_addn(io_data, JSON1, 1);
+                io_add_escape(io_data, (char *)(root->data), isjson);
                 if (isjson)
-                    add_item_buf(item, JSON1);
-                if (escape != original)
-                    free(escape);
-                done = true;
+                    io_addn(io_data, JSON1, 1);
                 break;
             case API_UINT8:
-                snprintf(buf, sizeof(buf), "%u", *(uint8_t *)root->data);
+                io_add_uint64(io_data, *(uint8_t *)root->data);
                 break;
             case API_INT16:
-                snprintf(buf, sizeof(buf), "%d", *(int16_t *)root->data);
+                io_add_int64(io_data, *(int16_t *)root->data);
                 break;
             case API_UINT16:
-                snprintf(buf, sizeof(buf), "%u", *(uint16_t *)root->data);
+                io_add_uint64(io_data, *(uint16_t *)root->data);
                 break;
             case API_INT:
-                snprintf(buf, sizeof(buf), "%d", *((int *)(root->data)));
+                io_add_int64(io_data, *((int *)(root->data)));
                 break;
             case API_UINT:
-                snprintf(buf, sizeof(buf), "%u", *((unsigned int *)(root->data)));
+                io_add_uint64(io_data, *((unsigned int *)(root->data)));
                 break;
             case API_UINT32:
-                snprintf(buf, sizeof(buf), "%"PRIu32, *((uint32_t *)(root->data)));
+                io_add_uint64(io_data, *((uint32_t *)(root->data)));
                 break;
             case API_HEX32:
                 if (isjson)
-                    add_item_buf(item, JSON1);
-                snprintf(buf, sizeof(buf), "0x%08x", *((uint32_t *)(root->data)));
-                add_item_buf(item, buf);
+                    io_addn(io_data, JSON1, 1);
+                io_add_fmt(io_data, "0x%08x", *((uint32_t *)(root->data)));
                 if (isjson)
-                    add_item_buf(item, JSON1);
-                done = true;
+                    io_addn(io_data, JSON1, 1);
                 break;
             case API_UINT64:
-                snprintf(buf, sizeof(buf), "%"PRIu64, *((uint64_t *)(root->data)));
+                io_add_uint64(io_data, *((uint64_t *)(root->data)));
                 break;
             case API_INT64:
-                snprintf(buf, sizeof(buf), "%"PRId64, *((int64_t *)(root->data)));
+                io_add_int64(io_data, *((int64_t *)(root->data)));
                 break;
             case API_TIME:
-                snprintf(buf, sizeof(buf), "%lu", *((unsigned long *)(root->data)));
+                io_add_uint64(io_data, *((unsigned long *)(root->data)));
                 break;
             case API_DOUBLE:
-                snprintf(buf, sizeof(buf), "%f", *((double *)(root->data)));
+                io_add_fmt(io_data, "%f", *((double *)(root->data)));
                 break;
             case API_ELAPSED:
-                snprintf(buf, sizeof(buf), "%.0f", *((double *)(root->data)));
+                io_add_fmt(io_data, "%.0f", *((double *)(root->data)));
                 break;
             case API_UTILITY:
             case API_FREQ:
             case API_MHS:
-                snprintf(buf, sizeof(buf), "%.2f", *((double *)(root->data)));
+                io_add_fmt(io_data, "%.2f", *((double *)(root->data)));
                 break;
             case API_VOLTS:
             case API_AVG:
-                snprintf(buf, sizeof(buf), "%.3f", *((float *)(root->data)));
+                io_add_fmt(io_data, "%.3f", *((float *)(root->data)));
                 break;
             case API_MHTOTAL:
-                snprintf(buf, sizeof(buf), "%.4f", *((double *)(root->data)));
+                io_add_fmt(io_data, "%.4f", *((double *)(root->data)));
                 break;
             case API_HS:
-                snprintf(buf, sizeof(buf), "%.15f", *((double *)(root->data)));
+                io_add_fmt(io_data, "%.15f", *((double *)(root->data)));
                 break;
             case API_DIFF:
-                snprintf(buf, sizeof(buf), "%.8f", *((double *)(root->data)));
+                io_add_fmt(io_data, "%.8f", *((double *)(root->data)));
                 break;
             case API_BOOL:
-                snprintf(buf, sizeof(buf), "%s", *((bool *)(root->data)) ? TRUESTR : FALSESTR);
+                io_add(io_data, (char *)(*((bool *)(root->data)) ? TRUESTR : FALSESTR));
                 break;
             case API_TIMEVAL:
-                snprintf(buf, sizeof(buf), "%ld.%06ld",
-                         (long)((struct timeval *)(root->data))->tv_sec,
-                         (long)((struct timeval *)(root->data))->tv_usec);
+                io_add_fmt(io_data, "%ld.%06ld",
+                           (long)((struct timeval *)(root->data))->tv_sec,
+                           (long)((struct timeval *)(root->data))->tv_usec);
                 break;
             case API_TEMP:
-                snprintf(buf, sizeof(buf), "%.2f", *((float *)(root->data)));
+                io_add_fmt(io_data, "%.2f", *((float *)(root->data)));
                 break;
             case API_PERCENT:
-                snprintf(buf, sizeof(buf), "%.4f", *((double *)(root->data)) * 100.0);
+                io_add_fmt(io_data, "%.4f", *((double *)(root->data)) * 100.0);
                 break;
             default:
                 applog(LOG_ERR, "API: unknown2 data type %d ignored", root->type);
                 if (isjson)
-                    add_item_buf(item, JSON1);
-                add_item_buf(item, UNKNOWN);
+                    io_addn(io_data, JSON1, 1);
+                io_add(io_data, (char *)UNKNOWN);
                 if (isjson)
-                    add_item_buf(item, JSON1);
-                done = true;
+                    io_addn(io_data, JSON1, 1);
                 break;
         }
 
-        if (!done)
-            add_item_buf(item, buf);
-
-        free(root->name);
-        if (root->data_was_malloc)
-            free(root->data);
+        if (!root->in_arena)
+        {
+            free(root->name);
+            if (root->data_was_malloc)
+                free(root->data);
+        }
 
         if (root->next == root)
         {
-            free(root);
+            if (!root->in_arena)
+                free(root);
             root = NULL;
         }
         else
@@ -1362,20 +1512,15 @@ static struct api_data *print_data(struct io_data *io_data, struct api_data *roo
             root = tmp->next;
             root->prev = tmp->prev;
             root->prev->next = root;
-            free(tmp);
+            if (!tmp->in_arena)
+                free(tmp);
         }
     }
 
     if (isjson)
-        add_item_buf(item, JSON5);
+        io_addn(io_data, JSON5, 1);
     else
-        add_item_buf(item, SEPSTR);
-
-    io_add(io_data, DATASB(item)->buf);
-
-    K_WLOCK(strbufs);
-    k_add_head(strbufs, item);
-    K_WUNLOCK(strbufs);
+        io_addn(io_data, SEPSTR, 1);
 
     return root;
 }
@@ -2290,10 +2435,7 @@ static struct api_data *bitmain_api_chainstatus(struct cgpu_info *cgpu, struct i
 		int temp;
                 if(last_freq[i][1] == FREQ_MAGIC)
                 {
-                    for(j = 0; j < dev->chain_asic_num[i]; j++)
-                    {
-                        dev_sum_freq += atoi(freq_pll_1385[last_freq[i][j*2+3]].freq);
-                    }
+                    dev_sum_freq += get_chain_freq_stats(i).sum_freq;
 
                     if(dev->chain_asic_num[i]>0)
                         dev_sum_freq=dev_sum_freq/dev->chain_asic_num[i];
@@ -2325,10 +2467,7 @@ static struct api_data *bitmain_api_chainstatus(struct cgpu_info *cgpu, struct i
 
                 if(last_freq[i][1] == FREQ_MAGIC)
                 {
-                    for(j = 0; j < dev->chain_asic_num[i]; j++)
-                    {
-                        dev_sum_freq += atoi(freq_pll_1385[last_freq[i][j*2+3]].freq)*(BM1387_CORE_NUM-chain_badcore_num[i][j]);
-                    }
+                    dev_sum_freq += get_chain_freq_stats(i).sum_rate;
 
                     dev_sum_freq=((dev_sum_freq*1.0)/1000);
                     temp=(int)(dev_sum_freq*100);
@@ -3186,6 +3325,8 @@ done:
     root = api_add_double(root, "Temperature", &fc.last_temp, false);
     root = api_add_int(root, "Output", &fc.fan_duty, false);
     root = api_add_double(root, "Interval", &fc.last_dt, false);
+    root = api_add_int(root, "Throttle", &fc.throttle, false);
+    root = api_add_int(root, "ThrottleEvents", &fc.throttle_events, false);
 
     /* print JSON reply */
     root = print_data(io_data, root, isjson, 0);
@@ -3993,6 +4134,7 @@ static void debugstate(struct io_data *io_data, __maybe_unused SOCKETTYPE c, cha
             // anything else just reports the settings
             break;
     }
+    log_update_levels();
 
     message(io_data, MSG_DEBUGSET, 0, NULL, isjson);
     io_open = io_add(io_data, isjson ? COMSTR JSON_DEBUGSET : _DEBUGSET COMSTR);
@@ -4010,6 +4152,60 @@ static void debugstate(struct io_data *io_data, __maybe_unused SOCKETTYPE c, cha
         io_close(io_data);
 }
 
+/* loglevel|<subsystem>,<err|warning|notice|info|debug|0-7|default> */
+static void loglevel(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char *param, bool isjson, __maybe_unused char group)
+{
+    struct api_data *root = NULL;
+    char *args = NULL;
+    char *argv[2];
+    char name[32];
+    bool io_open = false;
+    int ok = 0;
+    int level;
+    int i;
+
+    if (param == NULL || *param == '\0') {
+        ok = 1;
+        goto done;
+    }
+
+    args = strdup(param);
+    if (parse_list(args, argv, ARRAY_SIZE(argv), ',') < 2)
+        goto done;
+
+    if (!strcasecmp(argv[1], "default"))
+        level = -1;
+    else if ((level = log_parse_level(argv[1])) < 0)
+        goto done;
+
+    ok = log_set_subsys_level(argv[0], level);
+
+done:
+    if (args != 0)
+        free(args);
+
+    if (!ok) {
+        message(io_data, MSG_INVCMD, 0, NULL, isjson);
+        return;
+    }
+
+    message(io_data, MSG_LOGLEVEL, 0, NULL, isjson);
+
+    if (isjson)
+        io_open = io_add(io_data, COMSTR JSON_LOGLEVEL);
+
+    /* effective level and the API override (-1 = follows debug/verbose) */
+    for (i = 0; i < LOGS_NUM; i++) {
+        root = api_add_int(root, (char *)log_subsys_name[i], &log_level_cut[i], true);
+        snprintf(name, sizeof(name), "%s_set", log_subsys_name[i]);
+        root = api_add_int(root, name, &log_subsys_level[i], true);
+    }
+
+    root = print_data(io_data, root, isjson, false);
+    if (isjson && io_open)
+        io_close(io_data);
+}
+
 static void setconfig(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char *param, bool isjson, __maybe_unused char group)
 {
     char *comma;
@@ -4615,6 +4811,7 @@ static void lcddata(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __mayb
 }
 
 static void checkcommand(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char *param, bool isjson, char group);
+static void apistats(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char *param, bool isjson, char group);
 
 struct CMDS
 {
@@ -4662,6 +4859,7 @@ struct CMDS
     { "failover-only",  failoveronly,   true,   false },
     { "coin",       minecoin,   false,  true },
     { "debug",      debugstate, true,   false },
+    { "loglevel",       loglevel,   true,   false },
     { "setconfig",      setconfig,  true,   false },
     { "usbstats",       usbstats,   false,  true },
 #ifdef HAVE_AN_FPGA
@@ -4679,9 +4877,64 @@ struct CMDS
     { "asccount",       asccount,   false,  true },
     { "lcd",        lcddisplay, false,  true },
     { "lockstats",      lockstats,  true,   true },
+    { "apistats",       apistats,   false,  true },
     { NULL,         NULL,       false,  false }
 };
 
+// per command service time, indexed like cmds[]
+static struct api_cmd_stats
+{
+    uint64_t num;
+    uint64_t total_us;
+    unsigned int max_us;
+} cmd_stats[sizeof(cmds) / sizeof(cmds[0])];
+
+// client connections of the API event loop
+struct api_conn
+{
+    SOCKETTYPE fd;
+    char *connectaddr;
+    char group;
+    bool http;          // request came in as GET /
+    bool keepalive;     // keep the connection after the reply
+    bool eof;           // client shut its side down
+    char in[TMPBUFSIZ];
+    int inlen;
+    char *out;
+    size_t outlen, outsent, outsiz;
+    struct timeval last;    // last data received or sent
+};
+
+/*
+ * Replies of the read only commands every monitor polls, served again
+ * for up to --api-cache-ms instead of being rebuilt from the driver
+ * state each time. Any privileged command drops them.
+ */
+static struct api_cache
+{
+    const char *name;
+    char *buf[2];       // [isjson]
+    size_t len[2];
+    size_t siz[2];
+    bool close[2];
+    struct timeval stamp[2];
+    bool valid[2];
+} api_cache[] =
+{
+    { "summary" },
+    { "devs" },
+    { "stats" },
+    { "estats" },
+    { NULL }
+};
+
+static uint64_t api_cache_hits, api_cache_misses;
+
+static struct api_conn api_conns[API_MAX_CONN];
+static int api_conn_num;
+static struct api_conn *api_cur_conn;   // the one whose request is being served
+static uint64_t api_accepted, api_rejected, api_requests;
+
 static void checkcommand(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char *param, bool isjson, char group)
 {
     struct api_data *root = NULL;
@@ -4723,6 +4976,103 @@ static void checkcommand(struct io_data *io_data, __maybe_unused SOCKETTYPE c, c
         io_close(io_data);
 }
 
+static void apistats(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __maybe_unused char *param, bool isjson, __maybe_unused char group)
+{
+    struct api_data *root = NULL;
+    char name[64];
+    bool io_open;
+    int i;
+
+    message(io_data, MSG_APISTATS, 0, NULL, isjson);
+    io_open = io_add(io_data, isjson ? COMSTR JSON_APISTATS : _APISTATS COMSTR);
+
+    root = api_add_int(root, "Connections", &api_conn_num, true);
+    root = api_add_uint64(root, "Accepted", &api_accepted, true);
+    root = api_add_uint64(root, "Rejected", &api_rejected, true);
+    root = api_add_uint64(root, "Requests", &api_requests, true);
+    root = api_add_int(root, "Cache Max Age", &opt_api_cache_ms, true);
+    root = api_add_uint64(root, "Cache Hits", &api_cache_hits, true);
+    root = api_add_uint64(root, "Cache Misses", &api_cache_misses, true);
+
+    for (i = 0; cmds[i].name != NULL; i++)
+    {
+        unsigned int avg_us;
+
+        if (cmd_stats[i].num == 0)
+            continue;
+
+        avg_us = cmd_stats[i].total_us / cmd_stats[i].num;
+        snprintf(name, sizeof(name), "%s_num", cmds[i].name);
+        root = api_add_uint64(root, name, &cmd_stats[i].num, true);
+        snprintf(name, sizeof(name), "%s_avg_us", cmds[i].name);
+        root = api_add_uint(root, name, &avg_us, true);
+        snprintf(name, sizeof(name), "%s_max_us", cmds[i].name);
+        root = api_add_uint(root, name, &cmd_stats[i].max_us, true);
+    }
+
+    root = print_data(io_data, root, isjson, false);
+    if (isjson && io_open)
+        io_close(io_data);
+}
+
+static struct api_cache *api_cache_find(const char *name)
+{
+    struct api_cache *ac;
+
+    if (opt_api_cache_ms <= 0)
+        return NULL;
+
+    for (ac = api_cache; ac->name != NULL; ac++)
+        if (strcmp(ac->name, name) == 0)
+            return ac;
+
+    return NULL;
+}
+
+// add the cached reply to io_data if it is recent enough
+static bool api_cache_get(struct io_data *io_data, struct api_cache *ac, bool isjson, struct timeval *now)
+{
+    if (!ac->valid[isjson] || ms_tdiff(now, &ac->stamp[isjson]) >= opt_api_cache_ms)
+    {
+        api_cache_misses++;
+        return false;
+    }
+
+    io_add(io_data, ac->buf[isjson]);
+    if (ac->close[isjson])
+        io_close(io_data);
+    api_cache_hits++;
+    return true;
+}
+
+// remember what the command added to io_data after offset start
+static void api_cache_put(struct io_data *io_data, struct api_cache *ac, bool isjson, size_t start, struct timeval *now)
+{
+    size_t len = (io_data->cur - io_data->ptr) - start;
+
+    if (len + 1 > ac->siz[isjson])
+    {
+        ac->siz[isjson] = len + 1 + SBEXTEND;
+        ac->buf[isjson] = realloc(ac->buf[isjson], ac->siz[isjson]);
+        if (!ac->buf[isjson])
+            quithere(1, "OOM api cache");
+    }
+    memcpy(ac->buf[isjson], io_data->ptr + start, len);
+    ac->buf[isjson][len] = '\0';
+    ac->len[isjson] = len;
+    ac->close[isjson] = io_data->close;
+    ac->stamp[isjson] = *now;
+    ac->valid[isjson] = true;
+}
+
+static void api_cache_clear(void)
+{
+    struct api_cache *ac;
+
+    for (ac = api_cache; ac->name != NULL; ac++)
+        ac->valid[0] = ac->valid[1] = false;
+}
+
 static void head_join(struct io_data *io_data, char *cmdptr, bool isjson, bool *firstjoin)
 {
     char *ptr;
@@ -4774,12 +5124,25 @@ static void tail_join(struct io_data *io_data, bool isjson)
     }
 }
 
-static void send_result(struct io_data *io_data, SOCKETTYPE c, bool isjson, bool end_with_nul)
+static void api_conn_queue(struct api_conn *conn, const char *buf, size_t len)
 {
-    int count, sendc, res, tosend, len, n;
-    char *buf = io_data->ptr;
+    if (conn->outlen + len > conn->outsiz)
+    {
+        conn->outsiz = conn->outlen + len + SOCKBUFALLOCSIZ;
+        conn->out = realloc(conn->out, conn->outsiz);
+        if (!conn->out)
+            quithere(1, "OOM api conn out");
+    }
+    memcpy(conn->out + conn->outlen, buf, len);
+    conn->outlen += len;
+}
 
-    strcpy(buf, io_data->ptr);
+// the reply is queued on the connection, the event loop sends it
+static void send_result(struct io_data *io_data, __maybe_unused SOCKETTYPE c, bool isjson, bool end_with_nul)
+{
+    struct api_conn *conn = api_cur_conn;
+    char *buf = io_data->ptr;
+    int tosend, len;
 
     if (io_data->close)
         strcat(buf, JSON_CLOSE);
@@ -4792,58 +5155,40 @@ static void send_result(struct io_data *io_data, SOCKETTYPE c, bool isjson, bool
 
     applog(LOG_DEBUG, "API: send reply: (%d) '%.10s%s'", tosend, buf, len > 10 ? "..." : BLANK);
 
-    count = sendc = 0;
-    while (count < 5 && tosend > 0)
+    if (conn->http)
     {
-        // allow 50ms per attempt
-        struct timeval timeout = {0, 50000};
-        fd_set wd;
-
-        FD_ZERO(&wd);
-        FD_SET(c, &wd);
-        if ((res = select(c + 1, NULL, &wd, NULL, &timeout)) < 1)
-        {
-            applog(LOG_WARNING, "API: send select failed (%d)", res);
-            return;
-        }
+        char head[256];
 
-        n = send(c, buf, tosend, 0);
-        sendc++;
+        snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                 "Access-Control-Allow-Origin: *\r\nContent-Length: %d\r\nConnection: %s\r\n\r\n",
+                 tosend, conn->keepalive ? "keep-alive" : "close");
+        api_conn_queue(conn, head, strlen(head));
+    }
 
-        if (SOCKETFAIL(n))
-        {
-            count++;
-            if (sock_blocks())
-                continue;
+    if (conn->outlen == 0)
+    {
+        // hand the whole reply buffer over instead of copying it
+        char *out = conn->out;
+        size_t outsiz = conn->outsiz;
 
-            applog(LOG_WARNING, "API: send (%d:%d) failed: %s", len+1, (len+1 - tosend), SOCKERRMSG);
+        conn->out = io_data->ptr;
+        conn->outsiz = io_data->siz;
+        conn->outlen = tosend;
 
-            return;
-        }
-        else
+        if (!out || outsiz < SOCKBUFALLOCSIZ)
         {
-            if (sendc <= 1)
-            {
-                if (n == tosend)
-                    applog(LOG_DEBUG, "API: sent all of %d first go", tosend);
-                else
-                    applog(LOG_DEBUG, "API: sent %d of %d first go", n, tosend);
-            }
-            else
-            {
-                if (n == tosend)
-                    applog(LOG_DEBUG, "API: sent all of remaining %d (sendc=%d)", tosend, sendc);
-                else
-                    applog(LOG_DEBUG, "API: sent %d of remaining %d (sendc=%d)", n, tosend, sendc);
-            }
-
-            tosend -= n;
-            buf += n;
-
-            if (n == 0)
-                count++;
+            free(out);
+            outsiz = SOCKBUFALLOCSIZ;
+            out = malloc(outsiz);
+            if (!out)
+                quithere(1, "OOM api reply buffer");
         }
+        io_data->ptr = out;
+        io_data->siz = outsiz;
+        io_reinit(io_data);
     }
+    else
+        api_conn_queue(conn, buf, tosend);
 }
 
 static void tidyup(__maybe_unused void *arg)
@@ -5492,38 +5837,549 @@ void reCalculateAVG()
     else new_total_secs=total_secs;
 }
 
-void api(int api_thr_id)
+/* serve one complete request of conn, the reply ends up in conn->out */
+static void api_process(struct io_data *io_data, struct api_conn *conn, char *buf, int n)
 {
-    struct io_data *io_data;
-    struct thr_info bye_thr;
-    char buf[TMPBUFSIZ];
     char param_buf[TMPBUFSIZ];
-    SOCKETTYPE c;
-    int n, bound;
-    char *connectaddr;
-    char *binderror;
-    time_t bindstart;
-    short int port = opt_api_port;
-    char port_s[10];
-    struct sockaddr_storage cli;
-    socklen_t clisiz;
     char cmdbuf[100];
     char *cmd = NULL;
     char *param;
-    bool addrok;
-    char group;
     json_error_t json_err;
     json_t *json_config = NULL;
     bool isjson;
     bool end_with_nul;
     bool did, isjoin = false, firstjoin;
+    SOCKETTYPE c = conn->fd;
+    char *connectaddr = conn->connectaddr;
+    char group = conn->group;
     int i;
-    struct addrinfo hints, *res, *host;
 
-    SOCKETTYPE *apisock;
+    api_cur_conn = conn;
+    api_requests++;
+    api_arena_begin();
 
-    apisock = malloc(sizeof(*apisock));
-    *apisock = INVSOCK;
+    // the time of the request in now
+    when = time(NULL);
+    io_reinit(io_data);
+
+    did = false;
+    isjoin = false;
+    json_config = 0;
+
+    if (conn->http) {
+        char *ptr = buf + 5;
+        char *end = strchr(ptr, ' ');
+        isjson = true;
+        end_with_nul = false;
+        param = NULL;
+        cmd = NULL;
+        if (!end) {
+            message(io_data, MSG_MISCMD, 0, NULL, isjson);
+            send_result(io_data, c, isjson, end_with_nul);
+            did = true;
+        } else {
+            *end = 0;
+            cmd = ptr;
+        }
+    } else if (*buf == ISJSON) {
+        isjson = true;
+        end_with_nul = true;
+
+        param = NULL;
+
+        json_config = json_loadb(buf, n, 0, &json_err);
+
+        if (!json_is_object(json_config))
+        {
+            message(io_data, MSG_INVJSON, 0, NULL, isjson);
+            send_result(io_data, c, isjson, end_with_nul);
+            did = true;
+        }
+        else
+        {
+            json_t *json_val;
+
+            json_val = json_object_get(json_config, JSON_COMMAND);
+            if (json_val == NULL)
+            {
+                message(io_data, MSG_MISCMD, 0, NULL, isjson);
+                send_result(io_data, c, isjson, end_with_nul);
+                did = true;
+            }
+            else
+            {
+                if (!json_is_string(json_val))
+                {
+                    message(io_data, MSG_INVCMD, 0, NULL, isjson);
+                    send_result(io_data, c, isjson, end_with_nul);
+                    did = true;
+                }
+                else
+                {
+                    cmd = (char *)json_string_value(json_val);
+                    json_val = json_object_get(json_config, JSON_PARAMETER);
+                    if (json_is_string(json_val))
+                        param = (char *)json_string_value(json_val);
+                    else if (json_is_integer(json_val))
+                    {
+                        sprintf(param_buf, "%d", (int)json_integer_value(json_val));
+                        param = param_buf;
+                    }
+                    else if (json_is_real(json_val))
+                    {
+                        sprintf(param_buf, "%f", (double)json_real_value(json_val));
+                        param = param_buf;
+                    }
+                }
+            }
+        }
+    } else {
+        isjson = false;
+        end_with_nul = true;
+
+        param = strchr(buf, SEPARATOR);
+        if (param != NULL)
+            *(param++) = '\0';
+
+        cmd = buf;
+    }
+
+    if (!did)
+    {
+        char *cmdptr, *cmdsbuf = NULL;
+
+        if (strchr(cmd, CMDJOIN))
+        {
+            firstjoin = isjoin = true;
+            // cmd + leading+tailing '|' + '\0'
+            cmdsbuf = malloc(strlen(cmd) + 3);
+            if (!cmdsbuf)
+                quithere(1, "OOM cmdsbuf");
+            strcpy(cmdsbuf, "|");
+            param = NULL;
+        }
+        else
+            firstjoin = isjoin = false;
+
+        cmdptr = cmd;
+        do
+        {
+            did = false;
+            if (isjoin)
+            {
+                cmd = strchr(cmdptr, CMDJOIN);
+                if (cmd)
+                    *(cmd++) = '\0';
+                if (!*cmdptr)
+                    goto inochi;
+            }
+
+            for (i = 0; cmds[i].name != NULL; i++)
+            {
+                if (strcmp(cmdptr, cmds[i].name) == 0)
+                {
+                    sprintf(cmdbuf, "|%s|", cmdptr);
+                    if (isjoin)
+                    {
+                        if (strstr(cmdsbuf, cmdbuf))
+                        {
+                            did = true;
+                            break;
+                        }
+                        strcat(cmdsbuf, cmdptr);
+                        strcat(cmdsbuf, "|");
+                        head_join(io_data, cmdptr, isjson, &firstjoin);
+                        if (!cmds[i].joinable)
+                        {
+                            message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
+                            did = true;
+                            tail_join(io_data, isjson);
+                            break;
+                        }
+                    }
+                    if (ISPRIVGROUP(group) || strstr(COMMANDS(group), cmdbuf))
+                    {
+                        struct api_cache *ac = NULL;
+                        struct timeval tv_start, tv_end;
+                        unsigned int us;
+
+                        if (param == NULL || *param == '\0')
+                            ac = api_cache_find(cmds[i].name);
+
+                        cgtime(&tv_start);
+                        if (!ac || !api_cache_get(io_data, ac, isjson, &tv_start))
+                        {
+                            size_t start = io_data->cur - io_data->ptr;
+
+                            (cmds[i].func)(io_data, c, param, isjson, group);
+                            if (ac)
+                                api_cache_put(io_data, ac, isjson, start, &tv_start);
+                        }
+                        if (cmds[i].iswritemode)
+                            api_cache_clear();
+                        cgtime(&tv_end);
+                        us = us_tdiff(&tv_end, &tv_start);
+                        cmd_stats[i].num++;
+                        cmd_stats[i].total_us += us;
+                        if (us > cmd_stats[i].max_us)
+                            cmd_stats[i].max_us = us;
+                    }
+                    else
+                    {
+                        message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
+                        applog(LOG_DEBUG, "API: access denied to '%s' for '%s' command", connectaddr, cmds[i].name);
+                    }
+
+                    did = true;
+                    if (!isjoin)
+                        send_result(io_data, c, isjson, end_with_nul);
+                    else
+                        tail_join(io_data, isjson);
+                    break;
+                }
+            }
+
+            if (!did)
+            {
+                if (isjoin)
+                    head_join(io_data, cmdptr, isjson, &firstjoin);
+                message(io_data, MSG_INVCMD, 0, NULL, isjson);
+                if (isjoin)
+                    tail_join(io_data, isjson);
+                else
+                    send_result(io_data, c, isjson, end_with_nul);
+            }
+        inochi:
+            if (isjoin)
+                cmdptr = cmd;
+        }
+        while (isjoin && cmdptr);
+        if (cmdsbuf != NULL)
+            free(cmdsbuf);
+    }
+
+    if (isjoin)
+        send_result(io_data, c, isjson, end_with_nul);
+
+    if (isjson && json_is_object(json_config))
+        json_decref(json_config);
+
+    api_arena_end();
+}
+
+static void api_conn_close(struct api_conn *conn)
+{
+    CLOSESOCKET(conn->fd);
+    free(conn->connectaddr);
+    free(conn->out);
+    *conn = api_conns[--api_conn_num];
+}
+
+static void api_conns_close(void)
+{
+    while (api_conn_num > 0)
+        api_conn_close(&api_conns[0]);
+}
+
+/* give replies still queued on exit (e.g. to "quit") a moment to go out */
+static void api_conns_flush(void)
+{
+    int tries, i, n;
+    bool pending;
+
+    for (tries = 0; tries < 25; tries++)
+    {
+        pending = false;
+        for (i = 0; i < api_conn_num; i++)
+        {
+            struct api_conn *conn = &api_conns[i];
+
+            if (conn->outsent >= conn->outlen)
+                continue;
+            n = send(conn->fd, conn->out + conn->outsent, conn->outlen - conn->outsent, MSG_NOSIGNAL);
+            if (n > 0)
+                conn->outsent += n;
+            else if (!sock_blocks())
+                conn->outsent = conn->outlen;
+            if (conn->outsent < conn->outlen)
+                pending = true;
+        }
+        if (!pending)
+            break;
+        cgsleep_ms(10);
+    }
+}
+
+static void api_accept(SOCKETTYPE apisock)
+{
+    struct sockaddr_storage cli;
+    socklen_t clisiz = sizeof(cli);
+    struct api_conn *conn;
+    char *connectaddr;
+    bool addrok;
+    char group;
+    SOCKETTYPE c;
+
+    if (SOCKETFAIL(c = accept(apisock, (struct sockaddr *)(&cli), &clisiz)))
+        return;
+
+    addrok = check_connect((struct sockaddr_storage *)&cli, &connectaddr, &group);
+    applog(LOG_DEBUG, "API: connection from %s - %s",
+           connectaddr, addrok ? "Accepted" : "Ignored");
+
+    if (!addrok || api_conn_num >= API_MAX_CONN)
+    {
+        if (addrok)
+        {
+            api_rejected++;
+            applog(LOG_DEBUG, "API: too many connections, dropping %s", connectaddr);
+        }
+        free(connectaddr);
+        CLOSESOCKET(c);
+        return;
+    }
+
+    fcntl(c, F_SETFL, fcntl(c, F_GETFL, 0) | O_NONBLOCK);
+
+    conn = &api_conns[api_conn_num++];
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = c;
+    conn->connectaddr = connectaddr;
+    conn->group = group;
+    cgtime(&conn->last);
+    api_accepted++;
+}
+
+/*
+ * Length of the first complete request in conn->in, 0 if more data is
+ * needed. "GET /" ends with an empty line, JSON with its closing brace
+ * and the plain "cmd|param" form with a newline, a NUL, the client
+ * shutting down its side or API_PLAIN_MS of silence.
+ */
+static int api_request_len(struct api_conn *conn, const struct timeval *now)
+{
+    char *buf = conn->in;
+    int len = conn->inlen;
+    int i, depth = 0;
+    bool instr = false;
+
+    // terminators left over from the previous request
+    for (i = 0; i < len && (buf[i] == '\0' || isspace((unsigned char)buf[i])); i++)
+        ;
+    if (i > 0)
+    {
+        len = conn->inlen -= i;
+        memmove(buf, buf + i, len);
+    }
+
+    if (len == 0)
+        return 0;
+
+    if (len >= 5 && strncmp(buf, "GET /", 5) == 0)
+    {
+        for (i = 0; i < len; i++)
+        {
+            if (buf[i] != '\n')
+                continue;
+            if (i + 1 < len && buf[i + 1] == '\n')
+                return i + 2;
+            if (i + 2 < len && buf[i + 1] == '\r' && buf[i + 2] == '\n')
+                return i + 3;
+        }
+    }
+    else if (*buf == ISJSON)
+    {
+        for (i = 0; i < len; i++)
+        {
+            if (instr)
+            {
+                if (buf[i] == '\\')
+                    i++;
+                else if (buf[i] == '"')
+                    instr = false;
+            }
+            else if (buf[i] == '"')
+                instr = true;
+            else if (buf[i] == '{')
+                depth++;
+            else if (buf[i] == '}' && --depth == 0)
+                return i + 1;
+        }
+    }
+    else
+    {
+        for (i = 0; i < len; i++)
+        {
+            if (buf[i] == '\n' || buf[i] == '\0')
+                return i + 1;
+        }
+        if (ms_tdiff((struct timeval *)now, &conn->last) >= API_PLAIN_MS)
+            return len;
+    }
+
+    // the client will not send more, or could not fit more
+    if (conn->eof || len >= TMPBUFSIZ - 1)
+        return len;
+
+    return 0;
+}
+
+/* handle the request at the start of conn->in if it is complete */
+static void api_conn_request(struct io_data *io_data, struct api_conn *conn, const struct timeval *now)
+{
+    char buf[TMPBUFSIZ];
+    int len, n;
+
+    if (conn->outlen > 0 || (len = api_request_len(conn, now)) == 0)
+        return;
+
+    memcpy(buf, conn->in, len);
+    conn->inlen -= len;
+    memmove(conn->in, conn->in + len, conn->inlen);
+
+    // strip the request terminator
+    n = len;
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == '\r' || buf[n - 1] == '\0'))
+        n--;
+    buf[n] = '\0';
+
+    applog(LOG_DEBUG, "API: recv command: (%d) '%s'", n, buf);
+
+    conn->http = strncmp(buf, "GET /", 5) == 0;
+    conn->keepalive = false;
+    if (conn->http)
+    {
+        /* HTTP/1.1 keeps the connection unless told otherwise, 1.0 only if asked */
+        if (strstr(buf, " HTTP/1.1"))
+            conn->keepalive = !strcasestr(buf, "Connection: close");
+        else
+            conn->keepalive = strcasestr(buf, "Connection: keep-alive") != NULL;
+    }
+
+    api_process(io_data, conn, buf, n);
+    api_cur_conn = NULL;
+}
+
+/*
+ * One round of the API event loop: wait for sockets to become ready,
+ * accept, read, serve complete requests and send queued replies.
+ * No client can hold up the others. Returns -1 if the listening
+ * socket failed.
+ */
+static int api_serve(struct io_data *io_data, SOCKETTYPE apisock)
+{
+    struct pollfd pfd[API_MAX_CONN + 1];
+    struct timeval now;
+    int i, n, num;
+
+    pfd[0].fd = apisock;
+    pfd[0].events = POLLIN;
+    num = api_conn_num;
+    for (i = 0; i < num; i++)
+    {
+        pfd[i + 1].fd = api_conns[i].fd;
+        pfd[i + 1].events = api_conns[i].outlen > 0 ? POLLOUT : POLLIN;
+    }
+
+    // wake up in time to finish plain requests and expire idle clients
+    n = poll(pfd, num + 1, num > 0 ? API_PLAIN_MS : 1000);
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+
+    cgtime(&now);
+
+    // walk backwards, closing a connection moves the last one into its slot
+    for (i = num - 1; i >= 0; i--)
+    {
+        struct api_conn *conn = &api_conns[i];
+        short revents = pfd[i + 1].revents;
+
+        if (revents & (POLLERR | POLLNVAL))
+        {
+            api_conn_close(conn);
+            continue;
+        }
+
+        if ((revents & (POLLIN | POLLHUP)) && conn->outlen == 0)
+        {
+            n = recv(conn->fd, conn->in + conn->inlen, TMPBUFSIZ - 1 - conn->inlen, 0);
+            if (n > 0)
+            {
+                conn->inlen += n;
+                conn->last = now;
+            }
+            else if (n == 0 || !sock_blocks())
+            {
+                conn->eof = true;
+                if (conn->inlen == 0)
+                {
+                    api_conn_close(conn);
+                    continue;
+                }
+            }
+        }
+
+        api_conn_request(io_data, conn, &now);
+
+        if (conn->outlen > 0)
+        {
+            n = send(conn->fd, conn->out + conn->outsent, conn->outlen - conn->outsent, MSG_NOSIGNAL);
+            if (n > 0)
+            {
+                conn->outsent += n;
+                conn->last = now;
+            }
+            else if (!sock_blocks())
+            {
+                applog(LOG_WARNING, "API: send to %s failed: %s", conn->connectaddr, SOCKERRMSG);
+                api_conn_close(conn);
+                continue;
+            }
+
+            if (conn->outsent == conn->outlen)
+            {
+                conn->outlen = conn->outsent = 0;
+                if (!conn->keepalive || conn->eof || bye)
+                {
+                    api_conn_close(conn);
+                    continue;
+                }
+                // a pipelined request may already be waiting
+                api_conn_request(io_data, conn, &now);
+            }
+        }
+
+        if ((conn->eof && conn->outlen == 0 && conn->inlen == 0) ||
+            now.tv_sec - conn->last.tv_sec > API_IDLE_SECS)
+            api_conn_close(conn);
+    }
+
+    if (pfd[0].revents & POLLIN)
+        api_accept(apisock);
+    else if (pfd[0].revents & (POLLERR | POLLNVAL))
+    {
+        applog(LOG_ERR, "API failed (%s)%s (%d)", SOCKERRMSG, UNAVAILABLE, (int)apisock);
+        return -1;
+    }
+
+    return 0;
+}
+
+void api(int api_thr_id)
+{
+    struct io_data *io_data;
+    struct thr_info bye_thr;
+    int bound;
+    char *binderror;
+    time_t bindstart;
+    short int port = opt_api_port;
+    char port_s[10];
+    struct addrinfo hints, *res, *host;
+
+    SOCKETTYPE *apisock;
+
+    apisock = malloc(sizeof(*apisock));
+    *apisock = INVSOCK;
 
     if (!opt_api_listen)
     {
@@ -5646,228 +6502,13 @@ void api(int api_thr_id)
     if (opt_api_mcast)
         mcast_init();
 
-    strbufs = k_new_list("StrBufs", sizeof(SBITEM), ALLOC_SBITEMS, LIMIT_SBITEMS, false);
-
     while (!bye)
     {
-        clisiz = sizeof(cli);
-        if (SOCKETFAIL(c = accept(*apisock, (struct sockaddr *)(&cli), &clisiz)))
-        {
-            applog(LOG_ERR, "API failed (%s)%s (%d)", SOCKERRMSG, UNAVAILABLE, (int)*apisock);
+        if (api_serve(io_data, *apisock) < 0)
             goto die;
-        }
-
-	/* XXX: serve all clients sequentially */
-
-        addrok = check_connect((struct sockaddr_storage *)&cli, &connectaddr, &group);
-        applog(LOG_DEBUG, "API: connection from %s - %s",
-               connectaddr, addrok ? "Accepted" : "Ignored");
-
-        if (addrok)
-        {
-	    /* XXX: if request arrives in two packets, only the first gets processed */
-            n = recv(c, &buf[0], TMPBUFSIZ-1, 0);
-            if (SOCKETFAIL(n))
-                buf[0] = '\0';
-            else
-                buf[n] = '\0';
-
-            if (opt_debug)
-            {
-                if (SOCKETFAIL(n))
-                    applog(LOG_DEBUG, "API: recv failed: %s", SOCKERRMSG);
-                else
-                    applog(LOG_DEBUG, "API: recv command: (%d) '%s'", n, buf);
-            }
-
-            if (!SOCKETFAIL(n))
-            {
-                // the time of the request in now
-                when = time(NULL);
-                io_reinit(io_data);
-
-                did = false;
-                isjoin = false;
-                json_config = 0;
-
-                if (strncmp(buf, "GET /", 5) == 0) {
-                    char *ptr = buf + 5;
-                    char *end = strchr(ptr, ' ');
-                    isjson = true;
-                    end_with_nul = false;
-                    param = NULL;
-                    cmd = NULL;
-                    io_add(io_data, "HTTP/1.1 200 OK\nContent-Type: application/json\nAccess-Control-Allow-Origin: *\n\n");
-                    if (!end) {
-                        message(io_data, MSG_MISCMD, 0, NULL, isjson);
-                        send_result(io_data, c, isjson, end_with_nul);
-                        did = true;
-                    } else {
-                        *end = 0;
-                        cmd = ptr;
-                    }
-                } else if (*buf == ISJSON) {
-                    isjson = true;
-                    end_with_nul = true;
-
-                    param = NULL;
-
-                    json_config = json_loadb(buf, n, 0, &json_err);
-
-                    if (!json_is_object(json_config))
-                    {
-                        message(io_data, MSG_INVJSON, 0, NULL, isjson);
-                        send_result(io_data, c, isjson, end_with_nul);
-                        did = true;
-                    }
-                    else
-                    {
-                        json_t *json_val;
-
-                        json_val = json_object_get(json_config, JSON_COMMAND);
-                        if (json_val == NULL)
-                        {
-                            message(io_data, MSG_MISCMD, 0, NULL, isjson);
-                            send_result(io_data, c, isjson, end_with_nul);
-                            did = true;
-                        }
-                        else
-                        {
-                            if (!json_is_string(json_val))
-                            {
-                                message(io_data, MSG_INVCMD, 0, NULL, isjson);
-                                send_result(io_data, c, isjson, end_with_nul);
-                                did = true;
-                            }
-                            else
-                            {
-                                cmd = (char *)json_string_value(json_val);
-                                json_val = json_object_get(json_config, JSON_PARAMETER);
-                                if (json_is_string(json_val))
-                                    param = (char *)json_string_value(json_val);
-                                else if (json_is_integer(json_val))
-                                {
-                                    sprintf(param_buf, "%d", (int)json_integer_value(json_val));
-                                    param = param_buf;
-                                }
-                                else if (json_is_real(json_val))
-                                {
-                                    sprintf(param_buf, "%f", (double)json_real_value(json_val));
-                                    param = param_buf;
-                                }
-                            }
-                        }
-                    }
-                } else {
-                    isjson = false;
-                    end_with_nul = true;
-
-                    param = strchr(buf, SEPARATOR);
-                    if (param != NULL)
-                        *(param++) = '\0';
-
-                    cmd = buf;
-                }
-
-                if (!did)
-                {
-                    char *cmdptr, *cmdsbuf = NULL;
-
-                    if (strchr(cmd, CMDJOIN))
-                    {
-                        firstjoin = isjoin = true;
-                        // cmd + leading+tailing '|' + '\0'
-                        cmdsbuf = malloc(strlen(cmd) + 3);
-                        if (!cmdsbuf)
-                            quithere(1, "OOM cmdsbuf");
-                        strcpy(cmdsbuf, "|");
-                        param = NULL;
-                    }
-                    else
-                        firstjoin = isjoin = false;
-
-                    cmdptr = cmd;
-                    do
-                    {
-                        did = false;
-                        if (isjoin)
-                        {
-                            cmd = strchr(cmdptr, CMDJOIN);
-                            if (cmd)
-                                *(cmd++) = '\0';
-                            if (!*cmdptr)
-                                goto inochi;
-                        }
-
-                        for (i = 0; cmds[i].name != NULL; i++)
-                        {
-                            if (strcmp(cmdptr, cmds[i].name) == 0)
-                            {
-                                sprintf(cmdbuf, "|%s|", cmdptr);
-                                if (isjoin)
-                                {
-                                    if (strstr(cmdsbuf, cmdbuf))
-                                    {
-                                        did = true;
-                                        break;
-                                    }
-                                    strcat(cmdsbuf, cmdptr);
-                                    strcat(cmdsbuf, "|");
-                                    head_join(io_data, cmdptr, isjson, &firstjoin);
-                                    if (!cmds[i].joinable)
-                                    {
-                                        message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
-                                        did = true;
-                                        tail_join(io_data, isjson);
-                                        break;
-                                    }
-                                }
-                                if (ISPRIVGROUP(group) || strstr(COMMANDS(group), cmdbuf))
-                                    (cmds[i].func)(io_data, c, param, isjson, group);
-                                else
-                                {
-                                    message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
-                                    applog(LOG_DEBUG, "API: access denied to '%s' for '%s' command", connectaddr, cmds[i].name);
-                                }
-
-                                did = true;
-                                if (!isjoin)
-                                    send_result(io_data, c, isjson, end_with_nul);
-                                else
-                                    tail_join(io_data, isjson);
-                                break;
-                            }
-                        }
-
-                        if (!did)
-                        {
-                            if (isjoin)
-                                head_join(io_data, cmdptr, isjson, &firstjoin);
-                            message(io_data, MSG_INVCMD, 0, NULL, isjson);
-                            if (isjoin)
-                                tail_join(io_data, isjson);
-                            else
-                                send_result(io_data, c, isjson, end_with_nul);
-                        }
-                    inochi:
-                        if (isjoin)
-                            cmdptr = cmd;
-                    }
-                    while (isjoin && cmdptr);
-                    if (cmdsbuf != NULL)
-                        free(cmdsbuf);
-                }
-
-                if (isjoin)
-                    send_result(io_data, c, isjson, end_with_nul);
-
-                if (isjson && json_is_object(json_config))
-                    json_decref(json_config);
-            }
-        }
-        free(connectaddr);
-        CLOSESOCKET(c);
     }
+    api_conns_flush();
+    api_conns_close();
 die:
     /* Blank line fix for older compilers since pthread_cleanup_pop is a
      * macro that gets confused by a label existing immediately before it
@@ -5876,6 +6517,7 @@ die:
     pthread_cleanup_pop(true);
 
     free(apisock);
+    api_arena_free();
 
     if (opt_debug)
         applog(LOG_DEBUG, "API: terminating due to: %s",
@@ -61,6 +61,8 @@ char *curly = ":D";
 #include "miner.h"
 #include "bench_block.h"
 #include "construct.h"
+#include "logwriter.h"
+#include "workcap.h"
 
 #ifdef USE_BITMAIN
 #include "driver-bitmain.h"
@@ -147,6 +149,7 @@ static bool opt_benchmark;
 
 bool opt_no_sensor_scan = false;
 int opt_no_sensor_scan_set;
+bool opt_sensor_cache = true;
 
 static int opt_config_format_revision = 1;
 
@@ -218,6 +221,7 @@ char *opt_logfile_path = NULL;
 char *opt_logfile_openflag = NULL;
 char *opt_logwork_path = NULL;
 char *opt_logwork_asicnum = NULL;
+char *opt_logwork_bin = NULL;
 
 bool opt_logwork_diff = false;
 
@@ -226,6 +230,7 @@ char *opt_api_groups;
 char *opt_api_description = "bmminer " BOS_SMALL_VERSION_STRING;
 int opt_api_description_set = 0;
 int opt_api_port = 4028;
+int opt_api_cache_ms = 1000;
 int opt_api_port_set = 0;
 char *opt_api_host = API_LISTEN_ADDR;
 int opt_api_host_set = 0;
@@ -271,6 +276,8 @@ int opt_fan_dangerous_temp = DANGEROUS_TEMP;
 int opt_fan_hot_temp = HOT_TEMP;
 int opt_fan_dangerous_temp_set = 0;
 int opt_fan_hot_temp_set = 0;
+int opt_fan_max_throttle = 8;
+int opt_fan_max_throttle_set = 0;
 int opt_disable_sensors = 0, opt_disable_sensors_set = 0;
 int opt_disable_remote_sensors = 0, opt_disable_remote_sensors_set = 0;
 
@@ -1324,6 +1331,7 @@ static char *enable_debug(bool *flag)
     *flag = true;
     /* Turn on verbose output, too. */
     opt_log_output = true;
+    log_update_levels();
     return NULL;
 }
 
@@ -1582,6 +1590,10 @@ static struct opt_table opt_config_table[] =
     opt_set_bool, &opt_logwork_diff,
     "Allow log work diff"),
 
+    OPT_WITH_ARG("--logwork-bin",
+    opt_set_charp, NULL, &opt_logwork_bin,
+    "Capture every nonce to this file in binary form, convert with workcap2txt"),
+
     OPT_WITH_ARG("--logfile",
     set_logfile_path, NULL, &opt_set_null,
     "Set log file, default: bmminer.log"),
@@ -1590,6 +1602,10 @@ static struct opt_table opt_config_table[] =
     opt_set_charp, NULL, &opt_api_allow,
     "Allow API access only to the given list of [G:]IP[/Prefix] addresses[/subnets]"),
 
+    OPT_WITH_ARG("--api-cache-ms",
+    set_int_0_to_9999, opt_show_intval, &opt_api_cache_ms,
+    "Serve summary/devs/stats/estats replies up to this old from cache, 0 disables (default: 1000)"),
+
     OPT_WITH_ARG_DEF("--api-description",
     opt_set_charp, NULL, &opt_api_description,
     "Description placed in the API status header, default: cgminer version",
@@ -1663,6 +1679,10 @@ static struct opt_table opt_config_table[] =
     "Disable i2c sensor scanner",
     &opt_no_sensor_scan_set),
 
+    OPT_WITHOUT_ARG("--no-sensor-cache",
+    opt_set_invbool, &opt_sensor_cache,
+    "Probe all temperature sensor addresses instead of checking the ones found last time"),
+
 
     OPT_WITH_ARG_DEF("--min-fans",
     set_int_0_to_100, opt_show_intval, &opt_min_fans,
@@ -1695,6 +1715,11 @@ static struct opt_table opt_config_table[] =
     "Limit for what is considered a hot temp (in degree celsius) - at which point miner turns fans full ON",
     &opt_fan_hot_temp_set),
 
+    OPT_WITH_ARG_DEF("--fan-max-throttle",
+    set_int_0_to_100, opt_show_intval, &opt_fan_max_throttle,
+    "Frequency steps chips may be slowed down by when fans on full can't hold the hot temp (0 disables)",
+    &opt_fan_max_throttle_set),
+
     OPT_WITHOUT_ARG_DEF("--disable-sensors",
     opt_set_bool, &opt_disable_sensors,
     "Disable temperature sensors (both local and remote)",
@@ -1733,6 +1758,22 @@ static struct opt_table opt_config_table[] =
     OPT_WITHOUT_ARG("--no-pre-heat",
     opt_set_invbool, &opt_pre_heat,
     "Set bitmain miner doesn't pre heat"),
+
+    OPT_WITHOUT_ARG("--warm-restart",
+    opt_set_bool, &opt_warm_restart,
+    "Reuse chip addressing and frequencies of the previous run when the hardware still matches"),
+
+    OPT_WITHOUT_ARG("--no-pic-cache",
+    opt_set_invbool, &opt_pic_cache,
+    "Do not keep a record of the hash boards' PIC tables to log swapped or retested boards"),
+
+    OPT_WITHOUT_ARG("--bitmain-autotune",
+    opt_set_bool, &opt_autotune,
+    "Tune each chip's frequency at runtime from its nonce and hash error rates"),
+
+    OPT_WITHOUT_ARG("--bitmain-autotune-dry-run",
+    opt_set_bool, &opt_autotune_dry_run,
+    "With --bitmain-autotune, only log the frequency changes it would make"),
 #endif
 
 #ifdef USE_BITMAIN
@@ -6520,6 +6561,7 @@ retry:
         opt_log_output ^= true;
         if (opt_log_output)
             opt_quiet = false;
+        log_update_levels();
         wlogprint("Verbose mode %s\n", opt_log_output ? "enabled" : "disabled");
         goto retry;
     }
@@ -6531,6 +6573,7 @@ retry:
         opt_protocol = false;
         opt_compact = false;
         want_per_device_stats = false;
+        log_update_levels();
         wlogprint("Output mode reset to normal\n");
         switch_logsize(false);
         goto retry;
@@ -6541,6 +6584,7 @@ retry:
         opt_log_output = opt_debug;
         if (opt_debug)
             opt_quiet = false;
+        log_update_levels();
         wlogprint("Debug mode %s\n", opt_debug ? "enabled" : "disabled");
         goto retry;
     }
@@ -6555,6 +6599,7 @@ retry:
     {
         want_per_device_stats ^= true;
         opt_log_output = want_per_device_stats;
+        log_update_levels();
         wlogprint("Per-device stats %s\n", want_per_device_stats ? "enabled" : "disabled");
         goto retry;
     }
@@ -9059,6 +9104,9 @@ void cg_savelogwork_uint32(struct work *work, uint32_t nonce)
 
 void savelog_nonce(struct work *work, uint32_t nonce)
 {
+    /* the driver already put it into the binary capture */
+    if (workcap_active)
+        return;
     if (test_nonce(work, nonce))
         cg_savelogwork_uint32(work, nonce);
 }
@@ -10748,6 +10796,8 @@ void __quit(int status, bool clean)
 #endif
     pthread_cancel(killall_t);
 
+    workcap_close();
+    logwriter_flush();
     exit(status);
 }
 
@@ -11866,6 +11916,14 @@ int main(int argc, char *argv[])
         }
     }
 
+    if(opt_logwork_bin)
+    {
+        if(!workcap_open(opt_logwork_bin))
+        {
+            quit(1, "Cannot open work capture file %s", opt_logwork_bin);
+        }
+    }
+
 #ifdef HAVE_CURSES
     if (opt_realquiet || opt_display_devs)
         use_curses = false;
@@ -11910,6 +11968,7 @@ int main(int argc, char *argv[])
     {
         opt_log_output = true;
     }
+    log_update_levels();
 
 #ifdef HAVE_SYSLOG_H
     if (opt_log_output)
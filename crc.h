@@ -18,6 +18,14 @@
 #ifndef _CRC_H_
 #define _CRC_H_
 
+#include <stdint.h>
+
 unsigned short crc16(const unsigned char *buffer, int len);
 
+/* CRC-16/MODBUS (init 0xffff), used for bmminer job and config buffers */
+uint16_t CRC16(const uint8_t *p_data, uint16_t w_len);
+
+/* BM1387 command CRC over the first len bits of ptr, MSB first */
+unsigned char CRC5(const unsigned char *ptr, unsigned char len);
+
 #endif	/* _CRC_H_ */
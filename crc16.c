@@ -1,3 +1,8 @@
+#include <stdint.h>
+#include <pthread.h>
+
+#include "crc.h"
+
 unsigned int crc16_table[256] = {
 	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
 	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
@@ -43,3 +48,78 @@ unsigned short crc16(const unsigned char *buffer, int len)
 
 	return crc;
 }
+
+/*
+ * CRC-16/MODBUS, reflected polynomial 0xa001, sliced by four bytes.
+ * crc16_modbus_table[k][b] is the CRC of byte b followed by k zero bytes.
+ */
+static uint16_t crc16_modbus_table[4][256];
+
+/* CRC5 of the BM1387 (x^5 + x^2 + 1), kept in the top five bits of a byte */
+static uint8_t crc5_table[256];
+
+static void crc_init_tables(void)
+{
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		uint16_t crc = i;
+		uint8_t crc5 = i;
+
+		for (k = 0; k < 8; k++) {
+			crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+			crc5 = (crc5 & 0x80) ? (crc5 << 1) ^ (0x05 << 3) : crc5 << 1;
+		}
+		crc16_modbus_table[0][i] = crc;
+		crc5_table[i] = crc5;
+	}
+
+	for (i = 0; i < 256; i++)
+		for (k = 1; k < 4; k++)
+			crc16_modbus_table[k][i] = (crc16_modbus_table[k-1][i] >> 8) ^
+				crc16_modbus_table[0][crc16_modbus_table[k-1][i] & 0xff];
+}
+
+static pthread_once_t crc_tables_once = PTHREAD_ONCE_INIT;
+
+uint16_t CRC16(const uint8_t *p_data, uint16_t w_len)
+{
+	uint32_t crc = 0xffff;
+
+	pthread_once(&crc_tables_once, crc_init_tables);
+
+	while (w_len >= 4) {
+		crc ^= p_data[0] | (p_data[1] << 8) | ((uint32_t)p_data[2] << 16) | ((uint32_t)p_data[3] << 24);
+		crc = crc16_modbus_table[3][crc & 0xff] ^
+		      crc16_modbus_table[2][(crc >> 8) & 0xff] ^
+		      crc16_modbus_table[1][(crc >> 16) & 0xff] ^
+		      crc16_modbus_table[0][crc >> 24];
+		p_data += 4;
+		w_len -= 4;
+	}
+	while (w_len--)
+		crc = (crc >> 8) ^ crc16_modbus_table[0][(crc ^ *p_data++) & 0xff];
+
+	return crc;
+}
+
+unsigned char CRC5(const unsigned char *ptr, unsigned char len)
+{
+	uint8_t crc = 0x1f << 3;
+	unsigned char bit;
+
+	pthread_once(&crc_tables_once, crc_init_tables);
+
+	for (; len >= 8; len -= 8)
+		crc = crc5_table[crc ^ *ptr++];
+
+	/* trailing bits of a partial byte */
+	for (bit = 0x80; len > 0; len--, bit >>= 1) {
+		if (!(crc & 0x80) != !(*ptr & bit))
+			crc = (crc << 1) ^ (0x05 << 3);
+		else
+			crc <<= 1;
+	}
+
+	return crc >> 3;
+}
@@ -49,6 +49,9 @@
 #include "elist.h"
 #include "miner.h"
 #include "fancontrol.h"
+#include "crc.h"
+#include "logwriter.h"
+#include "workcap.h"
 #include "sensors.h"
 // #include "usbutils.h"
 
@@ -185,6 +188,7 @@ extern void writeLogFile(char *logstr);
 
 bool gBegin_get_nonce = false;
 struct timeval tv_send_job = {0, 0};
+time_t last_new_job = 0;  // when the pool last gave a new job, re-sends do not count
 struct timeval tv_send = {0, 0};
 
 pthread_mutex_t reg_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -219,6 +223,10 @@ int FatalErrorValue=0;
 bool opt_bitmain_new_cmd_type_vil = false;
 bool opt_fixed_freq = false;
 bool opt_pre_heat = true;
+bool opt_warm_restart = false;
+bool opt_pic_cache = true;
+bool opt_autotune = false;
+bool opt_autotune_dry_run = false;
 
 bool status_error = false;
 bool once_error = false;
@@ -274,9 +282,19 @@ unsigned char badcore_num_buf[BITMAIN_MAX_CHAIN_NUM][64] = {0};
 
 int chain_badcore_num[BITMAIN_MAX_CHAIN_NUM][256] = {0};
 int chain_core_num[BITMAIN_MAX_CHAIN_NUM] = {0};
+int chain_recover_num[BITMAIN_MAX_CHAIN_NUM] = {0};  // per-chain re-init count
+int chain_recover_ms[BITMAIN_MAX_CHAIN_NUM] = {0};   // hashing time lost to them
+
+// hash errors are not counted while the chains are paused for a single chain re-init
+static volatile bool hw_error_mask = false;
+static struct timeval hw_error_mask_end;    // and until work sent before it is done
+#define HW_ERROR_MASK_TAIL_MS   1000
+int throttle_applied[BITMAIN_MAX_CHAIN_NUM] = {0};  // PLL steps below the frequency table, see fancontrol
+int chain_opencore_ms[BITMAIN_MAX_CHAIN_NUM] = {0};  // duration of the last open core per chain
 
 unsigned char show_last_freq[BITMAIN_MAX_CHAIN_NUM][256] = {0}; // only used to showed to users
 unsigned char chip_last_freq[BITMAIN_MAX_CHAIN_NUM][256] = {0}; // this is the real value , which set freq into chips
+unsigned char chip_flash_freq[BITMAIN_MAX_CHAIN_NUM][256] = {0}; // chip_last_freq as first set up, before autotune
 
 unsigned char pic_temp_offset[BITMAIN_MAX_CHAIN_NUM] = {0};
 unsigned char base_freq_index[BITMAIN_MAX_CHAIN_NUM] = {0};
@@ -287,6 +305,8 @@ int temp_offside[BITMAIN_MAX_CHAIN_NUM] = {0};
 #define CHAIN_ERROR_RATE_WINDOW_SEC (60*60)
 struct timed_avg chain_error_rate[BITMAIN_MAX_CHAIN_NUM];
 
+struct asic_stats *asic_stats[BITMAIN_MAX_CHAIN_NUM];
+
 static bool global_stop = false;
 
 //Test Core
@@ -320,6 +340,8 @@ pthread_mutex_t reinit_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static int reinit_counter=0;
 void bitmain_core_reInit();
+void bitmain_chain_reInit(int chainIndex);
+void thermal_throttle_apply(int steps);
 
 signed char getMeddleOffsetForTestPatten(int chainIndex)
 {
@@ -371,139 +393,6 @@ unsigned int is_first_job = 0;
 
 //other equipment related
 
-// --------------------------------------------------------------
-//      CRC16 check table
-// --------------------------------------------------------------
-const uint8_t chCRCHTalbe[] =                                 // CRC high byte table
-{
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40
-};
-
-const uint8_t chCRCLTalbe[] =                                 // CRC low byte table
-{
-    0x00, 0xC0, 0xC1, 0x01, 0xC3, 0x03, 0x02, 0xC2, 0xC6, 0x06, 0x07, 0xC7,
-    0x05, 0xC5, 0xC4, 0x04, 0xCC, 0x0C, 0x0D, 0xCD, 0x0F, 0xCF, 0xCE, 0x0E,
-    0x0A, 0xCA, 0xCB, 0x0B, 0xC9, 0x09, 0x08, 0xC8, 0xD8, 0x18, 0x19, 0xD9,
-    0x1B, 0xDB, 0xDA, 0x1A, 0x1E, 0xDE, 0xDF, 0x1F, 0xDD, 0x1D, 0x1C, 0xDC,
-    0x14, 0xD4, 0xD5, 0x15, 0xD7, 0x17, 0x16, 0xD6, 0xD2, 0x12, 0x13, 0xD3,
-    0x11, 0xD1, 0xD0, 0x10, 0xF0, 0x30, 0x31, 0xF1, 0x33, 0xF3, 0xF2, 0x32,
-    0x36, 0xF6, 0xF7, 0x37, 0xF5, 0x35, 0x34, 0xF4, 0x3C, 0xFC, 0xFD, 0x3D,
-    0xFF, 0x3F, 0x3E, 0xFE, 0xFA, 0x3A, 0x3B, 0xFB, 0x39, 0xF9, 0xF8, 0x38,
-    0x28, 0xE8, 0xE9, 0x29, 0xEB, 0x2B, 0x2A, 0xEA, 0xEE, 0x2E, 0x2F, 0xEF,
-    0x2D, 0xED, 0xEC, 0x2C, 0xE4, 0x24, 0x25, 0xE5, 0x27, 0xE7, 0xE6, 0x26,
-    0x22, 0xE2, 0xE3, 0x23, 0xE1, 0x21, 0x20, 0xE0, 0xA0, 0x60, 0x61, 0xA1,
-    0x63, 0xA3, 0xA2, 0x62, 0x66, 0xA6, 0xA7, 0x67, 0xA5, 0x65, 0x64, 0xA4,
-    0x6C, 0xAC, 0xAD, 0x6D, 0xAF, 0x6F, 0x6E, 0xAE, 0xAA, 0x6A, 0x6B, 0xAB,
-    0x69, 0xA9, 0xA8, 0x68, 0x78, 0xB8, 0xB9, 0x79, 0xBB, 0x7B, 0x7A, 0xBA,
-    0xBE, 0x7E, 0x7F, 0xBF, 0x7D, 0xBD, 0xBC, 0x7C, 0xB4, 0x74, 0x75, 0xB5,
-    0x77, 0xB7, 0xB6, 0x76, 0x72, 0xB2, 0xB3, 0x73, 0xB1, 0x71, 0x70, 0xB0,
-    0x50, 0x90, 0x91, 0x51, 0x93, 0x53, 0x52, 0x92, 0x96, 0x56, 0x57, 0x97,
-    0x55, 0x95, 0x94, 0x54, 0x9C, 0x5C, 0x5D, 0x9D, 0x5F, 0x9F, 0x9E, 0x5E,
-    0x5A, 0x9A, 0x9B, 0x5B, 0x99, 0x59, 0x58, 0x98, 0x88, 0x48, 0x49, 0x89,
-    0x4B, 0x8B, 0x8A, 0x4A, 0x4E, 0x8E, 0x8F, 0x4F, 0x8D, 0x4D, 0x4C, 0x8C,
-    0x44, 0x84, 0x85, 0x45, 0x87, 0x47, 0x46, 0x86, 0x82, 0x42, 0x43, 0x83,
-    0x41, 0x81, 0x80, 0x40
-};
-
-
-//crc
-uint16_t CRC16(const uint8_t* p_data, uint16_t w_len)
-{
-    uint8_t chCRCHi = 0xFF; // CRC high byte initialize
-    uint8_t chCRCLo = 0xFF; // CRC low byte initialize
-    uint16_t wIndex = 0;    // CRC cycling index
-
-    while (w_len--)
-    {
-        wIndex = chCRCLo ^ *p_data++;
-        chCRCLo = chCRCHi ^ chCRCHTalbe[wIndex];
-        chCRCHi = chCRCLTalbe[wIndex];
-    }
-    return ((chCRCHi << 8) | chCRCLo);
-}
-
-unsigned char CRC5(unsigned char *ptr, unsigned char len)
-{
-    unsigned char i, j, k;
-    unsigned char crc = 0x1f;
-
-    unsigned char crcin[5] = {1, 1, 1, 1, 1};
-    unsigned char crcout[5] = {1, 1, 1, 1, 1};
-    unsigned char din = 0;
-
-    j = 0x80;
-    k = 0;
-    for (i = 0; i < len; i++)
-    {
-        if (*ptr & j)
-        {
-            din = 1;
-        }
-        else
-        {
-            din = 0;
-        }
-        crcout[0] = crcin[4] ^ din;
-        crcout[1] = crcin[0];
-        crcout[2] = crcin[1] ^ crcin[4] ^ din;
-        crcout[3] = crcin[2];
-        crcout[4] = crcin[3];
-
-        j = j >> 1;
-        k++;
-        if (k == 8)
-        {
-            j = 0x80;
-            k = 0;
-            ptr++;
-        }
-        memcpy(crcin, crcout, 5);
-    }
-    crc = 0;
-    if(crcin[4])
-    {
-        crc |= 0x10;
-    }
-    if(crcin[3])
-    {
-        crc |= 0x08;
-    }
-    if(crcin[2])
-    {
-        crc |= 0x04;
-    }
-    if(crcin[1])
-    {
-        crc |= 0x02;
-    }
-    if(crcin[0])
-    {
-        crc |= 0x01;
-    }
-    return crc;
-}
-
 unsigned char getPICvoltageFromValue(int vol_value) // vol_value = 940  means 9.4V
 {
 #ifdef S9_PLUS
@@ -701,78 +590,6 @@ int getFixedFreqVoltageValue(int freq)
 
 }
 
-#ifdef T9_18
-void getPICChainIndexOffset(int chainIndex, int *pChain, int *pOffset)
-{
-    int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset;
-    switch(chainIndex)
-    {
-        case 1:
-            new_T9_PLUS_chainIndex=1;
-            new_T9_PLUS_chainOffset=0;
-            break;
-        case 8:
-            new_T9_PLUS_chainIndex=1;
-            new_T9_PLUS_chainOffset=1;
-            break;
-        case 9:
-            new_T9_PLUS_chainIndex=1;
-            new_T9_PLUS_chainOffset=2;
-            break;
-        case 2:
-            new_T9_PLUS_chainIndex=2;
-            new_T9_PLUS_chainOffset=0;
-            break;
-        case 10:
-            new_T9_PLUS_chainIndex=2;
-            new_T9_PLUS_chainOffset=1;
-            break;
-        case 11:
-            new_T9_PLUS_chainIndex=2;
-            new_T9_PLUS_chainOffset=2;
-            break;
-        case 3:
-            new_T9_PLUS_chainIndex=3;
-            new_T9_PLUS_chainOffset=0;
-            break;
-        case 12:
-            new_T9_PLUS_chainIndex=3;
-            new_T9_PLUS_chainOffset=1;
-            break;
-        case 13:
-            new_T9_PLUS_chainIndex=3;
-            new_T9_PLUS_chainOffset=2;
-            break;
-        default:
-            new_T9_PLUS_chainIndex=0;
-            new_T9_PLUS_chainOffset=0;
-            break;
-    }
-
-    *pChain=new_T9_PLUS_chainIndex;
-    *pOffset=new_T9_PLUS_chainOffset;
-}
-#endif
-
-int getChainAsicFreqIndex(int chainIndex, int asicIndex)
-{
-#ifdef T9_18
-    if(fpga_version>=0xE)
-    {
-        int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset; // only used by new T9+ FPGA
-        getPICChainIndexOffset(chainIndex,&new_T9_PLUS_chainIndex,&new_T9_PLUS_chainOffset);
-
-        return chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+asicIndex];
-    }
-    else
-    {
-        return chain_pic_buf[((chainIndex/3)*3)][7+(chainIndex%3)*31+4+asicIndex];
-    }
-#else
-    return last_freq[chainIndex][asicIndex*2+3];
-#endif
-}
-
 // pic
 unsigned int get_pic_iic()
 {
@@ -788,22 +605,24 @@ unsigned char set_pic_iic(unsigned int data)
     unsigned int ret=0;
     unsigned char ret_data = 0;
 
+    int polls = 0;
+
     *((unsigned int *)(axi_fpga_addr + IIC_COMMAND)) = data & 0x7fffffff;
     applog(LOG_DEBUG,"%s: set IIC_COMMAND is 0x%x\n", __FUNCTION__, data & 0x7fffffff);
 
     while(1)
     {
-        ret = get_pic_iic();
+        ret = *(axi_fpga_addr + IIC_COMMAND);
         if(ret & 0x80000000)
         {
             ret_data = (unsigned char)(ret & 0x000000ff);
             return ret_data;
         }
+        // a byte is done in about 100us, do not sleep a whole 1ms for each one
+        if(polls++ < PIC_IIC_FAST_POLLS)
+            cgsleep_us(PIC_IIC_FAST_POLL_US);
         else
-        {
-            applog(LOG_DEBUG,"%s: waiting write pic iic\n", __FUNCTION__);
             cgsleep_us(1000);
-        }
     }
 }
 
@@ -834,10 +653,27 @@ unsigned char write_pic_iic(bool read, bool reg_addr_valid, unsigned char reg_ad
     return ret;
 }
 
+/*
+ * Write txlen bytes to the PIC of the chain and read rxlen bytes back,
+ * the same as that many write_pic_iic() calls but with the command word
+ * built once. Callers hold iic_mutex as for write_pic_iic().
+ */
+void pic_iic_xfer(unsigned char chain, const unsigned char *tx, int txlen, unsigned char *rx, int rxlen)
+{
+    unsigned int value = IIC_ADDR_HIGH_4_BIT | IIC_CHAIN_NUMBER(chain);
+    int i;
+
+    for(i=0; i<txlen; i++)
+        set_pic_iic(value | tx[i]);
+    for(i=0; i<rxlen; i++)
+        rx[i] = set_pic_iic(value | IIC_READ);
+}
+
 void send_pic_command(unsigned char chain)
 {
-    write_pic_iic(false, false, 0x0, chain, PIC_COMMAND_1);
-    write_pic_iic(false, false, 0x0, chain, PIC_COMMAND_2);
+    static const unsigned char cmd[] = {PIC_COMMAND_1, PIC_COMMAND_2};
+
+    pic_iic_xfer(chain, cmd, sizeof(cmd), NULL, 0);
 }
 
 void get_pic_iic_flash_addr_pointer(unsigned char chain, unsigned char *addr_H, unsigned char *addr_L);
@@ -851,11 +687,9 @@ void set_pic_iic_flash_addr_pointer(unsigned char chain, unsigned char addr_H, u
     do
     {
 #endif
-        send_pic_command(chain);
+        unsigned char cmd[] = {PIC_COMMAND_1, PIC_COMMAND_2, SET_PIC_FLASH_POINTER, addr_H, addr_L};
 
-        write_pic_iic(false, false, 0x0, chain, SET_PIC_FLASH_POINTER);
-        write_pic_iic(false, false, 0x0, chain, addr_H);
-        write_pic_iic(false, false, 0x0, chain, addr_L);
+        pic_iic_xfer(chain, cmd, sizeof(cmd), NULL, 0);
 
         // we need check this address, because some PIC lost data of flash!!!
         get_pic_iic_flash_addr_pointer(chain,&check_addr_H,&check_addr_L);
@@ -881,36 +715,38 @@ void set_pic_iic_flash_addr_pointer(unsigned char chain, unsigned char addr_H, u
 
     void send_data_to_pic_iic(unsigned char chain, unsigned char command, unsigned char *buf, unsigned char length)
     {
-        int i=0;
-
-        write_pic_iic(false, false, 0x0, chain, command);
-        for(i=0; i<length; i++)
-        {
-            write_pic_iic(false, false, 0x0, chain, *(buf + i));
-        }
+        pic_iic_xfer(chain, &command, 1, NULL, 0);
+        pic_iic_xfer(chain, buf, length, NULL, 0);
     }
 
     void get_data_from_pic_iic(unsigned char chain, unsigned char command, unsigned char *buf, unsigned char length)
     {
-        int i=0;
-
-        write_pic_iic(false, false, 0x0, chain, command);
-        for(i=0; i<length; i++)
-        {
-            *(buf + i) = write_pic_iic(true, false, 0x0, chain, 0);
-        }
+        pic_iic_xfer(chain, &command, 1, buf, length);
     }
 
     void send_data_to_pic_flash(unsigned char chain, unsigned char *buf)
     {
-        send_pic_command(chain);
-        send_data_to_pic_iic(chain, SEND_DATA_TO_IIC, buf, 16);
+        unsigned char cmd[3+16] = {PIC_COMMAND_1, PIC_COMMAND_2, SEND_DATA_TO_IIC};
+
+        memcpy(cmd+3, buf, 16);
+        pic_iic_xfer(chain, cmd, sizeof(cmd), NULL, 0);
     }
 
     void get_data_from_pic_flash(unsigned char chain, unsigned char *buf)
     {
-        send_pic_command(chain);
-        get_data_from_pic_iic(chain, READ_DATA_FROM_IIC, buf, 16);
+        static const unsigned char cmd[] = {PIC_COMMAND_1, PIC_COMMAND_2, READ_DATA_FROM_IIC};
+
+        pic_iic_xfer(chain, cmd, sizeof(cmd), buf, 16);
+    }
+
+    // read len bytes (a multiple of 16) of PIC flash from addr_H:addr_L on
+    void read_pic_flash(unsigned char chain, unsigned char addr_H, unsigned char addr_L, unsigned char *buf, int len)
+    {
+        int i;
+
+        set_pic_iic_flash_addr_pointer(chain, addr_H, addr_L);
+        for(i=0; i<len; i+=16)
+            get_data_from_pic_flash(chain, buf+i);
     }
 
     unsigned char erase_pic_flash(unsigned char chain)
@@ -1387,10 +1223,12 @@ void set_pic_iic_flash_addr_pointer(unsigned char chain, unsigned char addr_H, u
 
     void get_pic_iic_flash_addr_pointer(unsigned char chain, unsigned char *addr_H, unsigned char *addr_L)
     {
-        send_pic_command(chain);
-        write_pic_iic(false, false, 0x0, chain, GET_PIC_FLASH_POINTER);
-        *addr_H = write_pic_iic(true, false, 0x0, chain, 0);
-        *addr_L = write_pic_iic(true, false, 0x0, chain, 0);
+        static const unsigned char cmd[] = {PIC_COMMAND_1, PIC_COMMAND_2, GET_PIC_FLASH_POINTER};
+        unsigned char addr[2];
+
+        pic_iic_xfer(chain, cmd, sizeof(cmd), addr, 2);
+        *addr_H = addr[0];
+        *addr_L = addr[1];
     }
 
 #ifdef T9_18
@@ -2614,29 +2452,6 @@ void set_Hardware_version(unsigned int value)
         get_time_out_control();
     }
 
-    int get_BC_command_buffer(unsigned int *buf)
-    {
-        int ret = -1;
-        ret = *((unsigned int *)(axi_fpga_addr + BC_COMMAND_BUFFER));
-        *(buf + 0) = ret;   //this is for FIL
-        ret = *((unsigned int *)(axi_fpga_addr + BC_COMMAND_BUFFER + 1));
-        *(buf + 1) = ret;
-        ret = *((unsigned int *)(axi_fpga_addr + BC_COMMAND_BUFFER + 2));
-        *(buf + 2) = ret;
-        applog(LOG_DEBUG,"%s: BC_COMMAND_BUFFER buf[0]: 0x%x, buf[1]: 0x%x, buf[2]: 0x%x\n", __FUNCTION__, *(buf + 0), *(buf + 1), *(buf + 2));
-        return ret;
-    }
-
-    void set_BC_command_buffer(unsigned int *value)
-    {
-        unsigned int buf[4] = {0};
-        *((unsigned int *)(axi_fpga_addr + BC_COMMAND_BUFFER)) = *(value + 0);      //this is for FIL
-        *((unsigned int *)(axi_fpga_addr + BC_COMMAND_BUFFER + 1)) = *(value + 1);
-        *((unsigned int *)(axi_fpga_addr + BC_COMMAND_BUFFER + 2)) = *(value + 2);
-        applog(LOG_DEBUG,"%s: set BC_COMMAND_BUFFER value[0]: 0x%x, value[1]: 0x%x, value[2]: 0x%x\n", __FUNCTION__, *(value + 0), *(value + 1), *(value + 2));
-        get_BC_command_buffer(buf);
-    }
-
     int get_nonce_number_in_fifo(void)
     {
         int ret = -1;
@@ -2693,6 +2508,136 @@ void set_Hardware_version(unsigned int value)
         }
     }
 
+    /* BC command engine: the FPGA has a single command buffer shared by all chains,
+     * a command is handed over as soon as BC_COMMAND_BUFFER_READY drops instead of
+     * sleeping a fixed time after each one */
+#define BC_CMD_TIMEOUT_US   3000000
+    /* a ready buffer only means the command went out, a chip needs this long
+     * after a PLL divider write before its clock is locked again */
+#define PLL_SETTLE_US       10000
+
+    static pthread_mutex_t bc_cmd_mutex = PTHREAD_MUTEX_INITIALIZER;
+    static struct bc_cmd_stats bc_stats;
+
+    void bc_cmd_fil(struct bc_cmd *cmd, unsigned char chain, const unsigned char *buf)
+    {
+        cmd->chain = chain;
+        cmd->buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
+        cmd->buf[1] = 0;
+        cmd->buf[2] = 0;
+    }
+
+    void bc_cmd_vil(struct bc_cmd *cmd, unsigned char chain, const unsigned char *buf, int len)
+    {
+        int i;
+
+        cmd->chain = chain;
+        memset(cmd->buf, 0, sizeof(cmd->buf));
+        for(i=0; i < len && i < (int)sizeof(cmd->buf); i++)
+            cmd->buf[i/4] |= buf[i] << (24 - 8*(i%4));
+    }
+
+    /* caller holds bc_cmd_mutex */
+    static bool bc_cmd_wait_ready(void)
+    {
+        struct timeval start, now;
+        unsigned int waited;
+        int polls = 0;
+
+        if(!(*((unsigned int *)(axi_fpga_addr + BC_WRITE_COMMAND)) & BC_COMMAND_BUFFER_READY))
+            return true;
+
+        cgtime(&start);
+        while(*((unsigned int *)(axi_fpga_addr + BC_WRITE_COMMAND)) & BC_COMMAND_BUFFER_READY)
+        {
+            // a command takes tens of us on the wire at working baud, so spin a little first
+            if(++polls > 20)
+                cgsleep_us(100);
+
+            cgtime(&now);
+            waited = us_tdiff(&now, &start);
+            if(waited > BC_CMD_TIMEOUT_US)
+            {
+                bc_stats.timeouts++;
+                writeInitLogFile("Error: BC command buffer ready timeout!\n");
+                return false;
+            }
+        }
+
+        cgtime(&now);
+        waited = us_tdiff(&now, &start);
+        bc_stats.wait_us += waited;
+        if(waited > bc_stats.max_us)
+            bc_stats.max_us = waited;
+        return true;
+    }
+
+    static bool bc_cmd_submit_locked(const struct bc_cmd *cmd)
+    {
+        unsigned int ret;
+
+        // the FPGA still holds a command, overwriting it would lose that one
+        if(!bc_cmd_wait_ready())
+            return false;
+
+        *((unsigned int *)(axi_fpga_addr + BC_COMMAND_BUFFER)) = cmd->buf[0];
+        *((unsigned int *)(axi_fpga_addr + BC_COMMAND_BUFFER + 1)) = cmd->buf[1];
+        *((unsigned int *)(axi_fpga_addr + BC_COMMAND_BUFFER + 2)) = cmd->buf[2];
+
+        ret = *((unsigned int *)(axi_fpga_addr + BC_WRITE_COMMAND));
+        *((unsigned int *)(axi_fpga_addr + BC_WRITE_COMMAND)) = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (cmd->chain << 16) | (ret & 0xfff0ffff);
+        bc_stats.num++;
+
+        return true;
+    }
+
+    /* returns once the FPGA took the command, it is still being shifted out */
+    bool bc_cmd_submit(const struct bc_cmd *cmd)
+    {
+        bool ok;
+
+        pthread_mutex_lock(&bc_cmd_mutex);
+        ok = bc_cmd_submit_locked(cmd);
+        pthread_mutex_unlock(&bc_cmd_mutex);
+        return ok;
+    }
+
+    /* stops at the first command the FPGA does not take, a stuck engine
+     * would otherwise cost BC_CMD_TIMEOUT_US per remaining command */
+    bool bc_cmd_submit_batch(const struct bc_cmd *cmd, int num)
+    {
+        bool ok = true;
+        int i;
+
+        pthread_mutex_lock(&bc_cmd_mutex);
+        for(i=0; i < num && ok; i++)
+            ok = bc_cmd_submit_locked(&cmd[i]);
+        pthread_mutex_unlock(&bc_cmd_mutex);
+        return ok;
+    }
+
+    /* read-modify-write of the control bits (bauddiv, null work, chain id) of
+     * BC_WRITE_COMMAND, done between two commands so a hand-over never writes
+     * back stale bits */
+    void bc_cmd_set_ctrl(unsigned int mask, unsigned int bits)
+    {
+        unsigned int ret;
+
+        pthread_mutex_lock(&bc_cmd_mutex);
+        bc_cmd_wait_ready();
+        ret = *((unsigned int *)(axi_fpga_addr + BC_WRITE_COMMAND));
+        ret = (ret & ~mask & ~BC_COMMAND_BUFFER_READY) | bits;
+        *((unsigned int *)(axi_fpga_addr + BC_WRITE_COMMAND)) = ret;
+        pthread_mutex_unlock(&bc_cmd_mutex);
+    }
+
+    void bc_cmd_get_stats(struct bc_cmd_stats *stats)
+    {
+        pthread_mutex_lock(&bc_cmd_mutex);
+        *stats = bc_stats;
+        pthread_mutex_unlock(&bc_cmd_mutex);
+    }
+
     int get_ticket_mask(void)
     {
         int ret = -1;
@@ -2937,6 +2882,33 @@ void set_Hardware_version(unsigned int value)
         return ret;
     }
 
+#define WORK_FIFO_DRAIN_MS      5000    // what the old re-init slept with RUN_BIT off
+#define WORK_SHIFT_OUT_MS       20      // one work leaving the shifter, ample even at 115200 baud
+
+    /* with RUN_BIT off, wait until the work FIFO of every present chain but
+     * skip_chain has room again and the last work is shifted out, false
+     * if one is still full after WORK_FIFO_DRAIN_MS */
+    static bool wait_work_fifo_drained(int skip_chain)
+    {
+        unsigned int mask = 0;
+        int i, waited = 0;
+
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(dev->chain_exist[i] == 1 && i != skip_chain)
+                mask |= 0x1 << i;
+        }
+        while(((unsigned int)get_buffer_space() & mask) != mask)
+        {
+            if(waited >= WORK_FIFO_DRAIN_MS)
+                return false;
+            cgsleep_ms(1);
+            waited++;
+        }
+        cgsleep_ms(WORK_SHIFT_OUT_MS);
+        return true;
+    }
+
     int get_hash_counting_number(void)
     {
         int ret = -1;
@@ -3252,10 +3224,13 @@ void wait_for_fans(void)
 		//float hitemp = MAX(dev->temp_top1[PWM_T], dev->temp_top1[TEMP_POS_LOCAL]);
 		float hitemp = MAX(all_chain_max_temp.remote, all_chain_max_temp.local);
 		int duty;
+		int throttle;
 		mutex_lock(&fancontrol_lock);
 		duty = fancontrol_calculate(&fancontrol, all_chain_max_temp_ok, hitemp);
+		throttle = fancontrol.throttle;
 		mutex_unlock(&fancontrol_lock);
 		set_PWM(duty);
+		thermal_throttle_apply(throttle);
 		return;
 	}
 
@@ -3415,206 +3390,283 @@ void wait_for_fans(void)
     static void get_plldata(int type,int freq,uint32_t * reg_data,uint16_t * reg_data2, uint32_t *vil_data)
     {
         uint32_t i;
-        char plldivider1[32] = {0};
-        char plldivider2[32] = {0};
-        char vildivider[32] = {0};
 
 	assert(type == 1385);
 
 	i = get_pll_index(freq);
 
-        sprintf(plldivider1, "%08x", freq_pll_1385[i].fildiv1);
-        sprintf(plldivider2, "%04x", freq_pll_1385[i].fildiv2);
-        sprintf(vildivider, "%04x", freq_pll_1385[i].vilpll);
-
         *reg_data = freq_pll_1385[i].fildiv1;
         *reg_data2 = freq_pll_1385[i].fildiv2;
         *vil_data = freq_pll_1385[i].vilpll;
     }
 
 
+    /* vil SET_CONFIG of PLL_PARAMETER, to the chip at addr or with all to every chip of the chain */
+    static void bc_cmd_pll(struct bc_cmd *cmd, int pllindex, bool all, unsigned char addr, unsigned char chain)
+    {
+        unsigned char buf[9] = {0,0,0,0,0,0,0,0,0};
+        uint32_t reg_data_vil = freq_pll_1385[pllindex].vilpll;
+
+        buf[0] = VIL_COMMAND_TYPE | SET_CONFIG;
+        if(all)
+            buf[0] |= VIL_ALL;
+        buf[1] = 0x09;
+        buf[2] = addr;
+        buf[3] = PLL_PARAMETER;
+        buf[4] = (reg_data_vil >> 24) & 0xff;
+        buf[5] = (reg_data_vil >> 16) & 0xff;
+        buf[6] = (reg_data_vil >> 8) & 0xff;
+        buf[7] = (reg_data_vil >> 0) & 0xff;
+        buf[8] = CRC5(buf, 8*8);
+
+        bc_cmd_vil(cmd, chain, buf, 9);
+    }
+
     void set_frequency_with_addr_plldatai(int pllindex,unsigned char mode,unsigned char addr, unsigned char chain)
     {
         unsigned char buf[9] = {0,0,0,0,0,0,0,0,0};
-        unsigned int cmd_buf[3] = {0,0,0};
+        struct bc_cmd cmd[2];
         int i;
-        unsigned int ret, value;
         uint32_t reg_data_pll = 0;
         uint16_t reg_data_pll2 = 0;
-        uint32_t reg_data_vil = 0;
         i = chain;
 
-        reg_data_vil = freq_pll_1385[pllindex].vilpll;;
+        invalidate_chain_freq_stats(chain);
 
         //applog(LOG_DEBUG,"%s: i = %d\n", __FUNCTION__, i);
         if(!opt_multi_version)  // fil mode
         {
             memset(buf,0,sizeof(buf));
-            memset(cmd_buf,0,sizeof(cmd_buf));
             buf[0] = 0;
             buf[0] |= SET_PLL_DIVIDER1;
             buf[1] = (reg_data_pll >> 16) & 0xff;
             buf[2] = (reg_data_pll >> 8) & 0xff;
             buf[3] = (reg_data_pll >> 0) & 0xff;
             buf[3] |= CRC5(buf, 4*8 - 5);
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-
-            set_BC_command_buffer(cmd_buf);
-            ret = get_BC_write_command();
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID| (i << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
-
-            cgsleep_us(3000);
+            bc_cmd_fil(&cmd[0], i, buf);
 
             memset(buf,0,sizeof(buf));
-            memset(cmd_buf,0,sizeof(cmd_buf));
             buf[0] = SET_PLL_DIVIDER2;
             buf[0] |= COMMAND_FOR_ALL;
             buf[1] = 0;     //addr
             buf[2] = reg_data_pll2 >> 8;
             buf[3] = reg_data_pll2& 0x0ff;
             buf[3] |= CRC5(buf, 4*8 - 5);
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-
-            set_BC_command_buffer(cmd_buf);
-            ret = get_BC_write_command();
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID| (i << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
+            bc_cmd_fil(&cmd[1], i, buf);
 
-            cgsleep_us(5000);
+            bc_cmd_submit_batch(cmd, 2);
         }
         else    // vil
         {
-            memset(buf,0,9);
-            memset(cmd_buf,0,3*sizeof(int));
-            if(mode)
-            {
-                buf[0] = VIL_COMMAND_TYPE | VIL_ALL | SET_CONFIG;
-            }
-            else
+            bc_cmd_pll(&cmd[0], pllindex, mode, addr, i);
+            bc_cmd_submit(&cmd[0]);
+        }
+        cgsleep_us(PLL_SETTLE_US);
+    }
+
+    /*
+     * Frequency plans: plan[i] holds the PLL index of every chip of chain
+     * i, NULL leaves the chain alone. The index most chips of a chain
+     * share goes out as one broadcast when at least half of them use it,
+     * then only the other chips are addressed; the commands of all chains
+     * go to the FPGA as one batch. Chips briefly run at the broadcast
+     * frequency before their own command arrives, a few hundred us.
+     * With running set the chips are hashing or keep the clocks of a
+     * previous run: only the lowest index of the plan may be broadcast,
+     * so no chip is clocked above its plan, and chips the broadcast does
+     * not cover are addressed once.
+     * Returns the number of commands sent, once the PLLs have settled,
+     * or -1 if the FPGA stopped taking them and the plan is only partly
+     * applied.
+     */
+    int set_frequency_plan(const unsigned char *plan[BITMAIN_MAX_CHAIN_NUM], bool running)
+    {
+        struct bc_cmd *cmd;
+        int count[FREQ_PLL_NUM];
+        int i, j, num = 0, common, lowest;
+        bool ok;
+
+        if(!opt_multi_version)  // fil mode has no per-chip PLL commands to group
+        {
+            for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
             {
-                buf[0] = VIL_COMMAND_TYPE | SET_CONFIG;
+                if(!plan[i] || dev->chain_exist[i] != 1)
+                    continue;
+                for(j = 0; j < dev->chain_asic_num[i]; j++)
+                    set_frequency_with_addr_plldatai(plan[i][j], 0, j * dev->addrInterval, i);
+                num += dev->chain_asic_num[i];
             }
+            return num;
+        }
 
-            buf[1] = 0x09;
-            buf[2] = addr;
-            buf[3] = PLL_PARAMETER;
-            buf[4] = (reg_data_vil >> 24) & 0xff;
-            buf[5] = (reg_data_vil >> 16) & 0xff;
-            buf[6] = (reg_data_vil >> 8) & 0xff;
-            buf[7] = (reg_data_vil >> 0) & 0xff;
-            buf[8] = CRC5(buf, 8*8);
+        cmd = calloc(BITMAIN_MAX_CHAIN_NUM * (CHAIN_ASIC_NUM + 1), sizeof(struct bc_cmd));
+        if(!cmd)
+            return 0;
 
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-            cmd_buf[1] = buf[4]<<24 | buf[5]<<16 | buf[6]<<8 | buf[7];;
-            cmd_buf[2] = buf[8]<<24;
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(!plan[i] || dev->chain_exist[i] != 1)
+                continue;
 
-            while (1)
+            memset(count, 0, sizeof(count));
+            common = lowest = plan[i][0];
+            for(j = 0; j < dev->chain_asic_num[i] && j < CHAIN_ASIC_NUM; j++)
             {
-                ret = get_BC_write_command();
-                if ((ret & 0x80000000) == 0)
-                    break;
-                cgsleep_us(500);
+                if(++count[plan[i][j]] > count[common])
+                    common = plan[i][j];
+                if(plan[i][j] < lowest)
+                    lowest = plan[i][j];
             }
-            set_BC_command_buffer(cmd_buf);
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID| (i << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
+            if(running)
+                common = lowest;
+            if(count[common] * 2 < dev->chain_asic_num[i])
+                common = -1;
+            else
+                bc_cmd_pll(&cmd[num++], common, true, 0, i);
 
-            cgsleep_us(10000);
+            for(j = 0; j < dev->chain_asic_num[i] && j < CHAIN_ASIC_NUM; j++)
+            {
+                if(plan[i][j] != common)
+                    bc_cmd_pll(&cmd[num++], plan[i][j], false, j * dev->addrInterval, i);
+            }
+            invalidate_chain_freq_stats(i);
         }
+
+        ok = bc_cmd_submit_batch(cmd, num);
+        free(cmd);
+        // all chips relock in parallel, one settle time covers the batch
+        cgsleep_us(PLL_SETTLE_US);
+        return ok ? num : -1;
     }
 
-    /* always return _some_ valid index */
-    int get_pll_index(int freq)
-    {
-        int i;
-	int n = sizeof(freq_pll_1385) / sizeof(freq_pll_1385[0]);
-        for (i = 0; i < n; i++) {
-		int tab_freq = atoi(freq_pll_1385[i].freq);
-		if (freq <= tab_freq)
-			break;
-        }
+    void read_asic_register(unsigned char chain, unsigned char mode, unsigned char chip_addr, unsigned char reg_addr);
+    void clear_register_value_buf();
 
-        if(i >= n) {
-            i = n - 1;
-        }
+    /*
+     * Read PLL_PARAMETER of all chips on all planned chains in one sweep
+     * and compare with the plan, chips answer in address order. Only for
+     * bring-up, when nothing else reads registers. Returns the number of
+     * chips that did not answer with their planned value.
+     */
+    int verify_frequency_plan(const unsigned char *plan[BITMAIN_MAX_CHAIN_NUM])
+    {
+        int got[BITMAIN_MAX_CHAIN_NUM] = {0}, bad[BITMAIN_MAX_CHAIN_NUM] = {0};
+        int i, idle = 0, waited = 0, pending, total = 0;
+        char logstr[256];
 
-        return i;
-    }
+        if(!opt_multi_version)
+            return 0;
 
-    int get_freqvalue_by_index(int index)
-    {
-        return atoi(freq_pll_1385[index].freq);
-    }
+        clear_register_value_buf();
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(plan[i] && dev->chain_exist[i] == 1)
+                read_asic_register(i, 1, 0, PLL_PARAMETER);
+        }
 
-    void overclock_freq_index(unsigned char *data, float mult)
-    {
-	int index = *data;
-        int freq = atoi(freq_pll_1385[index].freq);
-	freq = round(freq * mult);
-	*data = get_pll_index(freq);
-    }
+        // done when every chip answered, or nothing came for 3 polls
+        while(idle < 3 && waited < 2000)
+        {
+            int n = 0;
 
+            cgsleep_ms(10);
+            waited += 10;
 
-    int GetTotalRate()
-    {
-        int i,j;
-        int totalrate=0;
-        for(i=0; i<BITMAIN_MAX_CHAIN_NUM; i++)
-        {
-            if(dev->chain_exist[i] == 1)
+            pthread_mutex_lock(&reg_mutex);
+            while(reg_value_buf.reg_value_num > 0)
             {
-                for(j = 0; j < CHAIN_ASIC_NUM; j ++)
+                struct reg_content *r = (struct reg_content *)&reg_value_buf.reg_buffer[reg_value_buf.p_rd];
+
+                i = r->chain_number;
+                if(i < BITMAIN_MAX_CHAIN_NUM && plan[i] && got[i] < dev->chain_asic_num[i])
                 {
-#ifdef T9_18
-                    if(fpga_version>=0xE)
-                    {
-                        int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset;
-                        getPICChainIndexOffset(i,&new_T9_PLUS_chainIndex,&new_T9_PLUS_chainOffset);
-                        totalrate+=atoi(freq_pll_1385[chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j]].freq)*(BM1387_CORE_NUM-chain_badcore_num[i][j]);
-                    }
-                    else
-                    {
-                        totalrate+=atoi(freq_pll_1385[chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j]].freq)*(BM1387_CORE_NUM-chain_badcore_num[i][j]);
-                    }
-#else
-                    totalrate+=atoi(freq_pll_1385[last_freq[i][j*2+3]].freq)*(BM1387_CORE_NUM-chain_badcore_num[i][j]);
-#endif
+                    if(r->reg_value != freq_pll_1385[plan[i][got[i]]].vilpll)
+                        bad[i]++;
+                    got[i]++;
                 }
+                reg_value_buf.p_rd++;
+                if(reg_value_buf.p_rd >= MAX_NONCE_NUMBER_IN_FIFO)
+                    reg_value_buf.p_rd = 0;
+                reg_value_buf.reg_value_num--;
+                n++;
             }
-        }
+            pthread_mutex_unlock(&reg_mutex);
 
-        return (totalrate/1000);
+            pending = 0;
+            for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+            {
+                if(plan[i] && dev->chain_exist[i] == 1 && got[i] < dev->chain_asic_num[i])
+                    pending = 1;
+            }
+            if(!pending)
+                break;
+            idle = n ? 0 : idle + 1;
+        }
+        clear_register_value_buf();
+
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(!plan[i] || dev->chain_exist[i] != 1)
+                continue;
+            bad[i] += dev->chain_asic_num[i] - got[i];
+            total += bad[i];
+            sprintf(logstr,"Chain[J%d] PLL readback: %d of %d chips as planned\n",i+1,dev->chain_asic_num[i]-bad[i],dev->chain_asic_num[i]);
+            writeInitLogFile(logstr);
+        }
+        return total;
     }
 
-    int GetBoardRate(int chainIndex)
+    /* run every chip the given number of PLL steps below the frequency
+     * it really runs (chip_last_freq, what re-init and the autotuner
+     * program), the table itself is left alone so 0 restores it */
+    void thermal_throttle_apply(int steps)
     {
-        int j;
-        int totalrate=0;
-        if(dev->chain_exist[chainIndex] == 1)
+        const unsigned char *plan[BITMAIN_MAX_CHAIN_NUM] = {NULL};
+        unsigned char index[CHAIN_ASIC_NUM];
+        char logstr[256];
+        int i, j, sent;
+
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
         {
-            for(j = 0; j < CHAIN_ASIC_NUM; j ++)
+            if(dev->chain_exist[i] != 1 || throttle_applied[i] == steps)
+                continue;
+
+            pthread_mutex_lock(&reinit_mutex);
+            for(j = 0; j < dev->chain_asic_num[i] && j < CHAIN_ASIC_NUM; j++)
             {
-#ifdef T9_18
-                if(fpga_version>=0xE)
-                {
-                    int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset;
-                    getPICChainIndexOffset(chainIndex,&new_T9_PLUS_chainIndex,&new_T9_PLUS_chainOffset);
-                    totalrate+=atoi(freq_pll_1385[chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j]].freq)*(BM1387_CORE_NUM-chain_badcore_num[chainIndex][j]);
-                }
-                else
-                {
-                    totalrate+=atoi(freq_pll_1385[chain_pic_buf[((chainIndex/3)*3)][7+(chainIndex%3)*31+4+j]].freq)*(BM1387_CORE_NUM-chain_badcore_num[chainIndex][j]);
-                }
-#else
-                totalrate+=atoi(freq_pll_1385[last_freq[chainIndex][j*2+3]].freq)*(BM1387_CORE_NUM-chain_badcore_num[chainIndex][j]);
-#endif
+                int k = chip_last_freq[i][j*2+3] - steps;
+
+                index[j] = k < 0 ? 0 : k;
+            }
+            plan[i] = index;
+            sent = set_frequency_plan(plan, true);
+            plan[i] = NULL;
+            if(sent < 0)
+            {
+                // not all chips took it, the next temperature pass tries again
+                pthread_mutex_unlock(&reinit_mutex);
+                sprintf(logstr, "Chain[J%d] thermal throttle to %d steps failed\n", i+1, steps);
+                writeLogFile(logstr);
+                continue;
             }
+            sprintf(logstr, "Chain[J%d] thermal throttle %d -> %d steps\n", i+1, throttle_applied[i], steps);
+            // under the lock, so the autotuner sees the steps with the chips
+            throttle_applied[i] = steps;
+            pthread_mutex_unlock(&reinit_mutex);
+
+            writeLogFile(logstr);
         }
+    }
 
-        return (totalrate/1000);
+    void overclock_freq_index(unsigned char *data, float mult)
+    {
+	int index = *data;
+        int freq = freq_pll_1385[index].freq;
+	freq = round(freq * mult);
+	*data = get_pll_index(freq);
     }
 
+
 #ifdef R4
     bool isChainEnough()
     {
@@ -3844,20 +3896,7 @@ void wait_for_fans(void)
         else
         {
             //down one step
-#ifdef T9_18
-            if(fpga_version>=0xE)
-            {
-                int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset;
-                getPICChainIndexOffset(max_rate_chainIndex,&new_T9_PLUS_chainIndex,&new_T9_PLUS_chainOffset);
-                chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+max_freq_chipIndex]-=1;    // down one step
-            }
-            else
-            {
-                chain_pic_buf[((max_rate_chainIndex/3)*3)][7+(max_rate_chainIndex%3)*31+4+max_freq_chipIndex]-=1;   // down one step
-            }
-#else
-            last_freq[max_rate_chainIndex][max_freq_chipIndex*2+3]-=1;  // down one step
-#endif
+            setChainAsicFreqIndex(max_rate_chainIndex, max_freq_chipIndex, max_freq-1);
             return true;
         }
     }
@@ -3868,8 +3907,15 @@ void wait_for_fans(void)
     static void ProcessFixFreq()
     {
         int i,j;
-        int totalRate=GetTotalRate();
-        int fixed_totalRate=ConvirtTotalRate(totalRate);
+        int totalRate;
+        int fixed_totalRate;
+
+        // frequency and badcore tables have just been loaded from PIC
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+            invalidate_chain_freq_stats(i);
+
+        totalRate=GetTotalRate();
+        fixed_totalRate=ConvirtTotalRate(totalRate);
 
         if(GetTotalRate()>fixed_totalRate)
         {
@@ -3883,20 +3929,7 @@ void wait_for_fans(void)
                     {
                         for(j = 0; j < CHAIN_ASIC_NUM; j ++)
                         {
-#ifdef T9_18
-                            if(fpga_version>=0xE)
-                            {
-                                int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset;
-                                getPICChainIndexOffset(i,&new_T9_PLUS_chainIndex,&new_T9_PLUS_chainOffset);
-                                last_record_freq[i][j]=chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j];
-                            }
-                            else
-                            {
-                                last_record_freq[i][j]=chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j];
-                            }
-#else
-                            last_record_freq[i][j]=last_freq[i][j*2+3];
-#endif
+                            last_record_freq[i][j]=getChainAsicFreqIndex(i,j);
                         }
                     }
                 }
@@ -3915,20 +3948,7 @@ void wait_for_fans(void)
                 {
                     for(j = 0; j < CHAIN_ASIC_NUM; j ++)
                     {
-#ifdef T9_18
-                        if(fpga_version>=0xE)
-                        {
-                            int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset;
-                            getPICChainIndexOffset(i,&new_T9_PLUS_chainIndex,&new_T9_PLUS_chainOffset);
-                            chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j]=last_record_freq[i][j];
-                        }
-                        else
-                        {
-                            chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j]=last_record_freq[i][j];
-                        }
-#else
-                        last_freq[i][j*2+3]=last_record_freq[i][j];
-#endif
+                        setChainAsicFreqIndex(i,j,last_record_freq[i][j]);
                     }
                 }
             }
@@ -3938,8 +3958,15 @@ void wait_for_fans(void)
     static void ProcessFixFreqForChips()
     {
         int i,j;
-        int totalRate=GetTotalRate();
-        int fixed_totalRate=ConvirtTotalRate(totalRate);
+        int totalRate;
+        int fixed_totalRate;
+
+        // frequency and badcore tables have just been loaded from PIC
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+            invalidate_chain_freq_stats(i);
+
+        totalRate=GetTotalRate();
+        fixed_totalRate=ConvirtTotalRate(totalRate);
 
         fixed_totalRate=fixed_totalRate*(100+UPRATE_PERCENT)/100;
 
@@ -3955,20 +3982,7 @@ void wait_for_fans(void)
                     {
                         for(j = 0; j < CHAIN_ASIC_NUM; j ++)
                         {
-#ifdef T9_18
-                            if(fpga_version>=0xE)
-                            {
-                                int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset;
-                                getPICChainIndexOffset(i,&new_T9_PLUS_chainIndex,&new_T9_PLUS_chainOffset);
-                                last_record_freq[i][j]=chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j];
-                            }
-                            else
-                            {
-                                last_record_freq[i][j]=chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j];
-                            }
-#else
-                            last_record_freq[i][j]=last_freq[i][j*2+3];
-#endif
+                            last_record_freq[i][j]=getChainAsicFreqIndex(i,j);
                         }
                     }
                 }
@@ -3987,20 +4001,7 @@ void wait_for_fans(void)
                 {
                     for(j = 0; j < CHAIN_ASIC_NUM; j ++)
                     {
-#ifdef T9_18
-                        if(fpga_version>=0xE)
-                        {
-                            int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset;
-                            getPICChainIndexOffset(i,&new_T9_PLUS_chainIndex,&new_T9_PLUS_chainOffset);
-                            chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j]=last_record_freq[i][j];
-                        }
-                        else
-                        {
-                            chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j]=last_record_freq[i][j];
-                        }
-#else
-                        last_freq[i][j*2+3]=last_record_freq[i][j];
-#endif
+                        setChainAsicFreqIndex(i,j,last_record_freq[i][j]);
                     }
                 }
             }
@@ -4011,14 +4012,17 @@ void wait_for_fans(void)
     {
         FILE *fd;
 
-        pthread_mutex_lock(&init_log_mutex);
-        fd=fopen("/tmp/freq","a+");
-        if(fd)
+        if(!logwriter_write(LOGW_FREQ, NULL, logstr, NULL))
         {
-            fwrite(logstr,1,strlen(logstr),fd);
-            fclose(fd);
+            pthread_mutex_lock(&init_log_mutex);
+            fd=fopen("/tmp/freq","a+");
+            if(fd)
+            {
+                fwrite(logstr,1,strlen(logstr),fd);
+                fclose(fd);
+            }
+            pthread_mutex_unlock(&init_log_mutex);
         }
-        pthread_mutex_unlock(&init_log_mutex);
 #ifdef DEBUG_LOG
         printf(logstr);
 #endif
@@ -4027,6 +4031,7 @@ void wait_for_fans(void)
     void clearInitLogFile()
     {
         FILE *fd;
+        logwriter_flush();
         pthread_mutex_lock(&init_log_mutex);
         fd=fopen("/tmp/freq","w");
         if(fd)
@@ -4086,10 +4091,12 @@ int calc_avg_freq(int i)
 
 void set_frequency(void)
 {
-	int i, j;
+	int i, j, sent;
 	int default_freq = 600;
 	int default_freq_index = get_pll_index(default_freq);
 	int max_freq_index = -1;
+	const unsigned char *plan[BITMAIN_MAX_CHAIN_NUM] = {NULL};
+	unsigned char plan_index[BITMAIN_MAX_CHAIN_NUM][CHAIN_ASIC_NUM];
 
 	/* iterate over all chains and try to load defaults from flash */
 	int chain_id; /* chain_id holds current "existing chain" index */
@@ -4208,6 +4215,9 @@ void set_frequency(void)
 					max_freq_index = last_freq[i][j*2+3];
 			}
 
+			/* tables were rewritten, drop cached sums */
+			invalidate_chain_freq_stats(i);
+
 			/* make description of chain frequency */
 			chain_frequency_desc[i] = make_freq_desc(orig_freq, orig_source,
 				opt_overclock, calc_avg_freq(i));
@@ -4221,18 +4231,30 @@ void set_frequency(void)
 		quit(1, "no enabled chains");
 	}
 
-	/* set the frequency */
+	/* set the frequency, all chains in one go */
 	for (i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++) {
 		if (dev->chain_exist[i] == 1 && dev->chain_asic_num[i] > 0) {
 			memcpy(chip_last_freq[i], last_freq[i], 256);
+			memcpy(chip_flash_freq[i], last_freq[i], 256);
 			memcpy(show_last_freq[i], last_freq[i], 256);
+			for (j = 0; j < CHAIN_ASIC_NUM; j++)
+				plan_index[i][j] = last_freq[i][j*2+3];
+			plan[i] = plan_index[i];
+		}
+	}
+	sent = set_frequency_plan(plan, false);
+	if (sent < 0)
+		quit(1, "frequency plan: the FPGA stopped taking PLL commands");
+	applog(LOG_NOTICE, "frequency plan: %d PLL commands", sent);
+	verify_frequency_plan(plan);
+
+	for (i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++) {
+		if (dev->chain_exist[i] == 1 && dev->chain_asic_num[i] > 0) {
 			int first_chip_freq_index = last_freq[i][0*2 + 3];
 			int different_freqs = 0;
 			for (j = 0; j < dev->chain_asic_num[i]; j++) {
 				if (last_freq[i][j*2 + 3] != first_chip_freq_index)
 					different_freqs = 1;
-				/* PERFORM SET FREQUENCY */
-				set_frequency_with_addr_plldatai(last_freq[i][j*2+3],0, j * dev->addrInterval,i);
 			}
 			applog(LOG_NOTICE, "chain %d: base FREQUENCY %d MHz",
 				i, get_freqvalue_by_index(base_freq_index[i]));
@@ -4276,7 +4298,7 @@ void set_frequency(void)
         applog(LOG_DEBUG,"\n--- %s\n", __FUNCTION__);
 
         get_plldata(1385, orig_frequency, &reg_data_pll, &reg_data_pll2, &reg_data_vil);
-	frequency = atoi(freq_pll_1385[default_freq_index].freq);
+	frequency = freq_pll_1385[default_freq_index].freq;
         applog(LOG_NOTICE, "%s: frequency = %d (index %d, was converted from %d)",
 		__FUNCTION__, frequency, default_freq_index, orig_frequency);
 
@@ -4517,7 +4539,7 @@ void set_frequency(void)
                         if(isUseDefaultFreq)
                             base_freq_index[i]=default_freq_index;
                         else base_freq_index[i]=chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31];
-                        sprintf(logstr,"Chain:%d base freq=%s\n",i,freq_pll_1385[base_freq_index[i]].freq);
+                        sprintf(logstr,"Chain:%d base freq=%d\n",i,freq_pll_1385[base_freq_index[i]].freq);
                         writeInitLogFile(logstr);
 
                         for(j = 0; j < dev->chain_asic_num[i]; j ++)
@@ -4540,7 +4562,7 @@ void set_frequency(void)
                                 chain_min_freq=chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j];
 
                             //     set_frequency_with_addr_plldatai(last_freq[i][j*2+3],0, j * dev->addrInterval,i);
-                            sprintf(logstr,"Asic[%2d]:%s ",j,freq_pll_1385[chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j]].freq);
+                            sprintf(logstr,"Asic[%2d]:%d ",j,freq_pll_1385[chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j]].freq);
                             writeInitLogFile(logstr);
                             if ((j % 8) == 0)
                             {
@@ -4554,7 +4576,7 @@ void set_frequency(void)
                         if(isUseDefaultFreq)
                             base_freq_index[i]=default_freq_index;
                         else base_freq_index[i]=chain_pic_buf[((i/3)*3)][7+(i%3)*31];
-                        sprintf(logstr,"Chain:%d base freq=%s\n",i,freq_pll_1385[base_freq_index[i]].freq);
+                        sprintf(logstr,"Chain:%d base freq=%d\n",i,freq_pll_1385[base_freq_index[i]].freq);
                         writeInitLogFile(logstr);
 
                         for(j = 0; j < dev->chain_asic_num[i]; j ++)
@@ -4577,7 +4599,7 @@ void set_frequency(void)
                                 chain_min_freq=chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j];
 
                             //     set_frequency_with_addr_plldatai(last_freq[i][j*2+3],0, j * dev->addrInterval,i);
-                            sprintf(logstr,"Asic[%2d]:%s ",j,freq_pll_1385[chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j]].freq);
+                            sprintf(logstr,"Asic[%2d]:%d ",j,freq_pll_1385[chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j]].freq);
                             writeInitLogFile(logstr);
                             if ((j % 8) == 0)
                             {
@@ -4594,7 +4616,7 @@ void set_frequency(void)
                     if(isUseDefaultFreq)
                         base_freq_index[i]=default_freq_index;
                     else base_freq_index[i]=((last_freq[i][6]&0x0f)<<4)+(last_freq[i][8]&0x0f);
-                    sprintf(logstr,"Chain:%d base freq=%s\n",i,freq_pll_1385[base_freq_index[i]].freq);
+                    sprintf(logstr,"Chain:%d base freq=%d\n",i,freq_pll_1385[base_freq_index[i]].freq);
                     writeInitLogFile(logstr);
 
                     for(j = 0; j < dev->chain_asic_num[i]; j ++)
@@ -4622,7 +4644,7 @@ void set_frequency(void)
                             chain_min_freq=last_freq[i][j*2+3];
 
                         //     set_frequency_with_addr_plldatai(last_freq[i][j*2+3],0, j * dev->addrInterval,i);
-                        sprintf(logstr,"Asic[%2d]:%s ",j,freq_pll_1385[last_freq[i][j*2+3]].freq);
+                        sprintf(logstr,"Asic[%2d]:%d ",j,freq_pll_1385[last_freq[i][j*2+3]].freq);
                         writeInitLogFile(logstr);
                         if ((j % 8) == 0)
                         {
@@ -4631,9 +4653,9 @@ void set_frequency(void)
                         }
                     }
 #endif
-                    sprintf(logstr,"\nChain:%d max freq=%s\n",i,freq_pll_1385[chain_max_freq].freq);
+                    sprintf(logstr,"\nChain:%d max freq=%d\n",i,freq_pll_1385[chain_max_freq].freq);
                     writeInitLogFile(logstr);
-                    sprintf(logstr,"Chain:%d min freq=%s\n",i,freq_pll_1385[chain_min_freq].freq);
+                    sprintf(logstr,"Chain:%d min freq=%d\n",i,freq_pll_1385[chain_min_freq].freq);
                     writeInitLogFile(logstr);
 
                     sprintf(logstr,"\n");
@@ -4660,6 +4682,7 @@ void set_frequency(void)
                 memcpy(chip_last_freq[i],chain_pic_buf[i],128);
 #else
                 memcpy(chip_last_freq[i],last_freq[i],256);
+                memcpy(chip_flash_freq[i],last_freq[i],256);
 #endif
             }
         }
@@ -4750,7 +4773,7 @@ void set_frequency(void)
                         if(isUseDefaultFreq)
                             base_freq_index[i]=default_freq_index;
                         else base_freq_index[i]=chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31];
-                        sprintf(logstr,"Chain:%d base freq=%s\n",i,freq_pll_1385[base_freq_index[i]].freq);
+                        sprintf(logstr,"Chain:%d base freq=%d\n",i,freq_pll_1385[base_freq_index[i]].freq);
                         writeInitLogFile(logstr);
                     }
                     for(j = 0; j < dev->chain_asic_num[i]; j ++)
@@ -4778,7 +4801,7 @@ void set_frequency(void)
                         else
                             set_frequency_with_addr_plldatai(chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j], 0, j * dev->addrInterval, i);
 
-                        sprintf(logstr,"Asic[%2d]:%s ",j,freq_pll_1385[chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j]].freq);
+                        sprintf(logstr,"Asic[%2d]:%d ",j,freq_pll_1385[chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j]].freq);
                         writeInitLogFile(logstr);
 
                         if ((j % 8) == 0)
@@ -4796,7 +4819,7 @@ void set_frequency(void)
                         if(isUseDefaultFreq)
                             base_freq_index[i]=default_freq_index;
                         else base_freq_index[i]=chain_pic_buf[((i/3)*3)][7+(i%3)*31];
-                        sprintf(logstr,"Chain:%d base freq=%s\n",i,freq_pll_1385[base_freq_index[i]].freq);
+                        sprintf(logstr,"Chain:%d base freq=%d\n",i,freq_pll_1385[base_freq_index[i]].freq);
                         writeInitLogFile(logstr);
                     }
                     for(j = 0; j < dev->chain_asic_num[i]; j ++)
@@ -4824,7 +4847,7 @@ void set_frequency(void)
                         else
                             set_frequency_with_addr_plldatai(chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j], 0, j * dev->addrInterval, i);
 
-                        sprintf(logstr,"Asic[%2d]:%s ",j,freq_pll_1385[chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j]].freq);
+                        sprintf(logstr,"Asic[%2d]:%d ",j,freq_pll_1385[chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j]].freq);
                         writeInitLogFile(logstr);
 
                         if ((j % 8) == 0)
@@ -4844,7 +4867,7 @@ void set_frequency(void)
                     if(isUseDefaultFreq)
                         base_freq_index[i]=default_freq_index;
                     else base_freq_index[i]=((last_freq[i][6]&0x0f)<<4)+(last_freq[i][8]&0x0f);
-                    sprintf(logstr,"Chain:%d base freq=%s\n",i,freq_pll_1385[base_freq_index[i]].freq);
+                    sprintf(logstr,"Chain:%d base freq=%d\n",i,freq_pll_1385[base_freq_index[i]].freq);
                     writeInitLogFile(logstr);
                 }
 
@@ -4881,7 +4904,7 @@ void set_frequency(void)
                     else
                         set_frequency_with_addr_plldatai(last_freq[i][j*2+3],0, j * dev->addrInterval,i);
 
-                    sprintf(logstr,"Asic[%2d]:%s ",j,freq_pll_1385[last_freq[i][j*2+3]].freq);
+                    sprintf(logstr,"Asic[%2d]:%d ",j,freq_pll_1385[last_freq[i][j*2+3]].freq);
                     writeInitLogFile(logstr);
 
                     if ((j % 8) == 0)
@@ -4892,9 +4915,9 @@ void set_frequency(void)
                 }
 #endif
 
-                sprintf(logstr,"\nChain:%d max freq=%s\n",i,freq_pll_1385[chain_max_freq].freq);
+                sprintf(logstr,"\nChain:%d max freq=%d\n",i,freq_pll_1385[chain_max_freq].freq);
                 writeInitLogFile(logstr);
-                sprintf(logstr,"Chain:%d min freq=%s\n",i,freq_pll_1385[chain_min_freq].freq);
+                sprintf(logstr,"Chain:%d min freq=%d\n",i,freq_pll_1385[chain_min_freq].freq);
                 writeInitLogFile(logstr);
 
                 sprintf(logstr,"\n");
@@ -4902,7 +4925,7 @@ void set_frequency(void)
             }
         }
 
-        value = atoi(freq_pll_1385[max_freq_index].freq);
+        value = freq_pll_1385[max_freq_index].freq;
         dev->frequency = value;
         sprintf(logstr,"max freq = %d\n",dev->frequency);
         writeInitLogFile(logstr);
@@ -4934,13 +4957,13 @@ void set_frequency(void)
     void set_frequency_with_addr(unsigned short int frequency,unsigned char mode,unsigned char addr, unsigned char chain)
     {
         unsigned char buf[9] = {0,0,0,0,0,0,0,0,0};
-        unsigned int cmd_buf[3] = {0,0,0};
+        struct bc_cmd cmd[2];
         int i;
-        unsigned int ret, value;
         uint32_t reg_data_pll = 0;
         uint16_t reg_data_pll2 = 0;
         uint32_t reg_data_vil = 0;
         i = chain;
+        invalidate_chain_freq_stats(chain);
 
         applog(LOG_DEBUG,"\n--- %s\n", __FUNCTION__);
 
@@ -4951,45 +4974,29 @@ void set_frequency(void)
         if(!opt_multi_version)  // fil mode
         {
             memset(buf,0,sizeof(buf));
-            memset(cmd_buf,0,sizeof(cmd_buf));
             buf[0] = 0;
             buf[0] |= SET_PLL_DIVIDER1;
             buf[1] = (reg_data_pll >> 16) & 0xff;
             buf[2] = (reg_data_pll >> 8) & 0xff;
             buf[3] = (reg_data_pll >> 0) & 0xff;
             buf[3] |= CRC5(buf, 4*8 - 5);
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-
-            set_BC_command_buffer(cmd_buf);
-            ret = get_BC_write_command();
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID| (i << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
-
-            cgsleep_us(3000);
+            bc_cmd_fil(&cmd[0], i, buf);
 
             memset(buf,0,sizeof(buf));
-            memset(cmd_buf,0,sizeof(cmd_buf));
             buf[0] = SET_PLL_DIVIDER2;
             buf[0] |= COMMAND_FOR_ALL;
             buf[1] = 0;     //addr
             buf[2] = reg_data_pll2 >> 8;
             buf[3] = reg_data_pll2& 0x0ff;
             buf[3] |= CRC5(buf, 4*8 - 5);
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-
-            set_BC_command_buffer(cmd_buf);
-            ret = get_BC_write_command();
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID| (i << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
+            bc_cmd_fil(&cmd[1], i, buf);
 
+            bc_cmd_submit_batch(cmd, 2);
             dev->freq[i] = frequency;
-
-            cgsleep_us(5000);
         }
         else    // vil
         {
             memset(buf,0,9);
-            memset(cmd_buf,0,3*sizeof(int));
             if(mode)
                 buf[0] = VIL_COMMAND_TYPE | VIL_ALL | SET_CONFIG;
             else
@@ -5003,18 +5010,11 @@ void set_frequency(void)
             buf[7] = (reg_data_vil >> 0) & 0xff;
             buf[8] = CRC5(buf, 8*8);
 
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-            cmd_buf[1] = buf[4]<<24 | buf[5]<<16 | buf[6]<<8 | buf[7];;
-            cmd_buf[2] = buf[8]<<24;
-
-            set_BC_command_buffer(cmd_buf);
-            ret = get_BC_write_command();
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID| (i << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
-
+            bc_cmd_vil(&cmd[0], i, buf, 9);
+            bc_cmd_submit(&cmd[0]);
             dev->freq[i] = frequency;
-            cgsleep_us(10000);
         }
+        cgsleep_us(PLL_SETTLE_US);
     }
 
 
@@ -5043,10 +5043,7 @@ void set_frequency(void)
     {
         unsigned char buf[5] = {0,0,0,0,0};
         unsigned char buf_vil[12] = {0,0,0,0,0,0,0,0,0,0,0,0};
-        unsigned int cmd_buf[3] = {0,0,0};
-        unsigned int ret, value;
-        char logstr[256];
-        int wait_count=0;
+        struct bc_cmd cmd;
 
         if(!opt_multi_version)    // fil mode
         {
@@ -5058,12 +5055,8 @@ void set_frequency(void)
             buf[3] = CRC5(buf, 4*8 - 5);
             applog(LOG_DEBUG,"%s: buf[0]=0x%x, buf[1]=0x%x, buf[2]=0x%x, buf[3]=0x%x\n", __FUNCTION__, buf[0], buf[1], buf[2], buf[3]);
 
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-            set_BC_command_buffer(cmd_buf);
-
-            ret = get_BC_write_command();
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (chain << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
+            bc_cmd_fil(&cmd, chain, buf);
+            bc_cmd_submit(&cmd);
         }
         else    // vil mode
         {
@@ -5076,39 +5069,15 @@ void set_frequency(void)
             buf[4] = CRC5(buf, 4*8);
             applog(LOG_DEBUG,"%s:VIL buf[0]=0x%x, buf[1]=0x%x, buf[2]=0x%x, buf[3]=0x%x, buf[4]=0x%x", __FUNCTION__, buf[0], buf[1], buf[2], buf[3], buf[4]);
 
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-            cmd_buf[1] = buf[4]<<24;
-
-            while (1)
-            {
-                if (((ret = get_BC_write_command()) & 0x80000000) == 0)
-                    break;
-                cgsleep_ms(1);
-
-                wait_count++;
-
-                if(wait_count>3000)
-                {
-                    sprintf(logstr,"Error: clement debug: wait BC ready timeout, PLUG ON=0x%08x..\n",(unsigned int)get_hash_on_plug());
-                    writeInitLogFile(logstr);
-                    break;
-                }
-            }
-
-            set_BC_command_buffer(cmd_buf);
-
-            ret = get_BC_write_command();
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (chain << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
+            bc_cmd_vil(&cmd, chain, buf, 5);
+            bc_cmd_submit(&cmd);
         }
     }
 
     void read_temp(unsigned char device,unsigned reg,unsigned char data,unsigned char write,unsigned char chip_addr,int chain)
     {
         unsigned char buf[9] = {0,0,0,0,0,0,0,0,0};
-        unsigned int cmd_buf[3] = {0,0,0};
-        unsigned int ret, value,i;
-        i = chain;
+        struct bc_cmd cmd;
         if(!opt_multi_version)
         {
             printf("fil mode do not support temp reading");
@@ -5124,19 +5093,8 @@ void set_frequency(void)
             buf[6] = reg;
             buf[7] = data;
             buf[8] = CRC5(buf, 8*8);
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-            cmd_buf[1] = buf[4]<<24 | buf[5]<<16 | buf[6]<<8 | buf[7];
-            cmd_buf[2] = buf[8]<<24;
-            while (1)
-            {
-                ret = get_BC_write_command();
-                if ((ret & 0x80000000) == 0)
-                    break;
-                cgsleep_ms(1);
-            }
-            set_BC_command_buffer(cmd_buf);
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID| (i << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
+            bc_cmd_vil(&cmd, chain, buf, 9);
+            bc_cmd_submit(&cmd);
         }
 
     }
@@ -5497,6 +5455,88 @@ void set_frequency(void)
         sleep(1);
     }
 
+    /*
+     * Count the chips of the given chains (NULL: all existing ones) with a
+     * CHIP_ADDRESS read sent to all of them at once, their answers come in
+     * in parallel. A chain is done when CHAIN_ASIC_NUM chips answered or
+     * nothing came from it for ASIC_ENUM_IDLE_MS. Sets chain_asic_num as
+     * check_asic_reg(CHIP_ADDRESS) does.
+     */
+    void enumerate_asics(const bool *chains)
+    {
+        struct timeval start, now, last[BITMAIN_MAX_CHAIN_NUM];
+        bool active[BITMAIN_MAX_CHAIN_NUM], done[BITMAIN_MAX_CHAIN_NUM];
+        int i, pending, retry = 0;
+        char logstr[256];
+
+    restart:
+        clear_register_value_buf();
+        cgtime(&start);
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            active[i] = dev->chain_exist[i] == 1 && (!chains || chains[i]);
+            done[i] = !active[i];
+            if(!active[i])
+                continue;
+            dev->chain_asic_num[i] = 0;
+            last[i] = start;
+            read_asic_register(i, 1, 0, CHIP_ADDRESS);
+        }
+
+        do
+        {
+            cgsleep_ms(ASIC_ENUM_POLL_MS);
+            cgtime(&now);
+
+            pthread_mutex_lock(&reg_mutex);
+            if(reg_value_buf.reg_value_num >= MAX_NONCE_NUMBER_IN_FIFO && retry++ < 3)
+            {
+                // answers were dropped, count again
+                pthread_mutex_unlock(&reg_mutex);
+                goto restart;
+            }
+            while(reg_value_buf.reg_value_num > 0)
+            {
+                i = reg_value_buf.reg_buffer[reg_value_buf.p_rd].chain_number;
+                if(i < BITMAIN_MAX_CHAIN_NUM && !done[i])
+                {
+                    last[i] = now;
+                    if(++dev->chain_asic_num[i] >= CHAIN_ASIC_NUM)
+                        done[i] = true;
+                }
+                reg_value_buf.p_rd++;
+                if(reg_value_buf.p_rd >= MAX_NONCE_NUMBER_IN_FIFO)
+                    reg_value_buf.p_rd = 0;
+                reg_value_buf.reg_value_num--;
+            }
+            pthread_mutex_unlock(&reg_mutex);
+
+            pending = 0;
+            for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+            {
+                if(done[i])
+                    continue;
+                // a chain gets longer for its first answer than between answers
+                if(ms_tdiff(&now, &last[i]) >= (dev->chain_asic_num[i] ? ASIC_ENUM_IDLE_MS : ASIC_ENUM_FIRST_MS))
+                    done[i] = true;
+                else
+                    pending++;
+            }
+        }
+        while(pending);
+        clear_register_value_buf();
+
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(!active[i])
+                continue;
+            if(dev->chain_asic_num[i] > dev->max_asic_num_in_one_chain)
+                dev->max_asic_num_in_one_chain = dev->chain_asic_num[i];
+            sprintf(logstr,"Chain[J%d] enumerated %d asic in %d ms\n",i+1,dev->chain_asic_num[i],ms_tdiff(&last[i], &start));
+            writeInitLogFile(logstr);
+        }
+    }
+
     bool check_asic_reg_oneChain(int chainIndex, unsigned int reg)
     {
 
@@ -6077,8 +6117,8 @@ int i2c_start_dev(struct i2c_dev *i2cdev)
     void set_baud_with_addr(unsigned char bauddiv,int mode,unsigned char chip_addr,int chain,int iic,int open_core,int bottom_or_mid)
     {
         unsigned char buf[9] = {0,0,0,0,0,0,0,0,0};
-        unsigned int cmd_buf[3] = {0,0,0};
-        unsigned int ret, value,i;
+        struct bc_cmd cmd;
+        unsigned int i;
         i = chain;
 
         //first step: send new bauddiv to ASIC, but FPGA doesn't change its bauddiv, it uses old bauddiv to send BC command to ASIC
@@ -6091,12 +6131,8 @@ int i2c_start_dev(struct i2c_dev *i2cdev)
             buf[3] = CRC5(buf, 4*8 - 5);
             applog(LOG_DEBUG,"%s: buf[0]=0x%x, buf[1]=0x%x, buf[2]=0x%x, buf[3]=0x%x\n", __FUNCTION__, buf[0], buf[1], buf[2], buf[3]);
 
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-            set_BC_command_buffer(cmd_buf);
-
-            ret = get_BC_write_command();
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (i << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
+            bc_cmd_fil(&cmd, i, buf);
+            bc_cmd_submit(&cmd);
         }
         else    // vil mode
         {
@@ -6130,19 +6166,8 @@ int i2c_start_dev(struct i2c_dev *i2cdev)
             buf[8] = 0;
             buf[8] = CRC5(buf, 8*8);
 
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-            cmd_buf[1] = buf[4]<<24 | buf[5]<<16 | buf[6]<<8 | buf[7];
-            cmd_buf[2] = buf[8]<<24;
-
-            while (1)
-            {
-                if (((ret = get_BC_write_command()) & 0x80000000) == 0)
-                    break;
-                cgsleep_ms(1);
-            }
-            set_BC_command_buffer(cmd_buf);
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID| (i << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
+            bc_cmd_vil(&cmd, i, buf, 9);
+            bc_cmd_submit(&cmd);
         }
     }
 
@@ -6311,6 +6336,7 @@ int i2c_start_dev(struct i2c_dev *i2cdev)
     void clearTempLogFile()
     {
         FILE *fd;
+        logwriter_flush();
         fd=fopen("/tmp/temp","w");
         if(fd)
         {
@@ -6321,11 +6347,14 @@ int i2c_start_dev(struct i2c_dev *i2cdev)
     void writeLogFile(char *logstr)
     {
         FILE *fd;
-        fd=fopen("/tmp/temp","a+");
-        if(fd)
+        if(!logwriter_write(LOGW_TEMP, NULL, logstr, NULL))
         {
-            fwrite(logstr,1,strlen(logstr),fd);
-            fclose(fd);
+            fd=fopen("/tmp/temp","a+");
+            if(fd)
+            {
+                fwrite(logstr,1,strlen(logstr),fd);
+                fclose(fd);
+            }
         }
 //  updateLogFile();
 #ifdef DEBUG_LOG
@@ -6335,6 +6364,7 @@ int i2c_start_dev(struct i2c_dev *i2cdev)
 
     void updateLogFile()
     {
+        logwriter_flush();
         system("cp /tmp/temp /tmp/lasttemp");
     }
 
@@ -6389,6 +6419,7 @@ int i2c_start_dev(struct i2c_dev *i2cdev)
 #else
                 memcpy(last_freq[i],chip_last_freq[i],256); // restore the real freq for chips
 #endif
+                invalidate_chain_freq_stats(i);
             }
         }
 
@@ -6404,6 +6435,7 @@ int i2c_start_dev(struct i2c_dev *i2cdev)
 #else
                 memcpy(last_freq[i],show_last_freq[i],256); // restore the user freq for showed on web for users
 #endif
+                invalidate_chain_freq_stats(i);
             }
         }
 
@@ -6942,6 +6974,7 @@ int i2c_start_dev(struct i2c_dev *i2cdev)
 #else
                 memcpy(last_freq[i],show_last_freq[i],256); // restore the user freq for showed on web for users
 #endif
+                invalidate_chain_freq_stats(i);
             }
         }
 
@@ -7150,32 +7183,67 @@ int i2c_start_dev(struct i2c_dev *i2cdev)
 static void
 read_temperature_from_sensors(void)
 {
-	int i, j;
+	int i, j, k;
 
 	/* temperature accumulator over all chains */
 	struct temp all_max = ZERO_TEMP;
 	int working_sensors = 0;
 
+	/* sensors to read this period */
+	struct sensor_due due[BITMAIN_MAX_CHAIN_NUM * BITMAIN_MAX_SENSORS_PER_CHAIN];
+	int n_due = 0;
+	float hottest = MAX(all_chain_max_temp.local, all_chain_max_temp.remote);
+	struct timeval start, now;
+
+	for (i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++) {
+		for (j = 0; j < chain_n_sensors[i]; j++) {
+			struct sensor *sensor = &chain_sensor[i][j];
+			int interval = sensor_read_interval(sensor, hottest);
+
+			if (++sensor->age < interval)
+				continue;
+			due[n_due].sensor = sensor;
+			due[n_due].overdue = sensor->age - interval;
+			due[n_due].temp = MAX(sensor->temp.local, sensor->temp.remote);
+			n_due++;
+		}
+	}
+	qsort(due, n_due, sizeof(due[0]), sensor_due_cmp);
+
+	/* read as many as fit into the I2C time of this period, the rest
+	 * stays due and comes first next time */
+	cgtime(&start);
+	for (k = 0; k < n_due; k++) {
+		struct sensor *sensor = due[k].sensor;
+		struct temp temp = ZERO_TEMP;
+
+		cgtime(&now);
+		if (k > 0 && ms_tdiff(&now, &start) >= SensorBudgetMs) {
+			sensor_log("sensors: %d reads deferred to next period", n_due - k);
+			break;
+		}
+		if (sensor_read_temp(sensor, &temp) < 0)
+			sensor_log("sensors: %d/%d temperature read failed, next try in %d periods",
+				sensor->dev.chain, (int)(sensor - chain_sensor[sensor->dev.chain]), sensor->backoff);
+	}
+
 	for (i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++) {
 		/* temperature accumulator for this chain */
 		struct temp chain_max = ZERO_TEMP;
 
 		for (j = 0; j < chain_n_sensors[i]; j++) {
+			struct sensor *sensor = &chain_sensor[i][j];
 			struct temp temp = ZERO_TEMP;
-			int ret;
-
-			/* read out temperature */
-			ret = sensor_read_temp(&chain_sensor[i][j], &temp);
-			if (ret < 0) {
-				/* temperature reading failed, use previous temperature */
-				temp = chain_sensor_temp[i][j];
-				sensor_log("sensors: %d/%d temperature read failed, using previous", i, j);
-			} else {
-				working_sensors++;
+
+			if (sensor->valid) {
+				/* last reading, possibly of an earlier period */
+				temp = sensor->temp;
+				if (!sensor->backoff)
+					working_sensors++;
 			}
 			/* got temperature */
-			sensor_log("sensors: %d/%d temperature (%.1f,%.1f)", i, j,
-				temp.local, temp.remote);
+			sensor_log("sensors: %d/%d temperature (%.1f,%.1f) age %d", i, j,
+				temp.local, temp.remote, sensor->age);
 
 			/* accumulate */
 			max_temp(&chain_max, &temp);
@@ -7810,8 +7878,7 @@ read_temperature_from_sensors(void)
     void chain_inactive(unsigned char chain)
     {
         unsigned char buf[5] = {0,0,0,0,5};
-        unsigned int cmd_buf[3] = {0,0,0};
-        unsigned int ret, value;
+        struct bc_cmd cmd;
 
         if(!opt_multi_version)  // fil mode
         {
@@ -7821,12 +7888,8 @@ read_temperature_from_sensors(void)
             buf[3] = CRC5(buf, 4*8 - 5);
             applog(LOG_DEBUG,"%s: buf[0]=0x%x, buf[1]=0x%x, buf[2]=0x%x, buf[3]=0x%x\n", __FUNCTION__, buf[0], buf[1], buf[2], buf[3]);
 
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-            set_BC_command_buffer(cmd_buf);
-
-            ret = get_BC_write_command();
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (chain << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
+            bc_cmd_fil(&cmd, chain, buf);
+            bc_cmd_submit(&cmd);
         }
         else    // vil mode
         {
@@ -7837,26 +7900,15 @@ read_temperature_from_sensors(void)
             buf[4] = CRC5(buf, 4*8);
             applog(LOG_DEBUG,"%s: buf[0]=0x%x, buf[1]=0x%x, buf[2]=0x%x, buf[3]=0x%x, buf[4]=0x%x\n", __FUNCTION__, buf[0], buf[1], buf[2], buf[3], buf[4]);
 
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-            cmd_buf[1] = buf[4]<<24;
-            while (1)
-            {
-                ret = get_BC_write_command();
-                if ((ret & 0x80000000) == 0)
-                    break;
-                cgsleep_ms(1);
-            }
-            set_BC_command_buffer(cmd_buf);
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (chain << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
+            bc_cmd_vil(&cmd, chain, buf, 5);
+            bc_cmd_submit(&cmd);
         }
     }
 
     void set_address(unsigned char chain, unsigned char mode, unsigned char address)
     {
         unsigned char buf[9] = {0};
-        unsigned int cmd_buf[3] = {0,0,0};
-        unsigned int ret, value;
+        struct bc_cmd cmd;
 
         if(!opt_multi_version)  // fil mode
         {
@@ -7868,12 +7920,8 @@ read_temperature_from_sensors(void)
             buf[3] = CRC5(buf, 4*8 - 5);
             applog(LOG_DEBUG,"%s: buf[0]=0x%x, buf[1]=0x%x, buf[2]=0x%x, buf[3]=0x%x\n", __FUNCTION__, buf[0], buf[1], buf[2], buf[3]);
 
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-            set_BC_command_buffer(cmd_buf);
-
-            ret = get_BC_write_command();
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (chain << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
+            bc_cmd_fil(&cmd, chain, buf);
+            bc_cmd_submit(&cmd);
         }
         else    // vil mode
         {
@@ -7884,18 +7932,8 @@ read_temperature_from_sensors(void)
             buf[4] = CRC5(buf, 4*8);
             //applog(LOG_DEBUG,"%s: buf[0]=0x%x, buf[1]=0x%x, buf[2]=0x%x, buf[3]=0x%x, buf[4]=0x%x\n", __FUNCTION__, buf[0], buf[1], buf[2], buf[3], buf[4]);
 
-            cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-            cmd_buf[1] = buf[4]<<24;
-            while (1)
-            {
-                ret = get_BC_write_command();
-                if ((ret & 0x80000000) == 0)
-                    break;
-                cgsleep_ms(1);
-            }
-            set_BC_command_buffer(cmd_buf);
-            value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (chain << 16) | (ret & 0xfff0ffff);
-            set_BC_write_command(value);
+            bc_cmd_vil(&cmd, chain, buf, 5);
+            bc_cmd_submit(&cmd);
         }
     }
 
@@ -8043,33 +8081,34 @@ read_temperature_from_sensors(void)
             dev->check_bit++;
         }
 
-        for(i=0; i<BITMAIN_MAX_CHAIN_NUM; i++)
+        // all chains in step, so they share the 30ms gaps between commands
+        for(j = 0; j < 3; j++)
         {
-            if(dev->chain_exist[i] == 1 && dev->chain_asic_num[i] > 0)
+            for(i=0; i<BITMAIN_MAX_CHAIN_NUM; i++)
             {
-                chip_addr = 0;
-                chain_inactive(i);
-                cgsleep_ms(30);
-                chain_inactive(i);
-                cgsleep_ms(30);
-                chain_inactive(i);
-                cgsleep_ms(30);
+                if(dev->chain_exist[i] == 1 && dev->chain_asic_num[i] > 0)
+                    chain_inactive(i);
+            }
+            cgsleep_ms(30);
+        }
 
-                for(j = 0; j < 0x100/dev->addrInterval; j++)
-                {
+        for(j = 0; j < 0x100/dev->addrInterval; j++)
+        {
+            for(i=0; i<BITMAIN_MAX_CHAIN_NUM; i++)
+            {
+                if(dev->chain_exist[i] == 1 && dev->chain_asic_num[i] > 0)
                     set_address(i, 0, chip_addr);
-                    chip_addr += dev->addrInterval;
-                    cgsleep_ms(30);
-                }
             }
+            chip_addr += dev->addrInterval;
+            cgsleep_ms(30);
         }
     }
 
     void set_asic_ticket_mask(unsigned int ticket_mask)
     {
         unsigned char buf[9] = {0};
-        unsigned int cmd_buf[3] = {0,0,0};
-        unsigned int ret, value,i;
+        struct bc_cmd cmd;
+        unsigned int i;
         unsigned int tm;
 
         tm = Swap32(ticket_mask);
@@ -8088,12 +8127,8 @@ read_temperature_from_sensors(void)
                     buf[3] = CRC5(buf, 4*8 - 5);
                     applog(LOG_DEBUG,"%s: buf[0]=0x%x, buf[1]=0x%x, buf[2]=0x%x, buf[3]=0x%x\n", __FUNCTION__, buf[0], buf[1], buf[2], buf[3]);
 
-                    cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-                    set_BC_command_buffer(cmd_buf);
-
-                    ret = get_BC_write_command();
-                    value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (i << 16) | (ret & 0xfff0ffff);
-                    set_BC_write_command(value);
+                    bc_cmd_fil(&cmd, i, buf);
+                    bc_cmd_submit(&cmd);
                 }
                 else    // vil mode
                 {
@@ -8107,14 +8142,8 @@ read_temperature_from_sensors(void)
                     buf[7] = (tm >> 24) & 0xff;
                     buf[8] = CRC5(buf, 8*8);
 
-                    cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-                    cmd_buf[1] = buf[4]<<24 | buf[5]<<16 | buf[6]<<8 | buf[7];
-                    cmd_buf[2] = buf[8]<<24;
-
-                    set_BC_command_buffer(cmd_buf);
-                    ret = get_BC_write_command();
-                    value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID| (i << 16) | (ret & 0xfff0ffff);
-                    set_BC_write_command(value);
+                    bc_cmd_vil(&cmd, i, buf, 9);
+                    bc_cmd_submit(&cmd);
                 }
             }
         }
@@ -8123,8 +8152,8 @@ read_temperature_from_sensors(void)
     void set_hcnt(unsigned int hcnt)
     {
         unsigned char buf[9] = {0};
-        unsigned int cmd_buf[3] = {0,0,0};
-        unsigned int ret, value,i;
+        struct bc_cmd cmd;
+        unsigned int i;
 
         for(i=0; i<BITMAIN_MAX_CHAIN_NUM; i++)
         {
@@ -8158,14 +8187,8 @@ read_temperature_from_sensors(void)
                     buf[7] = hcnt;
                     buf[8] = CRC5(buf, 8*8);
 
-                    cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-                    cmd_buf[1] = buf[4]<<24 | buf[5]<<16 | buf[6]<<8 | buf[7];
-                    cmd_buf[2] = buf[8]<<24;
-
-                    set_BC_command_buffer(cmd_buf);
-                    ret = get_BC_write_command();
-                    value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID| (i << 16) | (ret & 0xFFF0FFFF);
-                    set_BC_write_command(value);
+                    bc_cmd_vil(&cmd, i, buf, 9);
+                    bc_cmd_submit(&cmd);
                 }
             }
         }
@@ -8173,69 +8196,62 @@ read_temperature_from_sensors(void)
 
 
 #if 1
-    void set_baud(unsigned char bauddiv,int no_use)
+    /* only the ASICs of one chain switch, the FPGA keeps its bauddiv */
+    void set_baud_onChain(int chainIndex, unsigned char bauddiv)
     {
         unsigned char buf[9] = {0};
-        unsigned int cmd_buf[3] = {0,0,0};
-        unsigned int ret, value,i;
+        struct bc_cmd cmd;
+        unsigned int i = chainIndex;
 
-        if(dev->baud == bauddiv)
+        //first step: send new bauddiv to ASIC, but FPGA doesn't change its bauddiv, it uses old bauddiv to send BC command to ASIC
+        if(!opt_multi_version)  // fil mode
         {
-            applog(LOG_DEBUG,"%s: the setting bauddiv(%d) is the same as before\n", __FUNCTION__, bauddiv);
-            return;
-        }
+            buf[0] = SET_BAUD_OPS;
+            buf[1] = 0x10;
+            buf[2] = bauddiv & 0x1f;
+            buf[0] |= COMMAND_FOR_ALL;
+            buf[3] = CRC5(buf, 4*8 - 5);
+            applog(LOG_DEBUG,"%s: buf[0]=0x%x, buf[1]=0x%x, buf[2]=0x%x, buf[3]=0x%x\n", __FUNCTION__, buf[0], buf[1], buf[2], buf[3]);
 
-        for(i=0; i<BITMAIN_MAX_CHAIN_NUM; i++)
+            bc_cmd_fil(&cmd, i, buf);
+            bc_cmd_submit(&cmd);
+        }
+        else    // vil mode
         {
-            if(dev->chain_exist[i] == 1)
-            {
-                //first step: send new bauddiv to ASIC, but FPGA doesn't change its bauddiv, it uses old bauddiv to send BC command to ASIC
-                if(!opt_multi_version)  // fil mode
-                {
-                    buf[0] = SET_BAUD_OPS;
-                    buf[1] = 0x10;
-                    buf[2] = bauddiv & 0x1f;
-                    buf[0] |= COMMAND_FOR_ALL;
-                    buf[3] = CRC5(buf, 4*8 - 5);
-                    applog(LOG_DEBUG,"%s: buf[0]=0x%x, buf[1]=0x%x, buf[2]=0x%x, buf[3]=0x%x\n", __FUNCTION__, buf[0], buf[1], buf[2], buf[3]);
+            buf[0] = VIL_COMMAND_TYPE | VIL_ALL | SET_CONFIG;
+            buf[1] = 0x09;
+            buf[2] = 0;
+            buf[3] = MISC_CONTROL;
+            buf[4] = 0;
+            buf[5] = INV_CLKO;
+            buf[6] = bauddiv & 0x1f;
+            buf[7] = 0;
+            buf[8] = CRC5(buf, 8*8);
 
-                    cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-                    set_BC_command_buffer(cmd_buf);
+            bc_cmd_vil(&cmd, i, buf, 9);
+            bc_cmd_submit(&cmd);
+        }
+    }
 
-                    ret = get_BC_write_command();
-                    value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (i << 16) | (ret & 0xfff0ffff);
-                    set_BC_write_command(value);
-                }
-                else    // vil mode
-                {
-                    buf[0] = VIL_COMMAND_TYPE | VIL_ALL | SET_CONFIG;
-                    buf[1] = 0x09;
-                    buf[2] = 0;
-                    buf[3] = MISC_CONTROL;
-                    buf[4] = 0;
-                    buf[5] = INV_CLKO;
-                    buf[6] = bauddiv & 0x1f;
-                    buf[7] = 0;
-                    buf[8] = CRC5(buf, 8*8);
+    void set_baud(unsigned char bauddiv,int no_use)
+    {
+        unsigned int i;
 
-                    cmd_buf[0] = buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
-                    cmd_buf[1] = buf[4]<<24 | buf[5]<<16 | buf[6]<<8 | buf[7];
-                    cmd_buf[2] = buf[8]<<24;
-                    applog(LOG_DEBUG,"%s: cmd_buf[0]=0x%x, cmd_buf[1]=0x%x, cmd_buf[2]=0x%x\n", __FUNCTION__, cmd_buf[0], cmd_buf[1], cmd_buf[2]);
+        if(dev->baud == bauddiv)
+        {
+            applog(LOG_DEBUG,"%s: the setting bauddiv(%d) is the same as before\n", __FUNCTION__, bauddiv);
+            return;
+        }
 
-                    set_BC_command_buffer(cmd_buf);
-                    ret = get_BC_write_command();
-                    value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID| (i << 16) | (ret & 0xfff0ffff);
-                    set_BC_write_command(value);
-                }
-            }
+        for(i=0; i<BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(dev->chain_exist[i] == 1)
+                set_baud_onChain(i, bauddiv);
         }
 
         // second step: change FPGA's bauddiv
         cgsleep_us(50000);
-        ret = get_BC_write_command();
-        value = (ret & 0xffffffe0) | (bauddiv & 0x1f);
-        set_BC_write_command(value);
+        bc_cmd_set_ctrl(0x1f, bauddiv & 0x1f);
         dev->baud = bauddiv;
     }
 #endif
@@ -8542,6 +8558,280 @@ read_temperature_from_sensors(void)
 #endif
     }
 
+#ifndef T9_18   // T9+ keeps its frequencies in chain_pic_buf
+    /*
+     * Online per-chip frequency tuning. A chip is judged once it has had
+     * time for AUTOTUNE_MIN_EXPECTED nonces at its current frequency:
+     * too many hash errors, or too few nonces in AUTOTUNE_BAD_PERIODS
+     * periods in a row, step it one PLL index down and remember that index
+     * as its ceiling, a clean chip steps one index up (at most
+     * AUTOTUNE_MAX_UP above the PIC flash value, never to its ceiling).
+     * Periods with throttling, a chain re-init or without new jobs from
+     * the pool are not judged. The result is kept in AUTOTUNE_FILE for the
+     * same boards.
+     */
+    #define AUTOTUNE_FILE           "/etc/bmminer/autotune"
+    #define AUTOTUNE_MIN_EXPECTED   400     // ~1.5 hours at 650M, +-5% noise
+    #define AUTOTUNE_MAX_UP         4       // PLL steps above the flash value
+    #define AUTOTUNE_MAX_DOWN       8       // and below it
+    #define AUTOTUNE_HW_HIGH        0.01    // step down above 1% hash errors
+    #define AUTOTUNE_HW_LOW         0.002   // step up only below 0.2%
+    #define AUTOTUNE_YIELD_LOW      0.90    // step down below 90% of expected nonces
+    #define AUTOTUNE_YIELD_HIGH     0.97    // step up only above 97%
+    #define AUTOTUNE_BAD_PERIODS    3       // low yield periods in a row before stepping down
+    #define AUTOTUNE_JOB_GAP        120     // seconds without a new job that spoil a period
+    #define AUTOTUNE_NO_CEILING     0xff
+
+    struct autotune_chip
+    {
+        unsigned char base;     // index from the PIC flash
+        unsigned char ceiling;  // lowest index found unstable
+        unsigned char bad_periods;  // low yield periods in a row
+        uint64_t nonce, hw;     // asic_stats counters at the last decision
+        time_t since;
+    };
+
+    static struct autotune_chip autotune_chip[BITMAIN_MAX_CHAIN_NUM][BITMAIN_DEFAULT_ASIC_NUM];
+    static uint16_t autotune_sig[BITMAIN_MAX_CHAIN_NUM];  // CRC16 of the flash frequencies
+    static int autotune_recover[BITMAIN_MAX_CHAIN_NUM];   // chain_recover_num at the last step
+    static time_t autotune_job_gap = 0;                   // end of the last gap between new jobs
+    static bool autotune_started = false;
+    int autotune_ups = 0, autotune_downs = 0;
+
+    static void autotune_save(void)
+    {
+        FILE *fd;
+        int i, j;
+
+        fd = fopen(AUTOTUNE_FILE ".tmp", "w");
+        if(!fd)
+            return;
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(dev->chain_exist[i] != 1)
+                continue;
+            fprintf(fd, "chain %d %04x %d", i, autotune_sig[i], dev->chain_asic_num[i]);
+            for(j = 0; j < dev->chain_asic_num[i]; j++)
+                fprintf(fd, " %d:%d", chip_last_freq[i][j*2+3], autotune_chip[i][j].ceiling);
+            fprintf(fd, "\n");
+        }
+        fclose(fd);
+        rename(AUTOTUNE_FILE ".tmp", AUTOTUNE_FILE);
+    }
+
+    /* the thermal governor may have throttled the chain since the caller
+     * looked, a throttled chip keeps its steps below the new index */
+    static void autotune_set_index(int chain, int asic, int index)
+    {
+        int pll;
+
+        pthread_mutex_lock(&opencore_readtemp_mutex);
+        pthread_mutex_lock(&reinit_mutex);
+        setChainAsicFreqIndex(chain, asic, index);
+        chip_last_freq[chain][asic*2+3] = index;
+        show_last_freq[chain][asic*2+3] = index;
+        pll = index - throttle_applied[chain];
+        set_frequency_with_addr_plldatai(pll < 0 ? 0 : pll, 0, asic * dev->addrInterval, chain);
+        pthread_mutex_unlock(&reinit_mutex);
+        pthread_mutex_unlock(&opencore_readtemp_mutex);
+    }
+
+    static void autotune_new_period(struct autotune_chip *c, struct asic_stats *st, int asic, time_t now)
+    {
+        c->nonce = st->nonce[asic];
+        c->hw = st->hw[asic];
+        c->since = now;
+    }
+
+    /* take over the result of an earlier run if it was made on these boards */
+    static void autotune_load(void)
+    {
+        char line[BITMAIN_DEFAULT_ASIC_NUM * 8 + 32];
+        int chain, asic_num, n, j;
+        unsigned int sig;
+        FILE *fd;
+
+        fd = fopen(AUTOTUNE_FILE, "r");
+        if(!fd)
+            return;
+        while(fgets(line, sizeof(line), fd))
+        {
+            char *p = line;
+            int index, ceiling;
+
+            if(sscanf(p, "chain %d %x %d%n", &chain, &sig, &asic_num, &n) != 3)
+                continue;
+            if(chain < 0 || chain >= BITMAIN_MAX_CHAIN_NUM || dev->chain_exist[chain] != 1 ||
+               sig != autotune_sig[chain] || asic_num != dev->chain_asic_num[chain])
+            {
+                applog(LOG_NOTICE, "autotune: ignoring saved chain %d, the board differs", chain);
+                continue;
+            }
+            p += n;
+            for(j = 0; j < asic_num && sscanf(p, " %d:%d%n", &index, &ceiling, &n) == 2; j++, p += n)
+            {
+                struct autotune_chip *c = &autotune_chip[chain][j];
+
+                if(index < c->base - AUTOTUNE_MAX_DOWN || index > c->base + AUTOTUNE_MAX_UP ||
+                   index >= (int)FREQ_PLL_NUM)
+                    continue;
+                c->ceiling = ceiling;
+                if(!opt_autotune_dry_run && index != chip_last_freq[chain][j*2+3])
+                    autotune_set_index(chain, j, index);
+            }
+            applog(LOG_NOTICE, "autotune: chain %d restored from %s", chain, AUTOTUNE_FILE);
+        }
+        fclose(fd);
+    }
+
+    static void autotune_start(void)
+    {
+        time_t now = time(NULL);
+        int i, j;
+
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(dev->chain_exist[i] != 1)
+                continue;
+            // the flash table, chip_last_freq may already hold tuned indexes after a warm restart
+            autotune_sig[i] = CRC16(chip_flash_freq[i], 256);
+            autotune_recover[i] = chain_recover_num[i];
+            for(j = 0; j < dev->chain_asic_num[i]; j++)
+            {
+                struct autotune_chip *c = &autotune_chip[i][j];
+
+                c->base = chip_flash_freq[i][j*2+3];
+                c->ceiling = AUTOTUNE_NO_CEILING;
+                c->bad_periods = 0;
+            }
+        }
+        autotune_load();
+
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(dev->chain_exist[i] != 1 || !asic_stats[i])
+                continue;
+            for(j = 0; j < dev->chain_asic_num[i]; j++)
+                autotune_new_period(&autotune_chip[i][j], asic_stats[i], j, now);
+        }
+        autotune_started = true;
+    }
+
+    /* called about once a minute from check_system_work */
+    static void autotune_step(void)
+    {
+        time_t now = time(NULL);
+        bool changed = false, throttled = false;
+        int i, j;
+
+        if(!opt_autotune || global_stop || status_error)
+            return;
+        if(!autotune_started)
+        {
+            autotune_start();
+            return;
+        }
+
+        // nonce rates of throttled chips say nothing about their table frequency
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+            if(throttle_applied[i] > 0)
+                throttled = true;
+
+        // nor do those of a pool outage or a pool that stopped sending jobs
+        if(now - last_new_job > AUTOTUNE_JOB_GAP)
+            autotune_job_gap = now;
+
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            struct asic_stats *st = asic_stats[i];
+            bool reinit;
+
+            if(dev->chain_exist[i] != 1 || !st)
+                continue;
+
+            // nor the time a chain spent in re-init
+            reinit = chain_recover_num[i] != autotune_recover[i];
+            autotune_recover[i] = chain_recover_num[i];
+
+            for(j = 0; j < dev->chain_asic_num[i] && j < BITMAIN_DEFAULT_ASIC_NUM; j++)
+            {
+                struct autotune_chip *c = &autotune_chip[i][j];
+                int index = chip_last_freq[i][j*2+3];
+                int cores = BM1387_CORE_NUM - chain_badcore_num[i][j];
+                double expected, yield, hw_ratio;
+                uint64_t nonce = st->nonce[j] - c->nonce;
+                uint64_t hw = st->hw[j] - c->hw;
+                int next = index;
+
+                if(throttled || reinit || autotune_job_gap >= c->since)
+                {
+                    autotune_new_period(c, st, j, now);
+                    continue;
+                }
+
+                // nonces of 2^DEVICE_DIFF difficulty the chip should have found
+                expected = (double)freq_pll_1385[index].freq * 1e6 * cores * (now - c->since) /
+                           4294967296.0 / (1 << DEVICE_DIFF);
+                if(expected < AUTOTUNE_MIN_EXPECTED)
+                    continue;
+
+                yield = nonce / expected;
+                hw_ratio = nonce + hw > 0 ? (double)hw / (nonce + hw) : 0.0;
+
+                // hash errors are the chip's own, a low yield must repeat before it counts
+                if(yield < AUTOTUNE_YIELD_LOW && hw_ratio <= AUTOTUNE_HW_HIGH &&
+                   ++c->bad_periods < AUTOTUNE_BAD_PERIODS)
+                {
+                    autotune_new_period(c, st, j, now);
+                    continue;
+                }
+                c->bad_periods = 0;
+
+                if(hw_ratio > AUTOTUNE_HW_HIGH || yield < AUTOTUNE_YIELD_LOW)
+                {
+                    if(index > 0 && index > c->base - AUTOTUNE_MAX_DOWN)
+                        next = index - 1;
+                    if(!opt_autotune_dry_run)
+                        c->ceiling = index;
+                }
+                else if(hw_ratio < AUTOTUNE_HW_LOW && yield > AUTOTUNE_YIELD_HIGH &&
+                        index + 1 < c->ceiling && index + 1 < c->base + AUTOTUNE_MAX_UP + 1 &&
+                        index + 1 < (int)FREQ_PLL_NUM)
+                {
+                    next = index + 1;
+                }
+
+                if(next != index)
+                {
+                    applog(LOG_NOTICE, "autotune%s: chain %d asic %d %dM -> %dM (yield %.1f%%, hw %.2f%%, %llu nonces)",
+                           opt_autotune_dry_run ? " (dry run)" : "", i, j,
+                           freq_pll_1385[index].freq, freq_pll_1385[next].freq,
+                           yield * 100.0, hw_ratio * 100.0, (unsigned long long)nonce);
+                    if(next > index)
+                        autotune_ups++;
+                    else
+                        autotune_downs++;
+                    if(!opt_autotune_dry_run)
+                    {
+                        autotune_set_index(i, j, next);
+                        changed = true;
+                    }
+                }
+
+                // judge the next period on its own numbers
+                autotune_new_period(c, st, j, now);
+            }
+        }
+
+        if(changed)
+            autotune_save();
+    }
+#else
+    static void autotune_step(void)
+    {
+    }
+#endif
+
     void * check_system_work()
     {
         struct timeval tv_start, tv_end,tv_reboot,tv_reboot_start;
@@ -8657,13 +8947,9 @@ read_temperature_from_sensors(void)
                                 sprintf(logstr,"Chain[%d] RT=%f ideal=%f need re-init\n",i,rt_board_rate,ideal_board_rate);
                                 writeInitLogFile(logstr);
 
-                                bitmain_core_reInit();
-
-                                sprintf(logstr,"Re-init Done\n");
-                                writeInitLogFile(logstr);
+                                bitmain_chain_reInit(i);
 
                                 reinit_counter=0;   // will wait for 10mins to start check to reinit  again
-                                break;
                             }
                         }
                     }
@@ -8778,13 +9064,9 @@ read_temperature_from_sensors(void)
                                 sprintf(logstr,"Chain[%d] get 0 nonce in 1 min\n",i);
                                 writeInitLogFile(logstr);
 
-                                bitmain_core_reInit();
-
-                                sprintf(logstr,"Re-init Done\n");
-                                writeInitLogFile(logstr);
+                                bitmain_chain_reInit(i);
 
                                 reinit_counter=0;   // will wait for 10mins to start check to reinit  again
-                                break;
                             }
                         }
                     }
@@ -8871,6 +9153,8 @@ read_temperature_from_sensors(void)
                 if(run_counter>60)
                     run_counter=0;
 
+                autotune_step();
+
                 copy_time(&tv_start, &tv_end);
             }
 
@@ -8881,18 +9165,177 @@ read_temperature_from_sensors(void)
 #ifdef DEBUG_OPENCORE_TWICE
     static int debug_once=1;    // clement for debug
 #endif
-    void open_core(bool nullwork_enable)
+
+    /* gateblk of one chain before its null work, false if the FPGA did not take it:
+     * without gateblk the null work opens nothing, so the caller skips the chain */
+    static bool open_core_gateblk(const struct bc_cmd *cmd, int chain)
     {
-        unsigned int i = 0, j = 0, k, m, work_id = 0, ret = 0, value = 0, work_fifo_ready = 0, loop=0;
-        unsigned char gateblk[4] = {0,0,0,0};
-        unsigned int cmd_buf[3] = {0,0,0}, buf[TW_WRITE_COMMAND_LEN/sizeof(unsigned int)]= {0};
+        char logstr[256];
+
+        if(!bc_cmd_submit(cmd))
+        {
+            sprintf(logstr,"Error: open core gateblk not sent on Chain[%d]!\n",chain);
+            writeInitLogFile(logstr);
+            return false;
+        }
+        cgsleep_us(10000);
+        return true;
+    }
+    /* open cores on all chains of chain_mask at once: every chain gets the same null work,
+     * so the packets are built once and fed to whichever chain FIFO has room */
+    static void open_core_vil(unsigned int chain_mask, unsigned int loop, bool nullwork_enable)
+    {
+        unsigned int packet[BITMAIN_MAX_CHAIN_NUM][2][TW_WRITE_COMMAND_LEN_VIL/sizeof(unsigned int)];
         unsigned int buf_vil_tw[TW_WRITE_COMMAND_LEN_VIL/sizeof(unsigned int)]= {0};
-        unsigned char data[TW_WRITE_COMMAND_LEN] = {0xff};
         unsigned char buf_vil[9] = {0,0,0,0,0,0,0,0,0};
-        struct vil_work work_vil;
+        struct bc_cmd gateblk_cmd[BITMAIN_MAX_CHAIN_NUM];
+        unsigned int sent[BITMAIN_MAX_CHAIN_NUM] = {0};
         struct vil_work_1387 work_vil_1387;
+        struct timeval tv_start, tv_now;
+        unsigned int i, j, work_fifo_ready;
+        int gateblk_num = 0, pending = 0, wait_count = 0;
         char logstr[256];
-        int wati_count=0;
+
+        set_dhash_acc_control((get_dhash_acc_control() & (~OPERATION_MODE)) | VIL_MODE | VIL_MIDSTATE_NUMBER(opt_multi_version));
+        set_hash_counting_number(0);
+
+        // prepare gateblk
+        buf_vil[0] = VIL_COMMAND_TYPE | VIL_ALL | SET_CONFIG;
+        buf_vil[1] = 0x09;
+        buf_vil[2] = 0;
+        buf_vil[3] = MISC_CONTROL;
+        buf_vil[4] = 0x40;
+        buf_vil[5] = INV_CLKO;  // enable INV_CLKO
+        buf_vil[6] = (dev->baud & 0x1f) | GATEBCLK; // enable gateblk
+        buf_vil[7] = MMEN;  // MMEN=1
+        buf_vil[8] = CRC5(buf_vil, 8*8);
+
+        // prepare special work for openning core, only the header word differs between chains
+        memset(&work_vil_1387, 0xff, sizeof(struct vil_work_1387));
+        work_vil_1387.reserved1[0]= 0;
+        work_vil_1387.reserved1[1]= 0;
+        work_vil_1387.work_count = 0;
+        work_vil_1387.data[0] = 0xff;
+        work_vil_1387.data[11] = 0xff;
+
+        buf_vil_tw[1] = work_vil_1387.work_count;
+        for(j=2; j<DATA2_LEN/sizeof(unsigned int)+2; j++)
+        {
+            buf_vil_tw[j] = (work_vil_1387.data[4*(j-2) + 0] << 24) | (work_vil_1387.data[4*(j-2) + 1] << 16) | (work_vil_1387.data[4*(j-2) + 2] << 8) | work_vil_1387.data[4*(j-2) + 3];
+        }
+        for(j=5; j<MIDSTATE_LEN/sizeof(unsigned int)+5; j++)
+        {
+            buf_vil_tw[j] = 0;
+        }
+
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(dev->chain_exist[i] != 1 || !(chain_mask & (0x1 << i)))
+            {
+                sent[i] = loop;
+                continue;
+            }
+
+            memcpy(packet[i][0], buf_vil_tw, sizeof(buf_vil_tw));
+            memcpy(packet[i][1], buf_vil_tw, sizeof(buf_vil_tw));
+            packet[i][0][0] = (NEW_BLOCK_MARKER << 24) | ((i | 0x80) << 16) | (work_vil_1387.reserved1[0] << 8) | work_vil_1387.reserved1[1];
+            packet[i][1][0] = (NORMAL_BLOCK_MARKER << 24) | ((i | 0x80) << 16) | (work_vil_1387.reserved1[0] << 8) | work_vil_1387.reserved1[1];
+
+            bc_cmd_vil(&gateblk_cmd[gateblk_num++], i, buf_vil, 9);
+            chain_opencore_ms[i] = 0;
+            pending++;
+        }
+
+        if(pending == 0)
+        {
+            set_dhash_acc_control(get_dhash_acc_control()| VIL_MODE | VIL_MIDSTATE_NUMBER(opt_multi_version));
+            return;
+        }
+
+        cgtime(&tv_start);
+
+        bc_cmd_set_ctrl(BC_COMMAND_EN_NULL_WORK, 0);    //disable null work
+
+        if(bc_cmd_submit_batch(gateblk_cmd, gateblk_num))
+        {
+            cgsleep_us(10000);      // one gateblk settle time shared by all chains
+        }
+        else
+        {
+            // without gateblk the null work opens nothing
+            writeInitLogFile("Error: open core gateblk not sent, no core opened!\n");
+            for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+                sent[i] = loop;
+            pending = 0;
+        }
+
+        while(pending > 0)
+        {
+            bool progress = false;
+
+            work_fifo_ready = get_buffer_space();
+            for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+            {
+                if(sent[i] >= loop || !(work_fifo_ready & (0x1 << i)))
+                    continue;
+
+                set_TW_write_command_vil(packet[i][sent[i] == 0 ? 0 : 1]);
+                sent[i]++;
+                progress = true;
+
+                if(sent[i] == loop)
+                {
+                    cgtime(&tv_now);
+                    chain_opencore_ms[i] = ms_tdiff(&tv_now, &tv_start);
+                    pending--;
+                }
+            }
+
+            if(progress)
+            {
+                wait_count = 0;
+                continue;
+            }
+
+            //work fifos are full, wait for 1ms
+            cgsleep_us(1000);
+            if(++wait_count > 3000)
+            {
+                for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+                {
+                    if(sent[i] < loop)
+                    {
+                        sprintf(logstr,"Error: send open core work Failed on Chain[%d]!\n",i);
+                        writeInitLogFile(logstr);
+                    }
+                }
+                break;
+            }
+        }
+
+        if(nullwork_enable)
+            bc_cmd_set_ctrl(BC_COMMAND_EN_NULL_WORK, BC_COMMAND_EN_NULL_WORK);  //enable null work
+
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(chain_opencore_ms[i] > 0 && (chain_mask & (0x1 << i)))
+            {
+                sprintf(logstr,"Chain[J%d] open core %d ms\n",i+1,chain_opencore_ms[i]);
+                writeInitLogFile(logstr);
+            }
+        }
+
+        set_dhash_acc_control(get_dhash_acc_control()| VIL_MODE | VIL_MIDSTATE_NUMBER(opt_multi_version));
+    }
+
+    void open_core(bool nullwork_enable)
+    {
+        unsigned int i = 0, j = 0, k, m, work_id = 0, work_fifo_ready = 0, loop=0;
+        unsigned char gateblk[4] = {0,0,0,0};
+        unsigned int buf[TW_WRITE_COMMAND_LEN/sizeof(unsigned int)]= {0};
+        struct bc_cmd cmd;
+        bool gate_ok;
+        unsigned char data[TW_WRITE_COMMAND_LEN] = {0xff};
 
 #ifdef DEBUG_OPENCORE_TWICE
         loop = BM1387_CORE_NUM-debug_once;
@@ -8912,7 +9355,6 @@ read_temperature_from_sensors(void)
             gateblk[3] = 0x80;  // MMEN=1
             gateblk[3] = 0x80 | (0x1f & CRC5(gateblk, 4*8 - 5));
             applog(LOG_DEBUG,"%s: gateblk[0]=0x%x, gateblk[1]=0x%x, gateblk[2]=0x%x, gateblk[3]=0x%x\n", __FUNCTION__, gateblk[0], gateblk[1], gateblk[2], gateblk[3]);
-            cmd_buf[0] = gateblk[0]<<24 | gateblk[1]<<16 | gateblk[2]<<8 | gateblk[3];
 
             memset(data, 0x00, TW_WRITE_COMMAND_LEN);
             data[TW_WRITE_COMMAND_LEN - 1] = 0xff;
@@ -8922,13 +9364,10 @@ read_temperature_from_sensors(void)
             {
                 if(dev->chain_exist[i] == 1)
                 {
-                    set_BC_command_buffer(cmd_buf);
-                    ret = get_BC_write_command();
-                    value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (i << 16) | (ret & 0xfff0ffff);
-                    set_BC_write_command(value);
-                    cgsleep_us(10000);
+                    bc_cmd_fil(&cmd, i, gateblk);
+                    gate_ok = open_core_gateblk(&cmd, i);
 
-                    for(m=0; m<loop; m++)
+                    for(m=0; gate_ok && m<loop; m++)
                     {
                         do
                         {
@@ -8957,18 +9396,10 @@ read_temperature_from_sensors(void)
                         data[1] = i | 0x80; //set chain id and enable it
 
                         if(m==0)
-                        {
-                            ret = get_BC_write_command();   //disable null work
-                            ret &= ~BC_COMMAND_EN_NULL_WORK;
-                            set_BC_write_command(ret);
-                        }
+                            bc_cmd_set_ctrl(BC_COMMAND_EN_NULL_WORK, 0);    //disable null work
 
-                        if(m==loop - 1 && nullwork_enable)
-                        {
-                            ret = get_BC_write_command();   //enable null work
-                            ret &= (BC_COMMAND_EN_CHAIN_ID | BC_COMMAND_EN_NULL_WORK | ((i & 0xf) << 16));
-                            set_BC_write_command(ret);
-                        }
+                        if(m==loop - 1 && nullwork_enable)  //enable null work
+                            bc_cmd_set_ctrl(~(BC_COMMAND_EN_CHAIN_ID | BC_COMMAND_EN_NULL_WORK | ((i & 0xf) << 16)), 0);
 
                         memset(buf, 0, TW_WRITE_COMMAND_LEN/sizeof(unsigned int));
 
@@ -8990,136 +9421,18 @@ read_temperature_from_sensors(void)
         }
         else    // vil mode
         {
-            set_dhash_acc_control((get_dhash_acc_control() & (~OPERATION_MODE)) | VIL_MODE | VIL_MIDSTATE_NUMBER(opt_multi_version));
-            set_hash_counting_number(0);
-            // prepare gateblk
-            buf_vil[0] = VIL_COMMAND_TYPE | VIL_ALL | SET_CONFIG;
-            buf_vil[1] = 0x09;
-            buf_vil[2] = 0;
-            buf_vil[3] = MISC_CONTROL;
-            buf_vil[4] = 0x40;
-            buf_vil[5] = INV_CLKO;  // enable INV_CLKO
-            buf_vil[6] = (dev->baud & 0x1f) | GATEBCLK; // enable gateblk
-            buf_vil[7] = MMEN;  // MMEN=1
-
-            buf_vil[8] = CRC5(buf_vil, 8*8);
-
-            cmd_buf[0] = buf_vil[0]<<24 | buf_vil[1]<<16 | buf_vil[2]<<8 | buf_vil[3];
-            cmd_buf[1] = buf_vil[4]<<24 | buf_vil[5]<<16 | buf_vil[6]<<8 | buf_vil[7];
-            cmd_buf[2] = buf_vil[8]<<24;
-
-            // prepare special work for openning core
-            memset(buf_vil_tw, 0x00, TW_WRITE_COMMAND_LEN_VIL/sizeof(unsigned int));
-            memset(&work_vil_1387, 0xff, sizeof(struct vil_work_1387));
-
-            for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
-            {
-                if(dev->chain_exist[i] == 1)
-                {
-                    ret = get_BC_write_command();   //disable null work
-                    ret = BC_COMMAND_EN_CHAIN_ID | (i << 16) | (ret & 0xfff0ffff);
-                    ret &= ~BC_COMMAND_EN_NULL_WORK;
-                    set_BC_write_command(ret);
-                    cgsleep_us(1000);
-
-                    work_vil_1387.work_type = NORMAL_BLOCK_MARKER;
-                    work_vil_1387.chain_id = 0x80 | i;
-                    work_vil_1387.reserved1[0]= 0;
-                    work_vil_1387.reserved1[1]= 0;
-                    work_vil_1387.work_count = 0;
-                    work_vil_1387.data[0] = 0xff;
-                    work_vil_1387.data[11] = 0xff;
-                    set_BC_command_buffer(cmd_buf);
-
-                    ret = get_BC_write_command();
-                    value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (i << 16) | (ret & 0xfff0ffff);
-                    //ret &= ~BC_COMMAND_EN_NULL_WORK;
-                    set_BC_write_command(value);
-                    cgsleep_us(10000);
-
-                    for(m=0; m<loop; m++)
-                    {
-                        wati_count=0;
-                        //applog(LOG_DEBUG,"%s: m = %d\n", __FUNCTION__, m);
-                        do
-                        {
-                            work_fifo_ready = get_buffer_space();
-                            if(work_fifo_ready & (0x1 << i))
-                            {
-                                wati_count=0;
-                                break;
-                            }
-                            else    //work fifo is full, wait for 50ms
-                            {
-                                //applog(LOG_DEBUG,"%s: chain%d work fifo not ready: 0x%x\n", __FUNCTION__, i, work_fifo_ready);
-                                cgsleep_us(1000);
-                                wati_count++;
-
-                                if(wati_count>3000)
-                                {
-                                    sprintf(logstr,"Error: send open core work Failed on Chain[%d]!\n",i);
-                                    writeInitLogFile(logstr);
-
-                                    break;
-                                }
-                            }
-                        }
-                        while(1);
-
-                        if(wati_count>3000) // failed on send open core work
-                            break;
-
-                        if(m==0)    //new block
-                        {
-                            work_vil_1387.work_type = NEW_BLOCK_MARKER;
-                        }
-                        else
-                        {
-                            work_vil_1387.work_type = NORMAL_BLOCK_MARKER;
-                        }
-
-                        work_vil_1387.chain_id = i | 0x80; //set chain id and enable it
-
-
-                        buf_vil_tw[0] = (work_vil_1387.work_type<< 24) | (work_vil_1387.chain_id << 16) | (work_vil_1387.reserved1[0] << 8) | work_vil_1387.reserved1[1];
-                        buf_vil_tw[1] = work_vil_1387.work_count;
-                        for(j=2; j<DATA2_LEN/sizeof(unsigned int)+2; j++)
-                        {
-                            buf_vil_tw[j] = (work_vil_1387.data[4*(j-2) + 0] << 24) | (work_vil_1387.data[4*(j-2) + 1] << 16) | (work_vil_1387.data[4*(j-2) + 2] << 8) | work_vil_1387.data[4*(j-2) + 3];
-                        }
-                        for(j=5; j<MIDSTATE_LEN/sizeof(unsigned int)+5; j++)
-                        {
-                            buf_vil_tw[j] = 0;
-                        }
-
-                        set_TW_write_command_vil(buf_vil_tw);
-                        if(m==loop - 1 && nullwork_enable)
-                        {
-                            ret = get_BC_write_command();   //enable null work
-                            ret |= BC_COMMAND_EN_NULL_WORK;
-                            set_BC_write_command(ret);
-                        }
-                    }
-
-
-                }
-            }
-            set_dhash_acc_control(get_dhash_acc_control()| VIL_MODE | VIL_MIDSTATE_NUMBER(opt_multi_version));
+            open_core_vil(0xffffffff, loop, nullwork_enable);
         }
     }
 
     void open_core_one_chain(int chainIndex, bool nullwork_enable)
     {
-        unsigned int i = 0, j = 0, k, m, work_id = 0, ret = 0, value = 0, work_fifo_ready = 0, loop=0;
+        unsigned int i = 0, j = 0, k, m, work_id = 0, work_fifo_ready = 0, loop=0;
         unsigned char gateblk[4] = {0,0,0,0};
-        unsigned int cmd_buf[3] = {0,0,0}, buf[TW_WRITE_COMMAND_LEN/sizeof(unsigned int)]= {0};
-        unsigned int buf_vil_tw[TW_WRITE_COMMAND_LEN_VIL/sizeof(unsigned int)]= {0};
+        unsigned int buf[TW_WRITE_COMMAND_LEN/sizeof(unsigned int)]= {0};
+        struct bc_cmd cmd;
+        bool gate_ok;
         unsigned char data[TW_WRITE_COMMAND_LEN] = {0xff};
-        unsigned char buf_vil[9] = {0,0,0,0,0,0,0,0,0};
-        struct vil_work work_vil;
-        struct vil_work_1387 work_vil_1387;
-        char logstr[256];
-        int wati_count=0;
 
 #ifdef DEBUG_OPENCORE_TWICE
         loop = BM1387_CORE_NUM-debug_once;
@@ -9140,7 +9453,6 @@ read_temperature_from_sensors(void)
             gateblk[3] = 0x80;  // MMEN=1
             gateblk[3] = 0x80 | (0x1f & CRC5(gateblk, 4*8 - 5));
             applog(LOG_DEBUG,"%s: gateblk[0]=0x%x, gateblk[1]=0x%x, gateblk[2]=0x%x, gateblk[3]=0x%x\n", __FUNCTION__, gateblk[0], gateblk[1], gateblk[2], gateblk[3]);
-            cmd_buf[0] = gateblk[0]<<24 | gateblk[1]<<16 | gateblk[2]<<8 | gateblk[3];
 
             memset(data, 0x00, TW_WRITE_COMMAND_LEN);
             data[TW_WRITE_COMMAND_LEN - 1] = 0xff;
@@ -9151,13 +9463,10 @@ read_temperature_from_sensors(void)
             {
                 if(dev->chain_exist[i] == 1)
                 {
-                    set_BC_command_buffer(cmd_buf);
-                    ret = get_BC_write_command();
-                    value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (i << 16) | (ret & 0xfff0ffff);
-                    set_BC_write_command(value);
-                    cgsleep_us(10000);
+                    bc_cmd_fil(&cmd, i, gateblk);
+                    gate_ok = open_core_gateblk(&cmd, i);
 
-                    for(m=0; m<loop; m++)
+                    for(m=0; gate_ok && m<loop; m++)
                     {
                         do
                         {
@@ -9186,18 +9495,10 @@ read_temperature_from_sensors(void)
                         data[1] = i | 0x80; //set chain id and enable it
 
                         if(m==0)
-                        {
-                            ret = get_BC_write_command();   //disable null work
-                            ret &= ~BC_COMMAND_EN_NULL_WORK;
-                            set_BC_write_command(ret);
-                        }
+                            bc_cmd_set_ctrl(BC_COMMAND_EN_NULL_WORK, 0);    //disable null work
 
-                        if(m==loop - 1 && nullwork_enable)
-                        {
-                            ret = get_BC_write_command();   //enable null work
-                            ret &= (BC_COMMAND_EN_CHAIN_ID | BC_COMMAND_EN_NULL_WORK | ((i & 0xf) << 16));
-                            set_BC_write_command(ret);
-                        }
+                        if(m==loop - 1 && nullwork_enable)  //enable null work
+                            bc_cmd_set_ctrl(~(BC_COMMAND_EN_CHAIN_ID | BC_COMMAND_EN_NULL_WORK | ((i & 0xf) << 16)), 0);
 
                         memset(buf, 0, TW_WRITE_COMMAND_LEN/sizeof(unsigned int));
 
@@ -9219,130 +9520,17 @@ read_temperature_from_sensors(void)
         }
         else    // vil mode
         {
-            set_dhash_acc_control((get_dhash_acc_control() & (~OPERATION_MODE)) | VIL_MODE | VIL_MIDSTATE_NUMBER(opt_multi_version));
-            set_hash_counting_number(0);
-            // prepare gateblk
-            buf_vil[0] = VIL_COMMAND_TYPE | VIL_ALL | SET_CONFIG;
-            buf_vil[1] = 0x09;
-            buf_vil[2] = 0;
-            buf_vil[3] = MISC_CONTROL;
-            buf_vil[4] = 0x40;
-            buf_vil[5] = INV_CLKO;  // enable INV_CLKO
-            buf_vil[6] = (dev->baud & 0x1f) | GATEBCLK; // enable gateblk
-            buf_vil[7] = MMEN;  // MMEN=1
-
-            buf_vil[8] = CRC5(buf_vil, 8*8);
-
-            cmd_buf[0] = buf_vil[0]<<24 | buf_vil[1]<<16 | buf_vil[2]<<8 | buf_vil[3];
-            cmd_buf[1] = buf_vil[4]<<24 | buf_vil[5]<<16 | buf_vil[6]<<8 | buf_vil[7];
-            cmd_buf[2] = buf_vil[8]<<24;
-
-            // prepare special work for openning core
-            memset(buf_vil_tw, 0x00, TW_WRITE_COMMAND_LEN_VIL/sizeof(unsigned int));
-            memset(&work_vil_1387, 0xff, sizeof(struct vil_work_1387));
-
-            i=chainIndex;
-            //for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
-            {
-                if(dev->chain_exist[i] == 1)
-                {
-                    ret = get_BC_write_command();   //disable null work
-                    ret = BC_COMMAND_EN_CHAIN_ID | (i << 16) | (ret & 0xfff0ffff);
-                    ret &= ~BC_COMMAND_EN_NULL_WORK;
-                    set_BC_write_command(ret);
-                    cgsleep_us(1000);
-
-                    work_vil_1387.work_type = NORMAL_BLOCK_MARKER;
-                    work_vil_1387.chain_id = 0x80 | i;
-                    work_vil_1387.reserved1[0]= 0;
-                    work_vil_1387.reserved1[1]= 0;
-                    work_vil_1387.work_count = 0;
-                    work_vil_1387.data[0] = 0xff;
-                    work_vil_1387.data[11] = 0xff;
-                    set_BC_command_buffer(cmd_buf);
-
-                    ret = get_BC_write_command();
-                    value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (i << 16) | (ret & 0xfff0ffff);
-                    //ret &= ~BC_COMMAND_EN_NULL_WORK;
-                    set_BC_write_command(value);
-                    cgsleep_us(10000);
-
-                    for(m=0; m<loop; m++)
-                    {
-                        wati_count=0;
-                        //applog(LOG_DEBUG,"%s: m = %d\n", __FUNCTION__, m);
-                        do
-                        {
-                            work_fifo_ready = get_buffer_space();
-                            if(work_fifo_ready & (0x1 << i))
-                            {
-                                wati_count=0;
-                                break;
-                            }
-                            else    //work fifo is full, wait for 50ms
-                            {
-                                //applog(LOG_DEBUG,"%s: chain%d work fifo not ready: 0x%x\n", __FUNCTION__, i, work_fifo_ready);
-                                cgsleep_us(1000);
-                                wati_count++;
-
-                                if(wati_count>3000)
-                                {
-                                    sprintf(logstr,"Error: send open core work Failed on Chain[%d]!\n",i);
-                                    writeInitLogFile(logstr);
-
-                                    break;
-                                }
-                            }
-                        }
-                        while(1);
-
-                        if(wati_count>3000) // failed on send open core work
-                            break;
-
-                        if(m==0)    //new block
-                        {
-                            work_vil_1387.work_type = NEW_BLOCK_MARKER;
-                        }
-                        else
-                        {
-                            work_vil_1387.work_type = NORMAL_BLOCK_MARKER;
-                        }
-
-                        work_vil_1387.chain_id = i | 0x80; //set chain id and enable it
-
-
-                        buf_vil_tw[0] = (work_vil_1387.work_type<< 24) | (work_vil_1387.chain_id << 16) | (work_vil_1387.reserved1[0] << 8) | work_vil_1387.reserved1[1];
-                        buf_vil_tw[1] = work_vil_1387.work_count;
-                        for(j=2; j<DATA2_LEN/sizeof(unsigned int)+2; j++)
-                        {
-                            buf_vil_tw[j] = (work_vil_1387.data[4*(j-2) + 0] << 24) | (work_vil_1387.data[4*(j-2) + 1] << 16) | (work_vil_1387.data[4*(j-2) + 2] << 8) | work_vil_1387.data[4*(j-2) + 3];
-                        }
-                        for(j=5; j<MIDSTATE_LEN/sizeof(unsigned int)+5; j++)
-                        {
-                            buf_vil_tw[j] = 0;
-                        }
-
-                        set_TW_write_command_vil(buf_vil_tw);
-                        if(m==loop - 1 && nullwork_enable)
-                        {
-                            ret = get_BC_write_command();   //enable null work
-                            ret |= BC_COMMAND_EN_NULL_WORK;
-                            set_BC_write_command(ret);
-                        }
-                    }
-
-
-                }
-            }
-            set_dhash_acc_control(get_dhash_acc_control()| VIL_MODE | VIL_MIDSTATE_NUMBER(opt_multi_version));
+            open_core_vil(0x1 << chainIndex, loop, nullwork_enable);
         }
     }
 
     void open_core_onChain(int chainIndex, int coreNum, int opencore_num, bool nullwork_enable)
     {
-        unsigned int i = 0, j = 0, k, m, work_id = 0, ret = 0, value = 0, work_fifo_ready = 0, loop=0;
+        unsigned int i = 0, j = 0, k, m, work_id = 0, work_fifo_ready = 0, loop=0;
         unsigned char gateblk[4] = {0,0,0,0};
-        unsigned int cmd_buf[3] = {0,0,0}, buf[TW_WRITE_COMMAND_LEN/sizeof(unsigned int)]= {0};
+        unsigned int buf[TW_WRITE_COMMAND_LEN/sizeof(unsigned int)]= {0};
+        struct bc_cmd cmd;
+        bool gate_ok;
         unsigned int buf_vil_tw[TW_WRITE_COMMAND_LEN_VIL/sizeof(unsigned int)]= {0};
         unsigned char data[TW_WRITE_COMMAND_LEN] = {0xff};
         unsigned char buf_vil[9] = {0,0,0,0,0,0,0,0,0};
@@ -9365,7 +9553,6 @@ read_temperature_from_sensors(void)
             gateblk[3] = 0x80;  // MMEN=1
             gateblk[3] = 0x80 | (0x1f & CRC5(gateblk, 4*8 - 5));
             applog(LOG_DEBUG,"%s: gateblk[0]=0x%x, gateblk[1]=0x%x, gateblk[2]=0x%x, gateblk[3]=0x%x\n", __FUNCTION__, gateblk[0], gateblk[1], gateblk[2], gateblk[3]);
-            cmd_buf[0] = gateblk[0]<<24 | gateblk[1]<<16 | gateblk[2]<<8 | gateblk[3];
 
             memset(data, 0x00, TW_WRITE_COMMAND_LEN);
             data[TW_WRITE_COMMAND_LEN - 1] = 0xff;
@@ -9376,13 +9563,10 @@ read_temperature_from_sensors(void)
             {
                 if(dev->chain_exist[i] == 1)
                 {
-                    set_BC_command_buffer(cmd_buf);
-                    ret = get_BC_write_command();
-                    value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (i << 16) | (ret & 0xfff0ffff);
-                    set_BC_write_command(value);
-                    cgsleep_us(10000);
+                    bc_cmd_fil(&cmd, i, gateblk);
+                    gate_ok = open_core_gateblk(&cmd, i);
 
-                    for(m=0; m<loop; m++)
+                    for(m=0; gate_ok && m<loop; m++)
                     {
                         do
                         {
@@ -9411,18 +9595,10 @@ read_temperature_from_sensors(void)
                         data[1] = i | 0x80; //set chain id and enable it
 
                         if(m==0)
-                        {
-                            ret = get_BC_write_command();   //disable null work
-                            ret &= ~BC_COMMAND_EN_NULL_WORK;
-                            set_BC_write_command(ret);
-                        }
+                            bc_cmd_set_ctrl(BC_COMMAND_EN_NULL_WORK, 0);    //disable null work
 
-                        if(m==loop - 1 && nullwork_enable)
-                        {
-                            ret = get_BC_write_command();   //enable null work
-                            ret &= (BC_COMMAND_EN_CHAIN_ID | BC_COMMAND_EN_NULL_WORK | ((i & 0xf) << 16));
-                            set_BC_write_command(ret);
-                        }
+                        if(m==loop - 1 && nullwork_enable)  //enable null work
+                            bc_cmd_set_ctrl(~(BC_COMMAND_EN_CHAIN_ID | BC_COMMAND_EN_NULL_WORK | ((i & 0xf) << 16)), 0);
 
                         memset(buf, 0, TW_WRITE_COMMAND_LEN/sizeof(unsigned int));
 
@@ -9458,10 +9634,6 @@ read_temperature_from_sensors(void)
 
             buf_vil[8] = CRC5(buf_vil, 8*8);
 
-            cmd_buf[0] = buf_vil[0]<<24 | buf_vil[1]<<16 | buf_vil[2]<<8 | buf_vil[3];
-            cmd_buf[1] = buf_vil[4]<<24 | buf_vil[5]<<16 | buf_vil[6]<<8 | buf_vil[7];
-            cmd_buf[2] = buf_vil[8]<<24;
-
             // prepare special work for openning core
             memset(buf_vil_tw, 0x00, TW_WRITE_COMMAND_LEN_VIL/sizeof(unsigned int));
             memset(&work_vil_1387, 0xff, sizeof(struct vil_work_1387));
@@ -9471,10 +9643,8 @@ read_temperature_from_sensors(void)
             {
                 if(dev->chain_exist[i] == 1)
                 {
-                    ret = get_BC_write_command();   //disable null work
-                    ret = BC_COMMAND_EN_CHAIN_ID | (i << 16) | (ret & 0xfff0ffff);
-                    ret &= ~BC_COMMAND_EN_NULL_WORK;
-                    set_BC_write_command(ret);
+                    //disable null work
+                    bc_cmd_set_ctrl(0x000f0000 | BC_COMMAND_EN_CHAIN_ID | BC_COMMAND_EN_NULL_WORK, BC_COMMAND_EN_CHAIN_ID | (i << 16));
                     cgsleep_us(1000);
 
                     work_vil_1387.work_type = NORMAL_BLOCK_MARKER;
@@ -9484,15 +9654,10 @@ read_temperature_from_sensors(void)
                     work_vil_1387.work_count = 0;
                     work_vil_1387.data[0] = 0xff;
                     work_vil_1387.data[11] = 0xff;
-                    set_BC_command_buffer(cmd_buf);
-
-                    ret = get_BC_write_command();
-                    value = BC_COMMAND_BUFFER_READY | BC_COMMAND_EN_CHAIN_ID | (i << 16) | (ret & 0xfff0ffff);
-                    //ret &= ~BC_COMMAND_EN_NULL_WORK;
-                    set_BC_write_command(value);
-                    cgsleep_us(10000);
+                    bc_cmd_vil(&cmd, i, buf_vil, 9);
+                    gate_ok = open_core_gateblk(&cmd, i);
 
-                    for(m=0; m<loop; m++)
+                    for(m=0; gate_ok && m<loop; m++)
                     {
                         if(m>=opencore_num)
                         {
@@ -9560,11 +9725,7 @@ read_temperature_from_sensors(void)
 
                         set_TW_write_command_vil(buf_vil_tw);
                         if(m==loop - 1 && nullwork_enable)
-                        {
-                            ret = get_BC_write_command();   //enable null work
-                            ret |= BC_COMMAND_EN_NULL_WORK;
-                            set_BC_write_command(ret);
-                        }
+                            bc_cmd_set_ctrl(BC_COMMAND_EN_NULL_WORK, BC_COMMAND_EN_NULL_WORK);  //enable null work
                     }
 
 
@@ -9592,7 +9753,7 @@ read_temperature_from_sensors(void)
         int i,j;
         int each_asic_freq;
         int freq_test=PRE_OPENCORE_FREQ;    //300M
-        int freq_value=atoi(freq_pll_1385[freq_test].freq);
+        int freq_value=freq_pll_1385[freq_test].freq;
 
         for(j=0; j<2; j++)
         {
@@ -9705,7 +9866,7 @@ read_temperature_from_sensors(void)
             if(nonce_number)
             {
                 read_loop = nonce_number;
-                applog(LOG_DEBUG,"%s: read_loop = %d\n", __FUNCTION__, read_loop);
+                applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: read_loop = %d\n", __FUNCTION__, read_loop);
 
                 for(j=0; j<read_loop; j++)
                 {
@@ -9734,20 +9895,23 @@ read_temperature_from_sensors(void)
                                     nonce_read_out.nonce_buffer[nonce_read_out.p_wr].midstate[m]  = *((unsigned char *)data_addr + MIDSTATE_OFFSET + m);
                                 }
 #ifdef DEBUG_LOG
-                                applog(LOG_DEBUG,"%s: buf[0] = 0x%x\n", __FUNCTION__, buf[0]);
-                                applog(LOG_DEBUG,"%s: work_id = 0x%x\n", __FUNCTION__, work_id);
-                                applog(LOG_DEBUG,"%s: nonce2_jobid_address = 0x%x\n", __FUNCTION__, nonce2_jobid_address);
-                                applog(LOG_DEBUG,"%s: data_addr = 0x%x\n", __FUNCTION__, data_addr);
-                                applog(LOG_DEBUG,"%s: nonce3 = 0x%x\n", __FUNCTION__, nonce_read_out.nonce_buffer[nonce_read_out.p_wr].nonce3);
-                                applog(LOG_DEBUG,"%s: job_id = 0x%x\n", __FUNCTION__, nonce_read_out.nonce_buffer[nonce_read_out.p_wr].job_id);
-                                applog(LOG_DEBUG,"%s: header_version = 0x%x\n", __FUNCTION__, nonce_read_out.nonce_buffer[nonce_read_out.p_wr].header_version);
-                                applog(LOG_DEBUG,"%s: nonce2 = 0x%x\n", __FUNCTION__, nonce_read_out.nonce_buffer[nonce_read_out.p_wr].nonce2);
-
-                                buf_hex = bin2hex(nonce_read_out.nonce_buffer[nonce_read_out.p_wr].midstate,32);
+                                applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: buf[0] = 0x%x\n", __FUNCTION__, buf[0]);
+                                applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: work_id = 0x%x\n", __FUNCTION__, work_id);
+                                applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: nonce2_jobid_address = 0x%x\n", __FUNCTION__, nonce2_jobid_address);
+                                applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: data_addr = 0x%x\n", __FUNCTION__, data_addr);
+                                applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: nonce3 = 0x%x\n", __FUNCTION__, nonce_read_out.nonce_buffer[nonce_read_out.p_wr].nonce3);
+                                applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: job_id = 0x%x\n", __FUNCTION__, nonce_read_out.nonce_buffer[nonce_read_out.p_wr].job_id);
+                                applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: header_version = 0x%x\n", __FUNCTION__, nonce_read_out.nonce_buffer[nonce_read_out.p_wr].header_version);
+                                applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: nonce2 = 0x%x\n", __FUNCTION__, nonce_read_out.nonce_buffer[nonce_read_out.p_wr].nonce2);
+
+                                if(applog_enabled(LOGS_NONCE, LOG_DEBUG))
+                                {
+                                    buf_hex = bin2hex(nonce_read_out.nonce_buffer[nonce_read_out.p_wr].midstate,32);
 
-                                applog(LOG_DEBUG,"%s: midstate: %s\n", __FUNCTION__, buf_hex);
+                                    applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: midstate: %s\n", __FUNCTION__, buf_hex);
 
-                                free(buf_hex);
+                                    free(buf_hex);
+                                }
 #endif
                                 nonce_read_out.p_wr++;
                                 if (nonce_read_out.p_wr >= MAX_NONCE_NUMBER_IN_FIFO)
@@ -10371,6 +10535,7 @@ read_temperature_from_sensors(void)
             fclose(fd);
         }
 
+        logwriter_flush();
         system("cp /tmp/search /tmp/err1.log -f");
         system("cp /tmp/freq /tmp/err2.log -f");
         system("cp /tmp/lasttemp /tmp/err3.log -f");
@@ -10403,6 +10568,440 @@ void bitmain_reconfigure_fans(void)
 	mutex_unlock(&fancontrol_lock);
 }
 
+    /* bring-up phase timing, written to /tmp/freq and shown in API stats */
+#define INIT_PHASE_MAX  16
+
+    struct init_phase
+    {
+        const char *name;
+        int ms;
+    };
+
+    static struct init_phase init_phases[INIT_PHASE_MAX];
+    static int init_phase_num = 0;
+    static struct timeval init_phase_tv;
+    static struct timeval init_start_tv;
+
+    static void init_phase_reset(void)
+    {
+        init_phase_num = 0;
+        cgtime(&init_start_tv);
+        init_phase_tv = init_start_tv;
+    }
+
+    /* close the phase that started at the previous mark */
+    static void init_phase_done(const char *name)
+    {
+        struct timeval now;
+        char logstr[256];
+        int ms;
+
+        cgtime(&now);
+        ms = ms_tdiff(&now, &init_phase_tv);
+        init_phase_tv = now;
+
+        if(init_phase_num < INIT_PHASE_MAX)
+        {
+            init_phases[init_phase_num].name = name;
+            init_phases[init_phase_num].ms = ms;
+            init_phase_num++;
+        }
+
+        sprintf(logstr,"init phase %s: %d ms (total %d ms)\n", name, ms, ms_tdiff(&now, &init_start_tv));
+        writeInitLogFile(logstr);
+    }
+
+    /*
+     * wait until FPGA releases hash board reset. It should within
+     * timeout_ms; if not, that is logged and the wait goes on as it always
+     * did, bring-up can not continue with the boards still in reset.
+     */
+    static void wait_hashboard_reset_done(int timeout_ms)
+    {
+        char logstr[256];
+        bool late = false;
+        int waited = 0;
+
+        while(get_QN_write_data_command() & RESET_HASH_BOARD)
+        {
+            if(!late && waited >= timeout_ms)
+            {
+                late = true;
+                sprintf(logstr,"hash board reset still pending after %d ms, waiting on\n", waited);
+                writeInitLogFile(logstr);
+                applog(LOG_WARNING, "%s: hash board reset still pending after %d ms", __FUNCTION__, waited);
+            }
+            cgsleep_ms(late ? 30 : 10);
+            waited += late ? 30 : 10;
+        }
+
+        if(late)
+        {
+            sprintf(logstr,"hash board reset done after %d ms\n", waited);
+            writeInitLogFile(logstr);
+        }
+    }
+
+#ifndef T9_18   // T9+ reads its tables from the AT24C02, not from PIC flash
+    /*
+     * PIC table record: the frequency table of each board is kept on the
+     * controller with its hash board ID. The tables are always read from
+     * flash in full (a batched read takes 10-20 ms per chain), the record
+     * only tells from the board ID and the table whether a board was
+     * swapped or retested in place since the last start.
+     */
+#define PIC_CACHE_FILE      "/etc/bmminer/pic_cache"
+#define PIC_CACHE_MAGIC     0x50494303
+
+    struct pic_cache_chain
+    {
+        unsigned char valid;
+        unsigned char board_id[12];
+        unsigned char freq[128];    // last_freq layout
+    };
+
+    struct pic_cache
+    {
+        unsigned int magic;
+        struct pic_cache_chain chain[BITMAIN_MAX_CHAIN_NUM];
+        uint16_t crc;
+    };
+
+    static struct pic_cache pic_cache;
+    static bool pic_cache_dirty = false;
+
+    static void pic_cache_load(void)
+    {
+        FILE *fd;
+        int len;
+
+        memset(&pic_cache, 0, sizeof(struct pic_cache));
+        if(!opt_pic_cache)
+            return;
+
+        fd = fopen(PIC_CACHE_FILE, "rb");
+        if(!fd)
+            return;
+        len = fread(&pic_cache, 1, sizeof(struct pic_cache), fd);
+        fclose(fd);
+
+        if(len != sizeof(struct pic_cache) || pic_cache.magic != PIC_CACHE_MAGIC ||
+           pic_cache.crc != CRC16((uint8_t *)&pic_cache, offsetof(struct pic_cache, crc)))
+        {
+            writeInitLogFile("PIC cache: " PIC_CACHE_FILE " is not valid, ignored\n");
+            memset(&pic_cache, 0, sizeof(struct pic_cache));
+        }
+    }
+
+    static void pic_cache_save(void)
+    {
+        FILE *fd;
+        int len;
+
+        if(!opt_pic_cache || !pic_cache_dirty)
+            return;
+
+        pic_cache.magic = PIC_CACHE_MAGIC;
+        pic_cache.crc = CRC16((uint8_t *)&pic_cache, offsetof(struct pic_cache, crc));
+
+        fd = fopen(PIC_CACHE_FILE ".tmp", "wb");
+        if(!fd)
+            return;
+        len = fwrite(&pic_cache, 1, sizeof(struct pic_cache), fd);
+        fclose(fd);
+        if(len == sizeof(struct pic_cache))
+            rename(PIC_CACHE_FILE ".tmp", PIC_CACHE_FILE);
+        else
+            unlink(PIC_CACHE_FILE ".tmp");
+        pic_cache_dirty = false;
+    }
+
+    /* fill last_freq and badcore_num_buf of the chain, its PIC in loader mode */
+    static void pic_read_tables(int chain)
+    {
+        read_pic_flash(chain, PIC_FLASH_POINTER_FREQ_START_ADDRESS_H, PIC_FLASH_POINTER_FREQ_START_ADDRESS_L, last_freq[chain], 128);
+        read_pic_flash(chain, PIC_FLASH_POINTER_BADCORE_START_ADDRESS_H, PIC_FLASH_POINTER_BADCORE_START_ADDRESS_L, badcore_num_buf[chain], 64);
+        invalidate_chain_freq_stats(chain);
+    }
+
+    /*
+     * With the PIC in app mode: compare board ID and tables with the record
+     * of the last start and log what changed. Boards without an ID cannot
+     * be told from the next one and are not recorded.
+     */
+    static void pic_cache_record(int chain)
+    {
+        struct pic_cache_chain *c = &pic_cache.chain[chain];
+        unsigned char id[12], blank_0[12], blank_ff[12];
+        char logstr[256];
+
+        if(!opt_pic_cache)
+            return;
+
+        get_hash_board_id_number(chain, id);
+
+        memset(blank_0, 0, 12);
+        memset(blank_ff, 0xff, 12);
+        if(memcmp(id, blank_0, 12) == 0 || memcmp(id, blank_ff, 12) == 0)
+        {
+            if(c->valid)
+            {
+                c->valid = 0;
+                pic_cache_dirty = true;
+            }
+            return;
+        }
+
+        if(c->valid && memcmp(id, c->board_id, 12) == 0 && memcmp(c->freq, last_freq[chain], 128) == 0)
+            return;
+
+        if(!c->valid)
+            sprintf(logstr,"Chain[J%d] PIC record: new board\n",chain+1);
+        else if(memcmp(id, c->board_id, 12) != 0)
+            sprintf(logstr,"Chain[J%d] PIC record: board replaced since the last start\n",chain+1);
+        else
+            sprintf(logstr,"Chain[J%d] PIC record: frequency table changed since the last start\n",chain+1);
+        writeInitLogFile(logstr);
+
+        memcpy(c->board_id, id, 12);
+        memcpy(c->freq, last_freq[chain], 128);
+        c->valid = 1;
+        pic_cache_dirty = true;
+    }
+#endif
+
+    /* warm restart: chip state left by the previous run is reused when it still matches the hardware */
+#define WARM_STATE_FILE     "/tmp/bmminer_warm_state"   // tmpfs, so it never survives a reboot
+#define WARM_STATE_MAGIC    0x57524d02
+
+    struct warm_chain_state
+    {
+        unsigned char exist;
+        unsigned char asic_num;
+        unsigned char voltage_pic;
+        unsigned char base_freq_index;
+        unsigned char pic_temp_offset;
+        int voltage_value;
+        int lowest_testOK_temp;
+        int core_num;
+        unsigned char freq[256];    // last_freq layout
+        unsigned char flash_freq[256];  // the same before autotune
+        unsigned char badcore[CHAIN_ASIC_NUM];
+    };
+
+    struct warm_state
+    {
+        unsigned int magic;
+        int fpga_version;
+        int pcb_version;
+        unsigned char addrInterval;
+        unsigned char check_bit;
+        unsigned char baud;
+        unsigned short int frequency;
+        struct warm_chain_state chain[BITMAIN_MAX_CHAIN_NUM];
+        uint16_t crc;
+    };
+
+    static bool warm_state_valid = false;   // set once init completed, so shutdown may save
+
+    static void warm_state_save(void)
+    {
+#ifndef T9_18   // T9+ keeps its frequencies in chain_pic_buf, warm restart is not supported there
+        struct warm_state *ws;
+        FILE *fd;
+        int i, j;
+
+        if(!opt_warm_restart || !warm_state_valid)
+            return;
+
+        ws = calloc(1, sizeof(struct warm_state));
+        if(!ws)
+            return;
+
+        ws->magic = WARM_STATE_MAGIC;
+        ws->fpga_version = fpga_version;
+        ws->pcb_version = pcb_version;
+        ws->addrInterval = dev->addrInterval;
+        ws->check_bit = dev->check_bit;
+        ws->baud = dev->baud;
+        ws->frequency = dev->frequency;
+
+        for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            struct warm_chain_state *cs = &ws->chain[i];
+
+            if(dev->chain_exist[i] != 1)
+                continue;
+
+            cs->exist = 1;
+            cs->asic_num = dev->chain_asic_num[i];
+            cs->voltage_pic = chain_voltage_pic[i];
+            cs->base_freq_index = base_freq_index[i];
+            cs->pic_temp_offset = pic_temp_offset[i];
+            cs->voltage_value = chain_voltage_value[i];
+            cs->lowest_testOK_temp = lowest_testOK_temp[i];
+            cs->core_num = chain_core_num[i];
+            memcpy(cs->freq, chip_last_freq[i], 256);
+            memcpy(cs->flash_freq, chip_flash_freq[i], 256);
+            for(j=0; j < CHAIN_ASIC_NUM; j++)
+                cs->badcore[j] = chain_badcore_num[i][j];
+        }
+
+        ws->crc = CRC16((uint8_t *)ws, offsetof(struct warm_state, crc));
+
+        fd = fopen(WARM_STATE_FILE, "wb");
+        if(fd)
+        {
+            fwrite(ws, 1, sizeof(struct warm_state), fd);
+            fclose(fd);
+        }
+        free(ws);
+#endif
+    }
+
+    static bool warm_state_load(struct warm_state *ws)
+    {
+#ifdef T9_18
+        return false;
+#else
+        FILE *fd;
+        int len;
+
+        if(!opt_warm_restart)
+            return false;
+
+        fd = fopen(WARM_STATE_FILE, "rb");
+        if(!fd)
+            return false;
+        len = fread(ws, 1, sizeof(struct warm_state), fd);
+        fclose(fd);
+
+        // the chips are about to be touched, a stale file must never be trusted again
+        unlink(WARM_STATE_FILE);
+
+        if(len != sizeof(struct warm_state) || ws->magic != WARM_STATE_MAGIC)
+            return false;
+        if(ws->crc != CRC16((uint8_t *)ws, offsetof(struct warm_state, crc)))
+            return false;
+        return true;
+#endif
+    }
+
+    /* one pass over FPGA, PICs and ASIC address registers, nothing is reset or rewritten */
+    static bool warm_state_verify(struct warm_state *ws)
+    {
+        int hardware_version;
+        char logstr[256];
+        int i;
+
+        hardware_version = get_hardware_version();
+        if(ws->fpga_version != (hardware_version & 0x000000ff) || ws->pcb_version != ((hardware_version >> 16) & 0x00007fff))
+        {
+            writeInitLogFile("warm restart: FPGA/PCB version changed\n");
+            return false;
+        }
+
+        if((get_BC_write_command() & 0x1f) != ws->baud)
+        {
+            writeInitLogFile("warm restart: FPGA baud was reset\n");
+            return false;
+        }
+
+        check_chain();
+        for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(dev->chain_exist[i] != ws->chain[i].exist)
+            {
+                sprintf(logstr,"warm restart: Chain[J%d] presence changed\n",i+1);
+                writeInitLogFile(logstr);
+                return false;
+            }
+        }
+
+        for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            unsigned char vol_pic;
+
+            if(dev->chain_exist[i] != 1)
+                continue;
+
+            pthread_mutex_lock(&iic_mutex);
+            vol_pic = get_pic_voltage(i);
+            pthread_mutex_unlock(&iic_mutex);
+
+            if(vol_pic != ws->chain[i].voltage_pic)
+            {
+                sprintf(logstr,"warm restart: Chain[J%d] PIC voltage %d, expected %d\n",i+1,vol_pic,ws->chain[i].voltage_pic);
+                writeInitLogFile(logstr);
+                return false;
+            }
+        }
+
+        // chips answer at the saved baud only if they kept their state since the last run
+        enumerate_asics(NULL);
+        for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(dev->chain_exist[i] == 1 && dev->chain_asic_num[i] != ws->chain[i].asic_num)
+            {
+                sprintf(logstr,"warm restart: Chain[J%d] has %d asic, expected %d\n",i+1,dev->chain_asic_num[i],ws->chain[i].asic_num);
+                writeInitLogFile(logstr);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void warm_state_restore(struct warm_state *ws)
+    {
+        const unsigned char *plan[BITMAIN_MAX_CHAIN_NUM] = {NULL};
+        unsigned char plan_index[BITMAIN_MAX_CHAIN_NUM][CHAIN_ASIC_NUM];
+        char logstr[256];
+        int i, j;
+
+        dev->addrInterval = ws->addrInterval;
+        dev->check_bit = ws->check_bit;
+        dev->baud = ws->baud;
+        dev->frequency = ws->frequency;
+        dev->corenum = BM1387_CORE_NUM;
+        sprintf(dev->frequency_t,"%u",dev->frequency);
+
+        for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            struct warm_chain_state *cs = &ws->chain[i];
+            int avg_freq;
+
+            if(dev->chain_exist[i] != 1)
+                continue;
+
+            chain_voltage_pic[i] = cs->voltage_pic;
+            chain_voltage_value[i] = cs->voltage_value;
+            lowest_testOK_temp[i] = cs->lowest_testOK_temp;
+            pic_temp_offset[i] = cs->pic_temp_offset;
+            base_freq_index[i] = cs->base_freq_index;
+            chain_core_num[i] = cs->core_num;
+            memcpy(last_freq[i], cs->freq, 256);
+            memcpy(chip_last_freq[i], cs->freq, 256);
+            memcpy(chip_flash_freq[i], cs->flash_freq, 256);
+            memcpy(show_last_freq[i], cs->freq, 256);
+            for(j=0; j < CHAIN_ASIC_NUM; j++)
+                chain_badcore_num[i][j] = cs->badcore[j];
+            invalidate_chain_freq_stats(i);
+
+            // the PLL write is cheap, resend it in case a runtime change was not saved
+            for(j=0; j < CHAIN_ASIC_NUM; j++)
+                plan_index[i][j] = last_freq[i][j*2+3];
+            plan[i] = plan_index[i];
+
+            avg_freq = calc_avg_freq(i);
+            chain_frequency_desc[i] = make_freq_desc(avg_freq, "warm restart", 0, avg_freq);
+
+            sprintf(logstr,"Chain[J%d] warm restart: %d asic, voltage=%d [%d], avg freq=%d\n",i+1,dev->chain_asic_num[i],getVolValueFromPICvoltage(chain_voltage_pic[i]),chain_voltage_pic[i],avg_freq);
+            writeInitLogFile(logstr);
+        }
+        if(set_frequency_plan(plan, true) < 0)
+            writeInitLogFile("warm restart: PLL resend failed, chips keep the clocks of the last run\n");
+    }
+
     int bitmain_c5_init(struct init_config config)
     {
         char ret=0,j;
@@ -10410,11 +11009,15 @@ void bitmain_reconfigure_fans(void)
         bool test_result;
         int i=0,x = 0,y = 0;
         int hardware_version;
-        unsigned int data = 0;
         bool testRet;
         int testCounter=0;
         struct sysinfo si;
         char logstr[256];
+        struct warm_state warm_state;
+        bool warm;
+#ifndef T9_18
+        struct timeval pic_start, pic_end;
+#endif
 
 #ifdef DISABLE_FINAL_TEST   // if disable test mode, we need set two value and save into files on flash
         saveRestartNum(2);
@@ -10422,6 +11025,7 @@ void bitmain_reconfigure_fans(void)
 #endif
 
         clearInitLogFile();
+        init_phase_reset();
 
         isC5_CtrlBoard=isC5_Board();
 
@@ -10526,30 +11130,37 @@ void bitmain_reconfigure_fans(void)
         //init axi
         bitmain_axi_init();
 
+        warm = warm_state_load(&warm_state) && warm_state_verify(&warm_state);
+        sprintf(logstr,"%s start\n", warm ? "warm" : "cold");
+        writeInitLogFile(logstr);
+
 #ifdef USE_NEW_RESET_FPGA
-        set_reset_allhashboard(1);
-        sleep(RESET_KEEP_TIME);
-        set_reset_allhashboard(0);
-        sleep(1);
-        set_reset_allhashboard(1);
+        if(!warm)
+        {
+            set_reset_allhashboard(1);
+            sleep(RESET_KEEP_TIME);
+            set_reset_allhashboard(0);
+            sleep(1);
+            set_reset_allhashboard(1);
+        }
 #endif
 
         //reset FPGA & HASH board
-        if(config_parameter.reset)
+        if(config_parameter.reset && !warm)
         {
             set_QN_write_data_command(RESET_HASH_BOARD | RESET_ALL | RESET_FPGA | RESET_TIME(RESET_HASHBOARD_TIME));
 #ifdef USE_NEW_RESET_FPGA
             sleep(2);
 #else
-            while(get_QN_write_data_command() & RESET_HASH_BOARD)
-            {
-                cgsleep_ms(30);
-            }
+            wait_hashboard_reset_done(5000);
             cgsleep_ms(500);
 #endif
         }
+        init_phase_done("reset");
+
         set_PWM(MAX_PWM_PERCENT);
 	wait_for_fans();
+        init_phase_done("fans");
 
 #ifdef T9_18
 	// config fpga into T9+ mode
@@ -10566,17 +11177,34 @@ void bitmain_reconfigure_fans(void)
         fpga_version = hardware_version & 0x000000ff;
         sprintf(g_miner_version, "%d.%d.%d.%d", fpga_version, pcb_version, C5_VERSION, BMMINER_VERSION);
 
+        set_nonce2_and_job_id_store_address(PHY_MEM_NONCE2_JOBID_ADDRESS);
+        set_job_start_address(PHY_MEM_JOB_START_ADDRESS_1);
+
+        if(warm)
+        {
+            // chips kept addresses, PLLs, baud and open cores: skip PIC reset, voltage, addressing and open core
+            warm_state_restore(&warm_state);
+
+            pic_heart_beat = calloc(1,sizeof(struct thr_info));
+            if(thr_info_create(pic_heart_beat, NULL, pic_heart_beat_func, pic_heart_beat))
+            {
+                applog(LOG_DEBUG,"%s: create thread error for pic_heart_beat_func\n", __FUNCTION__);
+                return -6;
+            }
+            pthread_detach(pic_heart_beat->pth);
+            init_phase_done("warm_restore");
+            goto warm_restored;
+        }
+
 #ifdef USE_NEW_RESET_FPGA
         set_reset_allhashboard(1);
 #endif
 
         dev->baud=DEFAULT_BAUD_VALUE;   // need set default value as init value
 
-        set_nonce2_and_job_id_store_address(PHY_MEM_NONCE2_JOBID_ADDRESS);
-        set_job_start_address(PHY_MEM_JOB_START_ADDRESS_1);
-
         //check chain
         check_chain();
+        init_phase_done("check_chain");
 
 #ifdef T9_18
         for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
@@ -10672,32 +11300,41 @@ void bitmain_reconfigure_fans(void)
             }
         }
 #else
+        pic_cache_load();
+
+        // reset all PICs at once, so they boot into loader concurrently
+        pthread_mutex_lock(&iic_mutex);
+        for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(dev->chain_exist[i] == 1)
+                reset_iic_pic(i);
+        }
+        pthread_mutex_unlock(&iic_mutex);
+        cgsleep_ms(500);
+
         for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
         {
             if(dev->chain_exist[i] == 1)
             {
                 pthread_mutex_lock(&iic_mutex);
-                reset_iic_pic(i);
-                cgsleep_ms(500);
+                cgtime(&pic_start);
 
                 if(!isFixedFreqMode())
                 {
-                    set_pic_iic_flash_addr_pointer(i, PIC_FLASH_POINTER_FREQ_START_ADDRESS_H, PIC_FLASH_POINTER_FREQ_START_ADDRESS_L);
-                    get_data_from_pic_flash(i, last_freq[i]);
-                    get_data_from_pic_flash(i, last_freq[i]+16);
-                    get_data_from_pic_flash(i, last_freq[i]+32);
-                    get_data_from_pic_flash(i, last_freq[i]+48);
-                    get_data_from_pic_flash(i, last_freq[i]+64);
-                    get_data_from_pic_flash(i, last_freq[i]+80);
-                    get_data_from_pic_flash(i, last_freq[i]+96);
-                    get_data_from_pic_flash(i, last_freq[i]+112);
-
-                    set_pic_iic_flash_addr_pointer(i, PIC_FLASH_POINTER_BADCORE_START_ADDRESS_H, PIC_FLASH_POINTER_BADCORE_START_ADDRESS_L);
-                    get_data_from_pic_flash(i, badcore_num_buf[i]);
-                    get_data_from_pic_flash(i, badcore_num_buf[i]+16);
-                    get_data_from_pic_flash(i, badcore_num_buf[i]+32);
-                    get_data_from_pic_flash(i, badcore_num_buf[i]+48);
+                    pic_read_tables(i);
+
+                    cgtime(&pic_end);
+                    sprintf(logstr,"Chain[J%d] PIC flash read: %d ms\n",i+1,ms_tdiff(&pic_end, &pic_start));
+                    writeInitLogFile(logstr);
+                }
+
+                jump_to_app_CheckAndRestorePIC(i);
 
+                if(!isFixedFreqMode())
+                    pic_cache_record(i);
+
+                if(!isFixedFreqMode())
+                {
                     if(last_freq[i][1] == FREQ_MAGIC && last_freq[i][40] == 0x23)   //0x23 is backup voltage magic number
                     {
                         chain_voltage_value[i]=(((last_freq[i][36]&0x0f)<<4)+(last_freq[i][38]&0x0f))*10;
@@ -10720,12 +11357,16 @@ void bitmain_reconfigure_fans(void)
                     }
                 }
 
-                jump_to_app_CheckAndRestorePIC(i);
-
+                cgtime(&pic_end);
                 pthread_mutex_unlock(&iic_mutex);
+
+                sprintf(logstr,"Chain[J%d] PIC done: %d ms\n",i+1,ms_tdiff(&pic_end, &pic_start));
+                writeInitLogFile(logstr);
             }
         }
+        pic_cache_save();
 #endif
+        init_phase_done("pic");
 
         pic_heart_beat = calloc(1,sizeof(struct thr_info));
         if(thr_info_create(pic_heart_beat, NULL, pic_heart_beat_func, pic_heart_beat))
@@ -10865,12 +11506,10 @@ void bitmain_reconfigure_fans(void)
         sleep(1);
 #else
         set_QN_write_data_command(RESET_HASH_BOARD | RESET_ALL | RESET_TIME(RESET_HASHBOARD_TIME));
-        while(get_QN_write_data_command() & RESET_HASH_BOARD)
-        {
-            cgsleep_ms(30);
-        }
+        wait_hashboard_reset_done(5000);
         cgsleep_ms(1000);
 #endif
+        init_phase_done("voltage");
 
         if(opt_multi_version)
             set_dhash_acc_control((get_dhash_acc_control() & (~OPERATION_MODE) & (~ VIL_MIDSTATE_NUMBER(0xf))) | VIL_MIDSTATE_NUMBER(1) | (VIL_MODE  & (~NEW_BLOCK) & (~RUN_BIT)));
@@ -10911,50 +11550,93 @@ void bitmain_reconfigure_fans(void)
         }
 #else
         //check ASIC number for every chain
-        check_asic_reg(CHIP_ADDRESS);
-        cgsleep_ms(10);
+        enumerate_asics(NULL);
 
         for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
         {
             if(dev->chain_exist[i] == 1)
             {
-                int retry_count=0;
                 sprintf(logstr,"Chain[J%d] has %d asic\n",i+1,dev->chain_asic_num[i]);
                 writeInitLogFile(logstr);
+            }
+        }
 
 #ifndef T9_18
-                while(dev->chain_asic_num[i] != CHAIN_ASIC_NUM && retry_count<6)
+        // power cycle all incomplete chains together, so they share the settle time
+        for(int retry_count=0; retry_count<6; retry_count++)
+        {
+            bool retry_chain[BITMAIN_MAX_CHAIN_NUM] = {false};
+            bool need_retry = false;
+
+            for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+            {
+                if(dev->chain_exist[i] == 1 && dev->chain_asic_num[i] != CHAIN_ASIC_NUM)
                 {
-                    dev->chain_asic_num[i]=0;
+                    retry_chain[i] = true;
+                    need_retry = true;
+                }
+            }
+            if(!need_retry)
+                break;
+
+            for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+            {
+                if(!retry_chain[i])
+                    continue;
+
+                dev->chain_asic_num[i]=0;
 
 #ifdef USE_NEW_RESET_FPGA
-                    set_reset_hashboard(i,1);
+                set_reset_hashboard(i,1);
 #endif
-                    pthread_mutex_lock(&iic_mutex);
-                    disable_pic_dac(i);
-                    pthread_mutex_unlock(&iic_mutex);
-                    sleep(1);
+                pthread_mutex_lock(&iic_mutex);
+                disable_pic_dac(i);
+                pthread_mutex_unlock(&iic_mutex);
+            }
+            sleep(1);
 
-                    pthread_mutex_lock(&iic_mutex);
-                    enable_pic_dac(i);
-                    pthread_mutex_unlock(&iic_mutex);
-                    sleep(2);
+            for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+            {
+                if(!retry_chain[i])
+                    continue;
+
+                pthread_mutex_lock(&iic_mutex);
+                enable_pic_dac(i);
+                pthread_mutex_unlock(&iic_mutex);
+            }
+            sleep(2);
+
+            for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+            {
+                if(!retry_chain[i])
+                    continue;
 
 #ifdef USE_NEW_RESET_FPGA
-                    set_reset_hashboard(i,0);
-                    sleep(1);
+                set_reset_hashboard(i,0);
 #else
-                    reset_one_hashboard(i);
+                reset_one_hashboard(i);
+#endif
+            }
+#ifdef USE_NEW_RESET_FPGA
+            sleep(1);
 #endif
 
-                    check_asic_reg_oneChain(i,CHIP_ADDRESS);
-
-                    sprintf(logstr,"retry Chain[J%d] has %d asic\n",i+1,dev->chain_asic_num[i]);
-                    writeInitLogFile(logstr);
+            enumerate_asics(retry_chain);
+            for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+            {
+                if(!retry_chain[i])
+                    continue;
 
-                    retry_count++;
-                }
+                sprintf(logstr,"retry Chain[J%d] has %d asic\n",i+1,dev->chain_asic_num[i]);
+                writeInitLogFile(logstr);
+            }
+        }
 #endif
+
+        for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(dev->chain_exist[i] == 1)
+            {
                 if(dev->chain_asic_num[i] != CHAIN_ASIC_NUM && readRebootTestNum()>0)
                 {
                     char error_info[256];
@@ -10972,12 +11654,14 @@ void bitmain_reconfigure_fans(void)
             }
         }
 #endif
+        init_phase_done("asic_num");
 
         // clement for debug
 //  check_asic_reg(TICKET_MASK);
 
         software_set_address();
         cgsleep_ms(10);
+        init_phase_done("address");
 
 //    check_asic_reg(CHIP_ADDRESS);
 //    cgsleep_ms(10);
@@ -10990,7 +11674,9 @@ void bitmain_reconfigure_fans(void)
         }
 
         cgsleep_ms(10);
+        init_phase_done("frequency");
 
+    warm_restored:
 	/* initialize fancontrol */
 	mutex_lock(&fancontrol_lock);
 	fancontrol_init(&fancontrol);
@@ -11051,6 +11737,7 @@ void bitmain_reconfigure_fans(void)
         //set baud
         init_uart_baud();
         cgsleep_ms(10);
+        init_phase_done("baud");
 
         if (!opt_disable_sensors) {
             for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++) {
@@ -11059,12 +11746,14 @@ void bitmain_reconfigure_fans(void)
                     cgsleep_ms(10);
                 }
             }
+            sensor_cache_save();
             for (int i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++) {
                 for (int j = 0; j < chain_n_sensors[i]; j++) {
                     sensor_init(&chain_sensor[i][j]);
                 }
             }
         }
+        init_phase_done("sensors");
 
 #ifdef T9_18
         for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
@@ -11170,6 +11859,9 @@ void bitmain_reconfigure_fans(void)
 #endif
         }
 
+	if (warm)
+		goto warm_core_opened;
+
 	int chain_id = 0;
 	for (i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++) {
 		if (dev->chain_exist[i] == 1) {
@@ -11185,6 +11877,11 @@ void bitmain_reconfigure_fans(void)
 	}
 
 #ifdef ENABLE_HIGH_VOLTAGE_OPENCORE
+#if !defined(T9_18) && !defined(USE_OPENCORE_ONEBYONE) && !defined(DEBUG_DOWN_VOLTAGE_TEST)
+        // all chains are at open core voltage now, feed them in one interleaved pass
+        open_core(true);
+        sleep(1);
+#endif
         for(i=0; i < BITMAIN_MAX_CHAIN_NUM; i++)
         {
             int vol_value;
@@ -11194,10 +11891,11 @@ void bitmain_reconfigure_fans(void)
             {
 #ifdef USE_OPENCORE_ONEBYONE
                 opencore_onebyone_onChain(i);
-#else
+                sleep(1);
+#elif defined(T9_18) || defined(DEBUG_DOWN_VOLTAGE_TEST)
                 open_core_one_chain(i,true);
-#endif
                 sleep(1);
+#endif
 
 #ifdef DEBUG_DOWN_VOLTAGE_TEST
                 vol_value=getVolValueFromPICvoltage(chain_voltage_pic[i])-DEBUG_DOWN_VOLTAGE_VALUE;
@@ -11307,6 +12005,14 @@ void bitmain_reconfigure_fans(void)
         sleep(5);
         open_core(true);
 #endif
+        init_phase_done("open_core");
+
+    warm_core_opened:
+        if(warm)
+        {
+            // shutdown of the previous run disabled null work, cores themselves are still open
+            bc_cmd_set_ctrl(BC_COMMAND_EN_NULL_WORK, BC_COMMAND_EN_NULL_WORK);
+        }
 
         // clement for debug
 //  check_asic_reg(TICKET_MASK);
@@ -11348,7 +12054,7 @@ void bitmain_reconfigure_fans(void)
         if(!isFixedFreqMode())
         {
 //#ifdef ENABLE_PREHEAT
-            if(opt_pre_heat)
+            if(opt_pre_heat && !warm)
             {
 #ifdef DEBUG_XILINX_NONCE_NOTENOUGH
                 set_bmc_counter(0);
@@ -11369,6 +12075,7 @@ void bitmain_reconfigure_fans(void)
 #else
                             memcpy(last_freq[i],chip_last_freq[i],256); // restore the real freq for chips
 #endif
+                            invalidate_chain_freq_stats(i);
                         }
                     }
 
@@ -11407,6 +12114,7 @@ void bitmain_reconfigure_fans(void)
 #else
                             memcpy(last_freq[i],show_last_freq[i],256); // restore the user freq for showed on web for users
 #endif
+                            invalidate_chain_freq_stats(i);
                         }
                     }
 
@@ -11421,6 +12129,7 @@ void bitmain_reconfigure_fans(void)
                 sprintf(logstr,"After TEST bmc counter=0x%08x\n",read_bmc_counter());
                 writeInitLogFile(logstr);
 #endif
+                init_phase_done("preheat");
             }
 //#endif
         }
@@ -11481,7 +12190,17 @@ void bitmain_reconfigure_fans(void)
 		avg_init(&chain_error_rate[i], CHAIN_ERROR_RATE_WINDOW_SEC);
 		/* start averaging right away*/
 		avg_insert(&chain_error_rate[i], now.tv_sec, 0);
+
+		if (dev->chain_exist[i] == 0)
+			continue;
+		if (!asic_stats[i])
+			asic_stats[i] = malloc(sizeof(struct asic_stats));
+		if (asic_stats[i])
+			memset(asic_stats[i], 0, sizeof(struct asic_stats));
 	}
+
+        warm_state_valid = true;
+        warm_state_save();
         return 0;
     }
 
@@ -11532,6 +12251,126 @@ void bitmain_reconfigure_fans(void)
         startCheckNetworkJob=true;
     }
 
+    /*
+     * Recover one chain while the others keep hashing. Its reset and voltage
+     * settling need no lock; re-addressing and PLL programming run at the
+     * default baud, and the FPGA baud divider is shared by all chains. For
+     * that part work generation is stopped for every chain, their nonces
+     * are flushed afterwards and hash errors are not counted meanwhile.
+     */
+    void bitmain_chain_reInit(int chainIndex)
+    {
+        const unsigned char *plan[BITMAIN_MAX_CHAIN_NUM] = {NULL};
+        unsigned char plan_index[CHAIN_ASIC_NUM];
+        struct timeval tv_start, tv_stop, tv_pause, tv_resume;
+        unsigned char work_baud;
+        char logstr[256];
+        int i, j, ms, paused_ms;
+
+#ifdef T9_18
+        // T9+ chains share their PIC with two other chains, recover all of them
+        bitmain_core_reInit();
+        return;
+#endif
+
+        cgtime(&tv_start);
+        sprintf(logstr,"Chain[J%d] re-init start\n",chainIndex+1);
+        writeInitLogFile(logstr);
+
+#ifdef ENABLE_HIGH_VOLTAGE_OPENCORE
+        pthread_mutex_lock(&iic_mutex);
+        set_pic_voltage(chainIndex, getPICvoltageFromValue(HIGHEST_VOLTAGE_LIMITED_HW));
+        pthread_mutex_unlock(&iic_mutex);
+#endif
+
+#ifdef USE_NEW_RESET_FPGA
+        set_reset_hashboard(chainIndex,1);
+        sleep(RESET_KEEP_TIME);
+        set_reset_hashboard(chainIndex,0);
+        sleep(1);
+#else
+        reset_one_hashboard(chainIndex);
+#endif
+
+        pthread_mutex_lock(&opencore_readtemp_mutex);
+        pthread_mutex_lock(&reinit_mutex);
+
+        // stop work for all chains, new jobs wait for reinit_mutex
+        cgtime(&tv_pause);
+        hw_error_mask = true;
+        set_dhash_acc_control((unsigned int)get_dhash_acc_control() & ~RUN_BIT);
+        while((unsigned int)get_dhash_acc_control() & RUN_BIT)
+            cgsleep_ms(1);
+        // the bauddiv is shared, work still queued for the other chains must go out at their baud
+        if(!wait_work_fifo_drained(chainIndex))
+        {
+            sprintf(logstr,"Chain[J%d] re-init: work FIFOs not drained after %d ms\n",chainIndex+1,WORK_FIFO_DRAIN_MS);
+            writeInitLogFile(logstr);
+        }
+
+        // reset chips listen at default baud, the FPGA bauddiv is shared by all chains
+        work_baud = dev->baud;
+        bc_cmd_set_ctrl(0x1f, DEFAULT_BAUD_VALUE & 0x1f);
+
+        software_set_address_onChain(chainIndex);
+        cgsleep_ms(10);
+
+        for(j = 0; j < CHAIN_ASIC_NUM; j++)
+            plan_index[j] = chip_last_freq[chainIndex][j*2+3];
+        plan[chainIndex] = plan_index;
+        if(set_frequency_plan(plan, true) < 0)
+        {
+            // the watchdog re-inits the chain again if it does not hash
+            sprintf(logstr,"Chain[J%d] re-init: frequency plan not sent\n",chainIndex+1);
+            writeInitLogFile(logstr);
+        }
+        // the thermal governor reapplies its steps on the next temperature pass
+        throttle_applied[chainIndex] = 0;
+
+        set_baud_onChain(chainIndex, work_baud);
+        cgsleep_us(50000);
+        bc_cmd_set_ctrl(0x1f, work_baud & 0x1f);
+
+        open_core_one_chain(chainIndex, true);
+        set_asic_ticket_mask(63);
+        cgsleep_ms(10);
+
+        // drop what the other chains sent while the baud was wrong, then restart their work
+        set_nonce_fifo_interrupt(get_nonce_fifo_interrupt() | FLUSH_NONCE3_FIFO);
+        clear_nonce_fifo();
+        pthread_mutex_unlock(&reinit_mutex);
+        re_send_last_job();
+
+        cgtime(&tv_resume);
+        paused_ms = ms_tdiff(&tv_resume, &tv_pause);
+        hw_error_mask_end = tv_resume;
+        hw_error_mask_end.tv_sec += HW_ERROR_MASK_TAIL_MS / 1000;
+        hw_error_mask = false;
+
+#ifdef ENABLE_HIGH_VOLTAGE_OPENCORE
+        pthread_mutex_lock(&iic_mutex);
+        set_pic_voltage(chainIndex, chain_voltage_pic[chainIndex]);
+        pthread_mutex_unlock(&iic_mutex);
+#endif
+
+        dev->chain_asic_num[chainIndex]=0;
+        check_asic_reg_oneChain(chainIndex, CHIP_ADDRESS);
+        pthread_mutex_unlock(&opencore_readtemp_mutex);
+
+        cgtime(&tv_stop);
+        ms = ms_tdiff(&tv_stop, &tv_start);
+        chain_recover_num[chainIndex]++;
+        chain_recover_ms[chainIndex] += ms;
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            if(i != chainIndex && dev->chain_exist[i] == 1)
+                chain_recover_ms[i] += paused_ms;
+        }
+
+        sprintf(logstr,"Chain[J%d] re-init done in %d ms, %d asic, other chains paused %d ms\n",chainIndex+1,ms,dev->chain_asic_num[chainIndex],paused_ms);
+        writeInitLogFile(logstr);
+    }
+
     int parse_job_to_c5(unsigned char **buf,struct pool *pool,uint32_t id)
     {
         uint16_t crc = 0;
@@ -11681,17 +12520,17 @@ void bitmain_reconfigure_fans(void)
 
         if(*(buf + 0) != SEND_JOB_TYPE)
         {
-            applog(LOG_DEBUG,"%s: SEND_JOB_TYPE is wrong : 0x%x\n", __FUNCTION__, *(buf + 0));
+            applog_sub(LOGS_WORK, LOG_DEBUG,"%s: SEND_JOB_TYPE is wrong : 0x%x\n", __FUNCTION__, *(buf + 0));
             return -1;
         }
 
         len = *((unsigned int *)buf + 4/sizeof(int));
-        applog(LOG_DEBUG,"%s: len = 0x%x\n", __FUNCTION__, len);
+        applog_sub(LOGS_WORK, LOG_DEBUG,"%s: len = 0x%x\n", __FUNCTION__, len);
 
         temp_buf = malloc(len + 8*sizeof(unsigned char));
         if(!temp_buf)
         {
-            applog(LOG_DEBUG,"%s: malloc buffer failed.\n", __FUNCTION__);
+            applog_sub(LOGS_WORK, LOG_DEBUG,"%s: malloc buffer failed.\n", __FUNCTION__);
             return -2;
         }
         else
@@ -11712,7 +12551,7 @@ void bitmain_reconfigure_fans(void)
         }
         else
         {
-            applog(LOG_DEBUG,"%s: dev->current_job_start_address = %p, but job_start_address_1 = %p, job_start_address_2 = %p\n", __FUNCTION__, dev->current_job_start_address, job_start_address_1, job_start_address_2);
+            applog_sub(LOGS_WORK, LOG_DEBUG,"%s: dev->current_job_start_address = %p, but job_start_address_1 = %p, job_start_address_2 = %p\n", __FUNCTION__, dev->current_job_start_address, job_start_address_1, job_start_address_2);
             return -3;
         }
 
@@ -11729,12 +12568,12 @@ void bitmain_reconfigure_fans(void)
         coinbase_padding = malloc(coinbase_padding_len);
         if(!coinbase_padding)
         {
-            applog(LOG_DEBUG,"%s: malloc coinbase_padding failed.\n", __FUNCTION__);
+            applog_sub(LOGS_WORK, LOG_DEBUG,"%s: malloc coinbase_padding failed.\n", __FUNCTION__);
             return -4;
         }
         else
         {
-            applog(LOG_DEBUG,"%s: coinbase_padding = 0x%x", __FUNCTION__, (unsigned int)coinbase_padding);
+            applog_sub(LOGS_WORK, LOG_DEBUG,"%s: coinbase_padding = 0x%x", __FUNCTION__, (unsigned int)coinbase_padding);
         }
 
         if(part_job->merkles_num)
@@ -11742,12 +12581,12 @@ void bitmain_reconfigure_fans(void)
             merkles_bin = malloc(part_job->merkles_num * MERKLE_BIN_LEN);
             if(!merkles_bin)
             {
-                applog(LOG_DEBUG,"%s: malloc merkles_bin failed.\n", __FUNCTION__);
+                applog_sub(LOGS_WORK, LOG_DEBUG,"%s: malloc merkles_bin failed.\n", __FUNCTION__);
                 return -5;
             }
             else
             {
-                applog(LOG_DEBUG,"%s: merkles_bin = 0x%x", __FUNCTION__, (unsigned int)merkles_bin);
+                applog_sub(LOGS_WORK, LOG_DEBUG,"%s: merkles_bin = 0x%x", __FUNCTION__, (unsigned int)merkles_bin);
             }
         }
 
@@ -11771,14 +12610,14 @@ void bitmain_reconfigure_fans(void)
         {
             if(*((unsigned char *)dev->current_job_start_address + i) != *(coinbase_padding + i))
             {
-                applog(LOG_DEBUG,"%s: coinbase_padding_in_ddr[%d] = 0x%x, but *(coinbase_padding + %d) = 0x%x", __FUNCTION__, i, *(((unsigned char *)dev->current_job_start_address + i)), i, *(coinbase_padding + i));
+                applog_sub(LOGS_WORK, LOG_DEBUG,"%s: coinbase_padding_in_ddr[%d] = 0x%x, but *(coinbase_padding + %d) = 0x%x", __FUNCTION__, i, *(((unsigned char *)dev->current_job_start_address + i)), i, *(coinbase_padding + i));
             }
         }
         l_merkles_num = c_merkles_num;
         c_merkles_num = part_job->merkles_num;
         if(part_job->merkles_num)
         {
-            applog(LOG_DEBUG,"%s: copy merkle bin into memory ...\n", __FUNCTION__);
+            applog_sub(LOGS_WORK, LOG_DEBUG,"%s: copy merkle bin into memory ...\n", __FUNCTION__);
             memset(merkles_bin, 0, part_job->merkles_num * MERKLE_BIN_LEN);
             memcpy(merkles_bin, buf + sizeof(struct part_of_job) + part_job->coinbase_len , part_job->merkles_num * MERKLE_BIN_LEN);
 
@@ -11792,7 +12631,7 @@ void bitmain_reconfigure_fans(void)
             {
                 if(*((unsigned char *)dev->current_job_start_address + coinbase_padding_len + i) != *(merkles_bin + i))
                 {
-                    applog(LOG_DEBUG,"%s: merkles_in_ddr[%d] = 0x%x, but *(merkles_bin + %d) =0x%x", __FUNCTION__, i, *(((unsigned char *)dev->current_job_start_address + coinbase_padding_len + i)), i, *(merkles_bin + i));
+                    applog_sub(LOGS_WORK, LOG_DEBUG,"%s: merkles_in_ddr[%d] = 0x%x, but *(merkles_bin + %d) =0x%x", __FUNCTION__, i, *(((unsigned char *)dev->current_job_start_address + coinbase_padding_len + i)), i, *(merkles_bin + i));
                 }
             }
         }
@@ -11801,7 +12640,7 @@ void bitmain_reconfigure_fans(void)
         while((unsigned int)get_dhash_acc_control() & RUN_BIT)
         {
             cgsleep_ms(1);
-            applog(LOG_DEBUG,"%s: run bit is 1 after set it to 0\n", __FUNCTION__);
+            applog_sub(LOGS_WORK, LOG_DEBUG,"%s: run bit is 1 after set it to 0\n", __FUNCTION__);
             times++;
         }
         cgsleep_ms(1);
@@ -11896,7 +12735,7 @@ void bitmain_reconfigure_fans(void)
         free(temp_buf);
         free((unsigned char *)coinbase_padding);
 
-        applog(LOG_DEBUG,"--- %s end\n", __FUNCTION__);
+        applog_sub(LOGS_WORK, LOG_DEBUG,"--- %s end\n", __FUNCTION__);
         cgtime(&tv_send_job);
         return 0;
     }
@@ -12009,6 +12848,10 @@ void bitmain_reconfigure_fans(void)
 
     static void bitmain_c5_reinit_device(struct cgpu_info *bitmain)
     {
+        // the device is sick, the restart must not reuse its chip state
+        warm_state_valid = false;
+        unlink(WARM_STATE_FILE);
+
         if(!status_error)
             system("/etc/init.d/bmminer.sh restart > /dev/null 2>&1 &");
     }
@@ -12047,6 +12890,16 @@ void bitmain_reconfigure_fans(void)
         for (i = 0; i < length/4; i++)
             dest[i] = swab32(src[i]);
     }
+    static bool hw_errors_masked(void)
+    {
+        struct timeval now;
+
+        if(hw_error_mask)
+            return true;
+        cgtime(&now);
+        return ms_tdiff(&hw_error_mask_end, &now) > 0;
+    }
+
     void chain_hw_error(struct thr_info *thr, int chain_id)
     {
 	struct timeval now;
@@ -12056,6 +12909,50 @@ void bitmain_reconfigure_fans(void)
         cgtime(&now);
 	avg_insert(&chain_error_rate[chain_id], now.tv_sec, 1);
     }
+    void asic_stats_add(int chain, uint32_t nonce, bool hw)
+    {
+	struct asic_stats *st = asic_stats[chain];
+	int asic = (nonce >> (24 + dev->check_bit)) & 0xff;
+	int core = nonce & (ASIC_STATS_CORES - 1);
+	time_t minute = time(NULL) / ASIC_STATS_BUCKET_SEC;
+	int b = minute % ASIC_STATS_BUCKETS;
+
+	if (!st || asic >= BITMAIN_DEFAULT_ASIC_NUM)
+		return;
+
+	if (st->bucket_min[b] != minute) {
+		memset(st->win_nonce[b], 0, sizeof(st->win_nonce[b]));
+		memset(st->win_hw[b], 0, sizeof(st->win_hw[b]));
+		st->bucket_min[b] = minute;
+	}
+
+	if (hw) {
+		st->hw[asic]++;
+		st->win_hw[b][asic]++;
+		st->core_hw[asic][core]++;
+	} else {
+		st->nonce[asic]++;
+		st->win_nonce[b][asic]++;
+		st->core_nonce[asic][core]++;
+	}
+    }
+    void asic_stats_window(int chain, int asic, uint32_t *nonce, uint32_t *hw)
+    {
+	struct asic_stats *st = asic_stats[chain];
+	time_t minute = time(NULL) / ASIC_STATS_BUCKET_SEC;
+	int b;
+
+	*nonce = *hw = 0;
+	if (!st || asic >= BITMAIN_DEFAULT_ASIC_NUM)
+		return;
+
+	for (b = 0; b < ASIC_STATS_BUCKETS; b++) {
+		if (minute - st->bucket_min[b] >= ASIC_STATS_BUCKETS)
+			continue;
+		*nonce += st->win_nonce[b][asic];
+		*hw += st->win_hw[b][asic];
+	}
+    }
     static uint64_t hashtest_submit(struct thr_info *thr, struct work *work, uint32_t nonce, uint8_t *midstate,struct pool *pool,uint64_t nonce2,uint32_t chain_id )
     {
         unsigned char hash1[32];
@@ -12077,7 +12974,7 @@ void bitmain_reconfigure_fans(void)
                 pool_diff_bit++;
             }
             pool_diff_bit--;
-            applog(LOG_DEBUG,"%s: pool_diff:%lld work_diff:%lf pool_diff_bit:%lld ...\n", __FUNCTION__,pool_diff,work->sdiff,pool_diff_bit);
+            applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: pool_diff:%lld work_diff:%lf pool_diff_bit:%lld ...\n", __FUNCTION__,pool_diff,work->sdiff,pool_diff_bit);
         }
 
         if(net_diff != (uint64_t)current_diff)
@@ -12091,7 +12988,7 @@ void bitmain_reconfigure_fans(void)
                 net_diff_bit++;
             }
             net_diff_bit--;
-            applog(LOG_DEBUG,"%s:net_diff:%lld current_diff:%lf net_diff_bit %lld ...\n", __FUNCTION__,net_diff,current_diff,net_diff_bit);
+            applog_sub(LOGS_NONCE, LOG_DEBUG,"%s:net_diff:%lld current_diff:%lf net_diff_bit %lld ...\n", __FUNCTION__,net_diff,current_diff,net_diff_bit);
         }
 
         uint32_t *hash2_32 = (uint32_t *)hash1;
@@ -12122,13 +13019,16 @@ void bitmain_reconfigure_fans(void)
 
         if (hash2_32[7] != 0)
         {
-            if(dev->chain_exist[chain_id] == 1)
+            if(dev->chain_exist[chain_id] == 1 && !hw_errors_masked())
             {
 		chain_hw_error(thr, chain_id);
+		asic_stats_add(chain_id, nonce, true);
             }
             //inc_hw_errors_with_diff(thr,(0x01UL << DEVICE_DIFF));
             //dev->chain_hw[chain_id]+=(0x01UL << DEVICE_DIFF);
-            applog(LOG_DEBUG,"%s: HASH2_32[7] != 0", __FUNCTION__);
+            applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: HASH2_32[7] != 0", __FUNCTION__);
+            if(workcap_active)
+                workcap_add(work, nonce, 0, chain_id, (nonce >> (24 + dev->check_bit)) & 0xff, WORKCAP_HWERR, hash1);
             return 0;
         }
         for(i=0; i < 7; i++)
@@ -12137,6 +13037,15 @@ void bitmain_reconfigure_fans(void)
                 break;
         }
 
+        asic_stats_add(chain_id, nonce, false);
+
+        if(workcap_active)
+        {
+            bool share = i >= pool_diff_bit/32 && be32toh(hash2_32[6 - pool_diff_bit/32]) < ((uint32_t)0xffffffff >> (pool_diff_bit%32));
+
+            workcap_add(work, nonce, 0, chain_id, (nonce >> (24 + dev->check_bit)) & 0xff, share ? WORKCAP_OK : 0, hash1);
+        }
+
 #ifdef CAPTURE_PATTEN
         // clement change below:
         savelog_nonce(work, nonce);
@@ -12146,7 +13055,7 @@ void bitmain_reconfigure_fans(void)
         {
             which_asic_nonce = (nonce >> (24 + dev->check_bit)) & 0xff;
             which_core_nonce = (nonce & 0x7f);
-            applog(LOG_DEBUG,"%s: chain %d which_asic_nonce %d which_core_nonce %d", __FUNCTION__, chain_id, which_asic_nonce, which_core_nonce);
+            applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: chain %d which_asic_nonce %d which_core_nonce %d", __FUNCTION__, chain_id, which_asic_nonce, which_core_nonce);
             dev->chain_asic_nonce[chain_id][which_asic_nonce]++;
             if(be32toh(hash2_32[6 - pool_diff_bit/32]) < ((uint32_t)0xffffffff >> (pool_diff_bit%32)))
             {
@@ -12209,7 +13118,7 @@ void bitmain_reconfigure_fans(void)
 
                 midstate[(7-(i/4))*4 + (i%4)] = nonce_read_out.nonce_buffer[nonce_read_out.p_rd].midstate[i];
             }
-            applog(LOG_DEBUG,"%s: job_id:0x%x   work_id:0x%x   nonce2:0x%llx   nonce3:0x%x   version:0x%x\n", __FUNCTION__,job_id, work_id,nonce2, nonce3,version);
+            applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: job_id:0x%x   work_id:0x%x   nonce2:0x%llx   nonce3:0x%x   version:0x%x\n", __FUNCTION__,job_id, work_id,nonce2, nonce3,version);
             struct work * work;
 
             struct pool *pool, *c_pool;
@@ -12241,10 +13150,10 @@ void bitmain_reconfigure_fans(void)
                 continue;
             }
 
-            applog(LOG_DEBUG,"%s: Chain ID J%d ...\n", __FUNCTION__, chain_id + 1);
+            applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: Chain ID J%d ...\n", __FUNCTION__, chain_id + 1);
             if( (given_id -2)> job_id && given_id < job_id)
             {
-                applog(LOG_DEBUG,"%s: job_id error ...\n", __FUNCTION__);
+                applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: job_id error ...\n", __FUNCTION__);
                 if(dev->chain_exist[chain_id] == 1)
                 {
 #ifdef DEBUG_LOG
@@ -12255,7 +13164,7 @@ void bitmain_reconfigure_fans(void)
                 continue;
             }
 
-            applog(LOG_DEBUG,"%s: given_id:%d job_id:%d switch:%d  ...\n", __FUNCTION__,given_id,job_id,given_id - job_id);
+            applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: given_id:%d job_id:%d switch:%d  ...\n", __FUNCTION__,given_id,job_id,given_id - job_id);
 
             switch (given_id - job_id)
             {
@@ -12269,7 +13178,7 @@ void bitmain_reconfigure_fans(void)
                     pool = pool_stratum2;
                     break;
                 default:
-                    applog(LOG_DEBUG,"%s: job_id non't found ...\n", __FUNCTION__);
+                    applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: job_id non't found ...\n", __FUNCTION__);
                     if(dev->chain_exist[chain_id] == 1)
                     {
 #ifdef DEBUG_LOG
@@ -12294,7 +13203,7 @@ void bitmain_reconfigure_fans(void)
         cgsleep_ms(1);
         if(h != 0)
         {
-            applog(LOG_DEBUG,"%s: hashes %llu ...\n", __FUNCTION__,h * 0xffffffffull);
+            applog_sub(LOGS_NONCE, LOG_DEBUG,"%s: hashes %llu ...\n", __FUNCTION__,h * 0xffffffffull);
         }
         h = h * 0xffffffffull;
 
@@ -12359,6 +13268,7 @@ void bitmain_reconfigure_fans(void)
             pthread_mutex_lock(&reinit_mutex);
             send_job(buf);
             pthread_mutex_unlock(&reinit_mutex);
+            last_new_job = time(NULL);
         }
         cg_runlock(&pool->data_lock);
         cg_wunlock(&info->update_lock);
@@ -12483,19 +13393,7 @@ void bitmain_reconfigure_fans(void)
 #ifdef T9_18
                 if(getChainPICMagicNumber(i)== FREQ_MAGIC)
                 {
-                    for(j = 0; j < dev->chain_asic_num[i]; j++)
-                    {
-                        if(fpga_version>=0xE)
-                        {
-                            int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset;
-                            getPICChainIndexOffset(i,&new_T9_PLUS_chainIndex,&new_T9_PLUS_chainOffset);
-                            dev_sum_freq += atoi(freq_pll_1385[chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j]].freq);
-                        }
-                        else
-                        {
-                            dev_sum_freq += atoi(freq_pll_1385[chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j]].freq);
-                        }
-                    }
+                    dev_sum_freq += get_chain_freq_stats(i).sum_freq;
 
                     if(dev->chain_asic_num[i]>0)
                         dev_sum_freq=dev_sum_freq/dev->chain_asic_num[i];
@@ -12513,10 +13411,7 @@ void bitmain_reconfigure_fans(void)
 #else
                 if(last_freq[i][1] == FREQ_MAGIC)
                 {
-                    for(j = 0; j < dev->chain_asic_num[i]; j++)
-                    {
-                        dev_sum_freq += atoi(freq_pll_1385[last_freq[i][j*2+3]].freq);
-                    }
+                    dev_sum_freq += get_chain_freq_stats(i).sum_freq;
 
                     if(dev->chain_asic_num[i]>0)
                         dev_sum_freq=dev_sum_freq/dev->chain_asic_num[i];
@@ -12555,27 +13450,12 @@ void bitmain_reconfigure_fans(void)
 #ifdef T9_18
                     if(getChainPICMagicNumber(i)== FREQ_MAGIC)
                     {
-                        for(j = 0; j < dev->chain_asic_num[i]; j++)
-                        {
-                            if(fpga_version>=0xE)
-                            {
-                                int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset;
-                                getPICChainIndexOffset(i,&new_T9_PLUS_chainIndex,&new_T9_PLUS_chainOffset);
-                                dev_sum_freq += atoi(freq_pll_1385[chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j]].freq)*(BM1387_CORE_NUM-chain_badcore_num[i][j]);
-                            }
-                            else
-                            {
-                                dev_sum_freq += atoi(freq_pll_1385[chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j]].freq)*(BM1387_CORE_NUM-chain_badcore_num[i][j]);
-                            }
-                        }
+                        dev_sum_freq += get_chain_freq_stats(i).sum_rate;
                     }
 #else
                     if(last_freq[i][1] == FREQ_MAGIC)
                     {
-                        for(j = 0; j < dev->chain_asic_num[i]; j++)
-                        {
-                            dev_sum_freq += atoi(freq_pll_1385[last_freq[i][j*2+3]].freq)*(BM1387_CORE_NUM-chain_badcore_num[i][j]);
-                        }
+                        dev_sum_freq += get_chain_freq_stats(i).sum_rate;
                     }
 #endif
                 }
@@ -12603,29 +13483,14 @@ void bitmain_reconfigure_fans(void)
 #ifdef T9_18
                     if(getChainPICMagicNumber(i)== FREQ_MAGIC)
                     {
-                        for(j = 0; j < dev->chain_asic_num[i]; j++)
-                        {
-                            if(fpga_version>=0xE)
-                            {
-                                int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset;
-                                getPICChainIndexOffset(i,&new_T9_PLUS_chainIndex,&new_T9_PLUS_chainOffset);
-                                dev_sum_freq += atoi(freq_pll_1385[chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j]].freq);
-                            }
-                            else
-                            {
-                                dev_sum_freq += atoi(freq_pll_1385[chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j]].freq);
-                            }
-                            total_acn_num++;
-                        }
+                        dev_sum_freq += get_chain_freq_stats(i).sum_freq;
+                        total_acn_num += dev->chain_asic_num[i];
                     }
 #else
                     if(last_freq[i][1] == FREQ_MAGIC)
                     {
-                        for(j = 0; j < dev->chain_asic_num[i]; j++)
-                        {
-                            dev_sum_freq += atoi(freq_pll_1385[last_freq[i][j*2+3]].freq);
-                            total_acn_num++;
-                        }
+                        dev_sum_freq += get_chain_freq_stats(i).sum_freq;
+                        total_acn_num += dev->chain_asic_num[i];
                     }
 #endif
                 }
@@ -12683,19 +13548,7 @@ void bitmain_reconfigure_fans(void)
 #ifdef T9_18
                 if(getChainPICMagicNumber(i)== FREQ_MAGIC)
                 {
-                    for(j = 0; j < dev->chain_asic_num[i]; j++)
-                    {
-                        if(fpga_version>=0xE)
-                        {
-                            int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset;
-                            getPICChainIndexOffset(i,&new_T9_PLUS_chainIndex,&new_T9_PLUS_chainOffset);
-                            dev_sum_freq += atoi(freq_pll_1385[chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+j]].freq)*(BM1387_CORE_NUM-chain_badcore_num[i][j]);
-                        }
-                        else
-                        {
-                            dev_sum_freq += atoi(freq_pll_1385[chain_pic_buf[((i/3)*3)][7+(i%3)*31+4+j]].freq)*(BM1387_CORE_NUM-chain_badcore_num[i][j]);
-                        }
-                    }
+                    dev_sum_freq += get_chain_freq_stats(i).sum_rate;
 
                     dev_sum_freq=((dev_sum_freq*1.0)/1000);
                     temp=(int)(dev_sum_freq*100);
@@ -12712,10 +13565,7 @@ void bitmain_reconfigure_fans(void)
 #else
                 if(last_freq[i][1] == FREQ_MAGIC)
                 {
-                    for(j = 0; j < dev->chain_asic_num[i]; j++)
-                    {
-                        dev_sum_freq += atoi(freq_pll_1385[last_freq[i][j*2+3]].freq)*(BM1387_CORE_NUM-chain_badcore_num[i][j]);
-                    }
+                    dev_sum_freq += get_chain_freq_stats(i).sum_rate;
 
                     dev_sum_freq=((dev_sum_freq*1.0)/1000);
                     temp=(int)(dev_sum_freq*100);
@@ -12763,6 +13613,19 @@ void bitmain_reconfigure_fans(void)
 	    }
         }
         for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            char chain_name[24];
+            if(dev->chain_exist[i] == 1)
+            {
+                sprintf(chain_name,"chain_recover%d",i+1);
+                root = api_add_int(root, chain_name, &chain_recover_num[i], copy_data);
+                sprintf(chain_name,"chain_recover_ms%d",i+1);
+                root = api_add_int(root, chain_name, &chain_recover_ms[i], copy_data);
+                sprintf(chain_name,"chain_opencore_ms%d",i+1);
+                root = api_add_int(root, chain_name, &chain_opencore_ms[i], copy_data);
+            }
+        }
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
         {
             char chain_asic_name[12];
             sprintf(chain_asic_name,"chain_acs%d",i+1);
@@ -12786,6 +13649,129 @@ void bitmain_reconfigure_fans(void)
             root = api_add_double(root, chain_hw, &rate, copy_data);
         }
 
+        /* per chip counters of the last ASIC_STATS_BUCKETS minutes, one
+         * space separated list per chain, and the cores with most errors */
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            char name[32];
+            char nonce_str[BITMAIN_DEFAULT_ASIC_NUM * 11 + 1];
+            char hw_str[BITMAIN_DEFAULT_ASIC_NUM * 11 + 1];
+            char core_str[8 * 32 + 1];
+            int worst_hw[8] = {0}, worst_id[8];
+            int nlen = 0, hlen = 0, clen = 0, j, k;
+            struct asic_stats *st = asic_stats[i];
+
+            if(dev->chain_exist[i] != 1 || !st)
+                continue;
+
+            for(j = 0; j < dev->chain_asic_num[i] && j < BITMAIN_DEFAULT_ASIC_NUM; j++)
+            {
+                uint32_t nonce, hw;
+                int c;
+
+                asic_stats_window(i, j, &nonce, &hw);
+                nlen += sprintf(nonce_str + nlen, "%s%u", j ? " " : "", nonce);
+                hlen += sprintf(hw_str + hlen, "%s%u", j ? " " : "", hw);
+
+                for(c = 0; c < ASIC_STATS_CORES; c++)
+                {
+                    int e = st->core_hw[j][c];
+
+                    if(e <= worst_hw[7])
+                        continue;
+                    for(k = 7; k > 0 && e > worst_hw[k - 1]; k--)
+                    {
+                        worst_hw[k] = worst_hw[k - 1];
+                        worst_id[k] = worst_id[k - 1];
+                    }
+                    worst_hw[k] = e;
+                    worst_id[k] = j * ASIC_STATS_CORES + c;
+                }
+            }
+            nonce_str[nlen] = hw_str[hlen] = core_str[0] = '\0';
+
+            // "asic:core=errors/nonces"
+            for(k = 0; k < 8 && worst_hw[k] > 0; k++)
+            {
+                int asic = worst_id[k] / ASIC_STATS_CORES, core = worst_id[k] % ASIC_STATS_CORES;
+
+                clen += sprintf(core_str + clen, "%s%d:%d=%u/%u", k ? " " : "", asic, core,
+                                st->core_hw[asic][core], st->core_nonce[asic][core]);
+            }
+
+            sprintf(name, "chain_asic_nonce%d", i+1);
+            root = api_add_string(root, name, nonce_str, copy_data);
+            sprintf(name, "chain_asic_hw%d", i+1);
+            root = api_add_string(root, name, hw_str, copy_data);
+            sprintf(name, "chain_core_hw%d", i+1);
+            root = api_add_string(root, name, core_str, copy_data);
+        }
+
+        /* per sensor reads, failures and average:max read time in us */
+        for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            char name[24];
+            char reads_str[BITMAIN_MAX_SENSORS_PER_CHAIN * 11 + 1];
+            char fail_str[BITMAIN_MAX_SENSORS_PER_CHAIN * 11 + 1];
+            char time_str[BITMAIN_MAX_SENSORS_PER_CHAIN * 22 + 1];
+            int rlen = 0, flen = 0, tlen = 0, j;
+
+            if(chain_n_sensors[i] == 0)
+                continue;
+            for(j = 0; j < chain_n_sensors[i]; j++)
+            {
+                struct sensor *sensor = &chain_sensor[i][j];
+                unsigned reads = sensor->reads;
+
+                rlen += sprintf(reads_str + rlen, "%s%u", j ? " " : "", reads);
+                flen += sprintf(fail_str + flen, "%s%u", j ? " " : "", sensor->failures);
+                tlen += sprintf(time_str + tlen, "%s%u:%u", j ? " " : "",
+                                reads ? (unsigned)(sensor->total_us / reads) : 0, sensor->max_us);
+            }
+            sprintf(name, "sensor_reads%d", i+1);
+            root = api_add_string(root, name, reads_str, copy_data);
+            sprintf(name, "sensor_fails%d", i+1);
+            root = api_add_string(root, name, fail_str, copy_data);
+            sprintf(name, "sensor_us%d", i+1);
+            root = api_add_string(root, name, time_str, copy_data);
+        }
+
+        {
+            int throttle, events;
+
+            mutex_lock(&fancontrol_lock);
+            throttle = fancontrol.throttle;
+            events = fancontrol.throttle_events;
+            mutex_unlock(&fancontrol_lock);
+            root = api_add_int(root, "thermal_throttle", &throttle, copy_data);
+            root = api_add_int(root, "thermal_throttle_events", &events, copy_data);
+        }
+
+#ifndef T9_18
+        root = api_add_const(root, "autotune", opt_autotune ? (opt_autotune_dry_run ? "dry-run" : "on") : "off", copy_data);
+        if(opt_autotune)
+        {
+            root = api_add_int(root, "autotune_ups", &autotune_ups, copy_data);
+            root = api_add_int(root, "autotune_downs", &autotune_downs, copy_data);
+        }
+        /* PLL steps of each chip away from its PIC flash frequency */
+        for(i = 0; autotune_started && i < BITMAIN_MAX_CHAIN_NUM; i++)
+        {
+            char name[16];
+            char tune_str[BITMAIN_DEFAULT_ASIC_NUM * 4 + 1];
+            int len = 0, j;
+
+            if(dev->chain_exist[i] != 1)
+                continue;
+            tune_str[0] = '\0';
+            for(j = 0; j < dev->chain_asic_num[i] && j < BITMAIN_DEFAULT_ASIC_NUM; j++)
+                len += sprintf(tune_str + len, "%s%d", j ? " " : "",
+                               chip_last_freq[i][j*2+3] - autotune_chip[i][j].base);
+            sprintf(name, "chain_tune%d", i+1);
+            root = api_add_string(root, name, tune_str, copy_data);
+        }
+#endif
+
 
         for(i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
         {
@@ -12875,6 +13861,50 @@ void bitmain_reconfigure_fans(void)
 
         suffix_string_c5(hash_rate_all, (char * )displayed_hash_rate, sizeof(displayed_hash_rate), 7,false);
 
+        if(init_phase_num > 0)
+        {
+            char phases[32*INIT_PHASE_MAX];
+            int total_ms = 0;
+
+            phases[0] = '\0';
+            for(i = 0; i < init_phase_num; i++)
+            {
+                char tmp[32];
+                sprintf(tmp, "%s%s:%d", i ? "," : "", init_phases[i].name, init_phases[i].ms);
+                strcat(phases, tmp);
+                total_ms += init_phases[i].ms;
+            }
+            root = api_add_string(root, "init_phases", phases, copy_data);
+            root = api_add_int(root, "init_time", &total_ms, copy_data);
+        }
+
+        {
+            struct bc_cmd_stats bc;
+            unsigned int avg_us;
+
+            bc_cmd_get_stats(&bc);
+            avg_us = bc.num ? bc.wait_us / bc.num : 0;
+            root = api_add_uint64(root, "bc_cmd_num", &bc.num, copy_data);
+            root = api_add_uint(root, "bc_cmd_wait_avg_us", &avg_us, copy_data);
+            root = api_add_uint(root, "bc_cmd_wait_max_us", &bc.max_us, copy_data);
+            root = api_add_uint(root, "bc_cmd_timeouts", &bc.timeouts, copy_data);
+        }
+
+        {
+            uint64_t log_dropped = logwriter_dropped();
+
+            root = api_add_uint64(root, "log_dropped", &log_dropped, copy_data);
+        }
+
+        if(workcap_active)
+        {
+            uint64_t records, dropped;
+
+            workcap_get_stats(&records, &dropped);
+            root = api_add_uint64(root, "workcap_records", &records, copy_data);
+            root = api_add_uint64(root, "workcap_dropped", &dropped, copy_data);
+        }
+
         if(1)
         {
             char param_name[32];
@@ -12887,7 +13917,6 @@ void bitmain_reconfigure_fans(void)
 
     static void bitmain_c5_shutdown(struct thr_info *thr)
     {
-        unsigned int ret;
 #ifdef DEBUG_LOG
         printf("!!! %s:%d\n", __FUNCTION__, __LINE__);
 #endif
@@ -12895,10 +13924,10 @@ void bitmain_reconfigure_fans(void)
         thr_info_cancel(read_nonce_reg_id);
         thr_info_cancel(read_temp_id);
         thr_info_cancel(pic_heart_beat);
-        
-        ret = get_BC_write_command();   //disable null work
-        ret &= ~BC_COMMAND_EN_NULL_WORK;
-        set_BC_write_command(ret);
+
+        warm_state_save();
+
+        bc_cmd_set_ctrl(BC_COMMAND_EN_NULL_WORK, 0);    //disable null work
         set_dhash_acc_control((unsigned int)get_dhash_acc_control() & ~RUN_BIT);
     }
 
@@ -179,6 +179,14 @@
 //#define IIC_ADDR_HIGH_4_BIT                   (0x0A << 20)
 #define IIC_CHAIN_NUMBER(x)                 ((x & 0x0f) << 16)
 #define IIC_REG_ADDR(x)                     ((x & 0xff) << 8)
+// chip enumeration: poll interval, wait for the first answer of a chain and after its last one
+#define ASIC_ENUM_POLL_MS                   5
+#define ASIC_ENUM_FIRST_MS                  500
+#define ASIC_ENUM_IDLE_MS                   100
+
+// PIC byte transfers: poll for completion this many times at this interval before 1ms sleeps
+#define PIC_IIC_FAST_POLLS                  16
+#define PIC_IIC_FAST_POLL_US                25
 
 // AT24C02
 #define AT24C02_ADDRESS     0x50
@@ -752,10 +760,11 @@ struct reg_buf
 
 struct freq_pll
 {
-    const char *freq;
+    unsigned int freq;      // MHz
     unsigned int fildiv1;
     unsigned int fildiv2;
     unsigned int vilpll;
+    unsigned int rate;      // MH/s of one chip with all BM1387_CORE_NUM cores
 };
 
 #define Swap32(l) (((l) >> 24) | (((l) & 0x00ff0000) >> 8) | (((l) & 0x0000ff00) << 8) | ((l) << 24))
@@ -785,126 +794,132 @@ struct vil_work_1387
 
 static struct freq_pll freq_pll_1385[] =
 {
-    {"100",0x020040, 0x0420, 0x200241},
-    {"125",0x028040, 0x0420, 0x280241},
-    {"150",0x030040, 0x0420, 0x300241},
-    {"175",0x038040, 0x0420, 0x380241},
-    {"200",0x040040, 0x0420, 0x400241},
-    {"225",0x048040, 0x0420, 0x480241},
-    {"250",0x050040, 0x0420, 0x500241},
-    {"275",0x058040, 0x0420, 0x580241},
-    {"300",0x060040, 0x0420, 0x600241},
-    {"325",0x068040, 0x0420, 0x680241},
-    {"350",0x070040, 0x0420, 0x700241},
-    {"375",0x078040, 0x0420, 0x780241},
-    {"400",0x080040, 0x0420, 0x800241},
-    {"404",0x061040, 0x0320, 0x610231},
-    {"406",0x041040, 0x0220, 0x410221},
-    {"408",0x062040, 0x0320, 0x620231},
-    {"412",0x042040, 0x0220, 0x420221},
-    {"416",0x064040, 0x0320, 0x640231},
-    {"418",0x043040, 0x0220, 0x430221},
-    {"420",0x065040, 0x0320, 0x650231},
-    {"425",0x044040, 0x0220, 0x440221},
-    {"429",0x067040, 0x0320, 0x670231},
-    {"431",0x045040, 0x0220, 0x450221},
-    {"433",0x068040, 0x0320, 0x680231},
-    {"437",0x046040, 0x0220, 0x460221},
-    {"441",0x06a040, 0x0320, 0x6a0231},
-    {"443",0x047040, 0x0220, 0x470221},
-    {"445",0x06b040, 0x0320, 0x6b0231},
-    {"450",0x048040, 0x0220, 0x480221},
-    {"454",0x06d040, 0x0320, 0x6d0231},
-    {"456",0x049040, 0x0220, 0x490221},
-    {"458",0x06e040, 0x0320, 0x6e0231},
-    {"462",0x04a040, 0x0220, 0x4a0221},
-    {"466",0x070040, 0x0320, 0x700231},
-    {"468",0x04b040, 0x0220, 0x4b0221},
-    {"470",0x071040, 0x0320, 0x710231},
-    {"475",0x04c040, 0x0220, 0x4c0221},
-    {"479",0x073040, 0x0320, 0x730231},
-    {"481",0x04d040, 0x0220, 0x4d0221},
-    {"483",0x074040, 0x0320, 0x740231},
-    {"487",0x04e040, 0x0220, 0x4e0221},
-    {"491",0x076040, 0x0320, 0x760231},
-    {"493",0x04f040, 0x0220, 0x4f0221},
-    {"495",0x077040, 0x0320, 0x770231},
-    {"500",0x050040, 0x0220, 0x500221},
-    {"504",0x079040, 0x0320, 0x790231},
-    {"506",0x051040, 0x0220, 0x510221},
-    {"508",0x07a040, 0x0320, 0x7a0231},
-    {"512",0x052040, 0x0220, 0x520221},
-    {"516",0x07c040, 0x0320, 0x7c0231},
-    {"518",0x053040, 0x0220, 0x530221},
-    {"520",0x07d040, 0x0320, 0x7d0231},
-    {"525",0x054040, 0x0220, 0x540221},
-    {"529",0x07f040, 0x0320, 0x7f0231},
-    {"531",0x055040, 0x0220, 0x550221},
-    {"533",0x080040, 0x0320, 0x800231},
-    {"537",0x056040, 0x0220, 0x560221},
-    {"543",0x057040, 0x0220, 0x570221},
-    {"550",0x058040, 0x0220, 0x580221},
-    {"556",0x059040, 0x0220, 0x590221},
-    {"562",0x05a040, 0x0220, 0x5a0221},
-    {"568",0x05b040, 0x0220, 0x5b0221},
-    {"575",0x05c040, 0x0220, 0x5c0221},
-    {"581",0x05d040, 0x0220, 0x5d0221},
-    {"587",0x05e040, 0x0220, 0x5e0221},
-    {"593",0x05f040, 0x0220, 0x5f0221},
-    {"600",0x060040, 0x0220, 0x600221},
-    {"606",0x061040, 0x0220, 0x610221},
-    {"612",0x062040, 0x0220, 0x620221},
-    {"618",0x063040, 0x0220, 0x630221},
-    {"625",0x064040, 0x0220, 0x640221},
-    {"631",0x065040, 0x0220, 0x650221},
-    {"637",0x066040, 0x0220, 0x660221},
-    {"643",0x067040, 0x0220, 0x670221},
-    {"650",0x068040, 0x0220, 0x680221},
-    {"656",0x069040, 0x0220, 0x690221},
-    {"662",0x06a040, 0x0220, 0x6a0221},
-    {"668",0x06b040, 0x0220, 0x6b0221},
-    {"675",0x06c040, 0x0220, 0x6c0221},
-    {"681",0x06d040, 0x0220, 0x6d0221},
-    {"687",0x06e040, 0x0220, 0x6e0221},
-    {"693",0x06f040, 0x0220, 0x6f0221},
-    {"700",0x070040, 0x0220, 0x700221},
-    {"706",0x071040, 0x0220, 0x710221},
-    {"712",0x072040, 0x0220, 0x720221},
-    {"718",0x073040, 0x0220, 0x730221},
-    {"725",0x074040, 0x0220, 0x740221},
-    {"731",0x075040, 0x0220, 0x750221},
-    {"737",0x076040, 0x0220, 0x760221},
-    {"743",0x077040, 0x0220, 0x770221},
-    {"750",0x078040, 0x0220, 0x780221},
-    {"756",0x079040, 0x0220, 0x790221},
-    {"762",0x07a040, 0x0220, 0x7a0221},
-    {"768",0x07b040, 0x0220, 0x7b0221},
-    {"775",0x07c040, 0x0220, 0x7c0221},
-    {"781",0x07d040, 0x0220, 0x7d0221},
-    {"787",0x07e040, 0x0220, 0x7e0221},
-    {"793",0x07f040, 0x0220, 0x7f0221},
-    {"800",0x080040, 0x0220, 0x800221},
-    {"825",0x042040, 0x0120, 0x420211},
-    {"850",0x044040, 0x0120, 0x440211},
-    {"875",0x046040, 0x0120, 0x460211},
-    {"900",0x048040, 0x0120, 0x480211},
-    {"925",0x04a040, 0x0120, 0x4a0211},
-    {"950",0x04c040, 0x0120, 0x4c0211},
-    {"975",0x04e040, 0x0120, 0x4e0211},
-    {"1000",0x050040, 0x0120, 0x500211},
-    {"1025",0x052040, 0x0120, 0x520211},
-    {"1050",0x054040, 0x0120, 0x540211},
-    {"1075",0x056040, 0x0120, 0x560211},
-    {"1100",0x058040, 0x0120, 0x580211},
-    {"1125",0x05a040, 0x0120, 0x5a0211},
-    {"1150",0x05c040, 0x0120, 0x5c0211},
-    {"1175",0x05e040, 0x0120, 0x5e0211},
+    {100,0x020040, 0x0420, 0x200241, 11400},
+    {125,0x028040, 0x0420, 0x280241, 14250},
+    {150,0x030040, 0x0420, 0x300241, 17100},
+    {175,0x038040, 0x0420, 0x380241, 19950},
+    {200,0x040040, 0x0420, 0x400241, 22800},
+    {225,0x048040, 0x0420, 0x480241, 25650},
+    {250,0x050040, 0x0420, 0x500241, 28500},
+    {275,0x058040, 0x0420, 0x580241, 31350},
+    {300,0x060040, 0x0420, 0x600241, 34200},
+    {325,0x068040, 0x0420, 0x680241, 37050},
+    {350,0x070040, 0x0420, 0x700241, 39900},
+    {375,0x078040, 0x0420, 0x780241, 42750},
+    {400,0x080040, 0x0420, 0x800241, 45600},
+    {404,0x061040, 0x0320, 0x610231, 46056},
+    {406,0x041040, 0x0220, 0x410221, 46284},
+    {408,0x062040, 0x0320, 0x620231, 46512},
+    {412,0x042040, 0x0220, 0x420221, 46968},
+    {416,0x064040, 0x0320, 0x640231, 47424},
+    {418,0x043040, 0x0220, 0x430221, 47652},
+    {420,0x065040, 0x0320, 0x650231, 47880},
+    {425,0x044040, 0x0220, 0x440221, 48450},
+    {429,0x067040, 0x0320, 0x670231, 48906},
+    {431,0x045040, 0x0220, 0x450221, 49134},
+    {433,0x068040, 0x0320, 0x680231, 49362},
+    {437,0x046040, 0x0220, 0x460221, 49818},
+    {441,0x06a040, 0x0320, 0x6a0231, 50274},
+    {443,0x047040, 0x0220, 0x470221, 50502},
+    {445,0x06b040, 0x0320, 0x6b0231, 50730},
+    {450,0x048040, 0x0220, 0x480221, 51300},
+    {454,0x06d040, 0x0320, 0x6d0231, 51756},
+    {456,0x049040, 0x0220, 0x490221, 51984},
+    {458,0x06e040, 0x0320, 0x6e0231, 52212},
+    {462,0x04a040, 0x0220, 0x4a0221, 52668},
+    {466,0x070040, 0x0320, 0x700231, 53124},
+    {468,0x04b040, 0x0220, 0x4b0221, 53352},
+    {470,0x071040, 0x0320, 0x710231, 53580},
+    {475,0x04c040, 0x0220, 0x4c0221, 54150},
+    {479,0x073040, 0x0320, 0x730231, 54606},
+    {481,0x04d040, 0x0220, 0x4d0221, 54834},
+    {483,0x074040, 0x0320, 0x740231, 55062},
+    {487,0x04e040, 0x0220, 0x4e0221, 55518},
+    {491,0x076040, 0x0320, 0x760231, 55974},
+    {493,0x04f040, 0x0220, 0x4f0221, 56202},
+    {495,0x077040, 0x0320, 0x770231, 56430},
+    {500,0x050040, 0x0220, 0x500221, 57000},
+    {504,0x079040, 0x0320, 0x790231, 57456},
+    {506,0x051040, 0x0220, 0x510221, 57684},
+    {508,0x07a040, 0x0320, 0x7a0231, 57912},
+    {512,0x052040, 0x0220, 0x520221, 58368},
+    {516,0x07c040, 0x0320, 0x7c0231, 58824},
+    {518,0x053040, 0x0220, 0x530221, 59052},
+    {520,0x07d040, 0x0320, 0x7d0231, 59280},
+    {525,0x054040, 0x0220, 0x540221, 59850},
+    {529,0x07f040, 0x0320, 0x7f0231, 60306},
+    {531,0x055040, 0x0220, 0x550221, 60534},
+    {533,0x080040, 0x0320, 0x800231, 60762},
+    {537,0x056040, 0x0220, 0x560221, 61218},
+    {543,0x057040, 0x0220, 0x570221, 61902},
+    {550,0x058040, 0x0220, 0x580221, 62700},
+    {556,0x059040, 0x0220, 0x590221, 63384},
+    {562,0x05a040, 0x0220, 0x5a0221, 64068},
+    {568,0x05b040, 0x0220, 0x5b0221, 64752},
+    {575,0x05c040, 0x0220, 0x5c0221, 65550},
+    {581,0x05d040, 0x0220, 0x5d0221, 66234},
+    {587,0x05e040, 0x0220, 0x5e0221, 66918},
+    {593,0x05f040, 0x0220, 0x5f0221, 67602},
+    {600,0x060040, 0x0220, 0x600221, 68400},
+    {606,0x061040, 0x0220, 0x610221, 69084},
+    {612,0x062040, 0x0220, 0x620221, 69768},
+    {618,0x063040, 0x0220, 0x630221, 70452},
+    {625,0x064040, 0x0220, 0x640221, 71250},
+    {631,0x065040, 0x0220, 0x650221, 71934},
+    {637,0x066040, 0x0220, 0x660221, 72618},
+    {643,0x067040, 0x0220, 0x670221, 73302},
+    {650,0x068040, 0x0220, 0x680221, 74100},
+    {656,0x069040, 0x0220, 0x690221, 74784},
+    {662,0x06a040, 0x0220, 0x6a0221, 75468},
+    {668,0x06b040, 0x0220, 0x6b0221, 76152},
+    {675,0x06c040, 0x0220, 0x6c0221, 76950},
+    {681,0x06d040, 0x0220, 0x6d0221, 77634},
+    {687,0x06e040, 0x0220, 0x6e0221, 78318},
+    {693,0x06f040, 0x0220, 0x6f0221, 79002},
+    {700,0x070040, 0x0220, 0x700221, 79800},
+    {706,0x071040, 0x0220, 0x710221, 80484},
+    {712,0x072040, 0x0220, 0x720221, 81168},
+    {718,0x073040, 0x0220, 0x730221, 81852},
+    {725,0x074040, 0x0220, 0x740221, 82650},
+    {731,0x075040, 0x0220, 0x750221, 83334},
+    {737,0x076040, 0x0220, 0x760221, 84018},
+    {743,0x077040, 0x0220, 0x770221, 84702},
+    {750,0x078040, 0x0220, 0x780221, 85500},
+    {756,0x079040, 0x0220, 0x790221, 86184},
+    {762,0x07a040, 0x0220, 0x7a0221, 86868},
+    {768,0x07b040, 0x0220, 0x7b0221, 87552},
+    {775,0x07c040, 0x0220, 0x7c0221, 88350},
+    {781,0x07d040, 0x0220, 0x7d0221, 89034},
+    {787,0x07e040, 0x0220, 0x7e0221, 89718},
+    {793,0x07f040, 0x0220, 0x7f0221, 90402},
+    {800,0x080040, 0x0220, 0x800221, 91200},
+    {825,0x042040, 0x0120, 0x420211, 94050},
+    {850,0x044040, 0x0120, 0x440211, 96900},
+    {875,0x046040, 0x0120, 0x460211, 99750},
+    {900,0x048040, 0x0120, 0x480211, 102600},
+    {925,0x04a040, 0x0120, 0x4a0211, 105450},
+    {950,0x04c040, 0x0120, 0x4c0211, 108300},
+    {975,0x04e040, 0x0120, 0x4e0211, 111150},
+    {1000,0x050040, 0x0120, 0x500211, 114000},
+    {1025,0x052040, 0x0120, 0x520211, 116850},
+    {1050,0x054040, 0x0120, 0x540211, 119700},
+    {1075,0x056040, 0x0120, 0x560211, 122550},
+    {1100,0x058040, 0x0120, 0x580211, 125400},
+    {1125,0x05a040, 0x0120, 0x5a0211, 128250},
+    {1150,0x05c040, 0x0120, 0x5c0211, 131100},
+    {1175,0x05e040, 0x0120, 0x5e0211, 133950},
 };
 
+#define FREQ_PLL_NUM (sizeof(freq_pll_1385) / sizeof(freq_pll_1385[0]))
+
 extern bool opt_bitmain_fan_ctrl;
 extern bool opt_bitmain_new_cmd_type_vil;
 extern bool opt_fixed_freq;
 extern bool opt_pre_heat;
+extern bool opt_warm_restart;
+extern bool opt_pic_cache;
+extern bool opt_autotune;
+extern bool opt_autotune_dry_run;
 extern int opt_bitmain_fan_pwm;
 extern int ADD_FREQ;
 extern int ADD_FREQ1;
@@ -915,7 +930,79 @@ extern char displayed_rate[BITMAIN_MAX_CHAIN_NUM][32];
 extern unsigned char last_freq[BITMAIN_MAX_CHAIN_NUM][256];
 extern int chain_badcore_num[BITMAIN_MAX_CHAIN_NUM][256];
 
+#ifdef T9_18
+extern unsigned char chain_pic_buf[BITMAIN_MAX_CHAIN_NUM][128];
+void getPICChainIndexOffset(int chainIndex, int *pChain, int *pOffset);
+#endif
+
 int get_pll_index(int freq);
+int get_freqvalue_by_index(int index);
+
+/* per-chain frequency aggregates, cached until a chip of that chain gets
+ * reprogrammed or its table entry changes */
+struct chain_freq_stats
+{
+    int valid;
+    int asic_num;
+    int sum_freq;       // sum of chip frequencies, MHz
+    int sum_rate;       // sum of freq * working cores, MH/s
+    int ideal_rate;     // sum_rate over all CHAIN_ASIC_NUM chips, MH/s
+};
+
+void invalidate_chain_freq_stats(int chain);
+struct chain_freq_stats get_chain_freq_stats(int chain);
+int getChainAsicFreqIndex(int chainIndex, int asicIndex);
+void setChainAsicFreqIndex(int chainIndex, int asicIndex, int index);
+/* program / read back the PLL index of every chip, plan[chain] NULL skips the chain,
+ * running: never clock a chip above its plan on the way */
+int set_frequency_plan(const unsigned char *plan[BITMAIN_MAX_CHAIN_NUM], bool running);
+int verify_frequency_plan(const unsigned char *plan[BITMAIN_MAX_CHAIN_NUM]);
+int GetTotalRate();
+int GetBoardRate(int chainIndex);
+
+/* per-chip nonce accounting, attributed from the nonce bits */
+#define ASIC_STATS_CORES        128     // which_core_nonce is nonce & 0x7f
+#define ASIC_STATS_BUCKET_SEC   60
+#define ASIC_STATS_BUCKETS      15      // rolling window of 15 minutes
+
+struct asic_stats
+{
+    uint64_t nonce[BITMAIN_DEFAULT_ASIC_NUM];   // valid nonces since start
+    uint64_t hw[BITMAIN_DEFAULT_ASIC_NUM];      // hash errors since start
+    time_t bucket_min[ASIC_STATS_BUCKETS];      // minute each bucket holds
+    uint32_t win_nonce[ASIC_STATS_BUCKETS][BITMAIN_DEFAULT_ASIC_NUM];
+    uint32_t win_hw[ASIC_STATS_BUCKETS][BITMAIN_DEFAULT_ASIC_NUM];
+    uint32_t core_nonce[BITMAIN_DEFAULT_ASIC_NUM][ASIC_STATS_CORES];
+    uint32_t core_hw[BITMAIN_DEFAULT_ASIC_NUM][ASIC_STATS_CORES];
+};
+
+extern struct asic_stats *asic_stats[BITMAIN_MAX_CHAIN_NUM];
+
+void asic_stats_add(int chain, uint32_t nonce, bool hw);
+/* valid nonces and hash errors of one chip over the rolling window */
+void asic_stats_window(int chain, int asic, uint32_t *nonce, uint32_t *hw);
+
+/* one encoded BC command, ready to be written into the FPGA command buffer */
+struct bc_cmd
+{
+    unsigned int buf[3];
+    unsigned char chain;
+};
+
+struct bc_cmd_stats
+{
+    uint64_t num;           // submitted commands
+    uint64_t wait_us;       // total time spent waiting for the command buffer
+    unsigned int max_us;    // longest single wait
+    unsigned int timeouts;
+};
+
+void bc_cmd_fil(struct bc_cmd *cmd, unsigned char chain, const unsigned char *buf);
+void bc_cmd_vil(struct bc_cmd *cmd, unsigned char chain, const unsigned char *buf, int len);
+bool bc_cmd_submit(const struct bc_cmd *cmd);
+bool bc_cmd_submit_batch(const struct bc_cmd *cmd, int num);
+void bc_cmd_set_ctrl(unsigned int mask, unsigned int bits);
+void bc_cmd_get_stats(struct bc_cmd_stats *stats);
 
 extern uint32_t g_accepted[BITMAIN_MAX_CHAIN_NUM];
 extern uint32_t g_rejected[BITMAIN_MAX_CHAIN_NUM];
@@ -1,3 +1,7 @@
+#ifdef FANCONTROL_SIM
+/* host build for tools/fansim */
+#include "tools/fansim.h"
+#else
 #include "config.h"
 
 #include <stdio.h>
@@ -7,6 +11,7 @@
 #include "compat.h"
 #include "miner.h"
 #include "util.h"
+#endif
 
 #include "fancontrol.h"
 
@@ -28,6 +33,16 @@
 
 #define WARMUP_PERIOD_SEC	(60*2)
 
+/* thermal governor: with fans on full from this far below the hot */
+/* limit, slow the chips down one PLL step at a time while the */
+/* temperature keeps rising; speed up again once it is this far */
+/* below the limit */
+#define THROTTLE_MARGIN_DEG	2
+#define THROTTLE_RELEASE_DEG	6
+/* time for a step to show in the temperature */
+#define THROTTLE_STEP_SEC	30
+#define THROTTLE_RELEASE_SEC	120
+
 const char *fancontrol_mode_name[] = {
 	"emergency",
 	"automatic",
@@ -116,6 +131,41 @@ fancontrol_setmode_emergency(struct fancontrol *fc)
 	fc->mode = FANCTRL_EMERGENCY;
 }
 
+static void
+fancontrol_throttle(struct fancontrol *fc, double now, double temp)
+{
+	double since = now - fc->throttle_changed;
+
+	if (fc->fan_duty >= FAN_DUTY_MAX &&
+	    temp >= opt_fan_hot_temp - THROTTLE_MARGIN_DEG) {
+		/* fans are saturated, step down unless the last step */
+		/* already turned the temperature around */
+		if (fc->throttle < opt_fan_max_throttle &&
+		    since >= THROTTLE_STEP_SEC &&
+		    (fc->throttle == 0 || temp >= fc->throttle_temp)) {
+			fc->throttle++;
+			fc->throttle_events++;
+			fc->throttle_changed = now;
+			fc->throttle_temp = temp;
+			fanlog(fc, "throttle: fans on full at %.2lf, chips down %d steps",
+				temp, fc->throttle);
+		}
+	} else if (fc->throttle > 0 &&
+		   temp <= opt_fan_hot_temp - THROTTLE_RELEASE_DEG &&
+		   since >= THROTTLE_RELEASE_SEC) {
+		fc->throttle--;
+		fc->throttle_changed = now;
+		fanlog(fc, "throttle: headroom at %.2lf, chips down %d steps",
+			temp, fc->throttle);
+	}
+
+	/* limit lowered at runtime */
+	if (fc->throttle > opt_fan_max_throttle) {
+		fc->throttle = opt_fan_max_throttle > 0 ? opt_fan_max_throttle : 0;
+		fc->throttle_changed = now;
+	}
+}
+
 int
 fancontrol_calculate(struct fancontrol *fc, int temp_ok, double temp)
 {
@@ -195,12 +245,16 @@ fancontrol_calculate(struct fancontrol *fc, int temp_ok, double temp)
 	fc->last_dt = dt;
 	fc->fan_duty = fan_duty;
 
+	/* an unknown temperature keeps the chips where they are */
+	if (temp_ok && temp >= MIN_TEMP && !fc->initializing)
+		fancontrol_throttle(fc, now, temp);
+
 
 	/* rotate log every x hours */
 	fancontrol_rotate_log(fc, now);
 
-	fanlog(fc, "output: fan_duty=%d dt=%.2lf mode=%d",
-		fc->fan_duty, dt, fc->mode);
+	fanlog(fc, "output: fan_duty=%d dt=%.2lf mode=%d throttle=%d",
+		fc->fan_duty, dt, fc->mode, fc->throttle);
 
 	return fan_duty;
 }
@@ -215,6 +269,8 @@ fancontrol_init(struct fancontrol *fc)
 	fc->started = cgtime_float();
 	fc->last_calc = fc->started;
 	fc->requested_fan_duty = fc->fan_duty = FAN_DUTY_MAX;
+	fc->throttle = 0;
+	fc->throttle_changed = fc->started;
 
 	PIDInit(&fc->pid, PID_KP, PID_KI, PID_KD, FAN_DUTY_MIN_WARMUP, FAN_DUTY_MAX, FAN_MIDPOINT, AUTOMATIC, REVERSE);
 	fancontrol_setmode_auto(fc, DEFAULT_TARGET_TEMP);
@@ -9,8 +9,11 @@ enum fancontrol_mode {
 };
 
 #define FANCTRL_MAX_LOG_AGE (3*3600)
+/* tools/fansim builds with its own log names */
+#ifndef FANCTRL_LOG_NAME
 #define FANCTRL_LOG_NAME "/tmp/fanctrl.log"
 #define FANCTRL_OLDLOG_NAME "/tmp/fanctrl.prev.log"
+#endif
 
 extern const char *fancontrol_mode_name[];
 
@@ -25,6 +28,11 @@ struct fancontrol {
 	double log_started;
 	FILE *log;
 	PIDControl pid;
+	/* thermal governor: PLL steps the chips are slowed down by */
+	int throttle;
+	int throttle_events;
+	double throttle_changed;
+	double throttle_temp;	/* temperature at the last step down */
 };
 
 void fancontrol_init(struct fancontrol *fc);
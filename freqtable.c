@@ -0,0 +1,212 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "miner.h"
+#include "util.h"
+
+#include "driver-btm-c5.h"
+
+/*
+ * Frequency index of every chip as loaded from the PIC flash (last_freq on
+ * S9/T9/R4, chain_pic_buf on T9+) and the per-chain sums derived from it.
+ * Kept apart from the driver so the host side tools/freqtest can check it.
+ */
+
+#ifdef T9_18
+void getPICChainIndexOffset(int chainIndex, int *pChain, int *pOffset)
+{
+    int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset;
+    switch(chainIndex)
+    {
+        case 1:
+            new_T9_PLUS_chainIndex=1;
+            new_T9_PLUS_chainOffset=0;
+            break;
+        case 8:
+            new_T9_PLUS_chainIndex=1;
+            new_T9_PLUS_chainOffset=1;
+            break;
+        case 9:
+            new_T9_PLUS_chainIndex=1;
+            new_T9_PLUS_chainOffset=2;
+            break;
+        case 2:
+            new_T9_PLUS_chainIndex=2;
+            new_T9_PLUS_chainOffset=0;
+            break;
+        case 10:
+            new_T9_PLUS_chainIndex=2;
+            new_T9_PLUS_chainOffset=1;
+            break;
+        case 11:
+            new_T9_PLUS_chainIndex=2;
+            new_T9_PLUS_chainOffset=2;
+            break;
+        case 3:
+            new_T9_PLUS_chainIndex=3;
+            new_T9_PLUS_chainOffset=0;
+            break;
+        case 12:
+            new_T9_PLUS_chainIndex=3;
+            new_T9_PLUS_chainOffset=1;
+            break;
+        case 13:
+            new_T9_PLUS_chainIndex=3;
+            new_T9_PLUS_chainOffset=2;
+            break;
+        default:
+            new_T9_PLUS_chainIndex=0;
+            new_T9_PLUS_chainOffset=0;
+            break;
+    }
+
+    *pChain=new_T9_PLUS_chainIndex;
+    *pOffset=new_T9_PLUS_chainOffset;
+}
+#endif
+
+int getChainAsicFreqIndex(int chainIndex, int asicIndex)
+{
+#ifdef T9_18
+    if(fpga_version>=0xE)
+    {
+        int new_T9_PLUS_chainIndex,new_T9_PLUS_chainOffset; // only used by new T9+ FPGA
+        getPICChainIndexOffset(chainIndex,&new_T9_PLUS_chainIndex,&new_T9_PLUS_chainOffset);
+
+        return chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+asicIndex];
+    }
+    else
+    {
+        return chain_pic_buf[((chainIndex/3)*3)][7+(chainIndex%3)*31+4+asicIndex];
+    }
+#else
+    return last_freq[chainIndex][asicIndex*2+3];
+#endif
+}
+
+/* rebuilt from the API and watchdog threads while autotune, the thermal
+ * governor and re-init apply deltas, one lock keeps sums and valid in step */
+static pthread_mutex_t chain_freq_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct chain_freq_stats chain_freq_stats[BITMAIN_MAX_CHAIN_NUM];
+
+void invalidate_chain_freq_stats(int chain)
+{
+	pthread_mutex_lock(&chain_freq_stats_lock);
+	chain_freq_stats[chain].valid = 0;
+	pthread_mutex_unlock(&chain_freq_stats_lock);
+}
+
+struct chain_freq_stats get_chain_freq_stats(int chain)
+{
+	struct chain_freq_stats *st = &chain_freq_stats[chain];
+	struct chain_freq_stats ret;
+	int n_asic = dev->chain_asic_num[chain];
+
+	pthread_mutex_lock(&chain_freq_stats_lock);
+	if (st->valid && st->asic_num == n_asic) {
+		ret = *st;
+		pthread_mutex_unlock(&chain_freq_stats_lock);
+		return ret;
+	}
+
+	st->sum_freq = 0;
+	st->sum_rate = 0;
+	st->ideal_rate = 0;
+	for (int j = 0; j < CHAIN_ASIC_NUM; j++) {
+		const struct freq_pll *pll = &freq_pll_1385[getChainAsicFreqIndex(chain, j)];
+		int freq = pll->freq;
+		int rate = pll->rate - freq * chain_badcore_num[chain][j];
+		if (j < n_asic) {
+			st->sum_freq += freq;
+			st->sum_rate += rate;
+		}
+		st->ideal_rate += rate;
+	}
+	st->asic_num = n_asic;
+	st->valid = 1;
+	ret = *st;
+	pthread_mutex_unlock(&chain_freq_stats_lock);
+
+	return ret;
+}
+
+/* change frequency index of one chip in the frequency table (without
+ * programming it) and keep the cached chain sums up to date */
+void setChainAsicFreqIndex(int chainIndex, int asicIndex, int index)
+{
+	struct chain_freq_stats *st = &chain_freq_stats[chainIndex];
+	int old_freq, delta;
+	int cores = BM1387_CORE_NUM - chain_badcore_num[chainIndex][asicIndex];
+
+	pthread_mutex_lock(&chain_freq_stats_lock);
+	old_freq = freq_pll_1385[getChainAsicFreqIndex(chainIndex, asicIndex)].freq;
+	delta = (int)freq_pll_1385[index].freq - old_freq;
+
+#ifdef T9_18
+	if (fpga_version >= 0xE) {
+		int new_T9_PLUS_chainIndex, new_T9_PLUS_chainOffset;
+		getPICChainIndexOffset(chainIndex, &new_T9_PLUS_chainIndex, &new_T9_PLUS_chainOffset);
+		chain_pic_buf[new_T9_PLUS_chainIndex][7+new_T9_PLUS_chainOffset*31+4+asicIndex] = index;
+	} else {
+		chain_pic_buf[((chainIndex/3)*3)][7+(chainIndex%3)*31+4+asicIndex] = index;
+	}
+#else
+	last_freq[chainIndex][asicIndex*2+3] = index;
+#endif
+
+	if (st->valid) {
+		st->ideal_rate += delta * cores;
+		if (asicIndex < st->asic_num) {
+			st->sum_freq += delta;
+			st->sum_rate += delta * cores;
+		}
+	}
+	pthread_mutex_unlock(&chain_freq_stats_lock);
+}
+
+/* always return _some_ valid index */
+int get_pll_index(int freq)
+{
+    int i;
+	int n = FREQ_PLL_NUM;
+    for (i = 0; i < n; i++) {
+		if (freq <= (int)freq_pll_1385[i].freq)
+			break;
+    }
+
+    if(i >= n) {
+        i = n - 1;
+    }
+
+    return i;
+}
+
+int get_freqvalue_by_index(int index)
+{
+    return freq_pll_1385[index].freq;
+}
+
+int GetTotalRate()
+{
+    int i;
+    int totalrate=0;
+    for(i=0; i<BITMAIN_MAX_CHAIN_NUM; i++)
+    {
+        if(dev->chain_exist[i] == 1)
+            totalrate+=get_chain_freq_stats(i).ideal_rate;
+    }
+
+    return (totalrate/1000);
+}
+
+int GetBoardRate(int chainIndex)
+{
+    if(dev->chain_exist[chainIndex] != 1)
+        return 0;
+
+    return (get_chain_freq_stats(chainIndex).ideal_rate/1000);
+}
@@ -15,6 +15,7 @@
 #include <unistd.h>
 
 #include "logging.h"
+#include "logwriter.h"
 #include "miner.h"
 
 bool opt_debug              = false;
@@ -26,6 +27,72 @@ bool g_logfile_enable       = false;
 char g_logfile_path[256]    = {0};
 char g_logfile_openflag[32] = {0};
 
+const char *log_subsys_name[LOGS_NUM] = {
+    [LOGS_CORE]  = "core",
+    [LOGS_NONCE] = "nonce",
+    [LOGS_WORK]  = "work",
+};
+int log_subsys_level[LOGS_NUM] = { [0 ... LOGS_NUM - 1] = -1 };
+int log_level_cut[LOGS_NUM] = { [0 ... LOGS_NUM - 1] = LOG_NOTICE };
+
+static const char *log_level_name[] = {
+    [LOG_ERR]     = "err",
+    [LOG_WARNING] = "warning",
+    [LOG_NOTICE]  = "notice",
+    [LOG_INFO]    = "info",
+    [LOG_DEBUG]   = "debug",
+};
+
+void log_update_levels(void)
+{
+    int cut, i;
+
+    /* same rules the applog() macros used to evaluate on every call */
+    if (use_syslog || opt_log_output)
+        cut = LOG_DEBUG;
+    else
+        cut = opt_log_level;
+    if (!opt_debug && cut > LOG_INFO)
+        cut = LOG_INFO;
+
+    for (i = 0; i < LOGS_NUM; i++)
+        log_level_cut[i] = log_subsys_level[i] >= 0 ? log_subsys_level[i] : cut;
+}
+
+/* "debug", "info", ... or a number, -1 for "default" or an unknown name */
+int log_parse_level(const char *name)
+{
+    unsigned int i;
+
+    if (name[0] >= '0' && name[0] <= '9')
+    {
+        i = atoi(name);
+        return i <= LOG_DEBUG ? (int)i : -1;
+    }
+    for (i = 0; i < sizeof(log_level_name) / sizeof(log_level_name[0]); i++)
+    {
+        if (log_level_name[i] && !strcasecmp(name, log_level_name[i]))
+            return i;
+    }
+    return -1;
+}
+
+bool log_set_subsys_level(const char *subsys, int level)
+{
+    int i;
+
+    for (i = 0; i < LOGS_NUM; i++)
+    {
+        if (!strcasecmp(subsys, log_subsys_name[i]))
+        {
+            log_subsys_level[i] = level;
+            log_update_levels();
+            return true;
+        }
+    }
+    return false;
+}
+
 static void my_log_curses(int prio, const char *datetime, const char *str, bool force)
 {
     if (opt_quiet && prio != LOG_ERR)
@@ -72,46 +139,50 @@ void _applog(int prio, const char *str, bool force)
 #endif
     else
     {
+        static int stderr_tty = -1;
         char datetime[64];
         struct timeval tv = {0, 0};
-        struct tm *tm;
 
         cgtime(&tv);
+        logwriter_timestamp(datetime, sizeof(datetime), &tv);
 
-        const time_t tmp_time = tv.tv_sec;
-        int ms = (int)(tv.tv_usec / 1000);
-        tm = localtime(&tmp_time);
-
-        snprintf(datetime, sizeof(datetime), " [%d-%02d-%02d %02d:%02d:%02d.%03d] ",
-                 tm->tm_year + 1900,
-                 tm->tm_mon + 1,
-                 tm->tm_mday,
-                 tm->tm_hour,
-                 tm->tm_min,
-                 tm->tm_sec, ms);
+        if (stderr_tty < 0)
+        {
+            stderr_tty = isatty(fileno((FILE *)stderr));
+        }
 
         /* Only output to stderr if it's not going to the screen as well */
-        if (!isatty(fileno((FILE *)stderr)))
+        if (!stderr_tty)
         {
-            fprintf(stderr, "%s%s\n", datetime, str);   /* atomic write to stderr */
-            fflush(stderr);
+            if (!logwriter_write(LOGW_STDERR, datetime, str, "\n"))
+            {
+                fprintf(stderr, "%s%s\n", datetime, str);   /* atomic write to stderr */
+                fflush(stderr);
+            }
         }
         if(g_logfile_enable)
         {
-
-            if(!g_log_file)
-            {
-                g_log_file = fopen(g_logfile_path, g_logfile_openflag);
-            }
-
-            if(g_log_file)
+            if (!logwriter_write(LOGW_LOGFILE, datetime, str, "\n"))
             {
-                fwrite(datetime, strlen(datetime), 1, g_log_file);
-                fwrite(str, strlen(str), 1, g_log_file);
-                fwrite("\n", 1, 1, g_log_file);
-                fflush(g_log_file);
+                if(!g_log_file)
+                {
+                    g_log_file = fopen(g_logfile_path, g_logfile_openflag);
+                }
+
+                if(g_log_file)
+                {
+                    fwrite(datetime, strlen(datetime), 1, g_log_file);
+                    fwrite(str, strlen(str), 1, g_log_file);
+                    fwrite("\n", 1, 1, g_log_file);
+                    fflush(g_log_file);
+                }
             }
         }
+        /* forced messages usually precede exit, get them out now */
+        if (force)
+        {
+            logwriter_flush();
+        }
 
         my_log_curses(prio, datetime, str, force);
     }
@@ -27,6 +27,33 @@ extern bool want_per_device_stats;
 /* global log_level, messages with lower or equal prio are logged */
 extern int opt_log_level;
 
+/* log subsystems, keep in sync with log_subsys_name */
+enum log_subsys
+{
+    LOGS_CORE,      /* everything logged through plain applog() */
+    LOGS_NONCE,     /* nonce readout and submission */
+    LOGS_WORK,      /* job and work dispatch to the chains */
+    LOGS_NUM,
+};
+
+extern const char *log_subsys_name[LOGS_NUM];
+/* per subsystem level set through the API, -1 follows the global options */
+extern int log_subsys_level[LOGS_NUM];
+/*
+ * Highest priority logged per subsystem, derived from the above and
+ * opt_debug/opt_log_output/use_syslog/opt_log_level by log_update_levels(),
+ * which has to be called whenever any of those change.
+ */
+extern int log_level_cut[LOGS_NUM];
+
+extern void log_update_levels(void);
+extern int log_parse_level(const char *name);
+extern bool log_set_subsys_level(const char *subsys, int level);
+
+/* a disabled message costs this one compare, the arguments are not evaluated */
+#define applog_enabled(subsys, prio) \
+    __builtin_expect((prio) <= log_level_cut[subsys], 0)
+
 #define SAVE_LAST_QUIT_FILE "/tmp/cgminer_quit_reason"
 
 #define LOGBUFSIZ 2048
@@ -38,44 +65,38 @@ extern void save_last_quit(int status, const char *str);
 
 #define IN_FMT_FFL " in %s %s():%d"
 
-#define applog(prio, fmt, ...) do { \
-    if (opt_debug || prio != LOG_DEBUG) { \
-        if (use_syslog || opt_log_output || prio <= opt_log_level) { \
-            char tmp42[LOGBUFSIZ]; \
-            snprintf(tmp42, sizeof(tmp42), fmt, ##__VA_ARGS__); \
-            _applog(prio, tmp42, false); \
-        } \
+#define applog_sub(subsys, prio, fmt, ...) do { \
+    if (applog_enabled(subsys, prio)) { \
+        char tmp42[LOGBUFSIZ]; \
+        snprintf(tmp42, sizeof(tmp42), fmt, ##__VA_ARGS__); \
+        _applog(prio, tmp42, false); \
     } \
 } while (0)
 
+#define applog(prio, fmt, ...) applog_sub(LOGS_CORE, prio, fmt, ##__VA_ARGS__)
+
 #define simplelog(prio, fmt, ...) do { \
-    if (opt_debug || prio != LOG_DEBUG) { \
-        if (use_syslog || opt_log_output || prio <= opt_log_level) { \
-            char tmp42[LOGBUFSIZ]; \
-            snprintf(tmp42, sizeof(tmp42), fmt, ##__VA_ARGS__); \
-            _simplelog(prio, tmp42, false); \
-        } \
+    if (applog_enabled(LOGS_CORE, prio)) { \
+        char tmp42[LOGBUFSIZ]; \
+        snprintf(tmp42, sizeof(tmp42), fmt, ##__VA_ARGS__); \
+        _simplelog(prio, tmp42, false); \
     } \
 } while (0)
 
 // unused here
 #define applogsiz(prio, _SIZ, fmt, ...) do { \
-    if (opt_debug || prio != LOG_DEBUG) { \
-        if (use_syslog || opt_log_output || prio <= opt_log_level) { \
-            char tmp42[_SIZ]; \
-            snprintf(tmp42, sizeof(tmp42), fmt, ##__VA_ARGS__); \
-            _applog(prio, tmp42, false); \
-        } \
+    if (applog_enabled(LOGS_CORE, prio)) { \
+        char tmp42[_SIZ]; \
+        snprintf(tmp42, sizeof(tmp42), fmt, ##__VA_ARGS__); \
+        _applog(prio, tmp42, false); \
     } \
 } while (0)
 
 #define forcelog(prio, fmt, ...) do { \
-    if (opt_debug || prio != LOG_DEBUG) { \
-        if (use_syslog || opt_log_output || prio <= opt_log_level) { \
-            char tmp42[LOGBUFSIZ]; \
-            snprintf(tmp42, sizeof(tmp42), fmt, ##__VA_ARGS__); \
-            _applog(prio, tmp42, true); \
-        } \
+    if (applog_enabled(LOGS_CORE, prio)) { \
+        char tmp42[LOGBUFSIZ]; \
+        snprintf(tmp42, sizeof(tmp42), fmt, ##__VA_ARGS__); \
+        _applog(prio, tmp42, true); \
     } \
 } while (0)
 
@@ -0,0 +1,316 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "miner.h"
+#include "util.h"
+
+#include "logwriter.h"
+
+/*
+ * Each logging thread owns a single producer/single consumer byte ring,
+ * so queueing a message is a couple of memcpys and one release store.
+ * The writer thread collects all rings into one buffer per destination
+ * and writes it with a single syscall (open/write/close for the /tmp
+ * logs, so they may be truncated or copied by other code at any time).
+ */
+
+struct logw_rec {
+	uint16_t len;
+	uint8_t dest;
+	uint8_t pad;
+};
+
+#define LOGW_REC_WRAP	0xff	/* dest of the filler record at the ring end */
+#define LOGW_ALIGN(x)	(((x) + 3) & ~3u)
+#define LOGW_BATCH_SIZE	(32*1024)
+
+struct logw_ring {
+	struct logw_ring *next;
+	unsigned head;		/* written by the owning thread */
+	unsigned tail;		/* written by the consumer */
+	int dead;		/* owning thread exited */
+	char buf[LOGW_RING_SIZE];
+};
+
+struct logw_batch {
+	size_t len;
+	uint64_t dropped_reported;
+	char buf[LOGW_BATCH_SIZE];
+};
+
+static const char *logw_path[LOGW_DEST_NUM] = {
+	[LOGW_FREQ] = "/tmp/freq",
+	[LOGW_TEMP] = "/tmp/temp",
+};
+
+static pthread_once_t logw_once = PTHREAD_ONCE_INIT;
+static pthread_key_t logw_key;
+static bool logw_running;
+/* protects the ring list and everything on the consumer side */
+static pthread_mutex_t logw_lock = PTHREAD_MUTEX_INITIALIZER;
+/* kicked by producers whose ring is filling up */
+static pthread_cond_t logw_cond = PTHREAD_COND_INITIALIZER;
+static struct logw_ring *logw_rings;
+static struct logw_batch logw_batch[LOGW_DEST_NUM];
+static uint64_t logw_dropped[LOGW_DEST_NUM];
+
+static void logw_thread_exit(void *arg)
+{
+	struct logw_ring *ring = arg;
+
+	__atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void logw_batch_flush(int dest)
+{
+	struct logw_batch *b = &logw_batch[dest];
+	int fd;
+
+	if (b->len == 0)
+		return;
+
+	switch (dest) {
+	case LOGW_STDERR:
+		if (write(STDERR_FILENO, b->buf, b->len) < 0)
+			;
+		break;
+	case LOGW_LOGFILE:
+		if (!g_logfile_enable)
+			break;
+		if (!g_log_file)
+			g_log_file = fopen(g_logfile_path, g_logfile_openflag);
+		if (g_log_file) {
+			fwrite(b->buf, b->len, 1, g_log_file);
+			fflush(g_log_file);
+		}
+		break;
+	default:
+		fd = open(logw_path[dest], O_WRONLY | O_APPEND | O_CREAT, 0644);
+		if (fd >= 0) {
+			if (write(fd, b->buf, b->len) < 0)
+				;
+			close(fd);
+		}
+		break;
+	}
+	b->len = 0;
+}
+
+static void logw_batch_add(int dest, const char *data, size_t len)
+{
+	struct logw_batch *b = &logw_batch[dest];
+
+	if (b->len + len > sizeof(b->buf))
+		logw_batch_flush(dest);
+	memcpy(b->buf + b->len, data, len);
+	b->len += len;
+}
+
+static void logw_drain_ring(struct logw_ring *ring)
+{
+	unsigned head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	unsigned tail = ring->tail;
+
+	while (tail != head) {
+		struct logw_rec *rec = (struct logw_rec *)(ring->buf + (tail & (LOGW_RING_SIZE - 1)));
+
+		if (rec->dest == LOGW_REC_WRAP) {
+			tail += LOGW_RING_SIZE - (tail & (LOGW_RING_SIZE - 1));
+			continue;
+		}
+		logw_batch_add(rec->dest, (char *)(rec + 1), rec->len);
+		tail += LOGW_ALIGN(sizeof(*rec) + rec->len);
+	}
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+/* call with logw_lock held */
+static void logw_drain(void)
+{
+	struct logw_ring **pp = &logw_rings;
+	char line[64];
+	int i;
+
+	while (*pp) {
+		struct logw_ring *ring = *pp;
+		int dead = __atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE);
+
+		logw_drain_ring(ring);
+		if (dead) {
+			*pp = ring->next;
+			free(ring);
+			continue;
+		}
+		pp = &ring->next;
+	}
+
+	for (i = 0; i < LOGW_DEST_NUM; i++) {
+		uint64_t dropped = __atomic_load_n(&logw_dropped[i], __ATOMIC_RELAXED);
+
+		if (dropped != logw_batch[i].dropped_reported) {
+			int len = snprintf(line, sizeof(line), "logwriter: %llu messages dropped\n",
+					   (unsigned long long)(dropped - logw_batch[i].dropped_reported));
+			logw_batch_add(i, line, len);
+			logw_batch[i].dropped_reported = dropped;
+		}
+		logw_batch_flush(i);
+	}
+}
+
+static void *logw_thread(void *arg)
+{
+	pthread_detach(pthread_self());
+	RenameThread("logwriter");
+
+	mutex_lock(&logw_lock);
+	while (1) {
+		struct timespec ts, tdiff;
+		struct timeval now;
+
+		cgtime(&now);
+		timeval_to_spec(&ts, &now);
+		ms_to_timespec(&tdiff, LOGW_DRAIN_MS);
+		timeraddspec(&ts, &tdiff);
+		pthread_cond_timedwait(&logw_cond, &logw_lock, &ts);
+		logw_drain();
+	}
+	mutex_unlock(&logw_lock);
+	return NULL;
+}
+
+static void logw_init(void)
+{
+	pthread_t thr;
+
+	if (pthread_key_create(&logw_key, logw_thread_exit))
+		return;
+	if (pthread_create(&thr, NULL, logw_thread, NULL))
+		return;
+	logw_running = true;
+}
+
+static struct logw_ring *logw_get_ring(void)
+{
+	struct logw_ring *ring;
+
+	pthread_once(&logw_once, logw_init);
+	if (!logw_running)
+		return NULL;
+
+	ring = pthread_getspecific(logw_key);
+	if (ring)
+		return ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+	if (pthread_setspecific(logw_key, ring)) {
+		free(ring);
+		return NULL;
+	}
+	mutex_lock(&logw_lock);
+	ring->next = logw_rings;
+	logw_rings = ring;
+	mutex_unlock(&logw_lock);
+	return ring;
+}
+
+bool logwriter_write(int dest, const char *prefix, const char *str, const char *suffix)
+{
+	struct logw_ring *ring = logw_get_ring();
+	size_t plen = prefix ? strlen(prefix) : 0;
+	size_t slen = str ? strlen(str) : 0;
+	size_t xlen = suffix ? strlen(suffix) : 0;
+	size_t len = plen + slen + xlen;
+	unsigned need = LOGW_ALIGN(sizeof(struct logw_rec) + len);
+	unsigned head, tail, off, room;
+	struct logw_rec *rec;
+	char *p;
+
+	if (!ring)
+		return false;
+
+	if (need > LOGW_RING_SIZE / 2)
+		goto drop;
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	off = head & (LOGW_RING_SIZE - 1);
+	room = LOGW_RING_SIZE - off;
+
+	/* records never wrap, fill the end of the ring and start over */
+	if (room < need) {
+		if (LOGW_RING_SIZE - (head - tail) < room + need)
+			goto drop;
+		rec = (struct logw_rec *)(ring->buf + off);
+		rec->dest = LOGW_REC_WRAP;
+		head += room;
+		off = 0;
+	} else if (LOGW_RING_SIZE - (head - tail) < need) {
+		goto drop;
+	}
+
+	rec = (struct logw_rec *)(ring->buf + off);
+	rec->len = len;
+	rec->dest = dest;
+	p = (char *)(rec + 1);
+	if (plen)
+		memcpy(p, prefix, plen);
+	if (slen)
+		memcpy(p + plen, str, slen);
+	if (xlen)
+		memcpy(p + plen + slen, suffix, xlen);
+	__atomic_store_n(&ring->head, head + need, __ATOMIC_RELEASE);
+	if (head + need - tail > LOGW_RING_SIZE / 2)
+		pthread_cond_signal(&logw_cond);
+	return true;
+
+drop:
+	__atomic_fetch_add(&logw_dropped[dest], 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+void logwriter_flush(void)
+{
+	if (!logw_running)
+		return;
+	mutex_lock(&logw_lock);
+	logw_drain();
+	mutex_unlock(&logw_lock);
+}
+
+uint64_t logwriter_dropped(void)
+{
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < LOGW_DEST_NUM; i++)
+		sum += __atomic_load_n(&logw_dropped[i], __ATOMIC_RELAXED);
+	return sum;
+}
+
+void logwriter_timestamp(char *buf, int size, const struct timeval *tv)
+{
+	static __thread time_t cached_sec = -1;
+	static __thread char cached[80];
+
+	if (tv->tv_sec != cached_sec) {
+		struct tm tm;
+		time_t t = tv->tv_sec;
+
+		localtime_r(&t, &tm);
+		snprintf(cached, sizeof(cached), "%d-%02d-%02d %02d:%02d:%02d",
+			 tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+			 tm.tm_hour, tm.tm_min, tm.tm_sec);
+		cached_sec = tv->tv_sec;
+	}
+	snprintf(buf, size, " [%s.%03d] ", cached, (int)(tv->tv_usec / 1000));
+}
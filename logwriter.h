@@ -0,0 +1,36 @@
+#ifndef __LOGWRITER_H__
+#define __LOGWRITER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+/* log destinations served by the background writer */
+enum logwriter_dest {
+	LOGW_STDERR,
+	LOGW_LOGFILE,	/* g_logfile_path, see --logfile */
+	LOGW_FREQ,	/* /tmp/freq, bring-up log */
+	LOGW_TEMP,	/* /tmp/temp, temperature log */
+	LOGW_DEST_NUM,
+};
+
+/* per calling thread ring size, must be a power of two */
+#define LOGW_RING_SIZE		(16*1024)
+/* how often the writer thread drains the rings */
+#define LOGW_DRAIN_MS		20
+
+/*
+ * Queue prefix + str + suffix (any of them may be NULL) as one record.
+ * Never blocks; when the calling thread's ring is full the record is
+ * counted as dropped. Returns false if asynchronous logging is not
+ * available and the caller has to write synchronously.
+ */
+bool logwriter_write(int dest, const char *prefix, const char *str, const char *suffix);
+/* write everything queued so far, from any thread (clear/copy of a log, exit) */
+void logwriter_flush(void);
+uint64_t logwriter_dropped(void);
+
+/* " [YYYY-MM-DD HH:MM:SS.mmm] " of tv, the date part is cached per thread */
+void logwriter_timestamp(char *buf, int size, const struct timeval *tv);
+
+#endif /* __LOGWRITER_H__ */
@@ -972,6 +972,7 @@ struct pool;
 #define API_MCAST_CODE "FTW"
 #define API_MCAST_ADDR "224.0.0.75"
 
+extern FILE * g_log_file;
 extern bool g_logfile_enable;
 extern char g_logfile_path[256];
 extern char g_logfile_openflag[32];
@@ -981,6 +982,7 @@ extern FILE * g_logwork_diffs[65];
 extern int g_logwork_asicnum;
 
 extern bool opt_no_sensor_scan;
+extern bool opt_sensor_cache;
 extern bool opt_work_update;
 extern bool opt_protocol;
 extern bool have_longpoll;
@@ -1006,6 +1008,7 @@ extern int opt_api_mcast_port;
 extern char *opt_api_groups;
 extern char *opt_api_description;
 extern int opt_api_port;
+extern int opt_api_cache_ms;
 extern char *opt_api_host;
 extern bool opt_api_listen;
 extern bool opt_api_network;
@@ -1020,6 +1023,7 @@ extern int opt_fan_ctrl;
 extern int opt_fan_ctrl_set;
 extern int opt_fan_dangerous_temp;
 extern int opt_fan_hot_temp;
+extern int opt_fan_max_throttle;
 extern int opt_disable_sensors, opt_disable_sensors_set;
 extern int opt_disable_remote_sensors, opt_disable_remote_sensors_set;
 extern float opt_overclock;
@@ -1588,6 +1592,7 @@ struct api_data
     char *name;
     void *data;
     bool data_was_malloc;
+    bool in_arena;  // name, data and node belong to the API request arena
     struct api_data *prev;
     struct api_data *next;
 };
@@ -2,6 +2,8 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
 #include <math.h>
 
 #include "compat.h"
@@ -10,9 +12,13 @@
 
 #include "sensors.h"
 #include "driver-btm-c5.h"
+#include "crc.h"
 
 #define CHIP_ID_TO_ADDR(x) (((x) - 1) * 4)
 #define I2C_SCAN_LOG_NAME "/tmp/i2c_scan.log"
+#define SENSOR_CACHE_FILE "/etc/bmminer/sensor_cache"
+#define SENSOR_CACHE_MAGIC 0x534e5302
+#define SENSOR_CACHE_PER_CHAIN 4
 
 static FILE *i2c_scan_log;
 
@@ -312,6 +318,157 @@ scan_i2c_sensors(int chain, int bus)
 	}
 }
 
+/*
+ * Sensors found by the last probe, so the next start only has to check
+ * their manufacturer id instead of trying every candidate address
+ */
+
+struct sensor_cache_entry {
+	uint8_t bus;
+	uint8_t chip_addr;
+	uint8_t i2c_addr;
+	uint8_t man_id;
+};
+
+struct sensor_cache {
+	uint32_t magic;
+	struct {
+		uint8_t probed;		/* n is known, 0 means no sensor */
+		uint8_t bus;
+		uint8_t n;
+		struct sensor_cache_entry sensor[SENSOR_CACHE_PER_CHAIN];
+	} chain[BITMAIN_MAX_CHAIN_NUM];
+	uint16_t crc;
+};
+
+static struct sensor_cache sensor_cache;
+static int sensor_cache_loaded;
+static int sensor_cache_dirty;
+
+static void
+sensor_cache_load(void)
+{
+	FILE *f;
+	size_t len;
+
+	if (sensor_cache_loaded)
+		return;
+	sensor_cache_loaded = 1;
+
+	memset(&sensor_cache, 0, sizeof(sensor_cache));
+	if (!opt_sensor_cache)
+		return;
+
+	f = fopen(SENSOR_CACHE_FILE, "rb");
+	if (f == NULL)
+		return;
+	len = fread(&sensor_cache, 1, sizeof(sensor_cache), f);
+	fclose(f);
+
+	if (len != sizeof(sensor_cache) || sensor_cache.magic != SENSOR_CACHE_MAGIC ||
+	    sensor_cache.crc != CRC16((uint8_t *)&sensor_cache, offsetof(struct sensor_cache, crc))) {
+		applog(LOG_NOTICE, "%s is not valid, ignored", SENSOR_CACHE_FILE);
+		memset(&sensor_cache, 0, sizeof(sensor_cache));
+	}
+}
+
+static void
+sensor_cache_store(int chain, int bus, struct sensor *sensors, int n)
+{
+	struct sensor_cache_entry entry[SENSOR_CACHE_PER_CHAIN];
+
+	if (chain >= BITMAIN_MAX_CHAIN_NUM)
+		return;
+	if (n > SENSOR_CACHE_PER_CHAIN)
+		n = SENSOR_CACHE_PER_CHAIN;
+
+	memset(entry, 0, sizeof(entry));
+	for (int i = 0; i < n; i++) {
+		entry[i].bus = sensors[i].dev.bus;
+		entry[i].chip_addr = sensors[i].dev.chip_addr;
+		entry[i].i2c_addr = sensors[i].dev.i2c_addr;
+		entry[i].man_id = sensors[i].ops->manufacturer_id;
+	}
+	if (sensor_cache.chain[chain].probed && sensor_cache.chain[chain].bus == bus &&
+	    sensor_cache.chain[chain].n == n &&
+	    memcmp(sensor_cache.chain[chain].sensor, entry, sizeof(entry)) == 0)
+		return;
+
+	sensor_cache.chain[chain].probed = 1;
+	sensor_cache.chain[chain].bus = bus;
+	sensor_cache.chain[chain].n = n;
+	memcpy(sensor_cache.chain[chain].sensor, entry, sizeof(entry));
+	sensor_cache_dirty = 1;
+}
+
+void
+sensor_cache_save(void)
+{
+	FILE *f;
+	size_t len;
+
+	if (!opt_sensor_cache || !sensor_cache_dirty)
+		return;
+
+	sensor_cache.magic = SENSOR_CACHE_MAGIC;
+	sensor_cache.crc = CRC16((uint8_t *)&sensor_cache, offsetof(struct sensor_cache, crc));
+
+	f = fopen(SENSOR_CACHE_FILE ".tmp", "wb");
+	if (f == NULL)
+		return;
+	len = fwrite(&sensor_cache, 1, sizeof(sensor_cache), f);
+	fclose(f);
+	if (len == sizeof(sensor_cache))
+		rename(SENSOR_CACHE_FILE ".tmp", SENSOR_CACHE_FILE);
+	else
+		unlink(SENSOR_CACHE_FILE ".tmp");
+	sensor_cache_dirty = 0;
+}
+
+/*
+ * Set up the sensors remembered for this chain. Returns their number, 0
+ * when the chain had no sensor last time, or -1 when nothing usable is
+ * remembered or any of them does not answer with the same manufacturer
+ * id anymore.
+ */
+static int
+probe_cached_sensors(int chain, int bus, struct sensor *sensors, int max_sensors)
+{
+	int n, ret;
+
+	if (!opt_sensor_cache || chain >= BITMAIN_MAX_CHAIN_NUM)
+		return -1;
+	if (!sensor_cache.chain[chain].probed || sensor_cache.chain[chain].bus != bus)
+		return -1;
+	n = sensor_cache.chain[chain].n;
+	if (n > max_sensors)
+		return -1;
+
+	for (int i = 0; i < n; i++) {
+		struct sensor_cache_entry *entry = &sensor_cache.chain[chain].sensor[i];
+		struct sensor *sensor = &sensors[i];
+
+		memset(sensor, 0, sizeof(*sensor));
+		if (entry->bus != bus)
+			return -1;
+		i2c_makedev(&sensor->dev, chain, bus, entry->chip_addr, entry->i2c_addr);
+
+		ret = i2c_start_dev(&sensor->dev);
+		if (ret == 0)
+			ret = probe_sensor_addr(sensor);
+		if (ret < 0 || sensor->ops->manufacturer_id != entry->man_id) {
+			applog(LOG_NOTICE, "chain %d: cached sensor at chip_addr=%02x, i2c_addr=%02x not found, probing",
+				chain, entry->chip_addr, entry->i2c_addr);
+			return -1;
+		}
+		applog(LOG_NOTICE, "chain %d: found cached sensor %s at chip_addr=%02x, i2c_addr=%02x",
+			chain, sensor->ops->name,
+			sensor->dev.chip_addr,
+			sensor->dev.i2c_addr);
+	}
+	return n;
+}
+
 static int probe_chip_addrs[] = {
 	CHIP_ID_TO_ADDR(62),
 };
@@ -324,13 +481,18 @@ static int probe_i2c_addrs[] = {
 int
 probe_sensors(int chain, int bus, struct sensor *sensors, int max_sensors)
 {
-	int ret;
+	int ret, cached;
 	int n = 0;
 
 #if 0
 	applog(LOG_NOTICE, "probing sensors: chain=%d max_sensors=%d",
 		chain, max_sensors);
 #endif
+	sensor_cache_load();
+	cached = probe_cached_sensors(chain, bus, sensors, max_sensors);
+	if (cached > 0)
+		return cached;
+
 	for (int i = 0; i < ARRAY_SIZE(probe_chip_addrs); i++) {
 		for (int j = 0; j < ARRAY_SIZE(probe_i2c_addrs); j++) {
 			struct sensor *sensor = &sensors[n];
@@ -365,22 +527,56 @@ probe_sensors(int chain, int bus, struct sensor *sensors, int max_sensors)
 	}
 	if (n == 0) {
 		applog(LOG_WARNING, "chain %d: no sensors found!", chain);
-		/* beware the double negative */
-		if (!opt_no_sensor_scan)
+		/* beware the double negative; a chain known to have none
+		 * was scanned already when that was found out */
+		if (cached == 0)
+			applog(LOG_NOTICE, "chain %d: no sensors last time either, I2C scan skipped", chain);
+		else if (!opt_no_sensor_scan)
 			scan_i2c_sensors(chain, bus);
 	}
 done:
+	sensor_cache_store(chain, bus, sensors, n);
 	return n;
 }
 
+static inline float
+temp_hottest(struct temp *temp)
+{
+	return MAX(temp->local, temp->remote);
+}
+
 int
 sensor_read_temp(struct sensor *sensor, struct temp *temp)
 {
+	struct timeval start, end;
 	int ret;
+
+	cgtime(&start);
 	ret = i2c_start_dev(&sensor->dev);
-	if (ret < 0)
+	if (ret >= 0)
+		ret = sensor->ops->read_temp(sensor, temp);
+	cgtime(&end);
+
+	/* account the read */
+	sensor->age = 0;
+	sensor->reads++;
+	sensor->last_us = us_tdiff(&end, &start);
+	sensor->max_us = MAX(sensor->max_us, sensor->last_us);
+	sensor->total_us += sensor->last_us;
+
+	if (ret < 0) {
+		sensor->failures++;
+		sensor->backoff = sensor->backoff ? MIN(sensor->backoff * 2, SensorMaxBackoff) : 1;
 		return ret;
-	return sensor->ops->read_temp(sensor, temp);
+	}
+	if (sensor->valid) {
+		float change = fabsf(temp_hottest(temp) - temp_hottest(&sensor->temp));
+		sensor->delta = (sensor->delta * 3 + change) / 4;
+	}
+	sensor->backoff = 0;
+	sensor->valid = 1;
+	sensor->temp = *temp;
+	return 0;
 #if 0
 	if (ret < 0) {
 		applog(LOG_NOTICE, "chain %d: failed reading temperature",
@@ -392,3 +588,31 @@ sensor_read_temp(struct sensor *sensor, struct temp *temp)
 	return ret;
 #endif
 }
+
+/*
+ * Number of control periods between reads of the sensor, given the
+ * temperature of the hottest sensor.
+ */
+int
+sensor_read_interval(struct sensor *sensor, float hottest)
+{
+	if (sensor->backoff)
+		return sensor->backoff;
+	if (!sensor->valid)
+		return 1;
+	if (temp_hottest(&sensor->temp) >= hottest - SensorHotMargin ||
+	    sensor->delta >= SensorVolatile)
+		return 1;
+	return SensorSlowInterval;
+}
+
+/* qsort order of the sensors due in a period: most overdue first, then the hottest */
+int
+sensor_due_cmp(const void *a, const void *b)
+{
+	const struct sensor_due *x = a, *y = b;
+
+	if (x->overdue != y->overdue)
+		return y->overdue - x->overdue;
+	return (y->temp > x->temp) - (y->temp < x->temp);
+}
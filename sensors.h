@@ -7,6 +7,22 @@ enum {
 	SensorMaxErrors = 8,
 };
 
+/*
+ * Read scheduling, in control periods (one round of the temperature
+ * thread). Sensors within SensorHotMargin degrees of the hottest one or
+ * changing by SensorVolatile degrees per read are read every period,
+ * the rest every SensorSlowInterval periods. A failing sensor waits
+ * 1, 2, 4... up to SensorMaxBackoff periods between tries.
+ */
+enum {
+	SensorSlowInterval = 4,
+	SensorMaxBackoff = 32,
+	SensorHotMargin = 10,
+	SensorVolatile = 1,
+	/* I2C time per period, at least one sensor is read regardless */
+	SensorBudgetMs = 100,
+};
+
 struct i2c_dev {
 	int chain, bus, chip_addr;
 	int i2c_addr;
@@ -47,12 +63,35 @@ struct sensor {
 	struct sensor_ops *ops;
 	int remote_sensor_errors;
 	int remote_sensor_disabled;
+
+	/* read scheduling */
+	int age;		/* periods since the last read */
+	int backoff;		/* periods between reads while failing, 0 if ok */
+	int valid;		/* temp holds a reading */
+	struct temp temp;	/* last reading */
+	float delta;		/* smoothed change between readings */
+
+	/* statistics */
+	unsigned reads, failures;
+	unsigned last_us, max_us;
+	uint64_t total_us;
 };
 
 int probe_sensors(int chain, int bus, struct sensor *sensors, int max_sensors);
+void sensor_cache_save(void);
 
 #define sensor_init(sens) (sens)->ops->init(sens)
 int sensor_read_temp(struct sensor *sensor, struct temp *temp);
+int sensor_read_interval(struct sensor *sensor, float hottest);
+
+/* a sensor due for a read, periods past its interval and last temperature */
+struct sensor_due {
+	struct sensor *sensor;
+	int overdue;
+	float temp;
+};
+
+int sensor_due_cmp(const void *a, const void *b);
 
 #define ZERO_TEMP {.local = 0, .remote = 0}
 
@@ -0,0 +1,235 @@
+/*
+ * apibench - host side benchmark of building "summary" and "stats" replies
+ *
+ * Build and run on the host with "make bench" (or "make apibench"),
+ * after setminertype like for the miner itself.
+ *
+ * api.c is compiled in whole and the summary() and minerstats() handlers
+ * are run against a fake device whose get_api_stats() returns the same
+ * item types and count per chain as bitmain_api_stats(). Each reply is
+ * built once with the api_data items malloced one by one, as outside a
+ * request, and once inside api_arena_begin()/api_arena_end(), as
+ * api_process() does now. Nothing is sent, the reply buffer is reused.
+ *
+ * Only the handlers are linked in (--gc-sections), the globals of the
+ * rest of the miner they read are defined below.
+ */
+
+#include "api.c"
+
+#include <time.h>
+
+/* what the summary and stats handlers read from the rest of the miner */
+int log_level_cut[LOGS_NUM] = { [0 ... LOGS_NUM - 1] = LOG_NOTICE };
+pthread_mutex_t hash_lock = PTHREAD_MUTEX_INITIALIZER;
+char *opt_api_description = "bmminer";
+char g_miner_compiletime[256] = "Thu Jan  1 00:00:00 UTC 1970";
+char g_miner_type[256] = "Antminer S9";
+char displayed_hash_rate[16] = "13521.37";
+unsigned int found_blocks, new_blocks, local_work = 123456, total_go, total_ro;
+int64_t total_accepted = 41234, total_rejected = 12, total_diff1;
+int64_t total_getworks = 5678, total_stale = 3, total_discarded = 12345;
+double total_diff_accepted = 1.3e9, total_diff_rejected = 4.1e5, total_diff_stale = 1024;
+double total_mhashes_done = 3.1e12, total_secs = 86400;
+double new_total_mhashes_done = 3.1e12, new_total_secs = 86400;
+uint64_t best_diff = 123456789;
+int hw_errors = 321;
+time_t last_getwork;
+struct timed_avg w_rolling1m, w_rolling15m, w_rolling24h;
+struct pool **pools;
+int total_pools;
+int total_devices = 1;
+
+int no_yield(void)
+{
+	return 0;
+}
+
+int (*selective_yield)(void) = &no_yield;
+
+void _applog(int prio, const char *str, bool force)
+{
+}
+
+void _quit(int status)
+{
+	exit(status);
+}
+
+void save_last_quit(int status, const char *str)
+{
+}
+
+void cgtime(struct timeval *tv)
+{
+	gettimeofday(tv, NULL);
+}
+
+double avg_getavg(struct timed_avg *ta, double now)
+{
+	return 13521370.0;
+}
+
+static struct device_drv bench_drv = {
+	.name = "BC5",
+};
+
+static struct cgpu_info bench_cgpu = {
+	.drv = &bench_drv,
+};
+
+struct cgpu_info *get_devices(int id)
+{
+	return &bench_cgpu;
+}
+
+#define CHAIN_NUM	16	/* BITMAIN_MAX_CHAIN_NUM of the S9 build */
+#define FAN_NUM		8
+#define CHAIN_EXIST(i)	((i) >= 5 && (i) <= 7)
+
+/* same items, types and names as bitmain_api_stats() with three chains */
+static struct api_data *
+bench_api_stats(struct cgpu_info *cgpu)
+{
+	static const char acs[] = "oooooooo oooooooo oooooooo oooooooo oooooooo oooooooo oooooooo ooooooo";
+	struct api_data *root = NULL;
+	uint8_t u8 = 3;
+	unsigned int fan = 5880;
+	int16_t i16 = 62;
+	uint32_t u32 = 17;
+	uint64_t u64 = 1234567;
+	float temp = 75.0;
+	double d = 4510.62;
+	int i, v = 1;
+	char name[32];
+
+	root = api_add_uint8(root, "miner_count", &u8, true);
+	root = api_add_string(root, "frequency", "650", true);
+	root = api_add_uint8(root, "fan_num", &u8, true);
+	for (i = 0; i < FAN_NUM; i++) {
+		sprintf(name, "fan%d", i + 1);
+		root = api_add_uint(root, name, &fan, true);
+	}
+	for (i = 0; i < CHAIN_NUM; i++) {
+		sprintf(name, "voltage%d", i + 1);
+		root = api_add_double(root, name, &d, true);
+	}
+	root = api_add_uint8(root, "temp_num", &u8, true);
+	for (i = 0; i < CHAIN_NUM; i++) {
+		sprintf(name, "temp%d", i + 1);
+		root = api_add_temp(root, name, &temp, true);
+		sprintf(name, "temp2_%d", i + 1);
+		root = api_add_temp(root, name, &temp, true);
+		sprintf(name, "temp3_%d", i + 1);
+		root = api_add_int16(root, name, &i16, true);
+	}
+	for (i = 0; i < CHAIN_NUM; i++) {
+		if (CHAIN_EXIST(i)) {
+			sprintf(name, "freq_desc%d", i + 1);
+			root = api_add_const(root, name, "per chip, 637-662 MHz", false);
+		}
+		sprintf(name, "freq_avg%d", i + 1);
+		root = api_add_mhs(root, name, &d, true);
+	}
+	root = api_add_mhs(root, "total_rateideal", &d, true);
+	root = api_add_mhs(root, "total_freqavg", &d, true);
+	root = api_add_int16(root, "total_acn", &i16, true);
+	root = api_add_mhs(root, "total_rate", &d, true);
+	for (i = 0; i < CHAIN_NUM; i++) {
+		sprintf(name, "chain_rateideal%d", i + 1);
+		root = api_add_mhs(root, name, &d, true);
+	}
+	root = api_add_int(root, "temp_max", &v, true);
+	root = api_add_percent(root, "Device Hardware%", &d, true);
+	root = api_add_int(root, "no_matching_work", &v, true);
+	for (i = 0; i < CHAIN_NUM; i++) {
+		sprintf(name, "chain_acn%d", i + 1);
+		root = api_add_uint8(root, name, &u8, true);
+		if (CHAIN_EXIST(i)) {
+			sprintf(name, "chain_cores%d", i + 1);
+			root = api_add_int(root, name, &v, true);
+			sprintf(name, "chain_recover%d", i + 1);
+			root = api_add_int(root, name, &v, true);
+			sprintf(name, "chain_recover_ms%d", i + 1);
+			root = api_add_int(root, name, &v, true);
+			sprintf(name, "chain_opencore_ms%d", i + 1);
+			root = api_add_int(root, name, &v, true);
+		}
+		sprintf(name, "chain_acs%d", i + 1);
+		root = api_add_string(root, name, CHAIN_EXIST(i) ? (char *)acs : "", true);
+		sprintf(name, "chain_hw%d", i + 1);
+		root = api_add_uint32(root, name, &u32, true);
+		sprintf(name, "chain_hwrate%d", i + 1);
+		root = api_add_double(root, name, &d, true);
+		sprintf(name, "chain_rate%d", i + 1);
+		root = api_add_string(root, name, CHAIN_EXIST(i) ? "4507.12" : "", true);
+	}
+	for (i = 0; i < FAN_NUM / 2; i++) {
+		sprintf(name, "nonce_total%d", i + 1);
+		root = api_add_uint64(root, name, &u64, true);
+	}
+	return root;
+}
+
+typedef void (*api_handler)(struct io_data *, SOCKETTYPE, char *, bool, char);
+
+static double
+run(api_handler handler, struct io_data *io, bool arena, int loops, size_t *len)
+{
+	struct timespec start, end;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < loops; i++) {
+		io_reinit(io);
+		if (arena)
+			api_arena_begin();
+		handler(io, 0, NULL, true, 'W');
+		if (arena)
+			api_arena_end();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	*len = io->cur - io->ptr;
+
+	return ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) / loops;
+}
+
+static void
+bench(const char *what, api_handler handler, struct io_data *io, int loops)
+{
+	double t_old, t_new;
+	size_t len_old, len_new;
+
+	/* warm up malloc and the arena chunks */
+	run(handler, io, true, loops / 10, &len_new);
+	run(handler, io, false, loops / 10, &len_old);
+	t_old = run(handler, io, false, loops, &len_old);
+	t_new = run(handler, io, true, loops, &len_new);
+	if (len_old != len_new)
+		printf("%s: reply length differs, %zu vs %zu\n", what, len_old, len_new);
+
+	printf("%-10s %6zu bytes %8.2f %8.2f us/reply %8.0f %8.0f replies/s\n",
+	       what, len_new, t_old, t_new, 1e6 / t_old, 1e6 / t_new);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int loops = argc > 1 ? atoi(argv[1]) : 20000;
+	struct io_data *io;
+
+	if (loops <= 0) {
+		fprintf(stderr, "usage: apibench [replies]\n");
+		return 1;
+	}
+	bench_drv.get_api_stats = bench_api_stats;
+	io = io_new(SOCKBUFALLOCSIZ);
+
+	printf("%-10s %12s %8s %8s %17s %8s\n", "", "", "malloc", "arena", "malloc", "arena");
+	bench("summary", summary, io, loops);
+	bench("stats", minerstats, io, loops);
+
+	io_free();
+	api_arena_free();
+	return 0;
+}
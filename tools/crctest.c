@@ -0,0 +1,204 @@
+/*
+ * crctest - host side check of the table driven CRC16/CRC5 (crc16.c)
+ *
+ * Build and run on the host with "make check" (or "make crctest").
+ *
+ * Both have to stay bit exact with the byte table CRC16 and the bit
+ * serial CRC5 the driver used before, kept below: over every CRC5 bit
+ * length of fixed patterns and over random buffers and lengths.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "crc.h"
+
+#define RANDOM_ROUNDS	300000
+
+static int failures;
+
+#define CHECK(cond, fmt, a...) do {				\
+	if (!(cond)) {						\
+		fprintf(stderr, "FAIL %s:%d: " fmt "\n",	\
+			__FILE__, __LINE__, ##a);		\
+		failures++;					\
+	}							\
+} while (0)
+
+/* the driver's CRC16 before it moved to crc16.c */
+static const uint8_t old_chCRCHTalbe[] = {
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+	0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+	0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
+	0x00, 0xC1, 0x81, 0x40
+};
+
+static const uint8_t old_chCRCLTalbe[] = {
+	0x00, 0xC0, 0xC1, 0x01, 0xC3, 0x03, 0x02, 0xC2, 0xC6, 0x06, 0x07, 0xC7,
+	0x05, 0xC5, 0xC4, 0x04, 0xCC, 0x0C, 0x0D, 0xCD, 0x0F, 0xCF, 0xCE, 0x0E,
+	0x0A, 0xCA, 0xCB, 0x0B, 0xC9, 0x09, 0x08, 0xC8, 0xD8, 0x18, 0x19, 0xD9,
+	0x1B, 0xDB, 0xDA, 0x1A, 0x1E, 0xDE, 0xDF, 0x1F, 0xDD, 0x1D, 0x1C, 0xDC,
+	0x14, 0xD4, 0xD5, 0x15, 0xD7, 0x17, 0x16, 0xD6, 0xD2, 0x12, 0x13, 0xD3,
+	0x11, 0xD1, 0xD0, 0x10, 0xF0, 0x30, 0x31, 0xF1, 0x33, 0xF3, 0xF2, 0x32,
+	0x36, 0xF6, 0xF7, 0x37, 0xF5, 0x35, 0x34, 0xF4, 0x3C, 0xFC, 0xFD, 0x3D,
+	0xFF, 0x3F, 0x3E, 0xFE, 0xFA, 0x3A, 0x3B, 0xFB, 0x39, 0xF9, 0xF8, 0x38,
+	0x28, 0xE8, 0xE9, 0x29, 0xEB, 0x2B, 0x2A, 0xEA, 0xEE, 0x2E, 0x2F, 0xEF,
+	0x2D, 0xED, 0xEC, 0x2C, 0xE4, 0x24, 0x25, 0xE5, 0x27, 0xE7, 0xE6, 0x26,
+	0x22, 0xE2, 0xE3, 0x23, 0xE1, 0x21, 0x20, 0xE0, 0xA0, 0x60, 0x61, 0xA1,
+	0x63, 0xA3, 0xA2, 0x62, 0x66, 0xA6, 0xA7, 0x67, 0xA5, 0x65, 0x64, 0xA4,
+	0x6C, 0xAC, 0xAD, 0x6D, 0xAF, 0x6F, 0x6E, 0xAE, 0xAA, 0x6A, 0x6B, 0xAB,
+	0x69, 0xA9, 0xA8, 0x68, 0x78, 0xB8, 0xB9, 0x79, 0xBB, 0x7B, 0x7A, 0xBA,
+	0xBE, 0x7E, 0x7F, 0xBF, 0x7D, 0xBD, 0xBC, 0x7C, 0xB4, 0x74, 0x75, 0xB5,
+	0x77, 0xB7, 0xB6, 0x76, 0x72, 0xB2, 0xB3, 0x73, 0xB1, 0x71, 0x70, 0xB0,
+	0x50, 0x90, 0x91, 0x51, 0x93, 0x53, 0x52, 0x92, 0x96, 0x56, 0x57, 0x97,
+	0x55, 0x95, 0x94, 0x54, 0x9C, 0x5C, 0x5D, 0x9D, 0x5F, 0x9F, 0x9E, 0x5E,
+	0x5A, 0x9A, 0x9B, 0x5B, 0x99, 0x59, 0x58, 0x98, 0x88, 0x48, 0x49, 0x89,
+	0x4B, 0x8B, 0x8A, 0x4A, 0x4E, 0x8E, 0x8F, 0x4F, 0x8D, 0x4D, 0x4C, 0x8C,
+	0x44, 0x84, 0x85, 0x45, 0x87, 0x47, 0x46, 0x86, 0x82, 0x42, 0x43, 0x83,
+	0x41, 0x81, 0x80, 0x40
+};
+
+static uint16_t
+old_CRC16(const uint8_t *p_data, uint16_t w_len)
+{
+	uint8_t chCRCHi = 0xFF;
+	uint8_t chCRCLo = 0xFF;
+	uint16_t wIndex = 0;
+
+	while (w_len--) {
+		wIndex = chCRCLo ^ *p_data++;
+		chCRCLo = chCRCHi ^ old_chCRCHTalbe[wIndex];
+		chCRCHi = old_chCRCLTalbe[wIndex];
+	}
+	return (chCRCHi << 8) | chCRCLo;
+}
+
+/* the driver's bit serial CRC5 */
+static unsigned char
+old_CRC5(const unsigned char *ptr, unsigned char len)
+{
+	unsigned char i, j, k;
+	unsigned char crc = 0x1f;
+	unsigned char crcin[5] = {1, 1, 1, 1, 1};
+	unsigned char crcout[5] = {1, 1, 1, 1, 1};
+	unsigned char din = 0;
+
+	j = 0x80;
+	k = 0;
+	for (i = 0; i < len; i++) {
+		din = (*ptr & j) ? 1 : 0;
+		crcout[0] = crcin[4] ^ din;
+		crcout[1] = crcin[0];
+		crcout[2] = crcin[1] ^ crcin[4] ^ din;
+		crcout[3] = crcin[2];
+		crcout[4] = crcin[3];
+
+		j = j >> 1;
+		k++;
+		if (k == 8) {
+			j = 0x80;
+			k = 0;
+			ptr++;
+		}
+		memcpy(crcin, crcout, 5);
+	}
+	crc = 0;
+	if (crcin[4])
+		crc |= 0x10;
+	if (crcin[3])
+		crc |= 0x08;
+	if (crcin[2])
+		crc |= 0x04;
+	if (crcin[1])
+		crc |= 0x02;
+	if (crcin[0])
+		crc |= 0x01;
+	return crc;
+}
+
+/* the driver hashes at most 255 bits with CRC5, CRC16 covers PIC and config buffers */
+#define CRC5_BUF_LEN	32
+#define CRC16_MAX_LEN	1100
+
+static void
+test_patterns(void)
+{
+	static const unsigned char fill[] = { 0x00, 0xff, 0xaa, 0x55, 0x80, 0x01 };
+	unsigned char buf[CRC16_MAX_LEN];
+	unsigned int f, len;
+
+	for (f = 0; f < sizeof(fill); f++) {
+		memset(buf, fill[f], sizeof(buf));
+		for (len = 0; len < 256; len++)
+			CHECK(CRC5(buf, len) == old_CRC5(buf, len),
+			      "CRC5 fill %02x, %u bits: %02x, was %02x",
+			      fill[f], len, CRC5(buf, len), old_CRC5(buf, len));
+		for (len = 0; len <= CRC16_MAX_LEN; len++)
+			CHECK(CRC16(buf, len) == old_CRC16(buf, len),
+			      "CRC16 fill %02x, %u bytes: %04x, was %04x",
+			      fill[f], len, CRC16(buf, len), old_CRC16(buf, len));
+	}
+}
+
+static void
+test_random(void)
+{
+	unsigned char buf[CRC16_MAX_LEN];
+	unsigned int i, j, len, off;
+
+	srand(1);
+	for (i = 0; i < RANDOM_ROUNDS; i++) {
+		for (j = 0; j < CRC5_BUF_LEN + 4; j++)
+			buf[j] = rand();
+
+		/* odd offsets too, the CRC16 reads four bytes per step */
+		len = rand() % 256;
+		off = rand() % 4;
+		CHECK(CRC5(buf + off, len) == old_CRC5(buf + off, len),
+		      "CRC5 round %u, %u bits: %02x, was %02x",
+		      i, len, CRC5(buf + off, len), old_CRC5(buf + off, len));
+
+		len = (i % 16) ? rand() % 64 : rand() % (CRC16_MAX_LEN - 4);
+		for (j = CRC5_BUF_LEN + 4; j < len + 4; j++)
+			buf[j] = rand();
+		CHECK(CRC16(buf + off, len) == old_CRC16(buf + off, len),
+		      "CRC16 round %u, %u bytes: %04x, was %04x",
+		      i, len, CRC16(buf + off, len), old_CRC16(buf + off, len));
+		if (failures > 20)
+			break;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	test_patterns();
+	test_random();
+
+	if (failures) {
+		fprintf(stderr, "crctest: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("crctest: ok\n");
+	return 0;
+}
@@ -0,0 +1,376 @@
+/*
+ * fansim - run fancontrol.c against a thermal model or a recorded log
+ *
+ * Build on the host with "make fansim".
+ *
+ *   fansim [options]              closed loop against the plant model
+ *   fansim [options] -r fanctrl.log
+ *                                 open loop replay of a recorded log
+ *
+ * The controller is the unmodified fancontrol.c/pid_controller.c, with
+ * cgtime() driven by the simulation clock. The simulation writes its own
+ * controller log to ./fansim.log, in the same format as /tmp/fanctrl.log,
+ * so it can be fed back with -r.
+ *
+ * Plant: one lumped heat capacity C (J/K) heated by the hash boards and
+ * cooled by the fans,
+ *
+ *   C dT/dt = P * (1 - throttle * f) - G(duty) * (T - ambient)
+ *   G(duty) = gmin + (gmax - gmin) * duty / 100
+ *
+ * and a sensor reading T plus gaussian noise, that fails to read with
+ * the given probability.
+ *
+ *   -k kp,ki,kd   PID constants (default those in fancontrol.c)
+ *   -t deg        target temperature (default DEFAULT_TARGET_TEMP)
+ *   -a deg        ambient temperature (25)
+ *   -s sec:deg    ambient steps to deg at sec, may be repeated
+ *   -P watts      heat of the boards at full speed (1300)
+ *   -g gmin,gmax  cooling in W/K with the fans stopped and on full (6,35)
+ *   -C J/K        heat capacity (2700)
+ *   -f pct        heat less per throttle step in percent (2)
+ *   -n deg        sensor noise, standard deviation (0.25)
+ *   -x prob       probability of a failed sensor read (0)
+ *   -i sec        controller period (5)
+ *   -d sec        simulated time (3600)
+ *   -b deg        band around the target for the settling time (1)
+ *   -S seed       noise seed (1)
+ *   -o file       write a CSV trace (time,ambient,temp,measured,ok,duty,throttle)
+ *   -r file       replay a fanctrl.log instead of simulating
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tools/fansim.h"
+#include "fancontrol.h"
+
+#define SIM_SUBSTEP	0.1
+#define SIM_MAX_STEPS	16
+
+int opt_fan_dangerous_temp = DANGEROUS_TEMP;
+int opt_fan_hot_temp = HOT_TEMP;
+int opt_fan_max_throttle = 8;
+
+static double sim_now;
+
+struct sim_step {
+	double at, ambient;
+};
+
+struct sim_stats {
+	long samples, dropouts;
+	double duty_sum, fan_power_sum, heat_lost_sum;
+	double peak, overshoot;
+	double last_disturbance, last_outside;
+	int reached, max_throttle;
+};
+
+static struct fancontrol fc;
+static struct sim_stats st;
+static double opt_target = DEFAULT_TARGET_TEMP;
+
+void cgtime(struct timeval *tv)
+{
+	tv->tv_sec = (time_t)sim_now;
+	tv->tv_usec = (suseconds_t)((sim_now - tv->tv_sec) * 1e6);
+}
+
+static void sim_report(void);
+
+void quit(int status, const char *format, ...)
+{
+	va_list ap;
+
+	printf("t=%.0lf: miner quits: ", sim_now);
+	va_start(ap, format);
+	vprintf(format, ap);
+	va_end(ap);
+	printf("\n");
+	sim_report();
+	exit(2);
+}
+
+static double gauss(unsigned *seed)
+{
+	double u1 = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+	double u2 = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+
+	return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+static void sim_report(void)
+{
+	long n = st.samples ? st.samples : 1;
+
+	printf("samples          %ld (%ld failed reads)\n", st.samples, st.dropouts);
+	printf("peak temp        %.2lf\n", st.peak);
+	if (st.reached)
+		printf("overshoot        %.2lf\n", st.overshoot);
+	else
+		printf("overshoot        target never reached\n");
+	if (st.last_outside + 2 * SIM_SUBSTEP < sim_now)
+		printf("settling time    %.0lf s\n",
+		       st.last_outside > st.last_disturbance ? st.last_outside - st.last_disturbance : 0);
+	else
+		printf("settling time    not settled\n");
+	printf("avg fan duty     %.1lf%%\n", st.duty_sum / n);
+	printf("avg fan power    %.1lf%% of full\n", st.fan_power_sum / n);
+	printf("throttle         max %d steps, %d events, %.2lf%% heat (hashrate) lost\n",
+	       st.max_throttle, fc.throttle_events, st.heat_lost_sum / n);
+}
+
+static void set_pid(const char *arg)
+{
+	float kp, ki, kd;
+
+	if (sscanf(arg, "%f,%f,%f", &kp, &ki, &kd) != 3) {
+		fprintf(stderr, "bad PID constants: %s\n", arg);
+		exit(1);
+	}
+	PIDTuningsSet(&fc.pid, kp, ki, kd);
+}
+
+/*
+ * Read all of a recorded log, before fancontrol_init() gets to truncate
+ * it when it is our own fansim.log.
+ */
+static char *replay_load(const char *path)
+{
+	FILE *f;
+	char *buf;
+	long len;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	rewind(f);
+	buf = malloc(len + 1);
+	if (!buf || fread(buf, 1, len, f) != (size_t)len) {
+		fprintf(stderr, "%s: read failed\n", path);
+		fclose(f);
+		free(buf);
+		return NULL;
+	}
+	buf[len] = 0;
+	fclose(f);
+	return buf;
+}
+
+/*
+ * Feed the recorded temperatures with the recorded timing into the
+ * controller. The loop is open: the recorded temperatures were shaped by
+ * the recorded duty, not by ours, so this shows where a change decides
+ * differently, not how the miner would have behaved with it.
+ */
+static int replay(char *log)
+{
+	char *line, *save;
+	int have_input = 0, first = 1;
+	int temp_ok = 0, mode = 0, init = 0, req_duty = 0;
+	double temp = 0, setpoint = 0;
+	double rec_sum = 0, new_sum = 0, diff_sum = 0;
+	int max_diff = 0;
+	long n = 0, differ = 0;
+
+	for (line = strtok_r(log, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+		char *p;
+		int rec_duty, duty, diff;
+		double dt;
+
+		if ((p = strstr(line, " input: ")) != NULL) {
+			have_input = sscanf(p, " input: temp_ok=%d temp=%lf mode=%d init=%d setpoint=%lf req_fan_duty=%d",
+					    &temp_ok, &temp, &mode, &init, &setpoint, &req_duty) == 6;
+			continue;
+		}
+		if ((p = strstr(line, " output: ")) == NULL || !have_input)
+			continue;
+		have_input = 0;
+		if (sscanf(p, " output: fan_duty=%d dt=%lf", &rec_duty, &dt) != 2)
+			continue;
+
+		/* a rotated log starts past the warmup */
+		if (first && !init)
+			fc.started = sim_now - 3600;
+		first = 0;
+
+		switch (mode) {
+		case FANCTRL_AUTO:
+			if (setpoint != fc.setpoint_deg || fc.mode != FANCTRL_AUTO)
+				fancontrol_setmode_auto(&fc, setpoint);
+			break;
+		case FANCTRL_MANUAL:
+			if (req_duty != fc.requested_fan_duty || fc.mode != FANCTRL_MANUAL)
+				fancontrol_setmode_manual(&fc, req_duty);
+			break;
+		default:
+			if (fc.mode != FANCTRL_EMERGENCY)
+				fancontrol_setmode_emergency(&fc);
+			break;
+		}
+
+		sim_now += dt;
+		duty = fancontrol_calculate(&fc, temp_ok, temp);
+
+		diff = abs(duty - rec_duty);
+		rec_sum += rec_duty;
+		new_sum += duty;
+		diff_sum += diff;
+		if (diff > max_diff)
+			max_diff = diff;
+		if (diff > 1)
+			differ++;
+		n++;
+	}
+	if (!n) {
+		fprintf(stderr, "no controller records\n");
+		return 1;
+	}
+	printf("records          %ld\n", n);
+	printf("avg fan duty     recorded %.1lf%%, replayed %.1lf%%\n", rec_sum / n, new_sum / n);
+	printf("duty difference  mean %.2lf, max %d, %ld records off by more than 1%%\n",
+	       diff_sum / n, max_diff, differ);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-k kp,ki,kd] [-t deg] [-a deg] [-s sec:deg]... [-P watts] [-g gmin,gmax]\n"
+		"       [-C J/K] [-f pct] [-n deg] [-x prob] [-i sec] [-d sec] [-b deg] [-S seed]\n"
+		"       [-o trace.csv] [-r fanctrl.log]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sim_step steps[SIM_MAX_STEPS];
+	const char *opt_pid = NULL, *opt_replay = NULL, *opt_trace = NULL;
+	char *replay_log = NULL;
+	double ambient = 25, power = 1300, gmin = 6, gmax = 35, capacity = 2700;
+	double step_pct = 2, noise = 0.25, dropout = 0, interval = 5, duration = 3600, band = 1;
+	unsigned seed = 1;
+	int nsteps = 0, next_step = 0;
+	double temp, t, next_calc;
+	FILE *trace = NULL;
+	int c, duty;
+
+	while ((c = getopt(argc, argv, "k:t:a:s:P:g:C:f:n:x:i:d:b:S:o:r:")) != -1) {
+		switch (c) {
+		case 'k': opt_pid = optarg; break;
+		case 't': opt_target = atof(optarg); break;
+		case 'a': ambient = atof(optarg); break;
+		case 's':
+			if (nsteps >= SIM_MAX_STEPS ||
+			    sscanf(optarg, "%lf:%lf", &steps[nsteps].at, &steps[nsteps].ambient) != 2)
+				usage(argv[0]);
+			nsteps++;
+			break;
+		case 'P': power = atof(optarg); break;
+		case 'g':
+			if (sscanf(optarg, "%lf,%lf", &gmin, &gmax) != 2)
+				usage(argv[0]);
+			break;
+		case 'C': capacity = atof(optarg); break;
+		case 'f': step_pct = atof(optarg); break;
+		case 'n': noise = atof(optarg); break;
+		case 'x': dropout = atof(optarg); break;
+		case 'i': interval = atof(optarg); break;
+		case 'd': duration = atof(optarg); break;
+		case 'b': band = atof(optarg); break;
+		case 'S': seed = atoi(optarg); break;
+		case 'o': opt_trace = optarg; break;
+		case 'r': opt_replay = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc || interval <= 0 || capacity <= 0)
+		usage(argv[0]);
+
+	if (opt_replay) {
+		replay_log = replay_load(opt_replay);
+		if (!replay_log)
+			return 1;
+	}
+
+	fancontrol_init(&fc);
+	if (opt_pid)
+		set_pid(opt_pid);
+
+	if (replay_log)
+		return replay(replay_log);
+
+	fancontrol_setmode_auto(&fc, opt_target);
+	if (opt_trace) {
+		trace = fopen(opt_trace, "w");
+		if (!trace) {
+			perror(opt_trace);
+			return 1;
+		}
+		fprintf(trace, "time,ambient,temp,measured,ok,duty,throttle\n");
+	}
+
+	/* cold start: boards at ambient, fans on full until the first reading */
+	temp = ambient;
+	duty = 100;
+	st.peak = temp;
+	st.last_outside = 0;
+	next_calc = 0;
+
+	for (t = 0; t < duration; t += SIM_SUBSTEP) {
+		double heat, g;
+
+		sim_now = t;
+		if (next_step < nsteps && t >= steps[next_step].at) {
+			ambient = steps[next_step++].ambient;
+			st.last_disturbance = t;
+		}
+
+		if (t >= next_calc) {
+			double measured = temp + noise * gauss(&seed);
+			int ok = (double)rand_r(&seed) / RAND_MAX >= dropout;
+
+			duty = fancontrol_calculate(&fc, ok, measured);
+			next_calc += interval;
+
+			if (trace)
+				fprintf(trace, "%.1lf,%.2lf,%.3lf,%.3lf,%d,%d,%d\n",
+					t, ambient, temp, measured, ok, duty, fc.throttle);
+
+			st.samples++;
+			if (!ok)
+				st.dropouts++;
+			st.duty_sum += duty;
+			st.fan_power_sum += 100 * pow(duty / 100.0, 3);
+			st.heat_lost_sum += fc.throttle * step_pct;
+			if (fc.throttle > st.max_throttle)
+				st.max_throttle = fc.throttle;
+		}
+
+		heat = power * (1 - fc.throttle * step_pct / 100);
+		if (heat < 0)
+			heat = 0;
+		g = gmin + (gmax - gmin) * duty / 100;
+		temp += (heat - g * (temp - ambient)) / capacity * SIM_SUBSTEP;
+
+		if (temp > st.peak)
+			st.peak = temp;
+		if (temp >= opt_target)
+			st.reached = 1;
+		if (st.reached && temp - opt_target > st.overshoot)
+			st.overshoot = temp - opt_target;
+		if (fabs(temp - opt_target) > band)
+			st.last_outside = t;
+	}
+	sim_now = duration;
+
+	if (trace)
+		fclose(trace);
+	sim_report();
+	return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef __FANSIM_H__
+#define __FANSIM_H__
+
+/*
+ * What fancontrol.c needs from the miner, provided by tools/fansim.c so
+ * the controller can be built and run on the host against a simulated
+ * clock.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+
+extern int opt_fan_dangerous_temp;
+extern int opt_fan_hot_temp;
+extern int opt_fan_max_throttle;
+
+void cgtime(struct timeval *tv);
+void quit(int status, const char *format, ...);
+
+#endif /* __FANSIM_H__ */
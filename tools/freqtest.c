@@ -0,0 +1,484 @@
+/*
+ * freqtest - host side checks of the frequency table code (freqtable.c)
+ *
+ * Build and run on the host with "make check" (or "make freqtest"),
+ * after setminertype like for the miner itself.
+ *
+ * The PLL register values of freq_pll_1385[] have to stay byte
+ * identical to the original string keyed table kept below, and the cached
+ * GetBoardRate()/GetTotalRate() have to match summing up every chip the
+ * way the driver used to, for each layout the PIC tables come in, also
+ * while other threads keep rebuilding them.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "miner.h"
+#include "driver-btm-c5.h"
+
+/* what freqtable.c expects from the driver */
+struct all_parameters *dev;
+unsigned char last_freq[BITMAIN_MAX_CHAIN_NUM][256];
+int chain_badcore_num[BITMAIN_MAX_CHAIN_NUM][256];
+int fpga_version;
+#ifdef T9_18
+unsigned char chain_pic_buf[BITMAIN_MAX_CHAIN_NUM][128];
+#endif
+
+static int failures;
+
+#define CHECK(cond, fmt, a...) do {				\
+	if (!(cond)) {						\
+		fprintf(stderr, "FAIL %s:%d: " fmt "\n",	\
+			__FILE__, __LINE__, ##a);		\
+		failures++;					\
+	}							\
+} while (0)
+
+/*
+ * PLL table as it was when frequencies were strings
+ */
+
+struct old_freq_pll {
+	const char *freq;
+	unsigned int fildiv1;
+	unsigned int fildiv2;
+	unsigned int vilpll;
+};
+
+static const struct old_freq_pll old_freq_pll_1385[] = {
+	{"100",0x020040, 0x0420, 0x200241},
+	{"125",0x028040, 0x0420, 0x280241},
+	{"150",0x030040, 0x0420, 0x300241},
+	{"175",0x038040, 0x0420, 0x380241},
+	{"200",0x040040, 0x0420, 0x400241},
+	{"225",0x048040, 0x0420, 0x480241},
+	{"250",0x050040, 0x0420, 0x500241},
+	{"275",0x058040, 0x0420, 0x580241},
+	{"300",0x060040, 0x0420, 0x600241},
+	{"325",0x068040, 0x0420, 0x680241},
+	{"350",0x070040, 0x0420, 0x700241},
+	{"375",0x078040, 0x0420, 0x780241},
+	{"400",0x080040, 0x0420, 0x800241},
+	{"404",0x061040, 0x0320, 0x610231},
+	{"406",0x041040, 0x0220, 0x410221},
+	{"408",0x062040, 0x0320, 0x620231},
+	{"412",0x042040, 0x0220, 0x420221},
+	{"416",0x064040, 0x0320, 0x640231},
+	{"418",0x043040, 0x0220, 0x430221},
+	{"420",0x065040, 0x0320, 0x650231},
+	{"425",0x044040, 0x0220, 0x440221},
+	{"429",0x067040, 0x0320, 0x670231},
+	{"431",0x045040, 0x0220, 0x450221},
+	{"433",0x068040, 0x0320, 0x680231},
+	{"437",0x046040, 0x0220, 0x460221},
+	{"441",0x06a040, 0x0320, 0x6a0231},
+	{"443",0x047040, 0x0220, 0x470221},
+	{"445",0x06b040, 0x0320, 0x6b0231},
+	{"450",0x048040, 0x0220, 0x480221},
+	{"454",0x06d040, 0x0320, 0x6d0231},
+	{"456",0x049040, 0x0220, 0x490221},
+	{"458",0x06e040, 0x0320, 0x6e0231},
+	{"462",0x04a040, 0x0220, 0x4a0221},
+	{"466",0x070040, 0x0320, 0x700231},
+	{"468",0x04b040, 0x0220, 0x4b0221},
+	{"470",0x071040, 0x0320, 0x710231},
+	{"475",0x04c040, 0x0220, 0x4c0221},
+	{"479",0x073040, 0x0320, 0x730231},
+	{"481",0x04d040, 0x0220, 0x4d0221},
+	{"483",0x074040, 0x0320, 0x740231},
+	{"487",0x04e040, 0x0220, 0x4e0221},
+	{"491",0x076040, 0x0320, 0x760231},
+	{"493",0x04f040, 0x0220, 0x4f0221},
+	{"495",0x077040, 0x0320, 0x770231},
+	{"500",0x050040, 0x0220, 0x500221},
+	{"504",0x079040, 0x0320, 0x790231},
+	{"506",0x051040, 0x0220, 0x510221},
+	{"508",0x07a040, 0x0320, 0x7a0231},
+	{"512",0x052040, 0x0220, 0x520221},
+	{"516",0x07c040, 0x0320, 0x7c0231},
+	{"518",0x053040, 0x0220, 0x530221},
+	{"520",0x07d040, 0x0320, 0x7d0231},
+	{"525",0x054040, 0x0220, 0x540221},
+	{"529",0x07f040, 0x0320, 0x7f0231},
+	{"531",0x055040, 0x0220, 0x550221},
+	{"533",0x080040, 0x0320, 0x800231},
+	{"537",0x056040, 0x0220, 0x560221},
+	{"543",0x057040, 0x0220, 0x570221},
+	{"550",0x058040, 0x0220, 0x580221},
+	{"556",0x059040, 0x0220, 0x590221},
+	{"562",0x05a040, 0x0220, 0x5a0221},
+	{"568",0x05b040, 0x0220, 0x5b0221},
+	{"575",0x05c040, 0x0220, 0x5c0221},
+	{"581",0x05d040, 0x0220, 0x5d0221},
+	{"587",0x05e040, 0x0220, 0x5e0221},
+	{"593",0x05f040, 0x0220, 0x5f0221},
+	{"600",0x060040, 0x0220, 0x600221},
+	{"606",0x061040, 0x0220, 0x610221},
+	{"612",0x062040, 0x0220, 0x620221},
+	{"618",0x063040, 0x0220, 0x630221},
+	{"625",0x064040, 0x0220, 0x640221},
+	{"631",0x065040, 0x0220, 0x650221},
+	{"637",0x066040, 0x0220, 0x660221},
+	{"643",0x067040, 0x0220, 0x670221},
+	{"650",0x068040, 0x0220, 0x680221},
+	{"656",0x069040, 0x0220, 0x690221},
+	{"662",0x06a040, 0x0220, 0x6a0221},
+	{"668",0x06b040, 0x0220, 0x6b0221},
+	{"675",0x06c040, 0x0220, 0x6c0221},
+	{"681",0x06d040, 0x0220, 0x6d0221},
+	{"687",0x06e040, 0x0220, 0x6e0221},
+	{"693",0x06f040, 0x0220, 0x6f0221},
+	{"700",0x070040, 0x0220, 0x700221},
+	{"706",0x071040, 0x0220, 0x710221},
+	{"712",0x072040, 0x0220, 0x720221},
+	{"718",0x073040, 0x0220, 0x730221},
+	{"725",0x074040, 0x0220, 0x740221},
+	{"731",0x075040, 0x0220, 0x750221},
+	{"737",0x076040, 0x0220, 0x760221},
+	{"743",0x077040, 0x0220, 0x770221},
+	{"750",0x078040, 0x0220, 0x780221},
+	{"756",0x079040, 0x0220, 0x790221},
+	{"762",0x07a040, 0x0220, 0x7a0221},
+	{"768",0x07b040, 0x0220, 0x7b0221},
+	{"775",0x07c040, 0x0220, 0x7c0221},
+	{"781",0x07d040, 0x0220, 0x7d0221},
+	{"787",0x07e040, 0x0220, 0x7e0221},
+	{"793",0x07f040, 0x0220, 0x7f0221},
+	{"800",0x080040, 0x0220, 0x800221},
+	{"825",0x042040, 0x0120, 0x420211},
+	{"850",0x044040, 0x0120, 0x440211},
+	{"875",0x046040, 0x0120, 0x460211},
+	{"900",0x048040, 0x0120, 0x480211},
+	{"925",0x04a040, 0x0120, 0x4a0211},
+	{"950",0x04c040, 0x0120, 0x4c0211},
+	{"975",0x04e040, 0x0120, 0x4e0211},
+	{"1000",0x050040, 0x0120, 0x500211},
+	{"1025",0x052040, 0x0120, 0x520211},
+	{"1050",0x054040, 0x0120, 0x540211},
+	{"1075",0x056040, 0x0120, 0x560211},
+	{"1100",0x058040, 0x0120, 0x580211},
+	{"1125",0x05a040, 0x0120, 0x5a0211},
+	{"1150",0x05c040, 0x0120, 0x5c0211},
+	{"1175",0x05e040, 0x0120, 0x5e0211},
+};
+
+#define OLD_FREQ_PLL_NUM (sizeof(old_freq_pll_1385) / sizeof(old_freq_pll_1385[0]))
+
+static int
+old_get_pll_index(int freq)
+{
+	int i;
+
+	for (i = 0; i < OLD_FREQ_PLL_NUM; i++) {
+		if (freq <= atoi(old_freq_pll_1385[i].freq))
+			break;
+	}
+	if (i >= OLD_FREQ_PLL_NUM)
+		i = OLD_FREQ_PLL_NUM - 1;
+	return i;
+}
+
+static void
+test_pll_table(void)
+{
+	CHECK(FREQ_PLL_NUM == OLD_FREQ_PLL_NUM, "table has %d entries, was %d",
+	      (int)FREQ_PLL_NUM, (int)OLD_FREQ_PLL_NUM);
+
+	for (int i = 0; i < FREQ_PLL_NUM && i < OLD_FREQ_PLL_NUM; i++) {
+		const struct freq_pll *pll = &freq_pll_1385[i];
+		const struct old_freq_pll *old = &old_freq_pll_1385[i];
+
+		CHECK(pll->freq == atoi(old->freq), "[%d] freq %u, was %s", i, pll->freq, old->freq);
+		CHECK(pll->fildiv1 == old->fildiv1, "[%d] fildiv1 %06x, was %06x", i, pll->fildiv1, old->fildiv1);
+		CHECK(pll->fildiv2 == old->fildiv2, "[%d] fildiv2 %04x, was %04x", i, pll->fildiv2, old->fildiv2);
+		CHECK(pll->vilpll == old->vilpll, "[%d] vilpll %06x, was %06x", i, pll->vilpll, old->vilpll);
+		CHECK(pll->rate == pll->freq * BM1387_CORE_NUM, "[%d] rate %u for %u MHz", i, pll->rate, pll->freq);
+		CHECK(get_freqvalue_by_index(i) == atoi(old->freq), "[%d] get_freqvalue_by_index", i);
+	}
+
+	/* every frequency the config or the tuners could ask for */
+	for (int freq = -1; freq <= 1300; freq++)
+		CHECK(get_pll_index(freq) == old_get_pll_index(freq), "get_pll_index(%d) = %d, was %d",
+		      freq, get_pll_index(freq), old_get_pll_index(freq));
+}
+
+/*
+ * Ideal rates, summed over all chips on every call as before the cache
+ */
+
+#ifdef T9_18
+/* PIC buffer and offset of a chain with the FPGA from version 0xE on */
+static const int new_pic_chain[BITMAIN_MAX_CHAIN_NUM] = {
+	[1] = 1, [8] = 1, [9] = 1, [2] = 2, [10] = 2, [11] = 2, [3] = 3, [12] = 3, [13] = 3,
+};
+static const int new_pic_offset[BITMAIN_MAX_CHAIN_NUM] = {
+	[8] = 1, [9] = 2, [10] = 1, [11] = 2, [12] = 1, [13] = 2,
+};
+
+static unsigned char *
+chip_index_ptr(int chain, int asic)
+{
+	if (fpga_version >= 0xE)
+		return &chain_pic_buf[new_pic_chain[chain]][7+new_pic_offset[chain]*31+4+asic];
+	return &chain_pic_buf[(chain/3)*3][7+(chain%3)*31+4+asic];
+}
+#else
+static unsigned char *
+chip_index_ptr(int chain, int asic)
+{
+	return &last_freq[chain][asic*2+3];
+}
+#endif
+
+static int
+old_chain_rate(int chain)
+{
+	int rate = 0;
+
+	for (int j = 0; j < CHAIN_ASIC_NUM; j++)
+		rate += atoi(old_freq_pll_1385[*chip_index_ptr(chain, j)].freq) *
+			(BM1387_CORE_NUM - chain_badcore_num[chain][j]);
+	return rate;
+}
+
+static int
+old_board_rate(int chain)
+{
+	if (dev->chain_exist[chain] != 1)
+		return 0;
+	return old_chain_rate(chain) / 1000;
+}
+
+static int
+old_total_rate(void)
+{
+	int rate = 0;
+
+	for (int i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+		if (dev->chain_exist[i] == 1)
+			rate += old_chain_rate(i);
+	return rate / 1000;
+}
+
+/*
+ * The layouts the frequency tables are loaded in
+ */
+
+enum {
+	LAYOUT_PER_CHIP,	/* FREQ_MAGIC board, a frequency index per chip */
+	LAYOUT_BASE_ONLY,	/* old or fixed frequency board, one index for all chips */
+	LAYOUT_NUM,
+};
+
+static const char *layout_name[LAYOUT_NUM] = {
+	[LAYOUT_PER_CHIP] = "per chip",
+	[LAYOUT_BASE_ONLY] = "base only",
+};
+
+static int chains[BITMAIN_MAX_CHAIN_NUM], n_chains;
+
+static int
+rand_index(void)
+{
+	return rand() % FREQ_PLL_NUM;
+}
+
+static void
+load_layout(int layout)
+{
+	memset(last_freq, 0, sizeof(last_freq));
+	memset(chain_badcore_num, 0, sizeof(chain_badcore_num));
+#ifdef T9_18
+	memset(chain_pic_buf, 0, sizeof(chain_pic_buf));
+#endif
+	memset(dev, 0, sizeof(*dev));
+
+	for (int k = 0; k < n_chains; k++) {
+		int i = chains[k];
+		int base = rand_index();
+
+		dev->chain_exist[i] = 1;
+		dev->chain_asic_num[i] = CHAIN_ASIC_NUM;
+#ifndef T9_18
+		last_freq[i][0] = rand() & 0x3f;	/* step down */
+		last_freq[i][1] = layout == LAYOUT_PER_CHIP ? FREQ_MAGIC : 0;
+		last_freq[i][6] = base >> 4;
+		last_freq[i][8] = base & 0x0f;
+#endif
+		for (int j = 0; j < CHAIN_ASIC_NUM; j++) {
+			int index = base;
+
+			/* PIC tables hold a few steps around the base */
+			if (layout == LAYOUT_PER_CHIP)
+				index += rand() % 9 - 4;
+			if (index < 0)
+				index = 0;
+			if (index >= FREQ_PLL_NUM)
+				index = FREQ_PLL_NUM - 1;
+			*chip_index_ptr(i, j) = index;
+			chain_badcore_num[i][j] = rand() % 8 == 0 ? rand() % 10 : 0;
+		}
+		invalidate_chain_freq_stats(i);
+	}
+}
+
+static void
+check_rates(const char *what, int step)
+{
+	for (int i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++) {
+		struct chain_freq_stats st;
+		int sum_freq = 0, sum_rate = 0;
+
+		CHECK(GetBoardRate(i) == old_board_rate(i), "%s, step %d: GetBoardRate(%d) = %d, was %d",
+		      what, step, i, GetBoardRate(i), old_board_rate(i));
+		if (dev->chain_exist[i] != 1)
+			continue;
+
+		st = get_chain_freq_stats(i);
+		for (int j = 0; j < dev->chain_asic_num[i]; j++) {
+			int freq = atoi(old_freq_pll_1385[*chip_index_ptr(i, j)].freq);
+
+			sum_freq += freq;
+			sum_rate += freq * (BM1387_CORE_NUM - chain_badcore_num[i][j]);
+		}
+		CHECK(st.sum_freq == sum_freq && st.sum_rate == sum_rate,
+		      "%s, step %d: chain %d sums %d/%d, should be %d/%d",
+		      what, step, i, st.sum_freq, st.sum_rate, sum_freq, sum_rate);
+	}
+	CHECK(GetTotalRate() == old_total_rate(), "%s, step %d: GetTotalRate() = %d, was %d",
+	      what, step, GetTotalRate(), old_total_rate());
+}
+
+static void
+test_rates_layout(int layout, const char *what)
+{
+	load_layout(layout);
+	check_rates(what, 0);
+
+	/* what the tuners, throttling and the driver do to the tables */
+	for (int step = 1; step <= 5000; step++) {
+		int i = chains[rand() % n_chains];
+		int j = rand() % CHAIN_ASIC_NUM;
+
+		switch (rand() % 10) {
+		case 0:
+			/* chips lost or found by a re-init */
+			dev->chain_asic_num[i] = CHAIN_ASIC_NUM - rand() % 4;
+			break;
+		case 1:
+			/* chain lost or back */
+			dev->chain_exist[i] = !dev->chain_exist[i];
+			break;
+		case 2:
+			/* tables reloaded from the PIC */
+			chain_badcore_num[i][j] = rand() % 10;
+			*chip_index_ptr(i, j) = rand_index();
+			invalidate_chain_freq_stats(i);
+			break;
+		case 3:
+			/* DownOneChipFreqOneStep() */
+			if (getChainAsicFreqIndex(i, j) > 0)
+				setChainAsicFreqIndex(i, j, getChainAsicFreqIndex(i, j) - 1);
+			break;
+		default:
+			setChainAsicFreqIndex(i, j, rand_index());
+			break;
+		}
+		check_rates(what, step);
+	}
+}
+
+/* the API and watchdog threads rebuild the sums while the tuners change chips */
+static volatile bool readers_stop;
+
+static void *
+rate_reader(void *arg)
+{
+	while (!readers_stop) {
+		for (int k = 0; k < n_chains; k++) {
+			int i = chains[k];
+
+			invalidate_chain_freq_stats(i);
+			get_chain_freq_stats(i);
+		}
+	}
+	return NULL;
+}
+
+static void
+test_rates_threads(const char *what)
+{
+	pthread_t thr[2];
+
+	load_layout(0);
+	readers_stop = false;
+	for (int t = 0; t < 2; t++)
+		pthread_create(&thr[t], NULL, rate_reader, NULL);
+	for (int step = 0; step < 200000; step++) {
+		int i = chains[rand() % n_chains];
+
+		setChainAsicFreqIndex(i, rand() % CHAIN_ASIC_NUM, rand_index());
+		get_chain_freq_stats(i);
+	}
+	readers_stop = true;
+	for (int t = 0; t < 2; t++)
+		pthread_join(thr[t], NULL);
+	check_rates(what, 200000);
+}
+
+static void
+test_rates(void)
+{
+	char what[64];
+
+	dev = calloc(1, sizeof(*dev));
+	srand(1);
+
+#ifdef T9_18
+	for (fpga_version = 0xD; fpga_version <= 0xE; fpga_version++) {
+		static const int new_chains[] = {1, 2, 3, 8, 9, 10, 11, 12, 13};
+
+		n_chains = 0;
+		if (fpga_version >= 0xE) {
+			for (int k = 0; k < ARRAY_SIZE(new_chains); k++)
+				chains[n_chains++] = new_chains[k];
+		} else {
+			for (int i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+				chains[n_chains++] = i;
+		}
+		for (int layout = 0; layout < LAYOUT_NUM; layout++) {
+			snprintf(what, sizeof(what), "%s, fpga %x", layout_name[layout], fpga_version);
+			test_rates_layout(layout, what);
+		}
+	}
+#else
+	for (int i = 0; i < BITMAIN_MAX_CHAIN_NUM; i++)
+		chains[n_chains++] = i;
+	for (int layout = 0; layout < LAYOUT_NUM; layout++) {
+		snprintf(what, sizeof(what), "%s", layout_name[layout]);
+		test_rates_layout(layout, what);
+	}
+#endif
+	test_rates_threads("threads");
+	free(dev);
+}
+
+int
+main(int argc, char *argv[])
+{
+	test_pll_table();
+	test_rates();
+
+	if (failures) {
+		fprintf(stderr, "freqtest: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("freqtest: ok\n");
+	return 0;
+}
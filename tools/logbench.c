@@ -0,0 +1,178 @@
+/*
+ * logbench - host side benchmark of the logging cost on the nonce path
+ *
+ * Build and run on the host with "make bench" (or "make logbench").
+ *
+ * Runs the debug messages hashtest_submit() logs for every nonce through
+ * the old applog() gating (kept below) and through the per-subsystem
+ * cutoff of logging.h, with debug off, with debug on, and with debug on
+ * but the nonce subsystem held at notice. Messages that pass go through
+ * the real _applog() and logwriter; stderr is sent to /dev/null and the
+ * console output is muted like with --quiet.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "miner.h"
+#include "logging.h"
+#include "logwriter.h"
+
+/* what logging.c and logwriter.c expect from the rest of the miner */
+bool use_syslog;
+bool opt_quiet = true;
+pthread_mutex_t console_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int no_yield(void)
+{
+	return 0;
+}
+
+int (*selective_yield)(void) = &no_yield;
+
+void _quit(int status)
+{
+	exit(status);
+}
+
+void cgtime(struct timeval *tv)
+{
+	gettimeofday(tv, NULL);
+}
+
+void timeval_to_spec(struct timespec *spec, const struct timeval *val)
+{
+	spec->tv_sec = val->tv_sec;
+	spec->tv_nsec = val->tv_usec * 1000;
+}
+
+void ms_to_timespec(struct timespec *spec, int64_t ms)
+{
+	spec->tv_sec = ms / 1000;
+	spec->tv_nsec = (ms % 1000) * 1000000;
+}
+
+void timeraddspec(struct timespec *a, const struct timespec *b)
+{
+	a->tv_sec += b->tv_sec;
+	a->tv_nsec += b->tv_nsec;
+	if (a->tv_nsec >= 1000000000) {
+		a->tv_nsec -= 1000000000;
+		a->tv_sec++;
+	}
+}
+
+void RenameThread(const char *name)
+{
+}
+
+/* applog() before the per-subsystem cutoff */
+#define old_applog(prio, fmt, ...) do { \
+	if (opt_debug || prio != LOG_DEBUG) { \
+		if (use_syslog || opt_log_output || prio <= opt_log_level) { \
+			char tmp42[LOGBUFSIZ]; \
+			snprintf(tmp42, sizeof(tmp42), fmt, ##__VA_ARGS__); \
+			_applog(prio, tmp42, false); \
+		} \
+	} \
+} while (0)
+
+struct nonce {
+	int chain, asic, core;
+	uint32_t job_id, work_id, nonce3, version;
+	uint64_t nonce2;
+	double sdiff;
+};
+
+/* the debug messages of one nonce in hashtest_submit(), checked and submitted */
+static void __attribute__((noinline))
+nonce_path_old(const struct nonce *n)
+{
+	old_applog(LOG_DEBUG, "%s: pool_diff:%lld work_diff:%lf pool_diff_bit:%lld ...\n", __FUNCTION__,
+		   1024LL, n->sdiff, 10LL);
+	old_applog(LOG_DEBUG, "%s: chain %d which_asic_nonce %d which_core_nonce %d", __FUNCTION__,
+		   n->chain, n->asic, n->core);
+	old_applog(LOG_DEBUG, "%s: job_id:0x%x   work_id:0x%x   nonce2:0x%llx   nonce3:0x%x   version:0x%x\n", __FUNCTION__,
+		   n->job_id, n->work_id, (unsigned long long)n->nonce2, n->nonce3, n->version);
+	old_applog(LOG_DEBUG, "%s: Chain ID J%d ...\n", __FUNCTION__, n->chain + 1);
+	old_applog(LOG_DEBUG, "%s: hashes %llu ...\n", __FUNCTION__, 1024 * 0xffffffffull);
+}
+
+static void __attribute__((noinline))
+nonce_path_new(const struct nonce *n)
+{
+	applog_sub(LOGS_NONCE, LOG_DEBUG, "%s: pool_diff:%lld work_diff:%lf pool_diff_bit:%lld ...\n", __FUNCTION__,
+		   1024LL, n->sdiff, 10LL);
+	applog_sub(LOGS_NONCE, LOG_DEBUG, "%s: chain %d which_asic_nonce %d which_core_nonce %d", __FUNCTION__,
+		   n->chain, n->asic, n->core);
+	applog_sub(LOGS_NONCE, LOG_DEBUG, "%s: job_id:0x%x   work_id:0x%x   nonce2:0x%llx   nonce3:0x%x   version:0x%x\n", __FUNCTION__,
+		   n->job_id, n->work_id, (unsigned long long)n->nonce2, n->nonce3, n->version);
+	applog_sub(LOGS_NONCE, LOG_DEBUG, "%s: Chain ID J%d ...\n", __FUNCTION__, n->chain + 1);
+	applog_sub(LOGS_NONCE, LOG_DEBUG, "%s: hashes %llu ...\n", __FUNCTION__, 1024 * 0xffffffffull);
+}
+
+static double
+run(void (*path)(const struct nonce *), int loops)
+{
+	struct timespec start, end;
+	struct nonce n;
+	int i;
+
+	memset(&n, 0, sizeof(n));
+	n.sdiff = 1024.0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < loops; i++) {
+		n.chain = i % 3 + 5;
+		n.asic = i % 63;
+		n.core = i % 114;
+		n.work_id = i;
+		n.nonce3 = i * 2654435761u;
+		n.nonce2 = i;
+		path(&n);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / loops;
+}
+
+static void
+bench(const char *what, bool debug, int nonce_level, int loops)
+{
+	double t_old, t_new;
+
+	opt_debug = debug;
+	opt_log_output = debug;
+	log_subsys_level[LOGS_NONCE] = nonce_level;
+	log_update_levels();
+
+	/* warm up the ring and the timestamp cache */
+	run(nonce_path_new, loops / 10);
+	t_old = run(nonce_path_old, loops);
+	t_new = run(nonce_path_new, loops);
+	logwriter_flush();
+
+	printf("%-24s %10.1f %10.1f ns/nonce\n", what, t_old, t_new);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int loops = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	if (loops <= 0 || !freopen("/dev/null", "w", stderr)) {
+		fprintf(stdout, "usage: logbench [nonces]\n");
+		return 1;
+	}
+
+	printf("%-24s %10s %10s\n", "", "old", "new");
+	bench("debug off", false, -1, loops);
+	/* the old gating cannot mute a subsystem, it formats all five messages */
+	bench("debug on, nonce notice", true, LOG_NOTICE, loops / 10);
+	bench("debug on", true, -1, loops / 10);
+	printf("logwriter dropped %llu records\n", (unsigned long long)logwriter_dropped());
+	return 0;
+}
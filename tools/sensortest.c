@@ -0,0 +1,308 @@
+/*
+ * sensortest - host side checks of the temperature sensor read scheduling
+ *
+ * Build and run on the host with "make check" (or "make sensortest"),
+ * after setminertype like for the miner itself.
+ *
+ * sensors.c is linked against a fake I2C bus and fake sensors. Checked
+ * are the read interval of sensor_read_interval(), the backoff of a
+ * failing sensor in sensor_read_temp() and its cap, the order of
+ * sensor_due_cmp(), and the periods a mix of sensors gets read in when
+ * they are scheduled the way read_temperature_from_sensors() does.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "miner.h"
+#include "logging.h"
+#include "sensors.h"
+
+/* what sensors.c expects from the rest of the miner */
+int log_level_cut[LOGS_NUM] = { [0 ... LOGS_NUM - 1] = LOG_WARNING };
+bool opt_no_sensor_scan = true;
+bool opt_sensor_cache = false;
+int opt_disable_remote_sensors;
+
+void _applog(int prio, const char *str, bool force)
+{
+}
+
+void cgtime(struct timeval *tv)
+{
+	gettimeofday(tv, NULL);
+}
+
+double us_tdiff(struct timeval *end, struct timeval *start)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000.0 + (end->tv_usec - start->tv_usec);
+}
+
+int i2c_read(struct i2c_dev *dev, uint8_t reg, uint8_t *data)
+{
+	return -1;
+}
+
+int i2c_write(struct i2c_dev *dev, uint8_t reg, uint8_t data)
+{
+	return -1;
+}
+
+int i2c_write2(struct i2c_dev *dev, uint8_t reg, uint8_t data, uint8_t reg_read)
+{
+	return -1;
+}
+
+int i2c_start_dev(struct i2c_dev *dev)
+{
+	return 0;
+}
+
+/*
+ * Fake sensors, dev.i2c_addr indexes their state
+ */
+
+#define N_FAKE 8
+
+static struct {
+	float temp;
+	float swing;	/* added with alternating sign on every read */
+	int fail;
+	int reads;
+} fake[N_FAKE];
+
+static int
+fake_read_temp(struct sensor *sensor, struct temp *temp)
+{
+	int k = sensor->dev.i2c_addr;
+
+	fake[k].reads++;
+	if (fake[k].fail)
+		return -1;
+	temp->local = fake[k].temp - 15;
+	temp->remote = fake[k].temp + (fake[k].reads & 1 ? fake[k].swing : -fake[k].swing);
+	return 0;
+}
+
+static struct sensor_ops fake_ops = {
+	.name = "fake",
+	.read_temp = fake_read_temp,
+};
+
+static void
+fake_sensor(struct sensor *sensor, int k, float temp, float swing, int fail)
+{
+	memset(sensor, 0, sizeof(*sensor));
+	i2c_makedev(&sensor->dev, 0, 0, 0, k);
+	sensor->ops = &fake_ops;
+	fake[k].temp = temp;
+	fake[k].swing = swing;
+	fake[k].fail = fail;
+	fake[k].reads = 0;
+}
+
+static int failures;
+
+#define CHECK(cond, fmt, a...) do {				\
+	if (!(cond)) {						\
+		fprintf(stderr, "FAIL %s:%d: " fmt "\n",	\
+			__FILE__, __LINE__, ##a);		\
+		failures++;					\
+	}							\
+} while (0)
+
+static void
+test_interval(void)
+{
+	struct sensor s;
+
+	memset(&s, 0, sizeof(s));
+	CHECK(sensor_read_interval(&s, 80) == 1, "never read: %d", sensor_read_interval(&s, 80));
+
+	s.valid = 1;
+	s.temp = (struct temp){ 60, 80 - SensorHotMargin };
+	CHECK(sensor_read_interval(&s, 80) == 1, "within the hot margin: %d", sensor_read_interval(&s, 80));
+
+	s.temp = (struct temp){ 50, 80 - SensorHotMargin - 1 };
+	CHECK(sensor_read_interval(&s, 80) == SensorSlowInterval, "cool and steady: %d",
+	      sensor_read_interval(&s, 80));
+
+	s.delta = SensorVolatile;
+	CHECK(sensor_read_interval(&s, 80) == 1, "volatile: %d", sensor_read_interval(&s, 80));
+	s.delta = SensorVolatile / 2.0;
+	CHECK(sensor_read_interval(&s, 80) == SensorSlowInterval, "below volatile: %d",
+	      sensor_read_interval(&s, 80));
+
+	/* a failing sensor waits out its backoff, hot or not */
+	s.backoff = 8;
+	CHECK(sensor_read_interval(&s, 80) == 8, "backoff: %d", sensor_read_interval(&s, 80));
+	s.temp = (struct temp){ 60, 80 };
+	CHECK(sensor_read_interval(&s, 80) == 8, "backoff, hot: %d", sensor_read_interval(&s, 80));
+}
+
+static void
+test_backoff(void)
+{
+	struct sensor s;
+	struct temp t;
+	int expect = 1;
+
+	fake_sensor(&s, 0, 70, 0, 0);
+	CHECK(sensor_read_temp(&s, &t) == 0 && s.valid && s.backoff == 0, "first read");
+
+	fake[0].fail = 1;
+	for (int i = 0; i < 12; i++) {
+		s.age = 5;
+		CHECK(sensor_read_temp(&s, &t) < 0, "failing read %d succeeded", i);
+		CHECK(s.backoff == expect, "failure %d: backoff %d, should be %d", i, s.backoff, expect);
+		CHECK(s.backoff <= SensorMaxBackoff, "failure %d: backoff %d above the cap", i, s.backoff);
+		CHECK(sensor_read_interval(&s, 70) == s.backoff, "failure %d: interval %d, backoff %d",
+		      i, sensor_read_interval(&s, 70), s.backoff);
+		CHECK(s.age == 0, "failure %d: age not reset", i);
+		CHECK(s.valid && s.temp.remote == 70, "failure %d: last reading lost", i);
+		expect = expect * 2 > SensorMaxBackoff ? SensorMaxBackoff : expect * 2;
+	}
+	CHECK(s.failures == 12, "%u failures counted, should be 12", s.failures);
+
+	fake[0].fail = 0;
+	CHECK(sensor_read_temp(&s, &t) == 0 && s.backoff == 0, "recovery: backoff %d", s.backoff);
+	CHECK(sensor_read_interval(&s, 70) == 1, "recovery: interval %d", sensor_read_interval(&s, 70));
+}
+
+static void
+test_due_order(void)
+{
+	struct sensor_due due[1000];
+
+	srand(1);
+	for (int round = 0; round < 100; round++) {
+		for (int i = 0; i < 1000; i++) {
+			due[i].sensor = NULL;
+			due[i].overdue = rand() % 6;
+			due[i].temp = 40 + rand() % 50 + (rand() % 10) / 10.0;
+		}
+		qsort(due, 1000, sizeof(due[0]), sensor_due_cmp);
+		for (int i = 1; i < 1000; i++) {
+			CHECK(due[i - 1].overdue >= due[i].overdue,
+			      "overdue %d before %d", due[i - 1].overdue, due[i].overdue);
+			CHECK(due[i - 1].overdue != due[i].overdue || due[i - 1].temp >= due[i].temp,
+			      "overdue %d: %.1f before %.1f", due[i].overdue, due[i - 1].temp, due[i].temp);
+		}
+	}
+}
+
+/*
+ * One period of read_temperature_from_sensors(), with the I2C time budget
+ * expressed in reads. Records the period of the last read of each sensor
+ * and the longest gap between two.
+ */
+static void
+schedule_period(struct sensor *s, int n, int budget, int period, int *last, int *max_gap)
+{
+	struct sensor_due due[N_FAKE];
+	float hottest = 0;
+	int n_due = 0;
+
+	for (int i = 0; i < n; i++)
+		if (s[i].valid && s[i].temp.remote > hottest)
+			hottest = s[i].temp.remote;
+
+	for (int i = 0; i < n; i++) {
+		int interval = sensor_read_interval(&s[i], hottest);
+
+		if (++s[i].age < interval)
+			continue;
+		due[n_due].sensor = &s[i];
+		due[n_due].overdue = s[i].age - interval;
+		due[n_due].temp = s[i].temp.remote;
+		n_due++;
+	}
+	qsort(due, n_due, sizeof(due[0]), sensor_due_cmp);
+
+	for (int k = 0; k < n_due && k < budget; k++) {
+		struct temp t;
+		int i = due[k].sensor - s;
+
+		sensor_read_temp(due[k].sensor, &t);
+		if (last[i] >= 0 && period - last[i] > max_gap[i])
+			max_gap[i] = period - last[i];
+		last[i] = period;
+	}
+}
+
+enum { HOT0, HOT1, COOL0, COOL1, COOL2, COOL3, VOLATILE, FAILING };
+
+static void
+setup_mix(struct sensor *s, int *last, int *max_gap)
+{
+	fake_sensor(&s[HOT0], HOT0, 80, 0, 0);
+	fake_sensor(&s[HOT1], HOT1, 78, 0, 0);
+	fake_sensor(&s[COOL0], COOL0, 55, 0, 0);
+	fake_sensor(&s[COOL1], COOL1, 56, 0, 0);
+	fake_sensor(&s[COOL2], COOL2, 57, 0, 0);
+	fake_sensor(&s[COOL3], COOL3, 58, 0, 0);
+	fake_sensor(&s[VOLATILE], VOLATILE, 50, 2, 0);
+	fake_sensor(&s[FAILING], FAILING, 60, 0, 1);
+	for (int i = 0; i < N_FAKE; i++) {
+		last[i] = -1;
+		max_gap[i] = 0;
+	}
+}
+
+static void
+test_schedule(void)
+{
+	struct sensor s[N_FAKE];
+	int last[N_FAKE], max_gap[N_FAKE];
+	int periods = 400, tries = 0, budget;
+
+	/* enough I2C time: every sensor at its own interval */
+	setup_mix(s, last, max_gap);
+	for (int p = 0; p < periods; p++)
+		schedule_period(s, N_FAKE, N_FAKE, p, last, max_gap);
+
+	CHECK(fake[HOT0].reads == periods && fake[HOT1].reads == periods,
+	      "hot sensors read %d/%d times in %d periods", fake[HOT0].reads, fake[HOT1].reads, periods);
+	CHECK(fake[VOLATILE].reads >= periods - SensorSlowInterval, "volatile sensor read %d times in %d periods",
+	      fake[VOLATILE].reads, periods);
+	for (int i = COOL0; i <= COOL3; i++)
+		CHECK(max_gap[i] == SensorSlowInterval && fake[i].reads >= periods / SensorSlowInterval,
+		      "cool sensor %d: %d reads, gap %d", i, fake[i].reads, max_gap[i]);
+	/* 1, 2, 4 ... then SensorMaxBackoff periods apart */
+	for (int gap = 1, p = 0; p < periods; p += gap, gap = gap * 2 > SensorMaxBackoff ? SensorMaxBackoff : gap * 2)
+		tries++;
+	CHECK(fake[FAILING].reads == tries && max_gap[FAILING] == SensorMaxBackoff,
+	      "failing sensor: %d tries, should be %d, gap %d", fake[FAILING].reads, tries, max_gap[FAILING]);
+
+	/* too little I2C time for all: the most overdue go first, nobody starves */
+	for (budget = 1; budget <= 3; budget++) {
+		setup_mix(s, last, max_gap);
+		fake[FAILING].fail = 0;
+		for (int p = 0; p < periods; p++)
+			schedule_period(s, N_FAKE, budget, p, last, max_gap);
+		for (int i = 0; i < N_FAKE; i++)
+			CHECK(last[i] >= periods - N_FAKE - SensorSlowInterval &&
+			      max_gap[i] <= N_FAKE + SensorSlowInterval,
+			      "budget %d: sensor %d last read in period %d, gap %d", budget, i, last[i], max_gap[i]);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	test_interval();
+	test_backoff();
+	test_due_order();
+	test_schedule();
+
+	if (failures) {
+		fprintf(stderr, "sensortest: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("sensortest: ok\n");
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * workcap2txt - convert a --logwork-bin capture to the --logwork text format
+ *
+ * Build on the host with "make workcap2txt".
+ *
+ *   workcap2txt [-s] [-v] [-o] [-c chain] [-a asic] capture.bin
+ *
+ *   -s  short lines as in the per-ASIC --logwork files
+ *       ("midstate .. data .. nonce .. hash ..")
+ *   -v  append chain, asic and time of capture to every line
+ *   -o  only nonces that met the pool target
+ *   -c  only this chain, -a only this asic (repeat the run per asic to
+ *       get the old --logwork-asicnum file split)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define WORKCAP_NO_MINER
+#include "workcap.h"
+
+static void hex_rev(char *out, const uint8_t *in, int len)
+{
+	static const char hex[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < len; i++) {
+		out[2 * i] = hex[in[len - 1 - i] >> 4];
+		out[2 * i + 1] = hex[in[len - 1 - i] & 0xf];
+	}
+	out[2 * len] = 0;
+}
+
+static void hex(char *out, const uint8_t *in, int len)
+{
+	static const char digits[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < len; i++) {
+		out[2 * i] = digits[in[i] >> 4];
+		out[2 * i + 1] = digits[in[i] & 0xf];
+	}
+	out[2 * len] = 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s] [-v] [-o] [-c chain] [-a asic] capture.bin\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt_short = 0, opt_verbose = 0, opt_ok = 0, opt_chain = -1, opt_asic = -1;
+	const struct workcap_hdr *hdr;
+	const struct workcap_rec *rec;
+	struct stat st;
+	size_t i, num;
+	uint8_t *map;
+	int c, fd;
+
+	while ((c = getopt(argc, argv, "svoc:a:")) != -1) {
+		switch (c) {
+		case 's': opt_short = 1; break;
+		case 'v': opt_verbose = 1; break;
+		case 'o': opt_ok = 1; break;
+		case 'c': opt_chain = atoi(optarg); break;
+		case 'a': opt_asic = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if ((size_t)st.st_size < sizeof(*hdr)) {
+		fprintf(stderr, "%s: too short\n", argv[optind]);
+		return 1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	hdr = (const struct workcap_hdr *)map;
+	if (memcmp(hdr->magic, WORKCAP_MAGIC, 4) != 0 ||
+	    le16toh(hdr->version) != WORKCAP_VERSION ||
+	    le16toh(hdr->rec_size) != sizeof(struct workcap_rec)) {
+		fprintf(stderr, "%s: not a version %d work capture\n", argv[optind], WORKCAP_VERSION);
+		return 1;
+	}
+
+	/* a trailing partial record is what an unclean shutdown leaves behind */
+	num = (st.st_size - sizeof(*hdr)) / sizeof(struct workcap_rec);
+	rec = (const struct workcap_rec *)(map + sizeof(*hdr));
+
+	for (i = 0; i < num; i++, rec++) {
+		char midstate[65], data[25], nonce[11], hash[65];
+		uint8_t nonce_bin[5];
+		uint32_t n = le32toh(rec->nonce);
+		int ok = rec->flags & WORKCAP_OK;
+
+		if (opt_ok && !ok)
+			continue;
+		if (opt_chain >= 0 && rec->chain != opt_chain)
+			continue;
+		if (opt_asic >= 0 && rec->asic != opt_asic)
+			continue;
+
+		memcpy(nonce_bin, &n, 4);
+		nonce_bin[4] = rec->nonce5;
+		hex_rev(midstate, rec->midstate, 32);
+		hex_rev(data, rec->data, 12);
+		hex_rev(hash, rec->hash, 32);
+
+		if (opt_short) {
+			hex(nonce, nonce_bin, 4);
+			printf("midstate %s data %s nonce %s hash %s", midstate, data, nonce, hash);
+		} else {
+			hex(nonce, nonce_bin, 5);
+			printf("%s %08x midstate %s data %s nonce %s hash %s diff %llu",
+			       ok ? "o" : "x", le32toh(rec->work_id), midstate, data, nonce, hash,
+			       (unsigned long long)le64toh(rec->diff));
+		}
+		if (opt_verbose)
+			printf(" chain %d asic %d%s time %u.%06u", rec->chain, rec->asic,
+			       rec->flags & WORKCAP_HWERR ? " hwerr" : "",
+			       le32toh(rec->tv_sec), le32toh(rec->tv_usec));
+		printf("\n");
+	}
+
+	munmap(map, st.st_size);
+	close(fd);
+	return 0;
+}
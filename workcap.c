@@ -0,0 +1,229 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "miner.h"
+#include "util.h"
+
+#include "workcap.h"
+
+/*
+ * Records are appended to one of two in-memory buffers under a mutex
+ * (a handful of memcpys per nonce); the flusher thread swaps the full or
+ * ageing buffer out and writes it with one write() call. If the flusher
+ * falls a whole buffer behind, new records are dropped and counted.
+ */
+
+struct workcap_buf {
+	int num;
+	struct workcap_rec rec[WORKCAP_BUF_RECS];
+};
+
+bool workcap_active;
+
+static int workcap_fd = -1;
+static pthread_t workcap_thr;
+static pthread_mutex_t workcap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workcap_cond = PTHREAD_COND_INITIALIZER;
+static struct workcap_buf workcap_bufs[2];
+static struct workcap_buf *workcap_fill = &workcap_bufs[0];
+static struct workcap_buf *workcap_pending;	/* handed to the flusher */
+static bool workcap_stop;
+static uint64_t workcap_records, workcap_dropped;
+
+/* same as share_ndiff(), but for a hash that is not in a struct work */
+static uint64_t workcap_hash_diff(const uint8_t *hash)
+{
+	static const double truediffone = 26959535291011309493156476344723991336010898738574164086137773096960.0;
+	const uint64_t *data64 = (const uint64_t *)hash;
+	double s64;
+
+	s64 = le64toh(data64[0]) + le64toh(data64[1]) * 18446744073709551616.0 +
+	      le64toh(data64[2]) * 340282366920938463463374607431768211456.0 +
+	      le64toh(data64[3]) * 6277101735386680763835789423207666416102355444464034512896.0;
+	if (!s64)
+		return 0;
+	return truediffone / s64;
+}
+
+static void workcap_write(struct workcap_buf *buf)
+{
+	size_t len = buf->num * sizeof(struct workcap_rec);
+	const char *p = (const char *)buf->rec;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(workcap_fd, p, len);
+		if (ret <= 0) {
+			applog(LOG_ERR, "workcap: write failed, %d records lost", (int)(len / sizeof(struct workcap_rec)));
+			break;
+		}
+		p += ret;
+		len -= ret;
+	}
+	buf->num = 0;
+}
+
+static void *workcap_thread(void *arg)
+{
+	struct workcap_buf *buf;
+
+	RenameThread("workcap");
+
+	mutex_lock(&workcap_lock);
+	while (!workcap_stop) {
+		struct timespec ts, tdiff;
+		struct timeval now;
+
+		if (!workcap_pending) {
+			cgtime(&now);
+			timeval_to_spec(&ts, &now);
+			ms_to_timespec(&tdiff, WORKCAP_FLUSH_MS);
+			timeraddspec(&ts, &tdiff);
+			pthread_cond_timedwait(&workcap_cond, &workcap_lock, &ts);
+		}
+
+		/* periodic flush of a partially filled buffer */
+		if (!workcap_pending && workcap_fill->num > 0) {
+			workcap_pending = workcap_fill;
+			workcap_fill = workcap_fill == &workcap_bufs[0] ? &workcap_bufs[1] : &workcap_bufs[0];
+		}
+		if (!workcap_pending)
+			continue;
+
+		buf = workcap_pending;
+		mutex_unlock(&workcap_lock);
+		workcap_write(buf);
+		mutex_lock(&workcap_lock);
+		workcap_pending = NULL;
+	}
+	mutex_unlock(&workcap_lock);
+	return NULL;
+}
+
+bool workcap_open(const char *path)
+{
+	struct workcap_hdr hdr;
+	struct stat st;
+
+	workcap_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (workcap_fd < 0) {
+		applog(LOG_ERR, "workcap: cannot open %s", path);
+		return false;
+	}
+
+	if (fstat(workcap_fd, &st) == 0 && st.st_size > 0) {
+		/* only keep appending to a file of the same layout */
+		if (pread(workcap_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+		    memcmp(hdr.magic, WORKCAP_MAGIC, 4) != 0 ||
+		    le16toh(hdr.version) != WORKCAP_VERSION ||
+		    le16toh(hdr.rec_size) != sizeof(struct workcap_rec)) {
+			applog(LOG_ERR, "workcap: %s is not a version %d capture, not appending", path, WORKCAP_VERSION);
+			goto out_close;
+		}
+	} else {
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, WORKCAP_MAGIC, 4);
+		hdr.version = htole16(WORKCAP_VERSION);
+		hdr.rec_size = htole16(sizeof(struct workcap_rec));
+		hdr.created = htole32(time(NULL));
+		if (write(workcap_fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+			applog(LOG_ERR, "workcap: cannot write header to %s", path);
+			goto out_close;
+		}
+	}
+
+	if (pthread_create(&workcap_thr, NULL, workcap_thread, NULL))
+		goto out_close;
+
+	workcap_active = true;
+	applog(LOG_NOTICE, "workcap: capturing nonces to %s", path);
+	return true;
+
+out_close:
+	close(workcap_fd);
+	workcap_fd = -1;
+	return false;
+}
+
+void workcap_add(struct work *work, uint32_t nonce, uint8_t nonce5, int chain, int asic, uint8_t flags, const uint8_t *hash)
+{
+	struct workcap_rec *rec;
+	struct timeval now;
+
+	if (!workcap_active)
+		return;
+
+	cgtime(&now);
+
+	mutex_lock(&workcap_lock);
+	if (!workcap_active) {
+		mutex_unlock(&workcap_lock);
+		return;
+	}
+	if (workcap_fill->num >= WORKCAP_BUF_RECS) {
+		if (workcap_pending) {
+			workcap_dropped++;
+			mutex_unlock(&workcap_lock);
+			return;
+		}
+		workcap_pending = workcap_fill;
+		workcap_fill = workcap_fill == &workcap_bufs[0] ? &workcap_bufs[1] : &workcap_bufs[0];
+		pthread_cond_signal(&workcap_cond);
+	}
+	rec = &workcap_fill->rec[workcap_fill->num++];
+	workcap_records++;
+
+	rec->tv_sec = htole32(now.tv_sec);
+	rec->tv_usec = htole32(now.tv_usec);
+	rec->work_id = htole32(work->id);
+	rec->nonce = htole32(nonce);
+	rec->diff = htole64(workcap_hash_diff(hash));
+	memcpy(rec->midstate, work->midstate, sizeof(rec->midstate));
+	memcpy(rec->data, work->data + 64, sizeof(rec->data));
+	rec->chain = chain;
+	rec->asic = asic;
+	rec->flags = flags;
+	rec->nonce5 = nonce5;
+	memcpy(rec->hash, hash, sizeof(rec->hash));
+	mutex_unlock(&workcap_lock);
+}
+
+void workcap_close(void)
+{
+	if (!workcap_active)
+		return;
+
+	mutex_lock(&workcap_lock);
+	workcap_active = false;
+	workcap_stop = true;
+	pthread_cond_signal(&workcap_cond);
+	mutex_unlock(&workcap_lock);
+	pthread_join(workcap_thr, NULL);
+
+	/* whatever the flusher did not get to */
+	mutex_lock(&workcap_lock);
+	if (workcap_pending)
+		workcap_write(workcap_pending);
+	if (workcap_fill->num > 0)
+		workcap_write(workcap_fill);
+	close(workcap_fd);
+	workcap_fd = -1;
+	mutex_unlock(&workcap_lock);
+}
+
+void workcap_get_stats(uint64_t *records, uint64_t *dropped)
+{
+	mutex_lock(&workcap_lock);
+	*records = workcap_records;
+	*dropped = workcap_dropped;
+	mutex_unlock(&workcap_lock);
+}
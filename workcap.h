@@ -0,0 +1,61 @@
+#ifndef __WORKCAP_H__
+#define __WORKCAP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Binary work/nonce capture (--logwork-bin).
+ *
+ * The file is a struct workcap_hdr followed by fixed size struct
+ * workcap_rec records, little endian, append only, so it can be mmapped
+ * and indexed directly. tools/workcap2txt converts it to the --logwork
+ * text format.
+ */
+
+#define WORKCAP_MAGIC		"BMWC"
+#define WORKCAP_VERSION		1
+
+struct workcap_hdr {
+	char magic[4];
+	uint16_t version;
+	uint16_t rec_size;	/* sizeof(struct workcap_rec) */
+	uint32_t created;	/* unix time the file was started */
+	uint32_t reserved;
+} __attribute__((packed));
+
+/* workcap_rec.flags */
+#define WORKCAP_OK		0x01	/* nonce met the pool target */
+#define WORKCAP_HWERR		0x02	/* hash did not verify */
+
+struct workcap_rec {
+	uint32_t tv_sec;
+	uint32_t tv_usec;
+	uint32_t work_id;
+	uint32_t nonce;
+	uint64_t diff;		/* share_ndiff() of the nonce */
+	uint8_t midstate[32];	/* as in struct work, not byte reversed */
+	uint8_t data[12];	/* header tail, work->data + 64 */
+	uint8_t chain;
+	uint8_t asic;
+	uint8_t flags;
+	uint8_t nonce5;		/* fifth nonce byte, 0 if the chip gave none */
+	uint8_t hash[32];
+} __attribute__((packed));
+
+#ifndef WORKCAP_NO_MINER
+struct work;
+
+/* records buffered in memory, twice this is the most held back at once */
+#define WORKCAP_BUF_RECS	1024
+#define WORKCAP_FLUSH_MS	1000
+
+extern bool workcap_active;
+
+bool workcap_open(const char *path);
+void workcap_add(struct work *work, uint32_t nonce, uint8_t nonce5, int chain, int asic, uint8_t flags, const uint8_t *hash);
+void workcap_close(void);
+void workcap_get_stats(uint64_t *records, uint64_t *dropped);
+#endif
+
+#endif /* __WORKCAP_H__ */